@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+
+# Expands the binary log records sent by the telnet "Monitor b" command
+# back into text. A record only carries the addresses of its tag and
+# format string plus the raw argument values (see include/binlog.hpp);
+# the strings are read from the firmware ELF the thermostat is running.
+# Lines that aren't records are passed through unchanged.
+#
+# Usage:
+#   { echo "monitor b"; cat; } | nc thermostat 23 | ./decode-log.py .pio/build/<env>/firmware.elf
+
+import base64
+import re
+import struct
+import sys
+
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+
+COLORS = {'E': '\033[0;31m', 'W': '\033[0;33m', 'I': '\033[0;32m'}
+RESET = '\033[0m'
+
+CONVERSION = re.compile(r'%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d*))?(hh|h|ll|l|L|q|j|z|t)?([diouxXcfFeEgGaAspn%])')
+
+
+class Elf:
+    """Maps load addresses to the file contents of the allocated sections."""
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.data = f.read()
+        if self.data[:4] != b'\x7fELF':
+            sys.exit(f'{path}: not an ELF file')
+        is64 = self.data[4] == 2
+        endian = '<' if self.data[5] == 1 else '>'
+        if is64:
+            shoff, = struct.unpack_from(endian + 'Q', self.data, 0x28)
+            shentsize, shnum = struct.unpack_from(endian + 'HH', self.data, 0x3a)
+            shdr = endian + 'IIQQQQIIQQ'
+        else:
+            shoff, = struct.unpack_from(endian + 'I', self.data, 0x20)
+            shentsize, shnum = struct.unpack_from(endian + 'HH', self.data, 0x2e)
+            shdr = endian + 'IIIIIIIIII'
+        self.sections = []
+        for i in range(shnum):
+            _, stype, flags, addr, offset, size = struct.unpack_from(shdr, self.data, shoff + i * shentsize)[:6]
+            if (flags & SHF_ALLOC) and stype != SHT_NOBITS and addr and size:
+                self.sections.append((addr, size, offset))
+
+    def string(self, addr):
+        for start, size, offset in self.sections:
+            if start <= addr < start + size:
+                pos = offset + addr - start
+                end = self.data.index(b'\0', pos)
+                return self.data[pos:end].decode('utf-8', 'replace')
+        return f'<0x{addr:08x}?>'
+
+
+def read_args(record, pos):
+    args = []
+    while pos < len(record):
+        kind = chr(record[pos])
+        pos += 1
+        if kind == 'i':
+            args.append(struct.unpack_from('<i', record, pos)[0])
+            pos += 4
+        elif kind == 'I':
+            args.append(struct.unpack_from('<q', record, pos)[0])
+            pos += 8
+        elif kind == 'f':
+            args.append(struct.unpack_from('<f', record, pos)[0])
+            pos += 4
+        elif kind == 'd':
+            args.append(struct.unpack_from('<d', record, pos)[0])
+            pos += 8
+        elif kind == 's':
+            n = record[pos]
+            args.append(record[pos + 1:pos + 1 + n].decode('utf-8', 'replace'))
+            pos += 1 + n
+        else:
+            break
+    return args
+
+
+def format_message(fmt, args):
+    args = iter(args)
+
+    def expand(m):
+        flags, width, prec, _, conv = m.groups()
+        if conv == '%':
+            return '%'
+        try:
+            if width == '*':
+                width = str(next(args))
+            if prec == '*':
+                prec = str(next(args))
+            value = next(args)
+        except StopIteration:
+            return '<?>'
+        spec = '%' + flags + (width or '') + ('.' + prec if prec is not None else '')
+        if conv in 'diu':
+            return (spec + 'd') % int(value)
+        if conv in 'oxX':
+            # Stored as int32, so show negative values the way C would
+            return (spec + conv) % (int(value) & 0xffffffff)
+        if conv == 'c':
+            return (spec + 'c') % chr(int(value) & 0xff)
+        if conv in 'fFeEgGaA':
+            return (spec + ('f' if conv in 'aA' else conv)) % float(value)
+        if conv == 's':
+            return (spec + 's') % value
+        if conv == 'p':
+            return '0x%x' % (int(value) & 0xffffffff)
+        return '<%' + conv + '?>'
+
+    return CONVERSION.sub(expand, fmt)
+
+
+def decode(elf, record):
+    level = chr(record[0])
+    timestamp, tag, fmt = struct.unpack_from('<III', record, 1)
+    text = '%c (%u) %s: %s' % (level, timestamp, elf.string(tag),
+                               format_message(elf.string(fmt), read_args(record, 13)))
+    if level in COLORS and sys.stdout.isatty():
+        text = COLORS[level] + text + RESET
+    return text
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(f'usage: {sys.argv[0]} <firmware.elf>  (log on stdin)')
+    elf = Elf(sys.argv[1])
+    for line in sys.stdin.buffer:
+        line = line.rstrip(b'\r\n')
+        start = line.find(b'#B')
+        if start < 0:
+            print(line.decode('utf-8', 'replace'))
+            continue
+        try:
+            print(decode(elf, base64.b64decode(line[start + 2:])))
+        except (ValueError, struct.error):
+            print(line.decode('utf-8', 'replace'))
+        sys.stdout.flush()
+
+
+if __name__ == '__main__':
+    main()
@@ -1,6 +1,11 @@
 /*
   This file is used to support Arduino libraries (like LD2410) by recreating
   some simple functions.
+
+  Received bytes are moved from the UART driver into a local ring buffer in
+  bulk by a small task that waits on the driver's event queue, so read() and
+  available() never have to call into the driver. The ring buffer has a
+  single producer (the event task) and a single consumer (the reader).
 */
 
 #pragma once
@@ -8,19 +13,31 @@
 #include "esp_log.h"
 #include "driver/gpio.h"
 #include "driver/uart.h"
+#include "freertos/semphr.h"
 
 #define GPIO_RTS (UART_PIN_NO_CHANGE)
 #define GPIO_CTS (UART_PIN_NO_CHANGE)
 #define BUF_SIZE (1024)
+#define RX_RING_SIZE (1024)             // Must be a power of 2
+#define UART_EVENT_QUEUE_SIZE (20)
 
 class Stream {
   public:
     Stream();      //Constructor function
     ~Stream();     //Destructor function
     bool begin(uart_port_t _uart_port, int baud_rate, int gpio_tx, int gpio_rx);
-    bool available();
+    int available();
+    int peek();
     uint8_t read();
-    bool write(uint8_t _ch);
+    size_t read(uint8_t *buf, size_t len);
+    size_t write(uint8_t _ch);
+    size_t write(const uint8_t *buf, size_t len);
+    void flush();
+    bool waitForData(TickType_t ticks);
+    void setMonitor(void (*monitor)(const uint8_t *buf, size_t len)) { rxMonitor = monitor; }
+
+    uint32_t bytesReceived() { return rxBytes; }
+    uint32_t overflows() { return rxOverflows; }
 
     void print(uint8_t) {};
     void print(const char *) {};
@@ -31,6 +48,18 @@ class Stream {
 
   protected:
   private:
+    static void eventTask(void *arg);
+    void fill(size_t len);
+    void overflow();
+
     uart_port_t uart_port;
     TickType_t timeout;
+    QueueHandle_t uartQueue;
+    SemaphoreHandle_t rxReady;
+    uint8_t rxRing[RX_RING_SIZE];
+    uint32_t rxHead;                    // Only written by the event task
+    uint32_t rxTail;                    // Only written by the reader
+    uint32_t rxBytes;
+    uint32_t rxOverflows;
+    void (*rxMonitor)(const uint8_t *buf, size_t len);   // Sees every byte read
 };
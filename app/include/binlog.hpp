@@ -0,0 +1,122 @@
+/*
+  Deferred-formatting ("binary") log macros.
+
+  BLOGE/BLOGW/BLOGI/BLOGD/BLOGV take the same arguments as ESP_LOGx but
+  don't format anything at the log site. They record the address of the
+  tag and format string plus the raw argument values in the log ring
+  (logging.cpp). Readers of the ring turn the record back into text when
+  they get to it, on their own task, or pass it on untouched (telnet
+  "Monitor binary") for decode-log.py to expand on the host using the
+  strings in the firmware ELF.
+
+  Every argument is stored with a one byte type code:
+    'i' int32  'I' int64  'f' float  'd' double  's' string (length byte
+    followed by the characters, truncated to fit the record)
+  A record starts with the level letter, the esp_log timestamp (ms) and
+  the tag and format addresses, all little endian.
+
+  Tags and formats must be string literals or other strings that live for
+  the life of the firmware (static arrays, __FUNCTION__).
+*/
+
+#pragma once
+
+#include <type_traits>
+#include "esp_log.h"
+
+#define LOG_RECORD_MAX      (152)     // Must fit a log ring slot
+#define LOG_RECORD_HEADER   (13)
+#define LOG_STRING_MAX      (128)     // Longer strings are cut short
+
+void logWriteRecord(char level, const uint8_t *record, size_t len);
+
+class BinLogRecord {
+  public:
+    BinLogRecord(char level, const char *tag, const char *format) {
+      buf[0] = level;
+      put32(esp_log_timestamp());
+      put32((uint32_t)(uintptr_t)tag);
+      put32((uint32_t)(uintptr_t)format);
+    }
+
+    template <typename T>
+    void arg(T value) {
+      if constexpr (std::is_floating_point_v<T>) {
+        if (sizeof(T) == sizeof(float)) {
+          float f = value;
+          putTyped('f', &f, sizeof(f));
+        } else {
+          double d = value;
+          putTyped('d', &d, sizeof(d));
+        }
+      } else if constexpr (std::is_integral_v<T> || std::is_enum_v<T>) {
+        if (sizeof(T) <= sizeof(int32_t)) {
+          int32_t v = (int32_t)value;
+          putTyped('i', &v, sizeof(v));
+        } else {
+          int64_t v = (int64_t)value;
+          putTyped('I', &v, sizeof(v));
+        }
+      } else if constexpr (std::is_convertible_v<T, const char *>) {
+        putString(value);
+      } else {
+        // Any other pointer is logged by value (%p, %x)
+        uint32_t v = (uint32_t)(uintptr_t)value;
+        putTyped('i', &v, sizeof(v));
+      }
+    }
+
+    const uint8_t *data() const { return buf; }
+    size_t length() const { return len; }
+
+  private:
+    uint8_t buf[LOG_RECORD_MAX];
+    size_t len = 1;
+
+    void put32(uint32_t v) {
+      memcpy(&buf[len], &v, sizeof(v));
+      len += sizeof(v);
+    }
+    void putTyped(char type, const void *v, size_t size) {
+      if (len + 1 + size > sizeof(buf))
+        return;
+      buf[len++] = type;
+      memcpy(&buf[len], v, size);
+      len += size;
+    }
+    void putString(const char *s) {
+      size_t n = (s == NULL) ? 0 : strnlen(s, LOG_STRING_MAX);
+
+      if (len + 2 > sizeof(buf))
+        return;
+      if (n > sizeof(buf) - len - 2)
+        n = sizeof(buf) - len - 2;
+      buf[len++] = 's';
+      buf[len++] = (uint8_t)n;
+      memcpy(&buf[len], s, n);
+      len += n;
+    }
+};
+
+template <typename... Args>
+static inline void logBinary(char level, const char *tag, const char *format, Args... args)
+{
+  BinLogRecord record(level, tag, format);
+
+  (record.arg(args), ...);
+  logWriteRecord(level, record.data(), record.length());
+}
+
+// The unreachable printf() lets the compiler check the format string
+#define BLOG(lvl, letter, tag, format, ...) do {                              \
+    if (false)                                                                \
+      printf(format, ##__VA_ARGS__);                                          \
+    if ((LOG_LOCAL_LEVEL >= (lvl)) && (esp_log_level_get(tag) >= (lvl)))      \
+      logBinary(letter, tag, format, ##__VA_ARGS__);                          \
+  } while (0)
+
+#define BLOGE(tag, format, ...) BLOG(ESP_LOG_ERROR,   'E', tag, format, ##__VA_ARGS__)
+#define BLOGW(tag, format, ...) BLOG(ESP_LOG_WARN,    'W', tag, format, ##__VA_ARGS__)
+#define BLOGI(tag, format, ...) BLOG(ESP_LOG_INFO,    'I', tag, format, ##__VA_ARGS__)
+#define BLOGD(tag, format, ...) BLOG(ESP_LOG_DEBUG,   'D', tag, format, ##__VA_ARGS__)
+#define BLOGV(tag, format, ...) BLOG(ESP_LOG_VERBOSE, 'V', tag, format, ##__VA_ARGS__)
@@ -32,8 +32,8 @@ class LGFX : public lgfx::LGFX_Device
 // Prepare an instance that matches the type of bus that connects the panels.
   lgfx::Bus_SPI        _bus_instance;   // SPI bus instance
 
-// Prepare an instance if backlight control is possible. (remove if not needed)
-  lgfx::Light_PWM     _light_instance;
+// The backlight is not handed to LovyanGFX; tft.cpp drives it with the
+// LEDC fade engine.
 
 // Prepare an instance that matches the type of touch screen. (remove if not needed)
   lgfx::Touch_XPT2046          _touch_instance;
@@ -96,18 +96,6 @@ public:
       _panel_instance.config(cfg);
     }
 
-    { // Set backlight control. (Delete if not necessary)
-      auto cfg = _light_instance.config();    // Get a structure for backlight settings
-
-      cfg.pin_bl = TFT_LED_PIN;              // Pin number with backlight connected
-      cfg.invert = false;           // To reverses the brightness of the backlight True
-      cfg.freq   = 44100;           // Backlight PWM frequency
-      cfg.pwm_channel = 7;          // PWM channel number to use
-
-      _light_instance.config(cfg);
-      _panel_instance.setLight(&_light_instance);  // Set the backlight on the panel
-    }
-
     { // Set the touch screen control. (Delete if not necessary)
       auto cfg = _touch_instance.config();
 
@@ -145,15 +133,20 @@ LGFX tft;
 
 static lv_disp_draw_buf_t draw_buf;
 static lv_color_t buf[screenWidth * 10];
+static uint32_t flushCount;     // Lets tftPump() tell whether lv_timer_handler() drew anything
 
 void my_disp_flush(lv_disp_drv_t *disp, const lv_area_t *area, lv_color_t *color_p)
 {
+  int64_t start = esp_timer_get_time();
   uint32_t w = (area->x2 - area->x1 + 1);
   uint32_t h = (area->y2 - area->y1 + 1);
   tft.startWrite();
   tft.setAddrWindow(area->x1, area->y1, w, h);
   tft.writePixels((lgfx::rgb565_t *)&color_p->full, w * h);
   tft.endWrite();
+  metricObserveSince(METRIC_LVGL_FLUSH, start);
+  flushCount++;
+  bootMilestone(BOOT_FIRST_FRAME);
   lv_disp_flush_ready(disp);
 }
 
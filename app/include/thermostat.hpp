@@ -54,6 +54,173 @@ typedef enum
     NR_HVAC_MODES
 } HVAC_MODE;
 
+/*
+ * Physical HVAC stages tracked for runtime and cycle accounting. Aux heat
+ * drives the same relay as heat, so it is accounted as heat.
+ */
+typedef enum
+{
+    STAGE_HEAT = 0,
+    STAGE_COOL,
+    STAGE_FAN,
+    NR_HVAC_STAGES
+} HVAC_STAGE;
+
+// Only heat and cool are regulated by the control algorithms
+#define NR_CONTROL_STAGES (STAGE_COOL + 1)
+
+/*
+ * Algorithm used to cycle the heat and cool stages. HYSTERESIS is the
+ * original bang-bang controller.
+ */
+typedef enum
+{
+    CONTROL_HYSTERESIS = 0,
+    CONTROL_PREDICTIVE,
+    CONTROL_TIME_PROPORTIONAL,
+    NR_CONTROL_MODES
+} HVAC_CONTROL_MODE;
+
+// Learned thermal response of the house for one stage (degrees Celsius)
+typedef struct
+{
+    float rate;         // Degrees/minute while the stage runs
+    float coast;        // Degrees the temp keeps moving after the stage stops
+    float lag;          // Minutes from stage start until the temp turns around
+    float drift;        // Degrees/minute lost while idle
+    uint16_t samples;   // Cycles learned
+} HVAC_THERMAL_MODEL;
+
+// Weekly schedule
+#define SCHEDULE_MAX_ENTRIES 28
+
+typedef enum
+{
+    SCHEDULE_OFF = 0,
+    SCHEDULE_RUN,
+    SCHEDULE_AWAY,          // Hold the away temp until "home"
+    SCHEDULE_VACATION,      // Hold the away temp until a date, then resume
+    NR_SCHEDULE_STATES
+} SCHEDULE_STATE;
+
+// Lifetime totals per stage; this is what gets persisted in NVS
+typedef struct
+{
+    uint32_t onSeconds;
+    uint32_t cycles;
+} HVAC_STAGE_TOTALS;
+
+// Snapshot of the runtime statistics for one stage
+typedef struct
+{
+    bool     active;            // Stage currently running
+    uint32_t todaySeconds;      // On-time since local midnight
+    uint32_t todayCycles;       // Cycles started since local midnight
+    uint32_t avgCycleSeconds;   // Average cycle length (lifetime)
+    float    dutyHour;          // Percent on-time over the last 60 minutes
+    float    dutyDay;           // Percent on-time over the last 24 hours
+    HVAC_STAGE_TOTALS lifetime;
+} HVAC_RUNTIME_STATS;
+
+// Radar UART path, measured over the last full second
+typedef struct
+{
+    uint32_t cpuUs;             // Time spent processing radar data
+    uint32_t frames;            // Complete frames parsed
+    uint32_t bytes;             // Bytes received
+    uint32_t overflows;         // Receive overflows since boot
+} RADAR_STATS;
+
+#define RADAR_MAX_GATES 9           // LD2410 gates 0-8
+#define RADAR_GATE_SIZE 0.75        // Meters per gate
+
+// Per-gate energies (0-100) reported in engineering mode, with the configured thresholds
+typedef struct
+{
+    bool     engineering;           // Engineering frames are being received
+    uint8_t  maxGate;
+    uint8_t  maxMovingGate;
+    uint8_t  maxStationaryGate;
+    uint16_t idleTime;              // Seconds
+    uint8_t  moving[RADAR_MAX_GATES];
+    uint8_t  stationary[RADAR_MAX_GATES];
+    uint8_t  movingPeak[RADAR_MAX_GATES];
+    uint8_t  stationaryPeak[RADAR_MAX_GATES];
+    uint8_t  movingThreshold[RADAR_MAX_GATES];
+    uint8_t  stationaryThreshold[RADAR_MAX_GATES];
+    uint32_t frames;
+} RADAR_GATES;
+
+// Radar settings kept in NVS and applied to the module when they differ
+typedef struct
+{
+    uint8_t  maxMovingGate;
+    uint8_t  maxStationaryGate;
+    uint16_t idleTime;              // Seconds
+    uint8_t  movingThreshold[RADAR_MAX_GATES];
+    uint8_t  stationaryThreshold[RADAR_MAX_GATES];
+} RADAR_CONFIG;
+
+/*
+ * Wifi power save profile. NONE keeps the radio on; MIN sleeps between
+ * DTIM beacons; MAX sleeps through WIFI_LISTEN_INTERVAL beacons at a time.
+ */
+typedef enum
+{
+    WIFI_POWER_NONE = 0,
+    WIFI_POWER_MIN,
+    WIFI_POWER_MAX,
+    NR_WIFI_POWER_MODES
+} WIFI_POWER_MODE;
+
+// Where the radio's time went since boot (wifi.cpp)
+typedef struct
+{
+    WIFI_POWER_MODE mode;           // Configured
+    WIFI_POWER_MODE active;         // In effect (MIN while MAX is boosted)
+    uint32_t boosts;                // Times web/telnet use lifted MAX to MIN
+    uint64_t connectedMs[NR_WIFI_POWER_MODES];  // Connected, per mode in effect
+    uint64_t downMs;                // Started but not connected (scanning, retrying)
+    uint64_t radioOnMs;             // Estimated radio on time, all of the above
+} WIFI_POWER_STATS;
+
+// A network found by a wifi scan
+#define WIFI_SCAN_MAX 32            // Networks a scan keeps, strongest first
+typedef struct
+{
+    char     ssid[33];
+    int8_t   rssi;                  // Strongest seen for the SSID
+    uint8_t  channel;
+    bool     secure;
+} WIFI_NETWORK;
+
+// A saved wifi network and how connecting to it has gone
+#define WIFI_NETWORKS_MAX 6
+typedef struct
+{
+    char     ssid[33];
+    char     password[64];
+    uint16_t successes;             // Attempts that got an address
+    uint16_t failures;              // Attempts that didn't
+    uint8_t  recentFailures;        // Failures since the last success
+    int8_t   lastRssi;              // When last connected; 0 if never
+} WIFI_SAVED_NETWORK;
+
+// Access point last connected to, kept in NVS for fast reconnects
+typedef struct
+{
+    char     ssid[33];
+    uint8_t  bssid[6];
+    uint8_t  channel;
+} WIFI_CACHE;
+
+// Read position of one consumer of the log ring
+typedef struct
+{
+    uint32_t next;                  // Sequence number of the next line to read
+    uint32_t dropped;               // Lines overwritten before they were read
+} LOG_CURSOR;
+
 typedef struct
 {
     ERRORS Errors;
@@ -75,16 +242,26 @@ typedef struct
     float tempSwing;
     float tempCorrection;
     float humidityCorrection;
-    int lightDetected;
+    int lightDetected;              // Filtered light sensor reading, 0-4095
+    float lightLux;                 // Estimated ambient light
     bool motionDetected;
+    bool occupied;                  // Debounced radar occupancy
+    uint16_t targetDistance;        // cm to the closest radar target, 0 if none
+    uint16_t vacancyTimeout;        // Minutes without presence until vacant
+    float ecoSetback;               // Degrees of setback while vacant (0 = off)
     bool wifiConnected;
+    WIFI_POWER_MODE wifiPowerSave;
     bool hvacCoolEnable;
     bool hvacFanEnable;
     bool hvac2StageHeatEnable;
     bool hvacReverseValveEnable;
+    HVAC_CONTROL_MODE hvacControlMode;
+    uint16_t hvacCyclesPerHour;     // Time proportional control only
 
     bool thermostatBeepEnable;
     uint16_t thermostatSleepTime;
+    uint16_t backlightMin;          // Percent duty at the lowest brightness
+    uint16_t backlightMax;          // Percent duty at full brightness
 
     char *timezone;
     uint16_t timezone_sel;
@@ -114,6 +291,11 @@ typedef struct
     // char hostname[24];   ...replaced by OperatingParameters.DeviceName
     char ssid[33];
     char password[64];
+    // Every saved network, most preferred first. The first one is the
+    // ssid/password above, which is what the UIs edit: setWifiCreds()
+    // moves what was entered to the front.
+    uint8_t count;
+    WIFI_SAVED_NETWORK networks[WIFI_NETWORKS_MAX];
 
 } WIFI_CREDS;
 
@@ -141,11 +323,23 @@ extern int64_t ui_WifiStatusLabel_timestamp;
 
 #ifdef MQTT_ENABLED
 #define MQTT_RECONNECT_DELAY 75000
+#define MQTT_KEEPALIVE 120              // Seconds
+#define MQTT_KEEPALIVE_POWER_SAVE 300   // With WIFI_POWER_MAX
 #endif
 #define MOTION_TIMEOUT 10000
-#define WIFI_CONNECT_INTERVAL 30000
+#define WIFI_BACKOFF_MIN 1000          // First wifi retry delay after the immediate one
+#define WIFI_BACKOFF_MAX 30000         // Retry delays double up to this (before jitter)
+#define WIFI_ATTEMPT_TIMEOUT 20000     // Give up on an attempt that hasn't got an IP address
+#define WIFI_LISTEN_INTERVAL 3         // Beacons per wake in WIFI_POWER_MAX (a multiple of DTIM 1 and 3)
+#define WIFI_POWER_BOOST_TIME 30000    // WIFI_POWER_MAX drops to MIN this long after web/telnet use
+#define WIFI_SCAN_FRESH 300000         // A scan this recent says which saved networks are in range
+#define WIFI_ROAM_RSSI -75             // Look for a better access point below this (dBm)
+#define WIFI_ROAM_HYSTERESIS 8         // ...and move if one is this much stronger (dB)
+#define WIFI_ROAM_INTERVAL 60000       // At most one look per this long
 #define UPDATE_TIME_INTERVAL 300000  //60000
 #define UI_TEXT_DELAY 3000
+#define RUNTIME_SAVE_INTERVAL 3600000
+#define RUNTIME_PUBLISH_INTERVAL 60000
 
 extern const char *gmt_timezones[];
 
@@ -180,21 +374,345 @@ bool MqttReconnect();
 void MqttUpdateStatusTopic();
 void MqttMotionUpdate(bool);
 void MqttHomeAssistantDiscovery();
+void MqttRuntimeUpdate();
+void MqttScheduleUpdate();
+void MqttDiagnosticsUpdate();
+void MqttAlert(const char *alert, const char *detail);
+void MqttOccupancyUpdate();
 #endif
 
 #ifdef TELNET_ENABLED
+#define TELNET_MAX_SESSIONS     (3)
 esp_err_t telnetStart();
 void terminateTelnetSession();
+void telnetRequestStop();
 bool telnetServiceRunning();
+int telnetSessionCount();
 #else
 static inline esp_err_t telnetStart(void) {return ESP_FAIL;}
 static inline void terminateTelnetSession(void) {}
+static inline void telnetRequestStop(void) {}
 static inline bool telnetServiceRunning(void) {return false;}
 #endif
 
+// Console commands, shared by telnet and any other line based console
+#define CONSOLE_MAX_ARGS        (10)    // Including the command name
+#define CONSOLE_HISTORY_LINES   (8)
+#define CONSOLE_HISTORY_SIZE    (96)    // Longer lines aren't kept
+
+typedef struct CONSOLE CONSOLE;
+
+typedef struct
+{
+    const char *name;
+    const char *args;               // Synopsis shown by Help, "" if none
+    const char *types;              // Per argument: i integer, f number, p parameter, s anything
+    uint8_t minArgs;
+    uint8_t maxArgs;
+    void (*handler)(CONSOLE *con, int argc, char *argv[]);
+    const char *help;               // NULL leaves the command out of Help
+} CONSOLE_CMD;
+
+struct CONSOLE
+{
+    const CONSOLE_CMD *commands;    // The console's own commands, ended by a NULL name
+    int (*print)(const char *fmt, ...);
+    void (*flush)();                // Push out pending output (before a reboot), or NULL
+};
+
+typedef struct
+{
+    char lines[CONSOLE_HISTORY_LINES][CONSOLE_HISTORY_SIZE];
+    uint8_t count;
+    uint8_t next;                   // Slot the next line goes in
+} CONSOLE_HISTORY;
+
+int consoleTokenize(char *line, char *argv[], int maxArgs);
+const CONSOLE_CMD *consoleLookup(CONSOLE *con, const char *name, int *matches);
+void consoleExecute(CONSOLE *con, char *line);
+int consoleComplete(CONSOLE *con, char *line, size_t *len, size_t size);
+void consoleHistoryAdd(CONSOLE_HISTORY *history, const char *line);
+const char *consoleHistoryGet(CONSOLE_HISTORY *history, int back);
+
+// Log ring
+#define LOG_LINE_MAX (256)           // Longest line logRead() returns, with the NUL
+void logInit();
+void logCursorInit(LOG_CURSOR *cursor, uint32_t backlog);
+int logRead(LOG_CURSOR *cursor, char *line, size_t len, char *level);
+int logReadRaw(LOG_CURSOR *cursor, char *buf, size_t len, char *level, bool *binary);
+void logGetStats(uint32_t *lines, uint32_t *uartDropped);
+void logPanic();
+
+// Metrics
+#define METRIC_BUCKETS    (17)      // Histogram buckets, the last one is +Inf
+#define METRIC_MAX_TASKS  (32)      // Tasks reported by metricsGetTasks()
+
+typedef enum
+{
+    // Histograms, in microseconds (these must come first)
+    METRIC_STATE_LOOP = 0,          // One pass of the state machine loop
+    METRIC_LVGL_RENDER,             // lv_timer_handler() calls that drew something
+    METRIC_LVGL_FLUSH,              // Pushing one area to the panel
+    METRIC_WEB_XML,                 // handleXML()
+    METRIC_MQTT_PUBLISH,            // esp_mqtt_client_publish() call
+    METRIC_MQTT_PUBACK,             // Publish until the broker acknowledged it
+    METRIC_NVS_COMMIT,              // nvs_commit() in closeNVS()
+    METRIC_I2C,                     // One i2c_master_cmd_begin() transaction
+    METRIC_WIFI_CONNECT,            // Wifi connect attempt until it got an IP address
+    METRIC_WIFI_OUTAGE,             // Wifi connection lost until it was back
+    // Counters
+    METRIC_I2C_ERRORS,
+    METRIC_NVS_ERRORS,
+    METRIC_MQTT_PUBLISH_ERRORS,
+    METRIC_WIFI_RETRIES,
+    METRIC_WIFI_FAST_MISSES,
+    // Gauges
+    METRIC_MQTT_INFLIGHT,           // QoS 1 publishes waiting for their PUBACK
+    NR_METRICS
+} METRIC_ID;
+
+#define METRIC_IS_HISTOGRAM(id)   ((id) < METRIC_I2C_ERRORS)
+
+typedef struct
+{
+    uint32_t count;                 // Observations, or the counter value
+    int32_t value;                  // Gauges only
+    uint32_t avg;                   // The rest are in microseconds and only
+    uint32_t p50;                   // apply to histograms; percentiles are
+    uint32_t p90;                   // interpolated within their bucket
+    uint32_t p99;
+    uint32_t max;
+} METRIC_SUMMARY;
+
+typedef struct
+{
+    char name[16];
+    uint32_t stackFree;             // Bytes of stack never used so far
+    uint8_t priority;
+} METRIC_TASK;
+
+typedef void (*METRICS_OUTPUT)(void *ctx, const char *text);
+
+void metricObserve(METRIC_ID id, uint32_t us);
+void metricObserveSince(METRIC_ID id, int64_t start);   // start from esp_timer_get_time()
+void metricInc(METRIC_ID id);
+void metricSet(METRIC_ID id, int32_t value);
+void metricAdd(METRIC_ID id, int32_t delta);
+const char *metricName(METRIC_ID id);
+void metricGetSummary(METRIC_ID id, METRIC_SUMMARY *summary);
+int metricsGetTasks(METRIC_TASK *tasks, int max);
+void metricsWrite(bool prometheus, METRICS_OUTPUT output, void *ctx);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void metricI2cTransaction(int64_t start, bool ok);      // Called from i2cdev.c
+
+#ifdef __cplusplus
+} /*extern "C"*/
+#endif
+
+// Task profiler
+#define PROFILE_INTERVAL  5000      // ms between samples
+#define PROFILE_HISTORY   12        // Samples kept, newest first
+
+typedef struct
+{
+    char name[16];
+    uint32_t number;                // FreeRTOS task number, unique per task
+    uint8_t priority;
+    uint8_t valid;                  // Entries of cpu[] sampled so far
+    uint32_t stackFree;             // Bytes of stack never used so far
+    uint16_t cpu[PROFILE_HISTORY];  // Tenths of a percent of one core
+    uint64_t runTimeUs;             // CPU time since the profiler first saw the task
+    uint32_t counter;               // FreeRTOS run time counter at the last sample
+} PROFILE_TASK;
+
+typedef struct
+{
+    uint8_t valid;                  // Entries of busy[] sampled so far
+    uint16_t busy[portNUM_PROCESSORS][PROFILE_HISTORY];   // Tenths of a percent
+} PROFILE_LOAD;
+
+void profilerLoop();
+int profilerGetTasks(PROFILE_TASK *tasks, int max);
+void profilerGetLoad(PROFILE_LOAD *load);
+
+// Heap monitor
+#define HEAP_SAMPLE_INTERVAL  60000         // ms between samples
+#define HEAP_LEAK_WINDOW      60            // Samples looked at for the leak trend
+#define HEAP_LEAK_RATE        2048          // Bytes/hour of lost internal heap that count as a leak
+#define HEAP_LOW_FREE         (24 * 1024)   // Internal heap below this raises an alert
+#define HEAP_FRAGMENTED       25            // Alert when the largest free block is under this % of free
+#define HEAP_CSV_LINES        30            // Samples shown by the console "Heap csv"
+
+void heapMonitorLoop();
+void heapMonitorWriteCsv(int lines, METRICS_OUTPUT output, void *ctx);
+void heapMonitorWriteStatus(METRICS_OUTPUT output, void *ctx);
+
+// Actions shared by the web UI buttons, the console and MQTT (actions.cpp)
+#define ACTION_NAME_MAX       31            // Longest action name
+
+typedef enum
+{
+    ACTION_TEMP_UP = 0,
+    ACTION_TEMP_DOWN,
+    ACTION_MODE_OFF,
+    ACTION_MODE_AUTO,
+    ACTION_MODE_HEAT,
+    ACTION_MODE_COOL,
+    ACTION_MODE_FAN,
+    ACTION_CLEAR_NVS,
+    ACTION_TERMINATE_TELNET,
+    ACTION_COOL_ENABLE,
+    ACTION_FAN_ENABLE,
+    ACTION_SWING_UP,
+    ACTION_SWING_DOWN,
+    ACTION_ECO_UP,
+    ACTION_ECO_DOWN,
+    ACTION_VACANCY_UP,
+    ACTION_VACANCY_DOWN,
+    ACTION_CONTROL_MODE,
+    ACTION_CORRECTION_UP,
+    ACTION_CORRECTION_DOWN,
+    ACTION_TWO_STAGE_ENABLE,
+    ACTION_REVERSE_ENABLE,
+    ACTION_UNIT_TOGGLE,
+    NR_ACTIONS,
+    ACTION_NONE = NR_ACTIONS
+} ACTION;
+
+typedef enum
+{
+    ACTION_SRC_WEB = 0,
+    ACTION_SRC_CONSOLE,
+    ACTION_SRC_MQTT,
+    NR_ACTION_SOURCES
+} ACTION_SOURCE;
+
+ACTION actionLookup(const char *name, size_t len);
+const char *actionName(ACTION action);
+ACTION actionForMode(HVAC_MODE mode);
+bool actionAllowed(ACTION action, ACTION_SOURCE source);
+bool actionRun(ACTION action, ACTION_SOURCE source);
+bool actionDispatch(const char *name, size_t len, ACTION_SOURCE source);
+float doTempUp(void);
+float doTempDown(void);
+void actionsWrite(bool prometheus, METRICS_OUTPUT output, void *ctx);
+
+// JSON API (/api/v1, see api.cpp)
+#define API_BODY_MAX          1024          // Largest PATCH/PUT body accepted
+#define API_MAX_CHANGES       24            // Fields in one request
+
+typedef enum
+{
+    API_STATE = 0,
+    API_CONFIG
+} API_RESOURCE;
+
+void apiWrite(API_RESOURCE resource, METRICS_OUTPUT output, void *ctx);
+void apiWriteError(const char *error, METRICS_OUTPUT output, void *ctx);
+bool apiUpdate(API_RESOURCE resource, const char *body, size_t len, char *error, size_t errorLen);
+
+// mDNS host name and DNS-SD services
+#define MDNS_CHECK_INTERVAL   1000          // ms between checks for a new address, name, mode or units
+#define MDNS_HOSTNAME_MAX     32            // Host name label, without ".local"
+#define WEB_PORT              80            // HTTPD_DEFAULT_CONFIG()
+#ifndef TELNET_PORT
+#define TELNET_PORT           23           // The host tests use another
+#endif
+
+bool mdnsStart();
+bool mdnsStop();
+void mdnsLoop();
+bool mdnsGetHostname(char *host, size_t len);
+
+// Headless setup: provisioning access point, captive DNS, /setup and /networks pages
+#define PROVISION_AP_PREFIX   "Thermostat-"   // Access point SSID, then the end of the MAC address
+#define PROVISION_AP_PASSWORD ""              // Open; 8 or more characters make it WPA2
+#define PROVISION_AP_CHANNEL  1               // Until the station connects (the AP follows its channel)
+#define PROVISION_LINGER      60000           // The access point stays up this long after the station connects
+#define PROVISION_FORM_MAX    256             // Largest /setup or /networks form body accepted
+
+void provisionDnsStart(uint32_t ip);
+void provisionDnsStop();
+bool provisionParseForm(const char *body, char *ssid, size_t ssidLen, char *pass, size_t passLen);
+bool provisionSubmit(const char *body, char *message, size_t len);
+void provisionWritePage(const char *message, METRICS_OUTPUT output, void *ctx);
+bool provisionNetworksSubmit(const char *body, char *message, size_t len);
+void provisionNetworksWritePage(const char *message, METRICS_OUTPUT output, void *ctx);
+
+// Boot profiler & startup sequencing
+typedef enum
+{
+    // Phases; each one either runs in app_main() or gets a task of its own
+    BOOT_NVS = 0,
+    BOOT_RELAYS,
+    BOOT_UI,
+    BOOT_SENSORS,
+    BOOT_INDICATORS,
+    BOOT_WIFI,
+    BOOT_MQTT,
+    BOOT_WEB,
+    BOOT_TELNET,
+    BOOT_CONTROL,
+    // Milestones, marked where they happen
+    BOOT_FIRST_FRAME,
+    BOOT_FIRST_READING,
+    BOOT_FIRST_DECISION,
+    NR_BOOT_EVENTS
+} BOOT_EVENT;
+
+#define BOOT_IS_MILESTONE(e)  ((e) >= BOOT_FIRST_FRAME)
+#define BOOT_BIT(e)           (1UL << (e))
+#define BOOT_TASK_STACK       4096
+#define BOOT_READING_WAIT     3000      // ms the sensors phase waits for a first temperature
+
+typedef struct
+{
+    int64_t startUs;                // esp_timer time; 0 if it hasn't happened
+    int64_t endUs;                  // Same as startUs for milestones
+    bool ok;
+} BOOT_TIMES;
+
+typedef bool (*BOOT_FN)();
+
+void bootInit();
+void bootStart(BOOT_EVENT phase);
+void bootEnd(BOOT_EVENT phase, bool ok);
+void bootRun(BOOT_EVENT phase, uint32_t needs, BOOT_FN fn, uint32_t stack);
+bool bootWait(uint32_t needs, uint32_t timeoutMs);
+bool bootDone(BOOT_EVENT event);
+void bootMilestone(BOOT_EVENT milestone);
+const char *bootEventName(BOOT_EVENT event);
+void bootGetTimes(BOOT_EVENT event, BOOT_TIMES *times);
+void bootWriteReport(METRICS_OUTPUT output, void *ctx);
+
 // State Machine
 void stateCreateTask();
-extern int64_t lastWifiReconnect;
+void hvacGetRuntimeStats(HVAC_STAGE stage, HVAC_RUNTIME_STATS *stats);
+const char *hvacStageToString(HVAC_STAGE stage);
+
+// HVAC control algorithms
+void hvacControlInit();
+bool hvacControlDemand(HVAC_STAGE stage, bool running, float currentTemp, float minTemp, float maxTemp);
+void hvacControlObserve(HVAC_MODE opMode, float currentTemp);
+void hvacControlSetMode(HVAC_CONTROL_MODE mode, uint16_t cyclesPerHour);
+bool hvacControlApplyMode(HVAC_CONTROL_MODE mode, uint16_t cyclesPerHour);
+void hvacControlGetModel(HVAC_STAGE stage, HVAC_THERMAL_MODEL *model);
+const char *hvacControlModeToString(HVAC_CONTROL_MODE mode);
+HVAC_CONTROL_MODE strToHvacControlMode(const char *str);
+
+// Schedule
+void scheduleInit();
+void scheduleLoop();
+void scheduleRecompile();
+bool scheduleCommand(const char *cmd, char *reply, size_t len);
+int scheduleFormat(char *buf, size_t len);
+SCHEDULE_STATE scheduleGetState();
+int32_t scheduleSecondsToNext();
+const char *scheduleStateToString(SCHEDULE_STATE state);
 
 // EEPROM
 void eepromInit();
@@ -206,6 +724,20 @@ void updateThermostatParams();
 
 bool eepromUpdateArbFloat(const char *key, float value);
 bool eepromUpdateArbMode(const char *key, HVAC_MODE mode);
+bool eepromUpdateHvacRuntime(HVAC_STAGE_TOTALS *totals);
+bool eepromGetHvacRuntime(HVAC_STAGE_TOTALS *totals);
+bool eepromUpdateHvacControl();
+bool eepromUpdateBacklight();
+bool eepromUpdateWifiPower();
+bool eepromUpdateThermalModel(HVAC_THERMAL_MODEL *model);
+bool eepromGetThermalModel(HVAC_THERMAL_MODEL *model);
+bool eepromUpdateSchedule(void *schedule, size_t len);
+bool eepromGetSchedule(void *schedule, size_t len);
+bool eepromUpdateRadarConfig(RADAR_CONFIG *config);
+bool eepromGetRadarConfig(RADAR_CONFIG *config);
+bool eepromUpdateWifiCache(WIFI_CACHE *cache);
+bool eepromUpdateWifiNetworks();
+bool eepromGetWifiCache(WIFI_CACHE *cache);
 
 // HTTP Server
 void webStart();
@@ -218,11 +750,30 @@ bool WifiStarted();
 bool WifiRestartPending();
 bool WifiConnected();
 void WifiDisconnect();
-void startReconnectTask();
+void WifiManagerStart();
+void WifiSetPowerSave(WIFI_POWER_MODE mode);
+void WifiPowerBoost();
+void WifiGetPowerStats(WIFI_POWER_STATS *stats);
+const char *wifiPowerModeToString(WIFI_POWER_MODE mode);
+WIFI_POWER_MODE strToWifiPowerMode(const char *str);
 uint16_t WifiSignal();
 char *WifiAddress();
-char *Get_WiFiSSID_DD_List( void );
-void WiFi_ScanSSID( void );
+bool WifiScanStart();
+void WifiScanStop();
+bool WifiScanRunning();
+uint32_t WifiScanVersion();
+int WifiScanResults(WIFI_NETWORK *networks, int max);
+bool WifiProvisionStart();
+void WifiProvisionStop();
+bool WifiProvisioning();
+uint32_t WifiProvisionAddress();
+const char *WifiProvisionSsid();
+bool WifiNetworkAdd(const char *ssid, const char *pass, int pos);
+bool WifiNetworkRemove(const char *ssid);
+bool WifiNetworkMove(const char *ssid, int pos);
+int WifiNetworksGet(WIFI_SAVED_NETWORK *networks, int max);
+const char *WifiConnectedSsid();
+uint32_t WifiRoamCount();
 
 // TFT
 void tftInit();
@@ -247,6 +798,12 @@ void tftEnableTouchTimer();
 void tftUpdateTouchTimestamp();
 void tftWakeDisplay(bool beep);
 void tftDimDisplay();
+bool tftSetBacklightRange(int minPercent, int maxPercent);
+bool tftApplyBacklightRange(int minPercent, int maxPercent);
+void tftApplyTempUnits();
+uint32_t tftLvglMemoryUsed();
+void tftWifiScanInit();
+void tftWifiScanUpdate();
 // void tftWakeDisplayMotion();
 
 #ifdef __cplusplus
@@ -257,6 +814,12 @@ void tftDimDisplay();
 void updateHvacMode(HVAC_MODE mode);
 void updateEnabledHvacModes();
 void updateHvacSetTemp(float setTemp);
+void updateTempUnits(char units);
+// Set point limits, as on the display's arc
+#define SET_TEMP_MIN_F  45.0
+#define SET_TEMP_MAX_F  92.0
+#define SET_TEMP_MIN_C  7.0
+#define SET_TEMP_MAX_C  33.0
 // float roundValue(float value, int places = 0);
 float roundValue(float value, int places);
 float getRoundedFrac(float value);
@@ -266,8 +829,21 @@ void sensorsInit();
 void initRelays();
 int getTemp();
 int getHumidity();
-void ld2410_loop();
-int readLightSensor();
+void ld2410_init();
+void ld2410GetStats(RADAR_STATS *stats);
+void initLightSensor();
+
+// Radar
+void radarGetGates(RADAR_GATES *gates);
+bool radarSetEngineeringMode(bool enable);
+int radarFormatGates(char *buf, size_t len);
+int radarFormatGatesJson(char *buf, size_t len);
+bool radarCommand(const char *cmd, char *reply, size_t len);
+
+// Occupancy
+void occupancyInit();
+void occupancyUpdate(bool presence, uint16_t movingDistance, uint16_t stationaryDistance);
+float occupancySetback();
 
 // Indicators
 void audioStartupBeep();
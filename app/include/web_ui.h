@@ -10,7 +10,7 @@ p{margin:0px;padding:0px}
 .flx{display:flex;flex-wrap:wrap;justify-content:center}.content-box{width:fit-content;float:left}
 .ctrl{margin-left:15px;margin-top:15px;margin-right:50px}.temp{font-size:72px}
 .arrow{font-size:25px}button{margin:5px}</style>
-<body onload="process()">
+<body onload="process(); scheduleCommand('list'); radarCommand('config')">
 <h1 class="pd border center">Smart Thermostat Control Panel</h1>
 <div class="center flx">
 	<div class="pd mr border content-box">
@@ -32,6 +32,13 @@ p{margin:0px;padding:0px}
 		<div id="humidity"></div>
 		<div id="light"></div>
 		<div id="motion"></div>
+		<div id="occupancy"></div>
+	</div>
+	<div class="pd mr border content-box">HVAC Runtime Today
+	<br><br>
+		<div id="heatRuntime"></div>
+		<div id="coolRuntime"></div>
+		<div id="fanRuntime"></div>
 	</div>
 	<div class="pd mr border content-box">Thermostat Settings
 	<br><br><br>
@@ -41,7 +48,14 @@ p{margin:0px;padding:0px}
 		<button onclick=pressButton('swingDown')>&darr;</button><br>
 		<span id="correction"></span>
 		<button onclick=pressButton('correctionUp')>&uarr;</button>
-		<button onclick=pressButton('correctionDown')>&darr;</button>
+		<button onclick=pressButton('correctionDown')>&darr;</button><br>
+		<span id="ecoSetback"></span>
+		<button onclick=pressButton('ecoUp')>&uarr;</button>
+		<button onclick=pressButton('ecoDown')>&darr;</button><br>
+		<span id="vacancyTimeout"></span>
+		<button onclick=pressButton('vacancyUp')>&uarr;</button>
+		<button onclick=pressButton('vacancyDown')>&darr;</button><br>
+		<span id="controlMode"></span><button onclick=pressButton('controlMode')>change</button>
 	</div>
 	<div class="pd mr border content-box">HVAC system settings
 	<br><br><br>
@@ -57,6 +71,22 @@ p{margin:0px;padding:0px}
 		<label for="reverseCheckBox">Enable Reverse Valve</label>
 		<span id="reverseCheckBox"></span>
 	</div>
+	<div class="pd mr border content-box">Weekly Schedule<br><br>
+		<pre id="schedule"></pre>
+		<input id="schedCmd" size=32 placeholder="add weekdays 06:30 70 heat">
+		<button onclick=scheduleCommand(document.getElementById('schedCmd').value)>Apply</button><br>
+		<button onclick=scheduleCommand('on')>Enable</button>
+		<button onclick=scheduleCommand('off')>Disable</button>
+		<button onclick=scheduleCommand('home')>Home</button>
+	</div>
+	<div class="pd mr border content-box">Presence Radar<br><br>
+		<pre id="radar"></pre>
+		<input id="radarCmd" size=32 placeholder="gate 1 50 30">
+		<button onclick=radarCommand(document.getElementById('radarCmd').value)>Apply</button><br>
+		<button onclick=radarCommand('config')>Settings</button>
+		<button onclick=radarCommand('')>Gates</button>
+		<button onclick=radarCommand('defaults')>Defaults</button>
+	</div>
 	<div class="pd mr border content-box">System Info<br><br>
 		<div id="wifiStrength"></div>
 		<div id="address"></div>
@@ -90,6 +120,20 @@ function pressButton(buttonID) {
 	xhttp.send(buttonID);
 }
 
+function scheduleCommand(cmd) {
+	let xhttp = new XMLHttpRequest();
+	xhttp.open('PUT', "/schedule", false);
+	xhttp.send(cmd);
+	document.getElementById("schedule").textContent = xhttp.responseText;
+}
+
+function radarCommand(cmd) {
+	let xhttp = new XMLHttpRequest();
+	xhttp.open('PUT', "/radar", false);
+	xhttp.send(cmd);
+	document.getElementById("radar").textContent = xhttp.responseText;
+}
+
 function fetchMessage(xmlResponse, tag) {
 	let xmlDoc = xmlResponse.getElementsByTagName(tag);
 	return xmlDoc[0].firstChild.nodeValue;
@@ -129,6 +173,11 @@ function populateHvacSliders(correction, swing) {
 	document.getElementById("swing").innerHTML="Temp Swing: " + swing;
 }
 
+function populateRuntime(xmlResponse, stage, label) {
+	document.getElementById(stage + "Runtime").innerHTML = label + ": " + fetchMessage(xmlResponse, stage + "Today") + " min, " +
+		fetchMessage(xmlResponse, stage + "Cycles") + " cycles, " + fetchMessage(xmlResponse, stage + "Duty") + "% duty";
+}
+
 function response() {
 	let xmlResponse = xmlHttp.responseXML;
 	if (xmlResponse == null) //sometimes the xml response is null?
@@ -144,11 +193,20 @@ function response() {
 
 	document.getElementById("curTemp").innerHTML = fetchMessage(xmlResponse, "curTemp") + "&deg;" + fetchMessage(xmlResponse, "units");
 	document.getElementById("humidity").innerHTML="Humidity: " + fetchMessage(xmlResponse, "humidity") + "%";
-	document.getElementById("light").innerHTML="Light level: " + fetchMessage(xmlResponse, "light");
+	document.getElementById("light").innerHTML="Light level: " + fetchMessage(xmlResponse, "light") + " (" + fetchMessage(xmlResponse, "lux") + " lux)";
 	document.getElementById("motion").innerHTML="Motion detected: " + fetchMessage(xmlResponse, "motion");
+	document.getElementById("occupancy").innerHTML="Occupancy: " + fetchMessage(xmlResponse, "occupancy") +
+		" (target " + fetchMessage(xmlResponse, "distance") + " cm)";
+	document.getElementById("ecoSetback").innerHTML="Vacant Setback: " + fetchMessage(xmlResponse, "ecoSetback");
+	document.getElementById("vacancyTimeout").innerHTML="Vacant After: " + fetchMessage(xmlResponse, "vacancyTimeout") + " min";
+
+	populateRuntime(xmlResponse, "heat", "Heat");
+	populateRuntime(xmlResponse, "cool", "Cool");
+	populateRuntime(xmlResponse, "fan", "Fan");
 
 	document.getElementById("units").innerHTML="Temp Units: " + fetchMessage(xmlResponse, "units");
 	populateHvacSliders(fetchMessage(xmlResponse, "correction"), fetchMessage(xmlResponse, "swing"));
+	document.getElementById("controlMode").innerHTML="Control: " + fetchMessage(xmlResponse, "controlMode");
 
 	populateOptionalHvacSettings(fetchMessage(xmlResponse, 'hvacCoolEnable'), fetchMessage(xmlResponse, 'hvacFanEnable'),
 			fetchMessage(xmlResponse, 'twoStageEnable'), fetchMessage(xmlResponse, 'reverseEnable'));
@@ -6,10 +6,22 @@
 # <time>,<heap size>
 # This can then be imported into a spreadsheet and graphed to see trends
 # (like identifying memory leaks)
+#
+# The thermostat also keeps its own history of every memory region (see
+# heapmon.cpp). Given a host name or address instead of a log file, the
+# script fetches that from the /heap page as <host>.csv
 
 if [ -z "$1" ]
   then
-    echo "Specify the name of the log file to analyze. Output will be in <name>.csv"
+    echo "Specify the name of the log file to analyze, or the thermostat's host name/address."
+    echo "Output will be in <name>.csv"
+    exit
+fi
+
+if [ ! -f "$1" ] && [ ! -f "${1%.*}.log" ]
+  then
+    curl -sf "http://$1/heap" -o "$1.csv" || { echo "Could not fetch http://$1/heap"; exit 1; }
+    echo "Created output file $1.csv"
     exit
 fi
 
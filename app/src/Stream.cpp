@@ -1,7 +1,17 @@
+#include <string.h>
 #include "Stream.h"
 
+#define RX_RING_MASK (RX_RING_SIZE - 1)
+
+static const char *TAG = "STREAM";
+
 Stream::Stream()
 {
+    uartQueue = NULL;
+    rxReady = NULL;
+    rxHead = rxTail = 0;
+    rxBytes = rxOverflows = 0;
+    rxMonitor = NULL;
 }
 
 Stream::~Stream() 
@@ -32,32 +42,148 @@ bool Stream::begin(uart_port_t _uart_port, int baud_rate, int gpio_tx, int gpio_
     uart_port = _uart_port;
     timeout = 5000;
 
-    ESP_ERROR_CHECK(uart_driver_install(uart_port, BUF_SIZE, 0, 0, NULL, intr_alloc_flags));
+    rxReady = xSemaphoreCreateBinary();
+    ESP_ERROR_CHECK(uart_driver_install(uart_port, BUF_SIZE, 0, UART_EVENT_QUEUE_SIZE, &uartQueue, intr_alloc_flags));
     ESP_ERROR_CHECK(uart_param_config(uart_port, &uart_config));
     ESP_ERROR_CHECK(ret = uart_set_pin(uart_port, gpio_tx, gpio_rx, GPIO_RTS, GPIO_CTS));
+    xTaskCreate(eventTask, "UART Events", 3072, this, 5, NULL);
     return ret == ESP_OK;
 }
 
-bool Stream::available()
+/// @brief Drop everything received so far; used when data arrives faster than it is consumed
+void Stream::overflow()
 {
-    size_t bytes_available = 0;
-    uart_get_buffered_data_len(uart_port, &bytes_available);
-    return bytes_available > 0;
+    rxOverflows++;
+    uart_flush_input(uart_port);
+    xQueueReset(uartQueue);
+    ESP_LOGW(TAG, "UART %d receive overflow (%lu)", uart_port, rxOverflows);
 }
 
+/// @brief Move 'len' bytes from the driver into the ring buffer, in as few calls as possible
+void Stream::fill(size_t len)
+{
+    while (len > 0)
+    {
+        uint32_t head = rxHead;
+        uint32_t space = RX_RING_SIZE - (head - __atomic_load_n(&rxTail, __ATOMIC_ACQUIRE));
+        uint32_t idx = head & RX_RING_MASK;
+        size_t chunk = len;
+
+        if (space == 0)
+        {
+            overflow();
+            break;
+        }
+        // Stop at the end of the ring; the wrap is picked up on the next pass
+        if (chunk > space)
+            chunk = space;
+        if (chunk > RX_RING_SIZE - idx)
+            chunk = RX_RING_SIZE - idx;
+
+        int n = uart_read_bytes(uart_port, &rxRing[idx], chunk, 0);
+        if (n <= 0)
+            break;
+        __atomic_store_n(&rxHead, head + n, __ATOMIC_RELEASE);
+        rxBytes += n;
+        len -= n;
+    }
+    xSemaphoreGive(rxReady);
+}
+
+void Stream::eventTask(void *arg)
+{
+    Stream *stream = (Stream *)arg;
+    uart_event_t event;
+
+    for (;;)
+    {
+        if (xQueueReceive(stream->uartQueue, &event, portMAX_DELAY) != pdTRUE)
+            continue;
+
+        switch (event.type)
+        {
+            case UART_DATA:
+                stream->fill(event.size);
+                break;
+            case UART_FIFO_OVF:
+            case UART_BUFFER_FULL:
+                stream->overflow();
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/// @brief Number of bytes that can be read without blocking
+int Stream::available()
+{
+    return (int)(__atomic_load_n(&rxHead, __ATOMIC_ACQUIRE) - rxTail);
+}
+
+int Stream::peek()
+{
+    if (available() == 0)
+        return -1;
+    return rxRing[rxTail & RX_RING_MASK];
+}
+
+/// @brief Non-blocking bulk read of up to 'len' buffered bytes
+size_t Stream::read(uint8_t *buf, size_t len)
+{
+    uint32_t tail = rxTail;
+    size_t count = __atomic_load_n(&rxHead, __ATOMIC_ACQUIRE) - tail;
+    size_t first;
+
+    if (len > count)
+        len = count;
+    first = RX_RING_SIZE - (tail & RX_RING_MASK);
+    if (first > len)
+        first = len;
+    memcpy(buf, &rxRing[tail & RX_RING_MASK], first);
+    memcpy(buf + first, &rxRing[0], len - first);
+    __atomic_store_n(&rxTail, tail + len, __ATOMIC_RELEASE);
+    if (rxMonitor && len)
+        rxMonitor(buf, len);
+    return len;
+}
+
+/// @brief Block until new data is received or 'ticks' pass
+/// @return true if there is data to read
+bool Stream::waitForData(TickType_t ticks)
+{
+    if (available() > 0)
+        return true;
+    xSemaphoreTake(rxReady, ticks);
+    return available() > 0;
+}
+
+/// @brief Read one byte, waiting up to the stream timeout for it to arrive
 uint8_t Stream::read()
 {
-    char ch;
-    uart_read_bytes(uart_port, &ch, 1, pdMS_TO_TICKS(timeout));
+    uint8_t ch = 0;
+
+    while (read(&ch, 1) == 0)
+    {
+        if (xSemaphoreTake(rxReady, pdMS_TO_TICKS(timeout)) != pdTRUE)
+            break;
+    }
     return ch;
 }
 
-bool Stream::write(uint8_t _ch)
+size_t Stream::write(uint8_t _ch)
 {
-    uint8_t ch = _ch;
-    esp_err_t ret;
+    return write(&_ch, 1);
+}
 
-    uart_write_bytes(uart_port, (const char *)&ch, 1);
-    ESP_ERROR_CHECK(ret = uart_wait_tx_done(uart_port, timeout));
-    return ret == ESP_OK;
+/// @brief Queue bytes for transmission; use flush() to wait for them to go out
+size_t Stream::write(const uint8_t *buf, size_t len)
+{
+    int ret = uart_write_bytes(uart_port, (const char *)buf, len);
+    return (ret < 0) ? 0 : (size_t)ret;
+}
+
+void Stream::flush()
+{
+    ESP_ERROR_CHECK_WITHOUT_ABORT(uart_wait_tx_done(uart_port, pdMS_TO_TICKS(timeout)));
 }
@@ -0,0 +1,434 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * actions.cpp
+ *
+ * The one-shot actions behind the web UI buttons ("tempUp", "hvacModeCool",
+ * "swingDown", ...). The web UI posts the name to /button, the console
+ * Up, Down, Mode and Action commands and the MQTT <device>/set/mode,
+ * fan and set/action topics run the same ACTION ids, so every front end
+ * changes the settings the same way and is counted the same way.
+ *
+ * Names are found through a perfect hash: the compiler tries seeds for
+ * an FNV-1a hash until every name lands in a slot of its own, so a lookup
+ * is one hash of the name, one table read and one compare. Adding a name
+ * that makes the search fail stops the build (static_assert), it doesn't
+ * slow lookups down.
+ *
+ * Clearing the NVS and closing telnet are only run for the web UI's
+ * System Info buttons; a broker or a console user can't send them.
+ *
+ * Each action is counted per source, as are names that weren't found;
+ * actionsWrite() adds the counts to the web /metrics page and the console
+ * Stats command.
+ *
+ */
+
+#include "thermostat.hpp"
+
+static const char *TAG = "ACTION";
+
+#define ACTION_HASH_BITS  6
+#define ACTION_HASH_SLOTS (1 << ACTION_HASH_BITS)   // A bit more than 2x NR_ACTIONS
+#define ACTION_SEED_TRIES 10000
+
+// In ACTION order
+static constexpr const char *actionNames[NR_ACTIONS] = {
+    "tempUp", "tempDown",
+    "hvacModeOff", "hvacModeAuto", "hvacModeHeat", "hvacModeCool", "hvacModeFan",
+    "clear", "terminateTelnet",
+    "hvacCoolEnable", "hvacFanEnable",
+    "swingUp", "swingDown", "ecoUp", "ecoDown", "vacancyUp", "vacancyDown",
+    "controlMode", "correctionUp", "correctionDown",
+    "twoStageEnable", "reverseEnable", "unitToggle"};
+
+static const char *sourceNames[NR_ACTION_SOURCES] = {"web", "console", "mqtt"};
+
+static constexpr size_t action_strlen(const char *s)
+{
+  size_t len = 0;
+
+  while (s[len] != '\0')
+    len++;
+  return len;
+}
+
+static constexpr uint32_t action_hash(const char *name, size_t len, uint32_t seed)
+{
+  uint32_t h = 2166136261u ^ seed;
+
+  for (size_t i = 0; i < len; i++)
+  {
+    h ^= (uint8_t)name[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+// The top bits: FNV's low bits only depend on the low bits of the seed
+static constexpr uint32_t action_slot(const char *name, size_t len, uint32_t seed)
+{
+  return action_hash(name, len, seed) >> (32 - ACTION_HASH_BITS);
+}
+
+static constexpr bool action_seed_works(uint32_t seed)
+{
+  bool used[ACTION_HASH_SLOTS] = {};
+
+  for (int a = 0; a < NR_ACTIONS; a++)
+  {
+    uint32_t slot = action_slot(actionNames[a], action_strlen(actionNames[a]), seed);
+
+    if (used[slot])
+      return false;
+    used[slot] = true;
+  }
+  return true;
+}
+
+static constexpr uint32_t action_find_seed()
+{
+  for (uint32_t seed = 0; seed < ACTION_SEED_TRIES; seed++)
+    if (action_seed_works(seed))
+      return seed;
+  return UINT32_MAX;
+}
+
+typedef struct
+{
+  uint8_t action[ACTION_HASH_SLOTS];    // ACTION_NONE if the slot is free
+  uint8_t len[NR_ACTIONS];
+} ACTION_TABLE;
+
+static constexpr uint32_t actionSeed = action_find_seed();
+static_assert(actionSeed != UINT32_MAX, "No perfect hash seed for the action names, raise ACTION_HASH_BITS");
+
+static constexpr ACTION_TABLE action_build_table()
+{
+  ACTION_TABLE table = {};
+
+  for (int s = 0; s < ACTION_HASH_SLOTS; s++)
+    table.action[s] = ACTION_NONE;
+  for (int a = 0; a < NR_ACTIONS; a++)
+  {
+    table.len[a] = action_strlen(actionNames[a]);
+    table.action[action_slot(actionNames[a], table.len[a], actionSeed)] = a;
+  }
+  return table;
+}
+
+static constexpr ACTION_TABLE actionTable = action_build_table();
+
+static constexpr bool action_names_fit()
+{
+  for (int a = 0; a < NR_ACTIONS; a++)
+    if (actionTable.len[a] > ACTION_NAME_MAX)
+      return false;
+  return true;
+}
+static_assert(action_names_fit(), "An action name is longer than ACTION_NAME_MAX");
+static_assert(NR_ACTIONS < 255, "Actions don't fit the uint8_t slots");
+
+static uint32_t actionCounts[NR_ACTIONS][NR_ACTION_SOURCES];
+static uint32_t actionUnknown[NR_ACTION_SOURCES];
+static portMUX_TYPE actionLock = portMUX_INITIALIZER_UNLOCKED;
+
+/////////////////////////////////////////////////////////////////////
+//     The actions
+/////////////////////////////////////////////////////////////////////
+
+static float enforceRange(float value, float min, float max)
+{
+  if (value < min)
+    return min;
+  if (value > max)
+    return max;
+  return value;
+}
+
+float doTempUp(void)
+{
+  if (OperatingParameters.tempUnits == 'C')
+  {
+    OperatingParameters.tempSet += 0.5;
+    updateHvacSetTemp(roundValue(OperatingParameters.tempSet, 1));
+  } else {
+    OperatingParameters.tempSet += 1.0;
+    updateHvacSetTemp(roundValue(OperatingParameters.tempSet, 0));
+  }
+  return OperatingParameters.tempSet;
+}
+
+float doTempDown(void)
+{
+  if (OperatingParameters.tempUnits == 'C')
+  {
+    OperatingParameters.tempSet -= 0.5;
+    updateHvacSetTemp(roundValue(OperatingParameters.tempSet, 1));
+  } else {
+    OperatingParameters.tempSet -= 1.0;
+    updateHvacSetTemp(roundValue(OperatingParameters.tempSet, 0));
+  }
+  return OperatingParameters.tempSet;
+}
+
+// Flip one of the HVAC hardware enables
+static void action_toggle(bool *enable)
+{
+  *enable = !*enable;
+#ifdef MQTT_ENABLED
+  updateEnabledHvacModes();
+#endif
+}
+
+static void action_swing(float delta)
+{
+  OperatingParameters.tempSwing = enforceRange(OperatingParameters.tempSwing + delta, 0.0, 6.0);
+  eepromUpdateArbFloat("setSwing", OperatingParameters.tempSwing);
+}
+
+static void action_eco(float delta)
+{
+  OperatingParameters.ecoSetback = enforceRange(OperatingParameters.ecoSetback + delta, 0.0, 10.0);
+  eepromUpdateArbFloat("ecoSetback", OperatingParameters.ecoSetback);
+}
+
+static void action_vacancy(int delta)
+{
+  OperatingParameters.vacancyTimeout = enforceRange(OperatingParameters.vacancyTimeout + delta, 5, 240);
+  updateThermostatParams();
+}
+
+static void action_correction(float delta)
+{
+  OperatingParameters.tempCorrection = enforceRange(OperatingParameters.tempCorrection + delta, -10.0, 10.0);
+  eepromUpdateArbFloat("setTempCorr", OperatingParameters.tempCorrection);
+}
+
+static void action_do(ACTION action)
+{
+  switch (action)
+  {
+  case ACTION_TEMP_UP:
+    doTempUp();
+    break;
+  case ACTION_TEMP_DOWN:
+    doTempDown();
+    break;
+  case ACTION_MODE_OFF:
+    updateHvacMode(OFF);
+    break;
+  case ACTION_MODE_AUTO:
+    updateHvacMode(AUTO);
+    break;
+  case ACTION_MODE_HEAT:
+    updateHvacMode(HEAT);
+    break;
+  case ACTION_MODE_COOL:
+    updateHvacMode(COOL);
+    break;
+  case ACTION_MODE_FAN:
+    updateHvacMode(FAN_ONLY);
+    break;
+  case ACTION_CLEAR_NVS:
+    clearNVS();
+    break;
+  case ACTION_TERMINATE_TELNET:
+    terminateTelnetSession();
+    break;
+  case ACTION_COOL_ENABLE:
+    action_toggle(&OperatingParameters.hvacCoolEnable);
+    break;
+  case ACTION_FAN_ENABLE:
+    action_toggle(&OperatingParameters.hvacFanEnable);
+    break;
+  case ACTION_SWING_UP:
+    action_swing(0.1);
+    break;
+  case ACTION_SWING_DOWN:
+    action_swing(-0.1);
+    break;
+  case ACTION_ECO_UP:
+    action_eco(0.5);
+    break;
+  case ACTION_ECO_DOWN:
+    action_eco(-0.5);
+    break;
+  case ACTION_VACANCY_UP:
+    action_vacancy(5);
+    break;
+  case ACTION_VACANCY_DOWN:
+    action_vacancy(-5);
+    break;
+  case ACTION_CONTROL_MODE:
+    hvacControlSetMode((HVAC_CONTROL_MODE)((OperatingParameters.hvacControlMode + 1) % NR_CONTROL_MODES),
+                       OperatingParameters.hvacCyclesPerHour);
+    break;
+  case ACTION_CORRECTION_UP:
+    action_correction(0.1);
+    break;
+  case ACTION_CORRECTION_DOWN:
+    action_correction(-0.1);
+    break;
+  case ACTION_TWO_STAGE_ENABLE:
+    action_toggle(&OperatingParameters.hvac2StageHeatEnable);
+    break;
+  case ACTION_REVERSE_ENABLE:
+    action_toggle(&OperatingParameters.hvacReverseValveEnable);
+    break;
+  case ACTION_UNIT_TOGGLE:
+    updateTempUnits((OperatingParameters.tempUnits == 'F') ? 'C' : 'F');
+    break;
+  case NR_ACTIONS:
+    break;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////
+//     Lookup and dispatch
+/////////////////////////////////////////////////////////////////////
+
+//
+// The action called 'name' ('len' bytes, need not be terminated), or
+// ACTION_NONE. Names are case sensitive, as the web UI sends them.
+//
+ACTION actionLookup(const char *name, size_t len)
+{
+  uint8_t a;
+
+  if (len > ACTION_NAME_MAX)
+    return ACTION_NONE;
+  a = actionTable.action[action_slot(name, len, actionSeed)];
+  if ((a == ACTION_NONE) || (actionTable.len[a] != len) || (memcmp(actionNames[a], name, len) != 0))
+    return ACTION_NONE;
+  return (ACTION)a;
+}
+
+const char *actionName(ACTION action)
+{
+  return (action < NR_ACTIONS) ? actionNames[action] : "none";
+}
+
+// The action that puts the HVAC in 'mode', ACTION_NONE if there isn't one
+ACTION actionForMode(HVAC_MODE mode)
+{
+  switch (mode)
+  {
+  case OFF:
+    return ACTION_MODE_OFF;
+  case AUTO:
+    return ACTION_MODE_AUTO;
+  case HEAT:
+    return ACTION_MODE_HEAT;
+  case COOL:
+    return ACTION_MODE_COOL;
+  case FAN_ONLY:
+    return ACTION_MODE_FAN;
+  default:
+    return ACTION_NONE;
+  }
+}
+
+// Whether 'source' may run 'action'
+bool actionAllowed(ACTION action, ACTION_SOURCE source)
+{
+  switch (action)
+  {
+  case ACTION_CLEAR_NVS:
+  case ACTION_TERMINATE_TELNET:
+    return (source == ACTION_SRC_WEB);
+  default:
+    return (action < NR_ACTIONS) && (source < NR_ACTION_SOURCES);
+  }
+}
+
+bool actionRun(ACTION action, ACTION_SOURCE source)
+{
+  if ((action >= NR_ACTIONS) || (source >= NR_ACTION_SOURCES))
+    return false;
+  if (!actionAllowed(action, source))
+  {
+    ESP_LOGW(TAG, "%s is not allowed from %s", actionNames[action], sourceNames[source]);
+    return false;
+  }
+
+  portENTER_CRITICAL(&actionLock);
+  actionCounts[action][source]++;
+  portEXIT_CRITICAL(&actionLock);
+  ESP_LOGD(TAG, "%s from %s", actionNames[action], sourceNames[source]);
+  action_do(action);
+  return true;
+}
+
+//
+// Look up 'name' and run it. Unknown names are logged, counted against
+// 'source' and in systemErrors.
+//
+bool actionDispatch(const char *name, size_t len, ACTION_SOURCE source)
+{
+  ACTION action = actionLookup(name, len);
+
+  if (action != ACTION_NONE)
+    return actionRun(action, source);
+
+  if (source < NR_ACTION_SOURCES)
+  {
+    portENTER_CRITICAL(&actionLock);
+    actionUnknown[source]++;
+    portEXIT_CRITICAL(&actionLock);
+  }
+  ESP_LOGE(TAG, "Could not dispatch request \"%.*s\"", (int)((len > ACTION_NAME_MAX) ? ACTION_NAME_MAX : len), name);
+  OperatingParameters.Errors.systemErrors++;
+  return false;
+}
+
+//
+// Counts per action and source: Prometheus counters, or a table of the
+// actions that have run for the console.
+//
+void actionsWrite(bool prometheus, METRICS_OUTPUT output, void *ctx)
+{
+  uint32_t counts[NR_ACTIONS][NR_ACTION_SOURCES];
+  uint32_t unknown[NR_ACTION_SOURCES];
+  char line[128];
+
+  portENTER_CRITICAL(&actionLock);
+  memcpy(counts, actionCounts, sizeof(counts));
+  memcpy(unknown, actionUnknown, sizeof(unknown));
+  portEXIT_CRITICAL(&actionLock);
+
+  if (prometheus)
+  {
+    output(ctx, "# HELP thermostat_actions_total Button actions run, by front end\n"
+                "# TYPE thermostat_actions_total counter\n");
+    for (int a = 0; a < NR_ACTIONS; a++)
+      for (int s = 0; s < NR_ACTION_SOURCES; s++)
+      {
+        snprintf(line, sizeof(line), "thermostat_actions_total{action=\"%s\",source=\"%s\"} %lu\n",
+                 actionNames[a], sourceNames[s], (unsigned long)counts[a][s]);
+        output(ctx, line);
+      }
+    output(ctx, "# HELP thermostat_actions_unknown_total Button actions not found, by front end\n"
+                "# TYPE thermostat_actions_unknown_total counter\n");
+    for (int s = 0; s < NR_ACTION_SOURCES; s++)
+    {
+      snprintf(line, sizeof(line), "thermostat_actions_unknown_total{source=\"%s\"} %lu\n",
+               sourceNames[s], (unsigned long)unknown[s]);
+      output(ctx, line);
+    }
+    return;
+  }
+
+  output(ctx, "\nAction                web  console     mqtt\n");
+  for (int a = 0; a < NR_ACTIONS; a++)
+  {
+    if ((counts[a][ACTION_SRC_WEB] | counts[a][ACTION_SRC_CONSOLE] | counts[a][ACTION_SRC_MQTT]) == 0)
+      continue;
+    snprintf(line, sizeof(line), "%-16s %8lu %8lu %8lu\n", actionNames[a],
+             (unsigned long)counts[a][ACTION_SRC_WEB], (unsigned long)counts[a][ACTION_SRC_CONSOLE],
+             (unsigned long)counts[a][ACTION_SRC_MQTT]);
+    output(ctx, line);
+  }
+  snprintf(line, sizeof(line), "%-16s %8lu %8lu %8lu\n", "(unknown)", (unsigned long)unknown[ACTION_SRC_WEB],
+           (unsigned long)unknown[ACTION_SRC_CONSOLE], (unsigned long)unknown[ACTION_SRC_MQTT]);
+  output(ctx, line);
+}
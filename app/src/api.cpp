@@ -0,0 +1,505 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * api.cpp
+ *
+ * Versioned JSON API for scripts and home automation (web.cpp serves it):
+ *   GET   /api/v1/state    readings, what the HVAC is doing and the set points
+ *   PATCH /api/v1/state    change any of the writable state fields
+ *   GET   /api/v1/config   the settings
+ *   PUT   /api/v1/config   change any of the settings
+ *
+ * A PATCH or PUT body is one JSON object of field names and new values;
+ * fields left out keep their value. The whole body is one transaction:
+ * every field is checked first, and if one is unknown, read only, of the
+ * wrong type or out of range nothing changes and the error names it.
+ * Otherwise all the values are applied together, saved to NVS in one
+ * commit (updateThermostatParams()) and published to MQTT once. A change
+ * of units converts the temperatures first, so set points in the same
+ * request are taken in the new units.
+ *
+ * Replies are written a field at a time with snprintf(), like the /xml
+ * page, so nothing is allocated for them. Parsing a body uses ArduinoJson
+ * (as mqtt.cpp does), bounded by API_BODY_MAX.
+ *
+ */
+
+#include "thermostat.hpp"
+#include <ArduinoJson.h>
+#include <ctype.h>
+#include <math.h>
+
+static const char *TAG = "API";
+
+typedef enum
+{
+  API_FLOAT = 0,
+  API_U16,
+  API_BOOL,
+  API_STRING,         // char array of 'size' bytes
+  API_UNITS,          // char, 'C' or 'F'
+  API_MODE,           // HVAC_MODE
+  API_CONTROL         // HVAC_CONTROL_MODE
+} API_TYPE;
+
+#define API_RO        (0x01)    // Read only
+#define API_TEMP      (0x02)    // A set point: limits depend on the units
+#define API_MODES     (0x04)    // Changes which HVAC modes are offered
+#define API_ALGORITHM (0x08)    // Control algorithm: hvacControlApplyMode()
+#define API_BACKLIGHT (0x10)    // Backlight range: tftApplyBacklightRange()
+
+typedef struct
+{
+  const char *name;
+  API_TYPE type;
+  void *value;
+  uint16_t size;
+  uint8_t flags;
+  float min;
+  float max;
+  float (*get)();       // Worked out rather than stored; read only
+} API_FIELD;
+
+typedef struct
+{
+  float f;
+  long i;
+  const char *s;
+} API_VALUE;
+
+typedef struct
+{
+  const API_FIELD *field;
+  API_VALUE value;
+} API_CHANGE;
+
+static float api_temperature()
+{
+  return OperatingParameters.tempCurrent + OperatingParameters.tempCorrection;
+}
+
+static float api_humidity()
+{
+  return OperatingParameters.humidCurrent + OperatingParameters.humidityCorrection;
+}
+
+#define API_OP(field) &OperatingParameters.field
+#define API_STR(field) API_STRING, API_OP(field), sizeof(OperatingParameters.field)
+
+static const API_FIELD stateFields[] = {
+    {"temperature", API_FLOAT, NULL, 0, API_RO, 0, 0, api_temperature},
+    {"humidity", API_FLOAT, NULL, 0, API_RO, 0, 0, api_humidity},
+    {"units", API_UNITS, API_OP(tempUnits), 0, API_RO},
+    {"mode", API_MODE, API_OP(hvacSetMode)},
+    {"action", API_MODE, API_OP(hvacOpMode), 0, API_RO},
+    {"setTemp", API_FLOAT, API_OP(tempSet), 0, API_TEMP},
+    {"setTempLow", API_FLOAT, API_OP(tempSetAutoMin), 0, API_TEMP},
+    {"setTempHigh", API_FLOAT, API_OP(tempSetAutoMax), 0, API_TEMP},
+    {"occupied", API_BOOL, API_OP(occupied), 0, API_RO},
+    {"motion", API_BOOL, API_OP(motionDetected), 0, API_RO},
+    {"distance", API_U16, API_OP(targetDistance), 0, API_RO},
+    {"lux", API_FLOAT, API_OP(lightLux), 0, API_RO},
+    {"wifiConnected", API_BOOL, API_OP(wifiConnected), 0, API_RO},
+    {NULL}};
+
+static const API_FIELD configFields[] = {
+    {"deviceName", API_STR(DeviceName), API_RO},
+    {"friendlyName", API_STR(FriendlyName)},
+    {"units", API_UNITS, API_OP(tempUnits)},
+    {"swing", API_FLOAT, API_OP(tempSwing), 0, 0, 0, 6},
+    {"correction", API_FLOAT, API_OP(tempCorrection), 0, 0, -10, 10},
+    {"humidityCorrection", API_FLOAT, API_OP(humidityCorrection), 0, 0, -20, 20},
+    {"ecoSetback", API_FLOAT, API_OP(ecoSetback), 0, 0, 0, 10},
+    {"vacancyTimeout", API_U16, API_OP(vacancyTimeout), 0, 0, 1, 1440},
+    {"coolEnable", API_BOOL, API_OP(hvacCoolEnable), 0, API_MODES},
+    {"fanEnable", API_BOOL, API_OP(hvacFanEnable), 0, API_MODES},
+    {"twoStageEnable", API_BOOL, API_OP(hvac2StageHeatEnable), 0, API_MODES},
+    {"reverseEnable", API_BOOL, API_OP(hvacReverseValveEnable), 0, API_MODES},
+    {"controlMode", API_CONTROL, API_OP(hvacControlMode), 0, API_ALGORITHM},
+    {"cyclesPerHour", API_U16, API_OP(hvacCyclesPerHour), 0, API_ALGORITHM, 1, 12},
+    {"beep", API_BOOL, API_OP(thermostatBeepEnable)},
+    {"sleepTime", API_U16, API_OP(thermostatSleepTime), 0, 0, 0, 3600},
+    {"backlightMin", API_U16, API_OP(backlightMin), 0, API_BACKLIGHT, 0, 99},
+    {"backlightMax", API_U16, API_OP(backlightMax), 0, API_BACKLIGHT, 1, 100},
+    {NULL}};
+
+static const API_FIELD *api_fields(API_RESOURCE resource)
+{
+  return (resource == API_CONFIG) ? configFields : stateFields;
+}
+
+static const API_FIELD *api_lookup(const API_FIELD *fields, const char *name)
+{
+  for (const API_FIELD *f = fields; f->name != NULL; f++)
+    if (strcmp(f->name, name) == 0)
+      return f;
+  return NULL;
+}
+
+// Send 'text' as a JSON string, quotes included
+static void json_string(const char *text, METRICS_OUTPUT output, void *ctx)
+{
+  char buf[64];
+  size_t n = 0;
+
+  buf[n++] = '"';
+  for (; *text != '\0'; text++)
+  {
+    unsigned char c = (unsigned char)*text;
+
+    // Room for the longest escape, the closing quote and the terminator
+    if (n + 8 > sizeof(buf))
+    {
+      buf[n] = '\0';
+      output(ctx, buf);
+      n = 0;
+    }
+    if ((c == '"') || (c == '\\'))
+    {
+      buf[n++] = '\\';
+      buf[n++] = c;
+    }
+    else if (c < 0x20)
+      n += snprintf(&buf[n], sizeof(buf) - n, "\\u%04x", c);
+    else
+      buf[n++] = c;
+  }
+  buf[n++] = '"';
+  buf[n] = '\0';
+  output(ctx, buf);
+}
+
+//
+// The resource as one JSON object
+//
+void apiWrite(API_RESOURCE resource, METRICS_OUTPUT output, void *ctx)
+{
+  char buf[48];
+
+  output(ctx, "{");
+  for (const API_FIELD *f = api_fields(resource); f->name != NULL; f++)
+  {
+    snprintf(buf, sizeof(buf), "%s\"%s\":", (f == api_fields(resource)) ? "" : ",", f->name);
+    output(ctx, buf);
+
+    switch (f->type)
+    {
+    case API_FLOAT:
+    {
+      float v = (f->get != NULL) ? f->get() : *(float *)f->value;
+
+      // JSON has no NaN (a sensor that hasn't read yet)
+      if (isfinite(v))
+        snprintf(buf, sizeof(buf), "%.2f", v);
+      else
+        strcpy(buf, "null");
+      output(ctx, buf);
+      break;
+    }
+    case API_U16:
+      snprintf(buf, sizeof(buf), "%u", *(uint16_t *)f->value);
+      output(ctx, buf);
+      break;
+    case API_BOOL:
+      output(ctx, *(bool *)f->value ? "true" : "false");
+      break;
+    case API_STRING:
+      json_string((const char *)f->value, output, ctx);
+      break;
+    case API_UNITS:
+      snprintf(buf, sizeof(buf), "\"%c\"", *(char *)f->value);
+      output(ctx, buf);
+      break;
+    case API_MODE:
+      json_string(hvacModeToString(*(HVAC_MODE *)f->value), output, ctx);
+      break;
+    case API_CONTROL:
+      json_string(hvacControlModeToString(*(HVAC_CONTROL_MODE *)f->value), output, ctx);
+      break;
+    }
+  }
+  output(ctx, "}");
+}
+
+// Why a request was turned down, as {"error": "..."}
+void apiWriteError(const char *error, METRICS_OUTPUT output, void *ctx)
+{
+  output(ctx, "{\"error\":");
+  json_string(error, output, ctx);
+  output(ctx, "}");
+}
+
+// A mode the HVAC can be put in, by name; ERROR if not
+static HVAC_MODE api_mode(const char *name)
+{
+  static const HVAC_MODE settable[] = {OFF, HEAT, COOL, FAN_ONLY, AUTO};
+
+  for (size_t m = 0; m < sizeof(settable) / sizeof(settable[0]); m++)
+    if (strcasecmp(name, hvacModeToString(settable[m])) == 0)
+      return settable[m];
+  return ERROR;
+}
+
+// What 'value' will be once 'changes' are applied
+static long api_final_int(const API_CHANGE *changes, int n, void *value, long current)
+{
+  for (int c = 0; c < n; c++)
+    if (changes[c].field->value == value)
+      current = changes[c].value.i;
+  return current;
+}
+
+static float api_final_float(const API_CHANGE *changes, int n, void *value, float current)
+{
+  for (int c = 0; c < n; c++)
+    if (changes[c].field->value == value)
+      current = changes[c].value.f;
+  return current;
+}
+
+// A set point as it will be once converted to 'units'
+static float api_in_units(float temp, char units)
+{
+  if (units == OperatingParameters.tempUnits)
+    return temp;
+  return (units == 'C') ? (temp - 32.0) * 5.0 / 9.0 : (temp * 9.0 / 5.0) + 32.0;
+}
+
+//
+// Check one change and turn its value into what gets stored. 'units' is
+// what the temperatures will be in. Returns an error message, or NULL.
+//
+static const char *api_check(API_CHANGE *change, char units)
+{
+  const API_FIELD *f = change->field;
+  API_VALUE *v = &change->value;
+  float min = f->min;
+  float max = f->max;
+
+  if (f->flags & API_RO)
+    return "read only";
+
+  switch (f->type)
+  {
+  case API_FLOAT:
+    if (f->flags & API_TEMP)
+    {
+      min = (units == 'C') ? SET_TEMP_MIN_C : SET_TEMP_MIN_F;
+      max = (units == 'C') ? SET_TEMP_MAX_C : SET_TEMP_MAX_F;
+    }
+    if (!isfinite(v->f) || (((min != 0) || (max != 0)) && ((v->f < min) || (v->f > max))))
+      return "out of range";
+    break;
+  case API_U16:
+    if ((v->i < 0) || (v->i > UINT16_MAX) || (((min != 0) || (max != 0)) && ((v->i < min) || (v->i > max))))
+      return "out of range";
+    break;
+  case API_BOOL:
+    break;
+  case API_STRING:
+    if (strlen(v->s) >= f->size)
+      return "too long";
+    break;
+  case API_UNITS:
+    if ((strlen(v->s) != 1) || ((toupper(v->s[0]) != 'C') && (toupper(v->s[0]) != 'F')))
+      return "expected \"C\" or \"F\"";
+    v->i = toupper(v->s[0]);
+    break;
+  case API_MODE:
+    v->i = api_mode(v->s);
+    if (v->i == ERROR)
+      return "unknown mode";
+    break;
+  case API_CONTROL:
+    v->i = strToHvacControlMode(v->s);
+    if (v->i == NR_CONTROL_MODES)
+      return "unknown control mode";
+    break;
+  }
+  return NULL;
+}
+
+//
+// Check all of 'changes' to 'resource' and, only if they're all good,
+// apply them. 'error' gets what was wrong otherwise.
+//
+static bool api_apply(API_RESOURCE resource, API_CHANGE *changes, int n, char *error, size_t errorLen)
+{
+  char units = OperatingParameters.tempUnits;
+  uint8_t effects = 0;
+  bool modeChanged = false;
+  const char *problem;
+  HVAC_MODE mode;
+
+  // Temperatures in the request are in the units it ends up with
+  for (int c = 0; c < n; c++)
+    if ((changes[c].field->type == API_UNITS) && (api_check(&changes[c], units) == NULL))
+      units = changes[c].value.i;
+
+  for (int c = 0; c < n; c++)
+  {
+    problem = api_check(&changes[c], units);
+    if (problem != NULL)
+    {
+      snprintf(error, errorLen, "%s: %s", changes[c].field->name, problem);
+      return false;
+    }
+    effects |= changes[c].field->flags;
+    if (changes[c].field->value == API_OP(hvacSetMode))
+      modeChanged = true;
+  }
+
+  // Settings that only make sense together
+  if (api_final_float(changes, n, API_OP(tempSetAutoMin), api_in_units(OperatingParameters.tempSetAutoMin, units)) >
+      api_final_float(changes, n, API_OP(tempSetAutoMax), api_in_units(OperatingParameters.tempSetAutoMax, units)))
+  {
+    snprintf(error, errorLen, "setTempLow: above setTempHigh");
+    return false;
+  }
+  if (api_final_int(changes, n, API_OP(backlightMin), OperatingParameters.backlightMin) >=
+      api_final_int(changes, n, API_OP(backlightMax), OperatingParameters.backlightMax))
+  {
+    snprintf(error, errorLen, "backlightMin: not below backlightMax");
+    return false;
+  }
+  mode = (HVAC_MODE)api_final_int(changes, n, API_OP(hvacSetMode), OperatingParameters.hvacSetMode);
+  if ((modeChanged || (effects & API_MODES)) &&
+      ((((mode == AUTO) || (mode == COOL)) &&
+        !api_final_int(changes, n, API_OP(hvacCoolEnable), OperatingParameters.hvacCoolEnable)) ||
+       ((mode == FAN_ONLY) &&
+        !api_final_int(changes, n, API_OP(hvacFanEnable), OperatingParameters.hvacFanEnable))))
+  {
+    snprintf(error, errorLen, "mode: %s is not enabled", hvacModeToString(mode));
+    return false;
+  }
+  if (n == 0)
+    return true;
+
+  //
+  // All good: apply everything in one go
+  //
+  if (units != OperatingParameters.tempUnits)
+    updateTempUnits(units);
+  for (int c = 0; c < n; c++)
+  {
+    const API_FIELD *f = changes[c].field;
+    const API_VALUE *v = &changes[c].value;
+
+    if (f->flags & (API_ALGORITHM | API_BACKLIGHT))
+      continue;                                     // Below, both values at once
+    switch (f->type)
+    {
+    case API_FLOAT:
+      *(float *)f->value = v->f;
+      break;
+    case API_U16:
+      *(uint16_t *)f->value = v->i;
+      break;
+    case API_BOOL:
+      *(bool *)f->value = v->i;
+      break;
+    case API_STRING:
+      strlcpy((char *)f->value, v->s, f->size);
+      break;
+    case API_MODE:
+      *(HVAC_MODE *)f->value = (HVAC_MODE)v->i;
+      break;
+    case API_UNITS:
+    case API_CONTROL:
+      break;
+    }
+  }
+  if (effects & API_ALGORITHM)
+    hvacControlApplyMode((HVAC_CONTROL_MODE)api_final_int(changes, n, API_OP(hvacControlMode), OperatingParameters.hvacControlMode),
+                         api_final_int(changes, n, API_OP(hvacCyclesPerHour), OperatingParameters.hvacCyclesPerHour));
+  if (effects & API_BACKLIGHT)
+    tftApplyBacklightRange(api_final_int(changes, n, API_OP(backlightMin), OperatingParameters.backlightMin),
+                           api_final_int(changes, n, API_OP(backlightMax), OperatingParameters.backlightMax));
+
+  updateThermostatParams();
+  ESP_LOGI(TAG, "%s: %d fields changed", (resource == API_CONFIG) ? "config" : "state", n);
+#ifdef MQTT_ENABLED
+  if (effects & API_MODES)
+    updateEnabledHvacModes();
+  MqttUpdateStatusTopic();
+#endif
+  return true;
+}
+
+//
+// Apply a PATCH/PUT body to 'resource'. False, with the reason in 'error',
+// if nothing was changed.
+//
+bool apiUpdate(API_RESOURCE resource, const char *body, size_t len, char *error, size_t errorLen)
+{
+  API_CHANGE changes[API_MAX_CHANGES];
+  JsonDocument doc;
+  DeserializationError err;
+  int n = 0;
+
+  err = deserializeJson(doc, body, len);
+  if (err)
+  {
+    snprintf(error, errorLen, "bad JSON: %s", err.c_str());
+    return false;
+  }
+  if (!doc.is<JsonObject>())
+  {
+    snprintf(error, errorLen, "expected a JSON object");
+    return false;
+  }
+
+  for (JsonPair kv : doc.as<JsonObject>())
+  {
+    const API_FIELD *f = api_lookup(api_fields(resource), kv.key().c_str());
+    JsonVariant value = kv.value();
+    API_VALUE *v;
+    bool ok;
+
+    if (f == NULL)
+    {
+      snprintf(error, errorLen, "%s: unknown field", kv.key().c_str());
+      return false;
+    }
+    if (n == API_MAX_CHANGES)
+    {
+      snprintf(error, errorLen, "too many fields");
+      return false;
+    }
+
+    changes[n].field = f;
+    v = &changes[n].value;
+    memset(v, 0, sizeof(API_VALUE));
+    switch (f->type)
+    {
+    case API_FLOAT:
+      ok = value.is<float>();
+      v->f = value.as<float>();
+      break;
+    case API_U16:
+      ok = value.is<long>();
+      v->i = value.as<long>();
+      break;
+    case API_BOOL:
+      ok = value.is<bool>();
+      v->i = value.as<bool>();
+      break;
+    default:
+      ok = value.is<const char *>();
+      v->s = ok ? value.as<const char *>() : "";
+      break;
+    }
+    if (!ok)
+    {
+      snprintf(error, errorLen, "%s: wrong type", f->name);
+      return false;
+    }
+    n++;
+  }
+
+  if (!api_apply(resource, changes, n, error, errorLen))
+  {
+    ESP_LOGW(TAG, "Rejected: %s", error);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,210 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * boot.cpp
+ *
+ * Boot profiler and startup sequencing. app_main() brings the thermostat
+ * up as a set of phases (NVS, UI, sensors, wifi, ...). Each phase that
+ * doesn't have to run on the main task gets a short-lived task of its
+ * own which waits for the phases it depends on, runs, and goes away, so
+ * independent work overlaps: the radar and AHT come up and wifi
+ * associates while the display is being built.
+ *
+ * The start and end of every phase is recorded, along with the
+ * milestones that matter to the user: the first frame on the display,
+ * the first temperature reading and the first control decision. The
+ * timeline is shown on the Info screen and by the console Boot command.
+ *
+ * Finished phases and milestones are bits in an event group; that is
+ * what the dependencies wait on.
+ *
+ */
+
+#include "thermostat.hpp"
+#include "esp_timer.h"
+
+#define BOOT_BAR_WIDTH  32
+
+static const char *TAG = "BOOT";
+
+static const char *bootNames[NR_BOOT_EVENTS] = {
+    "nvs", "relays", "ui", "sensors", "indicators", "wifi", "mqtt", "web", "telnet", "control",
+    "first frame", "first reading", "first decision"};
+
+typedef struct
+{
+  BOOT_EVENT phase;
+  uint32_t needs;
+  BOOT_FN fn;
+} BOOT_JOB;
+
+static BOOT_TIMES bootTimes[NR_BOOT_EVENTS];
+static BOOT_JOB bootJobs[NR_BOOT_EVENTS];
+static int64_t bootAppMain;                 // When app_main() was reached
+static EventGroupHandle_t bootEvents;
+static portMUX_TYPE bootLock = portMUX_INITIALIZER_UNLOCKED;
+
+void bootInit()
+{
+  bootAppMain = esp_timer_get_time();
+  bootEvents = xEventGroupCreate();
+}
+
+void bootStart(BOOT_EVENT phase)
+{
+  portENTER_CRITICAL(&bootLock);
+  bootTimes[phase].startUs = esp_timer_get_time();
+  portEXIT_CRITICAL(&bootLock);
+}
+
+//
+// A phase counts as done whether or not it worked; phases that depend
+// on it still go ahead (MQTT starts even if wifi didn't connect).
+//
+void bootEnd(BOOT_EVENT phase, bool ok)
+{
+  portENTER_CRITICAL(&bootLock);
+  bootTimes[phase].endUs = esp_timer_get_time();
+  bootTimes[phase].ok = ok;
+  portEXIT_CRITICAL(&bootLock);
+
+  ESP_LOGI(TAG, "%s %s after %lld ms", bootNames[phase], ok ? "done" : "failed",
+           (bootTimes[phase].endUs - bootTimes[phase].startUs) / 1000);
+  xEventGroupSetBits(bootEvents, BOOT_BIT(phase));
+}
+
+// Only the first time counts; later calls are cheap
+void bootMilestone(BOOT_EVENT milestone)
+{
+  if (bootTimes[milestone].endUs != 0)
+    return;
+
+  portENTER_CRITICAL(&bootLock);
+  if (bootTimes[milestone].endUs == 0)
+  {
+    bootTimes[milestone].startUs = bootTimes[milestone].endUs = esp_timer_get_time();
+    bootTimes[milestone].ok = true;
+  }
+  portEXIT_CRITICAL(&bootLock);
+  xEventGroupSetBits(bootEvents, BOOT_BIT(milestone));
+}
+
+bool bootDone(BOOT_EVENT event)
+{
+  return (bootEvents != NULL) && ((xEventGroupGetBits(bootEvents) & BOOT_BIT(event)) != 0);
+}
+
+// Wait for all of 'needs'; false on timeout (0 = wait for ever)
+bool bootWait(uint32_t needs, uint32_t timeoutMs)
+{
+  TickType_t ticks = (timeoutMs == 0) ? portMAX_DELAY : pdMS_TO_TICKS(timeoutMs);
+
+  return (xEventGroupWaitBits(bootEvents, needs, pdFALSE, pdTRUE, ticks) & needs) == needs;
+}
+
+static void boot_task(void *parameter)
+{
+  BOOT_JOB *job = (BOOT_JOB *)parameter;
+
+  bootWait(job->needs, 0);
+  bootStart(job->phase);
+  bootEnd(job->phase, job->fn());
+  vTaskDelete(NULL);
+}
+
+//
+// Run a phase on its own task once everything in 'needs' (BOOT_BIT()s)
+// is done.
+//
+void bootRun(BOOT_EVENT phase, uint32_t needs, BOOT_FN fn, uint32_t stack)
+{
+  char name[configMAX_TASK_NAME_LEN];
+  BOOT_JOB *job = &bootJobs[phase];
+
+  job->phase = phase;
+  job->needs = needs;
+  job->fn = fn;
+  snprintf(name, sizeof(name), "Boot %s", bootNames[phase]);
+  if (xTaskCreate(boot_task, name, stack, job, tskIDLE_PRIORITY + 1, NULL) != pdPASS)
+  {
+    // Don't leave whatever depends on it waiting
+    ESP_LOGE(TAG, "Could not start the %s task", bootNames[phase]);
+    OperatingParameters.Errors.systemErrors++;
+    bootStart(phase);
+    bootEnd(phase, false);
+  }
+}
+
+const char *bootEventName(BOOT_EVENT event)
+{
+  return bootNames[event];
+}
+
+void bootGetTimes(BOOT_EVENT event, BOOT_TIMES *times)
+{
+  portENTER_CRITICAL(&bootLock);
+  *times = bootTimes[event];
+  portEXIT_CRITICAL(&bootLock);
+}
+
+//
+// The timeline as text, in ms since the system timer started (about when
+// the bootloader handed over), with a bar per phase.
+//
+void bootWriteReport(METRICS_OUTPUT output, void *ctx)
+{
+  BOOT_TIMES times[NR_BOOT_EVENTS];
+  int64_t last = bootAppMain;
+  char line[128];
+
+  portENTER_CRITICAL(&bootLock);
+  memcpy(times, bootTimes, sizeof(times));
+  portEXIT_CRITICAL(&bootLock);
+
+  for (int e = 0; e < NR_BOOT_EVENTS; e++)
+    if (times[e].endUs > last)
+      last = times[e].endUs;
+  if (last <= bootAppMain)
+    last = bootAppMain + 1;
+
+  snprintf(line, sizeof(line), "app_main() reached at %lld ms; times in ms\n\n", bootAppMain / 1000);
+  output(ctx, line);
+  output(ctx, "Phase           Start    End   Took\n");
+  for (int e = 0; e < NR_BOOT_EVENTS; e++)
+  {
+    char bar[BOOT_BAR_WIDTH + 1];
+    const BOOT_TIMES *t = &times[e];
+
+    if (e == BOOT_FIRST_FRAME)
+      output(ctx, "\nMilestone        Time\n");
+
+    if (BOOT_IS_MILESTONE(e))
+    {
+      if (t->endUs == 0)
+        snprintf(line, sizeof(line), "%-15s      -\n", bootNames[e]);
+      else
+        snprintf(line, sizeof(line), "%-15s %6lld\n", bootNames[e], t->endUs / 1000);
+      output(ctx, line);
+      continue;
+    }
+    if (t->startUs == 0)
+    {
+      snprintf(line, sizeof(line), "%-15s      -\n", bootNames[e]);
+      output(ctx, line);
+      continue;
+    }
+
+    // Scale app_main() .. the last event onto the bar
+    int from = (int)((t->startUs - bootAppMain) * BOOT_BAR_WIDTH / (last - bootAppMain));
+    int to = (int)(((t->endUs ? t->endUs : last) - bootAppMain) * BOOT_BAR_WIDTH / (last - bootAppMain));
+    for (int i = 0; i < BOOT_BAR_WIDTH; i++)
+      bar[i] = (i < from) ? ' ' : (i <= to) ? '#' : '\0';
+    bar[BOOT_BAR_WIDTH] = '\0';
+
+    if (t->endUs == 0)
+      snprintf(line, sizeof(line), "%-15s %6lld      -      -  |%s\n", bootNames[e], t->startUs / 1000, bar);
+    else
+      snprintf(line, sizeof(line), "%-15s %6lld %6lld %6lld  |%s%s\n", bootNames[e], t->startUs / 1000,
+               t->endUs / 1000, (t->endUs - t->startUs) / 1000, bar, t->ok ? "" : "  FAILED");
+    output(ctx, line);
+  }
+}
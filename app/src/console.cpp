@@ -0,0 +1,1390 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * console.cpp
+ *
+ * Command line interpreter shared by the telnet server and any other line
+ * based console.
+ *
+ * Commands are described by CONSOLE_CMD tables: name, argument synopsis,
+ * argument types, argument count limits, handler and help text. A console
+ * passes its own table (commands that only make sense for it, e.g. telnet's
+ * Quit) in its CONSOLE; it is searched before the shared table below.
+ *
+ * A line is split into words (double quotes keep spaces in a word). The
+ * first word selects the command: an exact match wins, otherwise it must be
+ * the start of exactly one command name. Argument counts and the numeric
+ * and parameter arguments are checked before the handler runs, so handlers
+ * get well formed input.
+ *
+ * Get and Set give access to every field of OperatingParameters by name.
+ * Settings that have side effects (set temperature, mode, backlight, ...)
+ * go through the same functions the UI uses; the others are stored and
+ * saved with updateThermostatParams().
+ *
+ */
+
+#include "thermostat.hpp"
+#include "version.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <math.h>
+#include <esp_heap_caps.h>
+
+#define min(x, y) ((x < y) ? x : y)
+#define max(x, y) ((x > y) ? x : y)
+
+static const char *TAG = "CONSOLE";
+
+extern const CONSOLE_CMD sharedCommands[];
+
+/////////////////////////////////////////////////////////////////////
+//     Parameters
+/////////////////////////////////////////////////////////////////////
+
+typedef enum
+{
+  PARAM_STRING = 0,   // char array of 'size' bytes
+  PARAM_STRPTR,       // char *
+  PARAM_FLOAT,
+  PARAM_INT,
+  PARAM_U16,
+  PARAM_BOOL,
+  PARAM_CHAR,
+  PARAM_MODE,         // HVAC_MODE
+  PARAM_CONTROL,      // HVAC_CONTROL_MODE
+  PARAM_MAC
+} PARAM_TYPE;
+
+#define PARAM_RO    (0x01)    // Read only
+#define PARAM_SAVE  (0x02)    // Saved with updateThermostatParams()
+#define PARAM_TEMP  (0x04)    // A set point: limits depend on the units
+
+typedef struct
+{
+  float f;
+  long i;
+  const char *s;
+} PARAM_VALUE;
+
+typedef struct PARAM PARAM;
+struct PARAM
+{
+  const char *name;
+  PARAM_TYPE type;
+  void *value;
+  uint16_t size;
+  uint8_t flags;
+  float min;
+  float max;
+  bool (*apply)(const PARAM *p, const PARAM_VALUE *v);    // Instead of storing the value
+};
+
+static bool apply_set_temp(const PARAM *p, const PARAM_VALUE *v)
+{
+  updateHvacSetTemp(v->f);
+  return true;
+}
+
+// The low auto set point may not go above the high one, nor the high below the low
+static bool apply_auto_min(const PARAM *p, const PARAM_VALUE *v)
+{
+  if (v->f > OperatingParameters.tempSetAutoMax)
+    return false;
+  OperatingParameters.tempSetAutoMin = v->f;
+  updateThermostatParams();
+  return true;
+}
+
+static bool apply_auto_max(const PARAM *p, const PARAM_VALUE *v)
+{
+  if (v->f < OperatingParameters.tempSetAutoMin)
+    return false;
+  OperatingParameters.tempSetAutoMax = v->f;
+  updateThermostatParams();
+  return true;
+}
+
+// Converts every temperature setting, not just the units
+static bool apply_temp_units(const PARAM *p, const PARAM_VALUE *v)
+{
+  updateTempUnits((char)v->i);
+  updateThermostatParams();
+  return true;
+}
+
+static bool apply_set_mode(const PARAM *p, const PARAM_VALUE *v)
+{
+  updateHvacMode((HVAC_MODE)v->i);
+  return true;
+}
+
+static bool apply_control_mode(const PARAM *p, const PARAM_VALUE *v)
+{
+  hvacControlSetMode((HVAC_CONTROL_MODE)v->i, OperatingParameters.hvacCyclesPerHour);
+  return true;
+}
+
+static bool apply_cycles(const PARAM *p, const PARAM_VALUE *v)
+{
+  hvacControlSetMode(OperatingParameters.hvacControlMode, v->i);
+  return true;
+}
+
+static bool apply_backlight_min(const PARAM *p, const PARAM_VALUE *v)
+{
+  return tftSetBacklightRange(v->i, OperatingParameters.backlightMax);
+}
+
+static bool apply_backlight_max(const PARAM *p, const PARAM_VALUE *v)
+{
+  return tftSetBacklightRange(OperatingParameters.backlightMin, v->i);
+}
+
+static bool apply_timezone(const PARAM *p, const PARAM_VALUE *v)
+{
+  OperatingParameters.timezone_sel = v->i;
+  OperatingParameters.timezone = (char *)gmt_timezones[OperatingParameters.timezone_sel];
+  updateThermostatParams();
+  updateTimezoneFromConfig();
+  return true;
+}
+
+static bool apply_device_name(const PARAM *p, const PARAM_VALUE *v)
+{
+  strlcpy(OperatingParameters.DeviceName, v->s, sizeof(OperatingParameters.DeviceName));
+  setWifiCreds();
+  return true;
+}
+
+static bool apply_hvac_enable(const PARAM *p, const PARAM_VALUE *v)
+{
+  *(bool *)p->value = v->i;
+  updateThermostatParams();
+#ifdef MQTT_ENABLED
+  updateEnabledHvacModes();
+#endif
+  return true;
+}
+
+#define PARAM_OP(field) &OperatingParameters.field
+#define PARAM_STR(field) PARAM_STRING, PARAM_OP(field), sizeof(OperatingParameters.field)
+
+// MqttClient is a handle, not a setting, and is left out
+static const PARAM params[] = {
+    {"FriendlyName", PARAM_STR(FriendlyName), PARAM_SAVE},
+    {"DeviceName", PARAM_STR(DeviceName), 0, 0, 0, apply_device_name},
+    {"mac", PARAM_MAC, PARAM_OP(mac), 0, PARAM_RO},
+    {"ld2410FirmWare", PARAM_STR(ld2410FirmWare), PARAM_RO},
+    {"hvacOpMode", PARAM_MODE, PARAM_OP(hvacOpMode), 0, PARAM_RO},
+    {"hvacSetMode", PARAM_MODE, PARAM_OP(hvacSetMode), 0, 0, 0, 0, apply_set_mode},
+    {"tempSet", PARAM_FLOAT, PARAM_OP(tempSet), 0, PARAM_TEMP, 0, 0, apply_set_temp},
+    {"tempSetAutoMin", PARAM_FLOAT, PARAM_OP(tempSetAutoMin), 0, PARAM_TEMP, 0, 0, apply_auto_min},
+    {"tempSetAutoMax", PARAM_FLOAT, PARAM_OP(tempSetAutoMax), 0, PARAM_TEMP, 0, 0, apply_auto_max},
+    {"tempCurrent", PARAM_FLOAT, PARAM_OP(tempCurrent), 0, PARAM_RO},
+    {"humidCurrent", PARAM_FLOAT, PARAM_OP(humidCurrent), 0, PARAM_RO},
+    {"tempUnits", PARAM_CHAR, PARAM_OP(tempUnits), 0, 0, 0, 0, apply_temp_units},
+    {"tempSwing", PARAM_FLOAT, PARAM_OP(tempSwing), 0, PARAM_SAVE, 0, 6},
+    {"tempCorrection", PARAM_FLOAT, PARAM_OP(tempCorrection), 0, PARAM_SAVE, -10, 10},
+    {"humidityCorrection", PARAM_FLOAT, PARAM_OP(humidityCorrection), 0, PARAM_SAVE, -20, 20},
+    {"lightDetected", PARAM_INT, PARAM_OP(lightDetected), 0, PARAM_RO},
+    {"lightLux", PARAM_FLOAT, PARAM_OP(lightLux), 0, PARAM_RO},
+    {"motionDetected", PARAM_BOOL, PARAM_OP(motionDetected), 0, PARAM_RO},
+    {"occupied", PARAM_BOOL, PARAM_OP(occupied), 0, PARAM_RO},
+    {"targetDistance", PARAM_U16, PARAM_OP(targetDistance), 0, PARAM_RO},
+    {"vacancyTimeout", PARAM_U16, PARAM_OP(vacancyTimeout), 0, PARAM_SAVE, 1, 1440},
+    {"ecoSetback", PARAM_FLOAT, PARAM_OP(ecoSetback), 0, PARAM_SAVE, 0, 10},
+    {"wifiConnected", PARAM_BOOL, PARAM_OP(wifiConnected), 0, PARAM_RO},
+    {"hvacCoolEnable", PARAM_BOOL, PARAM_OP(hvacCoolEnable), 0, 0, 0, 0, apply_hvac_enable},
+    {"hvacFanEnable", PARAM_BOOL, PARAM_OP(hvacFanEnable), 0, 0, 0, 0, apply_hvac_enable},
+    {"hvac2StageHeatEnable", PARAM_BOOL, PARAM_OP(hvac2StageHeatEnable), 0, 0, 0, 0, apply_hvac_enable},
+    {"hvacReverseValveEnable", PARAM_BOOL, PARAM_OP(hvacReverseValveEnable), 0, 0, 0, 0, apply_hvac_enable},
+    {"hvacControlMode", PARAM_CONTROL, PARAM_OP(hvacControlMode), 0, 0, 0, 0, apply_control_mode},
+    {"hvacCyclesPerHour", PARAM_U16, PARAM_OP(hvacCyclesPerHour), 0, 0, 1, 12, apply_cycles},
+    {"thermostatBeepEnable", PARAM_BOOL, PARAM_OP(thermostatBeepEnable), 0, PARAM_SAVE},
+    {"thermostatSleepTime", PARAM_U16, PARAM_OP(thermostatSleepTime), 0, PARAM_SAVE, 0, 3600},
+    {"backlightMin", PARAM_U16, PARAM_OP(backlightMin), 0, 0, 0, 99, apply_backlight_min},
+    {"backlightMax", PARAM_U16, PARAM_OP(backlightMax), 0, 0, 1, 100, apply_backlight_max},
+    {"timezone", PARAM_STRPTR, PARAM_OP(timezone), 0, PARAM_RO},
+    {"timezone_sel", PARAM_U16, PARAM_OP(timezone_sel), 0, 0, 0, 23, apply_timezone},
+#ifdef MQTT_ENABLED
+    {"MqttEnabled", PARAM_BOOL, PARAM_OP(MqttEnabled), 0, PARAM_SAVE},
+    {"MqttConnected", PARAM_BOOL, PARAM_OP(MqttConnected), 0, PARAM_RO},
+    {"MqttBrokerHost", PARAM_STR(MqttBrokerHost), PARAM_SAVE},
+    {"MqttBrokerPort", PARAM_U16, PARAM_OP(MqttBrokerPort), 0, PARAM_SAVE, 1, 65535},
+    {"MqttBrokerUsername", PARAM_STR(MqttBrokerUsername), PARAM_SAVE},
+    {"MqttBrokerPassword", PARAM_STR(MqttBrokerPassword), PARAM_SAVE},
+#endif
+#ifdef MATTER_ENABLED
+    {"MatterEnabled", PARAM_BOOL, PARAM_OP(MatterEnabled), 0, PARAM_SAVE},
+    {"MatterStarted", PARAM_BOOL, PARAM_OP(MatterStarted), 0, PARAM_RO},
+#endif
+    {"Errors.systemErrors", PARAM_U16, PARAM_OP(Errors.systemErrors), 0, PARAM_RO},
+    {"Errors.hardwareErrors", PARAM_U16, PARAM_OP(Errors.hardwareErrors), 0, PARAM_RO},
+    {"Errors.wifiErrors", PARAM_U16, PARAM_OP(Errors.wifiErrors), 0, PARAM_RO},
+#ifdef MQTT_ENABLED
+    {"Errors.mqttConnectErrors", PARAM_U16, PARAM_OP(Errors.mqttConnectErrors), 0, PARAM_RO},
+    {"Errors.mqttProtocolErrors", PARAM_U16, PARAM_OP(Errors.mqttProtocolErrors), 0, PARAM_RO},
+#endif
+#ifdef MATTER_ENABLED
+    {"Errors.matterConnectErrors", PARAM_U16, PARAM_OP(Errors.matterConnectErrors), 0, PARAM_RO},
+#endif
+#ifdef TELNET_ENABLED
+    {"Errors.telnetNetworkErrors", PARAM_U16, PARAM_OP(Errors.telnetNetworkErrors), 0, PARAM_RO},
+#endif
+    {NULL}};
+
+static const PARAM *param_lookup(const char *name)
+{
+  for (const PARAM *p = params; p->name != NULL; p++)
+    if (strcasecmp(p->name, name) == 0)
+      return p;
+  return NULL;
+}
+
+static void param_format(const PARAM *p, char *buf, size_t len)
+{
+  switch (p->type)
+  {
+  case PARAM_STRING:
+    snprintf(buf, len, "%s", (const char *)p->value);
+    break;
+  case PARAM_STRPTR:
+    snprintf(buf, len, "%s", *(const char **)p->value ? *(const char **)p->value : "");
+    break;
+  case PARAM_FLOAT:
+    snprintf(buf, len, "%.2f", *(float *)p->value);
+    break;
+  case PARAM_INT:
+    snprintf(buf, len, "%d", *(int *)p->value);
+    break;
+  case PARAM_U16:
+    snprintf(buf, len, "%u", *(uint16_t *)p->value);
+    break;
+  case PARAM_BOOL:
+    snprintf(buf, len, "%s", *(bool *)p->value ? "yes" : "no");
+    break;
+  case PARAM_CHAR:
+    snprintf(buf, len, "%c", *(char *)p->value);
+    break;
+  case PARAM_MODE:
+    snprintf(buf, len, "%s", hvacModeToString(*(HVAC_MODE *)p->value));
+    break;
+  case PARAM_CONTROL:
+    snprintf(buf, len, "%s", hvacControlModeToString(*(HVAC_CONTROL_MODE *)p->value));
+    break;
+  case PARAM_MAC:
+  {
+    uint8_t *mac = (uint8_t *)p->value;
+    snprintf(buf, len, "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    break;
+  }
+  }
+}
+
+static bool parse_number(const char *str, bool integer, float *value)
+{
+  char *end;
+
+  if (integer)
+    *value = strtol(str, &end, 10);
+  else
+    *value = strtof(str, &end);
+  return (*str != '\0') && (*end == '\0') && !isnan(*value);
+}
+
+static bool parse_bool(const char *str, long *value)
+{
+  static const char *yes[] = {"yes", "on", "true", "1", NULL};
+  static const char *no[] = {"no", "off", "false", "0", NULL};
+
+  for (int i = 0; yes[i] != NULL; i++)
+  {
+    if (strcasecmp(str, yes[i]) == 0)
+    {
+      *value = 1;
+      return true;
+    }
+    if (strcasecmp(str, no[i]) == 0)
+    {
+      *value = 0;
+      return true;
+    }
+  }
+  return false;
+}
+
+//
+// Parse, check and apply a new value. Returns an error message, or NULL.
+//
+static const char *param_set(const PARAM *p, const char *str)
+{
+  PARAM_VALUE v = {0.0, 0, str};
+  float min = p->min;
+  float max = p->max;
+
+  if (p->flags & PARAM_RO)
+    return "read only";
+
+  switch (p->type)
+  {
+  case PARAM_STRING:
+    if (strlen(str) >= p->size)
+      return "too long";
+    break;
+  case PARAM_FLOAT:
+  case PARAM_INT:
+  case PARAM_U16:
+    if (!parse_number(str, p->type != PARAM_FLOAT, &v.f))
+      return (p->type == PARAM_FLOAT) ? "not a number" : "not a whole number";
+    if (p->flags & PARAM_TEMP)
+    {
+      min = (OperatingParameters.tempUnits == 'C') ? SET_TEMP_MIN_C : SET_TEMP_MIN_F;
+      max = (OperatingParameters.tempUnits == 'C') ? SET_TEMP_MAX_C : SET_TEMP_MAX_F;
+    }
+    if (((min != 0) || (max != 0)) && ((v.f < min) || (v.f > max)))
+      return "out of range";
+    if ((p->type == PARAM_U16) && ((v.f < 0) || (v.f > UINT16_MAX)))
+      return "out of range";
+    v.i = (long)v.f;
+    break;
+  case PARAM_BOOL:
+    if (!parse_bool(str, &v.i))
+      return "expected yes or no";
+    break;
+  case PARAM_CHAR:
+    if ((strlen(str) != 1) || ((toupper(str[0]) != 'C') && (toupper(str[0]) != 'F')))
+      return "expected C or F";
+    v.i = toupper(str[0]);
+    break;
+  case PARAM_MODE:
+  {
+    char mode[16];
+
+    strlcpy(mode, str, sizeof(mode));
+    mode[0] = toupper(mode[0]);
+    v.i = strToHvacMode(mode);
+    if (v.i == ERROR)
+      return "unknown mode";
+    break;
+  }
+  case PARAM_CONTROL:
+    v.i = strToHvacControlMode(str);
+    if (v.i == NR_CONTROL_MODES)
+      return "unknown control mode";
+    break;
+  default:
+    return "read only";
+  }
+
+  if (p->apply != NULL)
+    return p->apply(p, &v) ? NULL : "rejected";
+
+  switch (p->type)
+  {
+  case PARAM_STRING:
+    strlcpy((char *)p->value, str, p->size);
+    break;
+  case PARAM_FLOAT:
+    *(float *)p->value = v.f;
+    break;
+  case PARAM_INT:
+    *(int *)p->value = v.i;
+    break;
+  case PARAM_U16:
+    *(uint16_t *)p->value = v.i;
+    break;
+  case PARAM_BOOL:
+    *(bool *)p->value = v.i;
+    break;
+  case PARAM_CHAR:
+    *(char *)p->value = v.i;
+    break;
+  default:
+    break;
+  }
+  if (p->flags & PARAM_SAVE)
+    updateThermostatParams();
+  return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////
+//     Parsing, lookup and completion
+/////////////////////////////////////////////////////////////////////
+
+//
+// Split a line into words in place. Double quotes group words and are
+// removed. Returns the number of words, maxArgs + 1 if there are more
+// than maxArgs, or -1 for an unterminated quote.
+//
+int consoleTokenize(char *line, char *argv[], int maxArgs)
+{
+  char *in = line;
+  int argc = 0;
+
+  for (;;)
+  {
+    while ((*in == ' ') || (*in == '\t'))
+      in++;
+    if (*in == '\0')
+      return argc;
+    if (argc == maxArgs)
+      return maxArgs + 1;
+
+    char *out = in;
+    bool quoted = false;
+
+    argv[argc++] = out;
+    while ((*in != '\0') && (quoted || ((*in != ' ') && (*in != '\t'))))
+    {
+      if (*in == '"')
+        quoted = !quoted;
+      else
+        *out++ = *in;
+      in++;
+    }
+    if (quoted)
+      return -1;
+    if (*in != '\0')
+      in++;
+    *out = '\0';
+  }
+}
+
+static bool cmd_matches(const CONSOLE_CMD *cmd, const char *name, size_t len)
+{
+  return (cmd->help != NULL) && (strncasecmp(cmd->name, name, len) == 0);
+}
+
+//
+// Find a command by name, or by the start of its name if only one command
+// starts that way. *matches returns the number of candidates.
+//
+const CONSOLE_CMD *consoleLookup(CONSOLE *con, const char *name, int *matches)
+{
+  const CONSOLE_CMD *tables[] = {con->commands, sharedCommands};
+  const CONSOLE_CMD *found = NULL;
+  size_t len = strlen(name);
+
+  *matches = 0;
+  for (int t = 0; t < 2; t++)
+  {
+    for (const CONSOLE_CMD *cmd = tables[t]; (cmd != NULL) && (cmd->name != NULL); cmd++)
+    {
+      if (strcasecmp(cmd->name, name) == 0)
+      {
+        *matches = 1;
+        return cmd;
+      }
+      if ((len > 0) && cmd_matches(cmd, name, len))
+      {
+        if (found == NULL)
+          found = cmd;
+        (*matches)++;
+      }
+    }
+  }
+  return (*matches == 1) ? found : NULL;
+}
+
+static char arg_type(const CONSOLE_CMD *cmd, int arg)
+{
+  size_t n = (cmd->types != NULL) ? strlen(cmd->types) : 0;
+
+  if (n == 0)
+    return 's';
+  return cmd->types[(arg - 1 < (int)n) ? arg - 1 : n - 1];
+}
+
+static void print_usage(CONSOLE *con, const CONSOLE_CMD *cmd)
+{
+  con->print("Usage: %s %s\n", cmd->name, cmd->args);
+}
+
+static void print_candidates(CONSOLE *con, const char *name)
+{
+  const CONSOLE_CMD *tables[] = {con->commands, sharedCommands};
+
+  for (int t = 0; t < 2; t++)
+    for (const CONSOLE_CMD *cmd = tables[t]; (cmd != NULL) && (cmd->name != NULL); cmd++)
+      if (cmd_matches(cmd, name, strlen(name)))
+        con->print(" %s", cmd->name);
+  con->print("\n");
+}
+
+//
+// Run one command line (without its line ending)
+//
+void consoleExecute(CONSOLE *con, char *line)
+{
+  char *argv[CONSOLE_MAX_ARGS];
+  const CONSOLE_CMD *cmd;
+  int matches;
+  int argc;
+  float number;
+
+  argc = consoleTokenize(line, argv, CONSOLE_MAX_ARGS);
+  if (argc < 0)
+  {
+    con->print("Missing closing quote\n");
+    return;
+  }
+  if (argc == 0)
+    return;
+
+  cmd = consoleLookup(con, argv[0], &matches);
+  if (cmd == NULL)
+  {
+    if (matches > 1)
+    {
+      con->print("Ambiguous command: %s could be", argv[0]);
+      print_candidates(con, argv[0]);
+    }
+    else
+    {
+      ESP_LOGW(TAG, "Unknown command: %s", argv[0]);
+      con->print("Unknown command: %s (Help lists commands)\n", argv[0]);
+    }
+    return;
+  }
+  ESP_LOGI(TAG, "Received command: %s", cmd->name);
+
+  if ((argc - 1 < cmd->minArgs) || (argc - 1 > cmd->maxArgs))
+  {
+    print_usage(con, cmd);
+    return;
+  }
+  for (int i = 1; i < argc; i++)
+  {
+    switch (arg_type(cmd, i))
+    {
+    case 'i':
+    case 'f':
+      if (!parse_number(argv[i], arg_type(cmd, i) == 'i', &number))
+      {
+        con->print("Not a %snumber: %s\n", (arg_type(cmd, i) == 'i') ? "whole " : "", argv[i]);
+        print_usage(con, cmd);
+        return;
+      }
+      break;
+    case 'p':
+      if (param_lookup(argv[i]) == NULL)
+      {
+        con->print("Unknown parameter: %s (Get lists them)\n", argv[i]);
+        return;
+      }
+      break;
+    }
+  }
+  cmd->handler(con, argc, argv);
+}
+
+static size_t common_prefix(const char *a, const char *b)
+{
+  size_t n = 0;
+
+  while (a[n] && b[n] && (tolower(a[n]) == tolower(b[n])))
+    n++;
+  return n;
+}
+
+//
+// Complete the word being typed at the end of line (*len characters, in a
+// buffer of size bytes): command names for the first word, parameter names
+// where a command takes one. Adds what all candidates have in common, plus
+// a space if there is only one; if nothing could be added and there are
+// several, they are listed. Returns the number of candidates.
+//
+int consoleComplete(CONSOLE *con, char *line, size_t *len, size_t size)
+{
+  char words[CONSOLE_HISTORY_SIZE];
+  char *argv[CONSOLE_MAX_ARGS];
+  const char *best = NULL;
+  const char *word;
+  size_t start = *len;
+  size_t common = 0;
+  int argc;
+  int matches = 0;
+
+  while ((start > 0) && (line[start - 1] != ' '))
+    start--;
+  word = &line[start];
+  size_t wordLen = *len - start;
+
+  // Which argument is being completed
+  strlcpy(words, line, min(start + 1, sizeof(words)));
+  argc = consoleTokenize(words, argv, CONSOLE_MAX_ARGS);
+  if ((argc < 0) || (argc >= CONSOLE_MAX_ARGS))
+    return 0;
+
+  const char *candidates[48];
+  int nr = 0;
+
+  if (argc == 0)
+  {
+    const CONSOLE_CMD *tables[] = {con->commands, sharedCommands};
+
+    for (int t = 0; t < 2; t++)
+      for (const CONSOLE_CMD *cmd = tables[t]; (cmd != NULL) && (cmd->name != NULL) && (nr < 48); cmd++)
+        if (cmd->help != NULL)
+          candidates[nr++] = cmd->name;
+  }
+  else
+  {
+    const CONSOLE_CMD *cmd = consoleLookup(con, argv[0], &matches);
+
+    if ((cmd == NULL) || (arg_type(cmd, argc) != 'p') || (argc > cmd->maxArgs))
+      return 0;
+    for (const PARAM *p = params; (p->name != NULL) && (nr < 48); p++)
+      candidates[nr++] = p->name;
+  }
+
+  matches = 0;
+  for (int i = 0; i < nr; i++)
+  {
+    if (strncasecmp(candidates[i], word, wordLen) != 0)
+      continue;
+    if (matches++ == 0)
+    {
+      best = candidates[i];
+      common = strlen(best);
+    }
+    else
+    {
+      size_t n = common_prefix(best, candidates[i]);
+      common = min(common, n);
+    }
+  }
+  if (matches == 0)
+    return 0;
+
+  size_t add = common - wordLen;
+  if ((add == 0) && (matches > 1))
+  {
+    con->print("\n");
+    for (int i = 0; i < nr; i++)
+      if (strncasecmp(candidates[i], word, wordLen) == 0)
+        con->print("%s  ", candidates[i]);
+    con->print("\n");
+    return matches;
+  }
+  if (*len + add + 1 < size)
+  {
+    memcpy(&line[*len], &best[wordLen], add);
+    *len += add;
+    if ((matches == 1) && (*len + 2 < size))
+      line[(*len)++] = ' ';
+    line[*len] = '\0';
+  }
+  return matches;
+}
+
+void consoleHistoryAdd(CONSOLE_HISTORY *history, const char *line)
+{
+  if ((*line == '\0') || (strlen(line) >= CONSOLE_HISTORY_SIZE))
+    return;
+  // Don't repeat the last line
+  if ((history->count > 0) &&
+      (strcmp(consoleHistoryGet(history, 1), line) == 0))
+    return;
+  strlcpy(history->lines[history->next], line, CONSOLE_HISTORY_SIZE);
+  history->next = (history->next + 1) % CONSOLE_HISTORY_LINES;
+  if (history->count < CONSOLE_HISTORY_LINES)
+    history->count++;
+}
+
+//
+// The line entered 'back' lines ago (1 is the last one), or NULL
+//
+const char *consoleHistoryGet(CONSOLE_HISTORY *history, int back)
+{
+  if ((back < 1) || (back > history->count))
+    return NULL;
+  return history->lines[(history->next + CONSOLE_HISTORY_LINES - back) % CONSOLE_HISTORY_LINES];
+}
+
+/////////////////////////////////////////////////////////////////////
+//     Shared commands
+/////////////////////////////////////////////////////////////////////
+
+static void join_args(int argc, char *argv[], char *buf, size_t len)
+{
+  size_t used = 0;
+
+  buf[0] = '\0';
+  for (int i = 1; (i < argc) && (used < len); i++)
+    used += snprintf(&buf[used], len - used, "%s%s", (i > 1) ? " " : "", argv[i]);
+}
+
+static void cmd_help(CONSOLE *con, int argc, char *argv[])
+{
+  const CONSOLE_CMD *tables[] = {con->commands, sharedCommands};
+  char synopsis[40];
+
+  con->print("Valid commands (any unique start of a name will do):\n");
+  for (int t = 0; t < 2; t++)
+  {
+    for (const CONSOLE_CMD *cmd = tables[t]; (cmd != NULL) && (cmd->name != NULL); cmd++)
+    {
+      if (cmd->help == NULL)
+        continue;
+      snprintf(synopsis, sizeof(synopsis), "%s %s", cmd->name, cmd->args);
+      con->print("  %-22s %s\n", synopsis, cmd->help);
+    }
+  }
+}
+
+static void cmd_up(CONSOLE *con, int argc, char *argv[])
+{
+  con->print("Temperature up\n");
+  actionRun(ACTION_TEMP_UP, ACTION_SRC_CONSOLE);
+  con->print("New set temp: %.1f\n", OperatingParameters.tempSet);
+}
+
+static void cmd_down(CONSOLE *con, int argc, char *argv[])
+{
+  con->print("Temperature down\n");
+  actionRun(ACTION_TEMP_DOWN, ACTION_SRC_CONSOLE);
+  con->print("New set temp: %.1f\n", OperatingParameters.tempSet);
+}
+
+static void cmd_temp(CONSOLE *con, int argc, char *argv[])
+{
+  float temp = atof(argv[1]);
+
+  con->print("Set temperature to %.1f\n", temp);
+  updateHvacSetTemp(temp);
+}
+
+static void cmd_log(CONSOLE *con, int argc, char *argv[])
+{
+  switch (toupper(argv[1][0]))
+  {
+  case 'E':
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    con->print("Log level set to ERROR\n");
+    break;
+  case 'W':
+    esp_log_level_set("*", ESP_LOG_WARN);
+    con->print("Log level set to WARN\n");
+    break;
+  case 'I':
+    esp_log_level_set("*", ESP_LOG_INFO);
+    con->print("Log level set to INFO\n");
+    break;
+  case 'D':
+    esp_log_level_set("*", ESP_LOG_DEBUG);
+    con->print("Log level set to DEBUG\n");
+    break;
+  default:
+    con->print("Invalid Log Level: %s - Please specify [E]rror, [W]arn, [I]nfo or [D]ebug\n", argv[1]);
+    break;
+  }
+}
+
+static void cmd_mode(CONSOLE *con, int argc, char *argv[])
+{
+  HVAC_MODE mode;
+
+  argv[1][0] = toupper(argv[1][0]);
+  ESP_LOGI(TAG, "Looking up %s", argv[1]);
+  mode = strToHvacMode(argv[1]);
+  if (mode == ERROR)
+  {
+    con->print("Invalid mode: %s\n", argv[1]);
+    return;
+  }
+  if (!actionRun(actionForMode(mode), ACTION_SRC_CONSOLE))
+    updateHvacMode(mode);
+  con->print("Mode now set to: %s\n", argv[1]);
+}
+
+static void cmd_action(CONSOLE *con, int argc, char *argv[])
+{
+  ACTION action;
+  int n = 0;
+
+  if (argc == 1)
+  {
+    for (int a = 0; a < NR_ACTIONS; a++)
+      if (actionAllowed((ACTION)a, ACTION_SRC_CONSOLE))
+        con->print("%s%s", actionName((ACTION)a), (++n % 6 == 0) ? "\n" : " ");
+    con->print("\n");
+    return;
+  }
+  action = actionLookup(argv[1], strlen(argv[1]));
+  if ((action != ACTION_NONE) && !actionAllowed(action, ACTION_SRC_CONSOLE))
+    con->print("Not allowed from the console: %s\n", argv[1]);
+  else if (!actionDispatch(argv[1], strlen(argv[1]), ACTION_SRC_CONSOLE))
+    con->print("Unknown action: %s\n", argv[1]);
+}
+
+static void cmd_status(CONSOLE *con, int argc, char *argv[])
+{
+  char host[MDNS_HOSTNAME_MAX + 1];
+
+  con->print("Current Status:\n");
+  con->print("--------------------------------------------------------\n");
+
+  con->print("Firmware version: %s\n", VersionString);
+  con->print("Firmware build date: %s\n", VersionBuildDateTime);
+
+  con->print("LD2410 Firmware: %s\n", OperatingParameters.ld2410FirmWare);
+
+  con->print("Device name: %s\n", OperatingParameters.DeviceName);
+  con->print("Friendly name: %s\n", OperatingParameters.FriendlyName);
+
+  {
+    int64_t uptime = millis();
+    con->print("Uptime: %d days, %02d:%02d:%02d\n",
+               (int)(uptime / (1000L * 60L * 60L * 24L)), // days
+               (int)(uptime / (1000L * 60L * 60L)) % 24,  // hours
+               (int)(uptime / (1000L * 60L)) % 60,        // mins
+               (int)(uptime / 1000L) % 60);               // seconds
+  }
+
+  uint32_t freeHeapBytes = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+  uint32_t totalHeapBytes = heap_caps_get_total_size(MALLOC_CAP_DEFAULT);
+  float percentageHeapFree = freeHeapBytes * 100.0f / (float)totalHeapBytes;
+  con->print("Free Heap size: %d\n", esp_get_free_heap_size());
+  con->print("[Memory] %.1f%% free - %d of %d bytes free\n", percentageHeapFree, freeHeapBytes, totalHeapBytes);
+
+  con->print("MAC Address: %02x:%02x:%02x:%02x:%02x:%02x\n",
+             OperatingParameters.mac[0],
+             OperatingParameters.mac[1],
+             OperatingParameters.mac[2],
+             OperatingParameters.mac[3],
+             OperatingParameters.mac[4],
+             OperatingParameters.mac[5]);
+  con->print("Wifi SSID: %s\n", WifiCreds.ssid);
+  if (OperatingParameters.wifiConnected && strcmp(WifiConnectedSsid(), WifiCreds.ssid))
+    con->print("Wifi connected to: %s\n", WifiConnectedSsid());
+  con->print("Wifi connected: %s\n", OperatingParameters.wifiConnected ? "Yes" : "No");
+  con->print("Wifi signal: %d%%\n", WifiSignal());
+  con->print("Wifi IP address: %s\n", WifiAddress());
+  if (mdnsGetHostname(host, sizeof(host)))
+    con->print("mDNS host name: %s.local\n", host);
+  con->print("Wifi power save: %s\n", wifiPowerModeToString(OperatingParameters.wifiPowerSave));
+  if (WifiProvisioning())
+    con->print("Wifi provisioning: access point \"%s\"\n", WifiProvisionSsid());
+#ifdef TELNET_ENABLED
+  con->print("Telnet sessions: %d of %d\n", telnetSessionCount(), TELNET_MAX_SESSIONS);
+#endif
+  {
+    uint32_t logLines, logUartDropped;
+    logGetStats(&logLines, &logUartDropped);
+    con->print("Log lines: %lu (%lu dropped on the serial console)\n", logLines, logUartDropped);
+  }
+
+  {
+    struct tm local_time;
+    char buffer[16];
+
+    getLocalTime(&local_time, 1);
+    strftime(buffer, sizeof(buffer), "%H:%M:%S", &local_time);
+    con->print("Current time: %s", buffer);
+  }
+  con->print("    Timezone: %s\n", OperatingParameters.timezone);
+
+#ifdef MQTT_ENABLED
+  con->print("MQTT Enabled: %s\n", (OperatingParameters.MqttEnabled) ? "Yes" : "No");
+  con->print("MQTT Connected: %s\n", (OperatingParameters.MqttConnected) ? "Yes" : "No");
+  con->print("MQTT Broker: %s  Port: %d\n", OperatingParameters.MqttBrokerHost, OperatingParameters.MqttBrokerPort);
+  con->print("MQTT Username:  %s\n", OperatingParameters.MqttBrokerUsername);
+  con->print("MQTT Password:  %s\n", OperatingParameters.MqttBrokerPassword);
+#endif
+
+#ifdef MATTER_ENABLED
+  con->print("Matter Enabled: %s\n", (OperatingParameters.MatterEnabled) ? "Yes" : "No");
+  con->print("Matter Started: %s\n", (OperatingParameters.MatterStarted) ? "Yes" : "No");
+#endif
+
+  con->print("Current temp: %.1f %c (Correction: %+.1f)\n",
+             OperatingParameters.tempCurrent + OperatingParameters.tempCorrection,
+             OperatingParameters.tempUnits,
+             OperatingParameters.tempCorrection);
+  con->print("Current humidity: %.1f%% (Correction: %+.1f)\n",
+             OperatingParameters.humidCurrent + OperatingParameters.humidityCorrection,
+             OperatingParameters.humidityCorrection);
+  con->print("Target temp: %.1f %c\n", OperatingParameters.tempSet, OperatingParameters.tempUnits);
+  con->print("Swing temp: %.1f %c\n", OperatingParameters.tempSwing, OperatingParameters.tempUnits);
+
+  con->print("Light detected: %d (%.0f lux)\n", OperatingParameters.lightDetected, OperatingParameters.lightLux);
+  con->print("Motion detected: %s\n", OperatingParameters.motionDetected ? "Yes" : "No");
+  con->print("Occupancy: %s (target %d cm, vacant after %d min, setback %.1f)\n",
+             OperatingParameters.occupied ? "Occupied" : "Vacant",
+             OperatingParameters.targetDistance,
+             OperatingParameters.vacancyTimeout,
+             OperatingParameters.ecoSetback);
+  {
+    RADAR_STATS radarStats;
+    ld2410GetStats(&radarStats);
+    con->print("Radar UART: %lu us/s CPU, %lu frames/s, %lu bytes/s, %lu overflows\n",
+               radarStats.cpuUs, radarStats.frames, radarStats.bytes, radarStats.overflows);
+  }
+  con->print("Display sleep time: %d\n", OperatingParameters.thermostatSleepTime);
+  con->print("Backlight range: %d%% - %d%%\n", OperatingParameters.backlightMin, OperatingParameters.backlightMax);
+  con->print("Touch screen beep: %s\n", OperatingParameters.thermostatBeepEnable ? "Enabled" : "Disabled");
+
+  con->print("Current HVAC mode set: %s (Currently: %s)\n",
+             hvacModeToString(OperatingParameters.hvacSetMode),
+             hvacModeToString(OperatingParameters.hvacOpMode));
+
+  con->print("HVAC modes enabled:\n");
+  con->print("  Heat: %s  Cool: %s  Fan: %s\n",
+             "True", OperatingParameters.hvacCoolEnable ? "True" : "False",
+             OperatingParameters.hvacFanEnable ? "True" : "False");
+  con->print("  2-stage heating enabled: %s\n",
+             OperatingParameters.hvac2StageHeatEnable ? "True" : "False");
+  con->print("  Reversing valve (heat pumps): %s\n",
+             OperatingParameters.hvacReverseValveEnable ? "True" : "False");
+}
+
+static void stats_output(void *ctx, const char *text)
+{
+  ((CONSOLE *)ctx)->print("%s", text);
+}
+
+static void cmd_stats(CONSOLE *con, int argc, char *argv[])
+{
+  metricsWrite(false, stats_output, con);
+}
+
+static void cmd_tasks(CONSOLE *con, int argc, char *argv[])
+{
+  bool history = (argc > 1);
+  PROFILE_LOAD load;
+  PROFILE_TASK *tasks = (PROFILE_TASK *)malloc(METRIC_MAX_TASKS * sizeof(PROFILE_TASK));
+  int n;
+
+  if ((argc > 1) && (strncasecmp(argv[1], "history", strlen(argv[1])) != 0))
+  {
+    con->print("Usage: Tasks [history]\n");
+    free(tasks);
+    return;
+  }
+  if (tasks == NULL)
+  {
+    con->print("Out of memory\n");
+    return;
+  }
+
+  profilerGetLoad(&load);
+  n = profilerGetTasks(tasks, METRIC_MAX_TASKS);
+  if ((n == 0) || (load.valid == 0))
+  {
+    con->print("No CPU samples yet (one is taken every %d s)\n", PROFILE_INTERVAL / 1000);
+    free(tasks);
+    return;
+  }
+
+  con->print("CPU load over the last %d s:", PROFILE_INTERVAL / 1000);
+  for (int core = 0; core < portNUM_PROCESSORS; core++)
+    con->print("  core %d %.1f%%", core, load.busy[core][0] / 10.0);
+  con->print("\n\n");
+
+  if (history)
+  {
+    // One column per sample, newest on the left, in percent of one core
+    con->print("Task               CPU %% every %d s, newest first\n", PROFILE_INTERVAL / 1000);
+    for (int i = 0; i < n; i++)
+    {
+      con->print("%-16s", tasks[i].name);
+      for (int h = 0; h < tasks[i].valid; h++)
+        con->print(" %3d", (tasks[i].cpu[h] + 5) / 10);
+      con->print("\n");
+    }
+  }
+  else
+  {
+    con->print("Task             Prio   CPU%%   Avg%%  Peak%%  CPU secs  Stack free\n");
+    for (int i = 0; i < n; i++)
+    {
+      uint32_t sum = 0, peak = 0;
+
+      for (int h = 0; h < tasks[i].valid; h++)
+      {
+        sum += tasks[i].cpu[h];
+        peak = max(peak, (uint32_t)tasks[i].cpu[h]);
+      }
+      con->print("%-16s %4u %6.1f %6.1f %6.1f %9.1f %11lu\n", tasks[i].name, (unsigned)tasks[i].priority,
+                 tasks[i].cpu[0] / 10.0, (tasks[i].valid > 0) ? sum / 10.0 / tasks[i].valid : 0.0,
+                 peak / 10.0, tasks[i].runTimeUs / 1e6, (unsigned long)tasks[i].stackFree);
+    }
+    con->print("\nAvg and Peak cover the last %d s\n", PROFILE_HISTORY * PROFILE_INTERVAL / 1000);
+  }
+  free(tasks);
+}
+
+static void cmd_heap(CONSOLE *con, int argc, char *argv[])
+{
+  if (argc == 1)
+  {
+    heapMonitorWriteStatus(stats_output, con);
+    return;
+  }
+  if ((strncasecmp(argv[1], "csv", strlen(argv[1])) != 0) || ((argc > 2) && (atoi(argv[2]) < 0)))
+  {
+    con->print("Usage: Heap [csv [samples]]\n");
+    return;
+  }
+  heapMonitorWriteCsv((argc > 2) ? atoi(argv[2]) : HEAP_CSV_LINES, stats_output, con);
+}
+
+static void cmd_boot(CONSOLE *con, int argc, char *argv[])
+{
+  bootWriteReport(stats_output, con);
+}
+
+static void cmd_errors(CONSOLE *con, int argc, char *argv[])
+{
+  con->print("Current Error Counts:\n");
+  con->print("--------------------------------------------------------\n");
+
+  con->print("System errors: %d\n", OperatingParameters.Errors.systemErrors);
+  con->print("Hardware errors: %d\n", OperatingParameters.Errors.hardwareErrors);
+  con->print("Wifi errors: %d\n", OperatingParameters.Errors.wifiErrors);
+
+#ifdef MQTT_ENABLED
+  con->print("MQTT Connect errors: %d\n", OperatingParameters.Errors.mqttConnectErrors);
+  con->print("MQTT Protocol errors: %d\n", OperatingParameters.Errors.mqttProtocolErrors);
+#endif
+#ifdef MATTER_ENABLED
+  con->print("Matter Connect errors: %d\n", OperatingParameters.Errors.matterConnectErrors);
+#endif
+#ifdef TELNET_ENABLED
+  con->print("Telnet network errors: %d\n", OperatingParameters.Errors.telnetNetworkErrors);
+#endif
+}
+
+static void cmd_runtime(CONSOLE *con, int argc, char *argv[])
+{
+  HVAC_RUNTIME_STATS stats;
+
+  con->print("HVAC Runtime:\n");
+  con->print("--------------------------------------------------------\n");
+  con->print("Stage  Today(min) Cycles AvgCycle(min) Duty1h  Duty24h  Total(h)\n");
+
+  for (int s = 0; s < NR_HVAC_STAGES; s++)
+  {
+    hvacGetRuntimeStats((HVAC_STAGE)s, &stats);
+    con->print("%-5s%c %10lu %6lu %13lu %5.1f%% %7.1f%% %9.1f\n",
+               hvacStageToString((HVAC_STAGE)s),
+               stats.active ? '*' : ' ',
+               stats.todaySeconds / 60,
+               stats.todayCycles,
+               stats.avgCycleSeconds / 60,
+               stats.dutyHour,
+               stats.dutyDay,
+               (float)stats.lifetime.onSeconds / 3600.0);
+  }
+  con->print("(* = stage currently running)\n");
+}
+
+static void cmd_control(CONSOLE *con, int argc, char *argv[])
+{
+  HVAC_THERMAL_MODEL model;
+
+  if (argc > 1)
+  {
+    HVAC_CONTROL_MODE mode = strToHvacControlMode(argv[1]);
+
+    if (mode == NR_CONTROL_MODES)
+    {
+      con->print("Invalid control mode: %s\n", argv[1]);
+      return;
+    }
+    hvacControlSetMode(mode, (argc > 2) ? atoi(argv[2]) : OperatingParameters.hvacCyclesPerHour);
+  }
+
+  con->print("HVAC Control: %s", hvacControlModeToString(OperatingParameters.hvacControlMode));
+  if (OperatingParameters.hvacControlMode == CONTROL_TIME_PROPORTIONAL)
+    con->print(" (%u cycles/hour)", OperatingParameters.hvacCyclesPerHour);
+  con->print("\n--------------------------------------------------------\n");
+  con->print("Stage  Rate(/min)  Coast   Lag(min)  Drift(/min)  Cycles\n");
+
+  for (int s = 0; s < NR_CONTROL_STAGES; s++)
+  {
+    hvacControlGetModel((HVAC_STAGE)s, &model);
+    con->print("%-5s  %10.3f  %5.2f  %8.1f  %11.3f  %6u\n",
+               hvacStageToString((HVAC_STAGE)s),
+               model.rate, model.coast, model.lag, model.drift, model.samples);
+  }
+}
+
+static void cmd_schedule(CONSOLE *con, int argc, char *argv[])
+{
+  static char reply[1200];
+  char cmd[CONSOLE_HISTORY_SIZE];
+
+  if ((argc > 1) && (strcasecmp(argv[1], "help") == 0))
+  {
+    con->print("Schedule list | on | off | clear\n");
+    con->print("Schedule add <sun..sat|daily|weekdays|weekends> <hh:mm> <temp> [off|heat|cool|auto|fan|aux]\n");
+    con->print("Schedule del <n>\n");
+    con->print("Schedule away <temp> | home\n");
+    con->print("Schedule vacation <days> <temp>\n");
+    return;
+  }
+  join_args(argc, argv, cmd, sizeof(cmd));
+  scheduleCommand((argc > 1) ? cmd : "list", reply, sizeof(reply));
+  con->print("%s", reply);
+}
+
+static void cmd_radar(CONSOLE *con, int argc, char *argv[])
+{
+  static char reply[1200];
+  char cmd[CONSOLE_HISTORY_SIZE];
+
+  if ((argc > 1) && (strcasecmp(argv[1], "help") == 0))
+  {
+    con->print("Radar                 Gate energy histogram ('|' marks the threshold)\n");
+    con->print("Radar eng on|off      Engineering mode (per-gate energies)\n");
+    con->print("Radar config          Saved settings vs. what the radar reports\n");
+    con->print("Radar gate <n> <moving> <stationary>  Set gate thresholds (0-100)\n");
+    con->print("Radar max <moving> <stationary> <idle>  Set farthest gates & idle seconds\n");
+    con->print("Radar defaults        Restore default gate settings\n");
+    con->print("Radar peak            Show and reset peak energies\n");
+    return;
+  }
+  join_args(argc, argv, cmd, sizeof(cmd));
+  radarCommand(cmd, reply, sizeof(reply));
+  con->print("%s", reply);
+}
+
+static void cmd_backlight(CONSOLE *con, int argc, char *argv[])
+{
+  if ((argc == 2) || ((argc == 3) && !tftSetBacklightRange(atoi(argv[1]), atoi(argv[2]))))
+  {
+    con->print("Usage: Backlight <min 0-99> <max 1-100> (min < max)\n");
+    return;
+  }
+  con->print("Backlight range: %d%% - %d%%\n", OperatingParameters.backlightMin, OperatingParameters.backlightMax);
+}
+
+static void cmd_powersave(CONSOLE *con, int argc, char *argv[])
+{
+  WIFI_POWER_STATS stats;
+  uint64_t total;
+
+  if (argc > 1)
+  {
+    WIFI_POWER_MODE mode = strToWifiPowerMode(argv[1]);
+
+    if (mode == NR_WIFI_POWER_MODES)
+    {
+      con->print("Invalid power save mode: %s\n", argv[1]);
+      return;
+    }
+    WifiSetPowerSave(mode);
+  }
+
+  WifiGetPowerStats(&stats);
+  total = stats.downMs;
+  con->print("Wifi power save: %s", wifiPowerModeToString(stats.mode));
+  if (stats.active != stats.mode)
+    con->print(" (%s while in use)", wifiPowerModeToString(stats.active));
+  con->print(", %lu boosts\n", (unsigned long)stats.boosts);
+  con->print("Mode     Connected (s)\n");
+  for (int m = 0; m < NR_WIFI_POWER_MODES; m++)
+  {
+    con->print("%-8s %13llu\n", wifiPowerModeToString((WIFI_POWER_MODE)m), stats.connectedMs[m] / 1000);
+    total += stats.connectedMs[m];
+  }
+  con->print("%-8s %13llu\n", "down", stats.downMs / 1000);
+  con->print("Radio on (estimate): %llu s, %.1f%% of the time\n", stats.radioOnMs / 1000,
+             (total == 0) ? 0.0 : stats.radioOnMs * 100.0 / total);
+}
+
+static void cmd_scan(CONSOLE *con, int argc, char *argv[])
+{
+  WIFI_NETWORK *networks;
+  int n;
+
+  if (argc > 1)
+  {
+    if (strcasecmp(argv[1], "start") != 0)
+    {
+      con->print("Usage: Scan [start]\n");
+      return;
+    }
+    if (!WifiScanStart())
+    {
+      con->print("Wifi isn't running\n");
+      return;
+    }
+  }
+
+  networks = (WIFI_NETWORK *)malloc(WIFI_SCAN_MAX * sizeof(WIFI_NETWORK));
+  if (networks == NULL)
+  {
+    con->print("Out of memory\n");
+    return;
+  }
+  n = WifiScanResults(networks, WIFI_SCAN_MAX);
+  con->print("Scan %s, %d networks\n", WifiScanRunning() ? "running" : "done", n);
+  if (n > 0)
+    con->print("SSID                              RSSI  Chan  Secure\n");
+  for (int i = 0; i < n; i++)
+    con->print("%-32s  %4d  %4u  %s\n", networks[i].ssid, networks[i].rssi, networks[i].channel,
+               networks[i].secure ? "yes" : "no");
+  free(networks);
+}
+
+static void cmd_get(CONSOLE *con, int argc, char *argv[])
+{
+  char value[80];
+
+  if (argc > 1)
+  {
+    const PARAM *p = param_lookup(argv[1]);
+
+    param_format(p, value, sizeof(value));
+    con->print("%s = %s\n", p->name, value);
+    return;
+  }
+  for (const PARAM *p = params; p->name != NULL; p++)
+  {
+    param_format(p, value, sizeof(value));
+    con->print("%-26s %s%s\n", p->name, value, (p->flags & PARAM_RO) ? "  (read only)" : "");
+  }
+}
+
+static void cmd_set(CONSOLE *con, int argc, char *argv[])
+{
+  const PARAM *p = param_lookup(argv[1]);
+  const char *error = param_set(p, argv[2]);
+  char value[80];
+
+  if (error != NULL)
+  {
+    con->print("Can't set %s: %s\n", p->name, error);
+    return;
+  }
+  ESP_LOGI(TAG, "%s set to %s", p->name, argv[2]);
+  param_format(p, value, sizeof(value));
+  con->print("%s = %s\n", p->name, value);
+}
+
+static void cmd_networks(CONSOLE *con, int argc, char *argv[])
+{
+  WIFI_SAVED_NETWORK *networks;
+  bool ok = true;
+  int n;
+
+  if (argc > 1)
+  {
+    if (!strcasecmp(argv[1], "add") && ((argc == 4) || (argc == 5)))
+    {
+      ok = WifiNetworkAdd(argv[2], argv[3], (argc == 5) ? atoi(argv[4]) - 1 : -1);
+      // A new first choice: go there now
+      if (ok && !strcmp(WifiCreds.ssid, argv[2]))
+        WifiDisconnect();
+    }
+    else if (!strcasecmp(argv[1], "remove") && (argc == 3))
+    {
+      ok = WifiNetworkRemove(argv[2]);
+      if (ok && !strcmp(WifiConnectedSsid(), argv[2]))
+        WifiDisconnect();
+    }
+    else if (!strcasecmp(argv[1], "move") && (argc == 4) && (atoi(argv[3]) > 0))
+      ok = WifiNetworkMove(argv[2], atoi(argv[3]) - 1);
+    else
+    {
+      con->print("Usage: Networks                            List saved networks\n");
+      con->print("       Networks add <ssid> <pass> [<pos>]  Add (or change) one, last by default\n");
+      con->print("       Networks remove <ssid>\n");
+      con->print("       Networks move <ssid> <pos>          Change the order they're preferred in\n");
+      return;
+    }
+    if (!ok)
+    {
+      con->print("No such network, or the name or password is too long\n");
+      return;
+    }
+    setWifiCreds();
+  }
+
+  networks = (WIFI_SAVED_NETWORK *)malloc(WIFI_NETWORKS_MAX * sizeof(WIFI_SAVED_NETWORK));
+  if (networks == NULL)
+  {
+    con->print("Out of memory\n");
+    return;
+  }
+  n = WifiNetworksGet(networks, WIFI_NETWORKS_MAX);
+  con->print("%d saved networks, %lu roams\n", n, (unsigned long)WifiRoamCount());
+  if (n > 0)
+    con->print("   SSID                              OK  Failed  In a row  Last RSSI\n");
+  for (int i = 0; i < n; i++)
+    con->print("%d%c %-32s %4u  %6u  %8u  %9d\n", i + 1,
+               strcmp(WifiConnectedSsid(), networks[i].ssid) ? ' ' : '*', networks[i].ssid,
+               networks[i].successes, networks[i].failures, networks[i].recentFailures, networks[i].lastRssi);
+  free(networks);
+}
+
+static void cmd_provision(CONSOLE *con, int argc, char *argv[])
+{
+  uint32_t ip;
+
+  if (argc > 1)
+  {
+    if (!strcasecmp(argv[1], "start"))
+    {
+      if (!WifiProvisionStart())
+        con->print("Could not start provisioning\n");
+    }
+    else if (!strcasecmp(argv[1], "stop"))
+      WifiProvisionStop();
+    else
+    {
+      con->print("Usage: Provision [start|stop]\n");
+      return;
+    }
+  }
+
+  if (!WifiProvisioning())
+  {
+    con->print("Provisioning: off\n");
+    return;
+  }
+  ip = WifiProvisionAddress();
+  con->print("Provisioning: join \"%s\", setup page at http://%d.%d.%d.%d/setup\n", WifiProvisionSsid(),
+             (int)(ip & 0xff), (int)((ip >> 8) & 0xff), (int)((ip >> 16) & 0xff), (int)(ip >> 24));
+}
+
+static void cmd_reboot(CONSOLE *con, int argc, char *argv[])
+{
+  con->print("Restarting the ESP32...\n");
+  if (con->flush != NULL)
+    con->flush();
+  vTaskDelay(pdMS_TO_TICKS(1500));
+  esp_restart();
+}
+
+const CONSOLE_CMD sharedCommands[] = {
+    {"Help", "", "", 0, 0, cmd_help, "This!"},
+    {"?", "", "", 0, 0, cmd_help, NULL},
+    {"Up", "", "", 0, 0, cmd_up, "Increase set temp"},
+    {"Down", "", "", 0, 0, cmd_down, "Decrease set temp"},
+    {"Temp", "<temp>", "f", 1, 1, cmd_temp, "Set arbitrary temp"},
+    {"Log", "<level>", "s", 1, 1, cmd_log, "Set log level for serial console"},
+    {"Mode", "<mode>", "s", 1, 1, cmd_mode, "Set operating mode"},
+    {"Action", "[name]", "s", 0, 1, cmd_action, "Run a web UI button action, or list them"},
+    {"Status", "", "", 0, 0, cmd_status, "Dump status counters"},
+    {"Error", "", "", 0, 0, cmd_errors, "Dump error counters"},
+    {"Runtime", "", "", 0, 0, cmd_runtime, "Dump HVAC runtime & cycle counts"},
+    {"Stats", "", "", 0, 0, cmd_stats, "Timing, heap & task stack metrics"},
+    {"Tasks", "[history]", "s", 0, 1, cmd_tasks, "Per-task CPU usage & stack margin"},
+    {"Boot", "", "", 0, 0, cmd_boot, "Startup timeline"},
+    {"Heap", "[csv [samples]]", "si", 0, 2, cmd_heap, "Heap levels & alerts, or recent samples as CSV"},
+    {"Control", "[hyst|pred|tpi [cph]]", "si", 0, 2, cmd_control, "Show/set HVAC control algorithm"},
+    {"Schedule", "[cmd]", "s", 0, CONSOLE_MAX_ARGS - 1, cmd_schedule, "Show/edit weekly schedule (Schedule help)"},
+    {"Radar", "[cmd]", "s", 0, CONSOLE_MAX_ARGS - 1, cmd_radar, "Show radar gates/tune them (Radar help)"},
+    {"Backlight", "[min max]", "i", 0, 2, cmd_backlight, "Show/set backlight duty range in percent"},
+    {"Powersave", "[none|min|max]", "s", 0, 1, cmd_powersave, "Show/set wifi power save & radio on time"},
+    {"Scan", "[start]", "s", 0, 1, cmd_scan, "Scan for wifi networks in the background, show results"},
+    {"Networks", "[add|remove|move ...]", "s", 0, 4, cmd_networks, "Show/edit saved wifi networks (Networks help)"},
+    {"Provision", "[start|stop]", "s", 0, 1, cmd_provision, "Show/start/stop the setup access point"},
+    {"Get", "[param]", "p", 0, 1, cmd_get, "Show one or all settings"},
+    {"Set", "<param> <value>", "ps", 2, 2, cmd_set, "Change a setting (quote values with spaces)"},
+    {"Reboot", "", "", 0, 0, cmd_reboot, "Reboot the ESP32"},
+    {NULL}};
@@ -23,6 +23,7 @@
 #include "esp_log.h"
 #include "nvs_flash.h"
 #include "nvs.h"
+#include "esp_timer.h"
 
 #define TAG "NVS"
 #define NVS_TAG "thermostat"
@@ -46,6 +47,13 @@
 #define DEF_HVAC_FAN_ENABLE false
 #define DEF_HVAC_2STAGE_ENABLE false
 #define DEF_HVAC_REVERSE_ENABLE false
+#define DEF_CONTROL_MODE CONTROL_HYSTERESIS
+#define DEF_CYCLES_PER_HOUR 4
+#define DEF_VACANCY_TIMEOUT 30
+#define DEF_ECO_SETBACK 0.0
+#define DEF_BACKLIGHT_MIN 2
+#define DEF_BACKLIGHT_MAX 100
+#define DEF_WIFI_POWER WIFI_POWER_MIN
 #define DEF_MQTT_ENABLE false
 #define DEF_MQTT_BROKER "mqtt"
 #define DEF_MQTT_USER "mqtt"
@@ -269,10 +277,14 @@ bool openNVS(nvs_handle_t *handle, const char *nvsNameSpace)
 void closeNVS(nvs_handle_t handle)
 {
   esp_err_t err;
+  int64_t start = esp_timer_get_time();
+
   err = nvs_commit(handle);
+  metricObserveSince(METRIC_NVS_COMMIT, start);
   if (err != ESP_OK)
   {
     ESP_LOGE(TAG, "Error (%s) commiting NVS!", esp_err_to_name(err));
+    metricInc(METRIC_NVS_ERRORS);
   }
   nvs_close(handle);
 }
@@ -315,6 +327,13 @@ void setDefaultThermostatParams()
   nvs_writeBool(my_handle, "hvacFanEnable", DEF_HVAC_FAN_ENABLE);
   nvs_writeBool(my_handle, "twoStageEnable", DEF_HVAC_2STAGE_ENABLE);
   nvs_writeBool(my_handle, "reverseEnable", DEF_HVAC_REVERSE_ENABLE);
+  nvs_writeInt16(my_handle, "ctrlMode", DEF_CONTROL_MODE);
+  nvs_writeInt16(my_handle, "cyclesPerHour", DEF_CYCLES_PER_HOUR);
+  nvs_writeInt16(my_handle, "vacancyTmo", DEF_VACANCY_TIMEOUT);
+  nvs_writeFloat(my_handle, "ecoSetback", DEF_ECO_SETBACK);
+  nvs_writeInt16(my_handle, "backlightMin", DEF_BACKLIGHT_MIN);
+  nvs_writeInt16(my_handle, "backlightMax", DEF_BACKLIGHT_MAX);
+  nvs_writeInt16(my_handle, "wifiPower", DEF_WIFI_POWER);
   #ifdef MQTT_ENABLED
   nvs_writeBool(my_handle, "MqttEn", DEF_MQTT_ENABLE);
   nvs_writeString(my_handle, "MqttBroker", DEF_MQTT_BROKER);
@@ -346,6 +365,13 @@ void setDefaultThermostatParams()
   OperatingParameters.hvacFanEnable = DEF_HVAC_FAN_ENABLE;
   OperatingParameters.hvac2StageHeatEnable = DEF_HVAC_2STAGE_ENABLE;
   OperatingParameters.hvacReverseValveEnable = DEF_HVAC_REVERSE_ENABLE;
+  OperatingParameters.hvacControlMode = DEF_CONTROL_MODE;
+  OperatingParameters.hvacCyclesPerHour = DEF_CYCLES_PER_HOUR;
+  OperatingParameters.vacancyTimeout = DEF_VACANCY_TIMEOUT;
+  OperatingParameters.ecoSetback = DEF_ECO_SETBACK;
+  OperatingParameters.backlightMin = DEF_BACKLIGHT_MIN;
+  OperatingParameters.backlightMax = DEF_BACKLIGHT_MAX;
+  OperatingParameters.wifiPowerSave = DEF_WIFI_POWER;
 #ifdef MQTT_ENABLED
   OperatingParameters.MqttEnabled = DEF_MQTT_ENABLE;
   strncpy (OperatingParameters.MqttBrokerHost, DEF_MQTT_BROKER, sizeof(OperatingParameters.MqttBrokerHost));
@@ -382,6 +408,13 @@ void updateThermostatParams()
   nvs_writeBool(my_handle, "hvacFanEnable", OperatingParameters.hvacFanEnable);
   nvs_writeBool(my_handle, "twoStageEnable", OperatingParameters.hvac2StageHeatEnable);
   nvs_writeBool(my_handle, "reverseEnable", OperatingParameters.hvacReverseValveEnable);
+  nvs_writeInt16(my_handle, "ctrlMode", OperatingParameters.hvacControlMode);
+  nvs_writeInt16(my_handle, "cyclesPerHour", OperatingParameters.hvacCyclesPerHour);
+  nvs_writeInt16(my_handle, "vacancyTmo", OperatingParameters.vacancyTimeout);
+  nvs_writeFloat(my_handle, "ecoSetback", OperatingParameters.ecoSetback);
+  nvs_writeInt16(my_handle, "backlightMin", OperatingParameters.backlightMin);
+  nvs_writeInt16(my_handle, "backlightMax", OperatingParameters.backlightMax);
+  nvs_writeInt16(my_handle, "wifiPower", OperatingParameters.wifiPowerSave);
   #ifdef MQTT_ENABLED
   nvs_writeBool(my_handle, "MqttEn", OperatingParameters.MqttEnabled);
   nvs_writeString(my_handle, "MqttBroker", OperatingParameters.MqttBrokerHost);
@@ -398,6 +431,8 @@ void updateThermostatParams()
 void getThermostatParams()
 {
   nvs_handle_t my_handle;
+  u_int16_t ctrlMode;
+  u_int16_t wifiPower;
 
   if (!openNVS(&my_handle, NVS_TAG))
   {
@@ -426,6 +461,15 @@ void getThermostatParams()
   nvs_readBool(my_handle, "hvacFanEnable", &OperatingParameters.hvacFanEnable, DEF_HVAC_FAN_ENABLE);
   nvs_readBool(my_handle, "twoStageEnable", &OperatingParameters.hvac2StageHeatEnable, DEF_HVAC_2STAGE_ENABLE);
   nvs_readBool(my_handle, "reverseEnable", &OperatingParameters.hvacReverseValveEnable, DEF_HVAC_REVERSE_ENABLE);
+  nvs_readInt16(my_handle, "ctrlMode", &ctrlMode, DEF_CONTROL_MODE);
+  OperatingParameters.hvacControlMode = (ctrlMode < NR_CONTROL_MODES) ? (HVAC_CONTROL_MODE)ctrlMode : DEF_CONTROL_MODE;
+  nvs_readInt16(my_handle, "cyclesPerHour", &OperatingParameters.hvacCyclesPerHour, DEF_CYCLES_PER_HOUR);
+  nvs_readInt16(my_handle, "vacancyTmo", &OperatingParameters.vacancyTimeout, DEF_VACANCY_TIMEOUT);
+  nvs_readFloat(my_handle, "ecoSetback", &OperatingParameters.ecoSetback, DEF_ECO_SETBACK);
+  nvs_readInt16(my_handle, "backlightMin", &OperatingParameters.backlightMin, DEF_BACKLIGHT_MIN);
+  nvs_readInt16(my_handle, "backlightMax", &OperatingParameters.backlightMax, DEF_BACKLIGHT_MAX);
+  nvs_readInt16(my_handle, "wifiPower", &wifiPower, DEF_WIFI_POWER);
+  OperatingParameters.wifiPowerSave = (wifiPower < NR_WIFI_POWER_MODES) ? (WIFI_POWER_MODE)wifiPower : DEF_WIFI_POWER;
   #ifdef MQTT_ENABLED
   nvs_readBool(my_handle, "MqttEn", &OperatingParameters.MqttEnabled, DEF_MQTT_ENABLE);
   nvs_readStr(my_handle, "MqttBroker", DEF_MQTT_BROKER, OperatingParameters.MqttBrokerHost, sizeof(OperatingParameters.MqttBrokerHost));
@@ -475,21 +519,43 @@ void setDefaultWifiCreds()
   strncpy (OperatingParameters.DeviceName, "thermostat", sizeof(OperatingParameters.DeviceName));
   strncpy (WifiCreds.ssid, "", sizeof(WifiCreds.ssid));
   strncpy (WifiCreds.password, "", sizeof(WifiCreds.password));
+  WifiCreds.count = 0;
 }
 
 //
-// Only called from ui_events.cpp
+// Save the device name and all the wifi networks. WifiCreds.ssid (as
+// just entered in a UI) becomes the first choice.
 //
 void setWifiCreds()
 {
   ESP_LOGW(TAG, "Saving latest WIFI credentials to NVS");
   // printf ("*** [setWifiCreds] WifiCreds.password = %s\n", WifiCreds.password);
+  if (strlen(WifiCreds.ssid))
+    WifiNetworkAdd(WifiCreds.ssid, WifiCreds.password, 0);
   nvs_handle_t my_handle;
   openNVS(&my_handle, NVS_WIFI_TAG);
   nvs_writeString(my_handle, "hostname", OperatingParameters.DeviceName);
   nvs_writeString(my_handle, "ssid", WifiCreds.ssid);
   nvs_writeString(my_handle, "pass", WifiCreds.password);
   closeNVS(my_handle);
+  eepromUpdateWifiNetworks();
+}
+
+// The saved networks with their connection history
+bool eepromUpdateWifiNetworks()
+{
+  WIFI_SAVED_NETWORK networks[WIFI_NETWORKS_MAX];
+  uint8_t count;
+  nvs_handle_t my_handle;
+
+  memset(networks, 0, sizeof(networks));
+  count = WifiNetworksGet(networks, WIFI_NETWORKS_MAX);
+  if (!openNVS(&my_handle, NVS_WIFI_TAG))
+    return false;
+  bool rc = writeNVS(my_handle, NVS_TYPE_U8, "netCount", &count) &&
+            writeNVS(my_handle, NVS_TYPE_BLOB, "networks", networks, sizeof(networks));
+  closeNVS(my_handle);
+  return rc;
 }
 
 void getWifiCreds()
@@ -506,7 +572,15 @@ void getWifiCreds()
   nvs_readStr(my_handle, "ssid", "", WifiCreds.ssid, sizeof(WifiCreds.ssid));
   nvs_readStr(my_handle, "pass", "", WifiCreds.password, sizeof(WifiCreds.password));
   // printf ("*** [getWifiCreds] WifiCreds.password = %s\n", WifiCreds.password);
+  if (!readNVS(my_handle, NVS_TYPE_U8, "netCount", &WifiCreds.count) ||
+      !readNVS(my_handle, NVS_TYPE_BLOB, "networks", WifiCreds.networks, sizeof(WifiCreds.networks)) ||
+      (WifiCreds.count > WIFI_NETWORKS_MAX))
+    WifiCreds.count = 0;
   closeNVS(my_handle);
+
+  // Saved before there was a list of networks
+  if (strlen(WifiCreds.ssid))
+    WifiNetworkAdd(WifiCreds.ssid, WifiCreds.password, 0);
 }
 
 ////////////////////////////////////////////////////////////////////////////
@@ -535,6 +609,163 @@ bool eepromUpdateArbMode(const char *key, HVAC_MODE mode)
   return true;
 }
 
+//
+// HVAC runtime totals are stored as a single blob (one entry per stage)
+// so they can be written with one NVS operation. The state machine only
+// calls this about once an hour to keep flash wear low.
+//
+bool eepromUpdateHvacRuntime(HVAC_STAGE_TOTALS *totals)
+{
+  nvs_handle_t my_handle;
+  if (!openNVS(&my_handle, NVS_TAG))
+    return false;
+  bool rc = writeNVS(my_handle, NVS_TYPE_BLOB, "hvacRuntime", totals, sizeof(HVAC_STAGE_TOTALS) * NR_HVAC_STAGES);
+  closeNVS(my_handle);
+  return rc;
+}
+
+bool eepromGetHvacRuntime(HVAC_STAGE_TOTALS *totals)
+{
+  nvs_handle_t my_handle;
+  if (!openNVS(&my_handle, NVS_TAG))
+    return false;
+  bool rc = readNVS(my_handle, NVS_TYPE_BLOB, "hvacRuntime", totals, sizeof(HVAC_STAGE_TOTALS) * NR_HVAC_STAGES);
+  closeNVS(my_handle);
+  if (!rc)
+    memset(totals, 0, sizeof(HVAC_STAGE_TOTALS) * NR_HVAC_STAGES);
+  return rc;
+}
+
+bool eepromUpdateHvacControl()
+{
+  nvs_handle_t my_handle;
+  if (!openNVS(&my_handle, NVS_TAG))
+    return false;
+  nvs_writeInt16(my_handle, "ctrlMode", OperatingParameters.hvacControlMode);
+  nvs_writeInt16(my_handle, "cyclesPerHour", OperatingParameters.hvacCyclesPerHour);
+  closeNVS(my_handle);
+  return true;
+}
+
+bool eepromUpdateBacklight()
+{
+  nvs_handle_t my_handle;
+  if (!openNVS(&my_handle, NVS_TAG))
+    return false;
+  nvs_writeInt16(my_handle, "backlightMin", OperatingParameters.backlightMin);
+  nvs_writeInt16(my_handle, "backlightMax", OperatingParameters.backlightMax);
+  closeNVS(my_handle);
+  return true;
+}
+
+bool eepromUpdateWifiPower()
+{
+  nvs_handle_t my_handle;
+  if (!openNVS(&my_handle, NVS_TAG))
+    return false;
+  nvs_writeInt16(my_handle, "wifiPower", OperatingParameters.wifiPowerSave);
+  closeNVS(my_handle);
+  return true;
+}
+
+//
+// Learned thermal model for the heat and cool stages, one blob entry
+// per stage.
+//
+bool eepromUpdateThermalModel(HVAC_THERMAL_MODEL *model)
+{
+  nvs_handle_t my_handle;
+  if (!openNVS(&my_handle, NVS_TAG))
+    return false;
+  bool rc = writeNVS(my_handle, NVS_TYPE_BLOB, "thermModel", model, sizeof(HVAC_THERMAL_MODEL) * NR_CONTROL_STAGES);
+  closeNVS(my_handle);
+  return rc;
+}
+
+bool eepromGetThermalModel(HVAC_THERMAL_MODEL *model)
+{
+  nvs_handle_t my_handle;
+  if (!openNVS(&my_handle, NVS_TAG))
+    return false;
+  bool rc = readNVS(my_handle, NVS_TYPE_BLOB, "thermModel", model, sizeof(HVAC_THERMAL_MODEL) * NR_CONTROL_STAGES);
+  closeNVS(my_handle);
+  if (!rc)
+    memset(model, 0, sizeof(HVAC_THERMAL_MODEL) * NR_CONTROL_STAGES);
+  return rc;
+}
+
+//
+// The weekly schedule is opaque to this module; schedule.cpp owns its layout
+//
+bool eepromUpdateSchedule(void *schedule, size_t len)
+{
+  nvs_handle_t my_handle;
+  if (!openNVS(&my_handle, NVS_TAG))
+    return false;
+  bool rc = writeNVS(my_handle, NVS_TYPE_BLOB, "schedule", schedule, len);
+  closeNVS(my_handle);
+  return rc;
+}
+
+bool eepromGetSchedule(void *schedule, size_t len)
+{
+  nvs_handle_t my_handle;
+  if (!openNVS(&my_handle, NVS_TAG))
+    return false;
+  bool rc = readNVS(my_handle, NVS_TYPE_BLOB, "schedule", schedule, len);
+  closeNVS(my_handle);
+  return rc;
+}
+
+//
+// Radar gate thresholds and max gates; radar.cpp falls back to its
+// defaults when nothing has been saved
+//
+bool eepromUpdateRadarConfig(RADAR_CONFIG *config)
+{
+  nvs_handle_t my_handle;
+  if (!openNVS(&my_handle, NVS_TAG))
+    return false;
+  bool rc = writeNVS(my_handle, NVS_TYPE_BLOB, "radarConfig", config, sizeof(RADAR_CONFIG));
+  closeNVS(my_handle);
+  return rc;
+}
+
+bool eepromGetRadarConfig(RADAR_CONFIG *config)
+{
+  nvs_handle_t my_handle;
+  if (!openNVS(&my_handle, NVS_TAG))
+    return false;
+  bool rc = readNVS(my_handle, NVS_TYPE_BLOB, "radarConfig", config, sizeof(RADAR_CONFIG));
+  closeNVS(my_handle);
+  return rc;
+}
+
+//
+// The access point wifi last connected to (see wifi.cpp). Only written
+// when it changes, so roaming between access points is all that wears
+// the flash.
+//
+bool eepromUpdateWifiCache(WIFI_CACHE *cache)
+{
+  nvs_handle_t my_handle;
+  if (!openNVS(&my_handle, NVS_TAG))
+    return false;
+  bool rc = writeNVS(my_handle, NVS_TYPE_BLOB, "wifiCache", cache, sizeof(WIFI_CACHE));
+  closeNVS(my_handle);
+  return rc;
+}
+
+bool eepromGetWifiCache(WIFI_CACHE *cache)
+{
+  nvs_handle_t my_handle;
+  if (!openNVS(&my_handle, NVS_TAG))
+    return false;
+  bool rc = readNVS(my_handle, NVS_TYPE_BLOB, "wifiCache", cache, sizeof(WIFI_CACHE));
+  closeNVS(my_handle);
+  return rc;
+}
+
 bool eepromUpdateHvacSetTemp()
 {
   return eepromUpdateArbFloat("setTemp", OperatingParameters.tempSet);
@@ -0,0 +1,406 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * heapmon.cpp
+ *
+ * Heap monitor. Every HEAP_SAMPLE_INTERVAL the state machine calls
+ * heapMonitorLoop(), which records the free, lowest-ever free and largest
+ * free block of each memory region (internal, DMA capable, PSRAM) in a
+ * ring, together with how much of its pool LVGL is using. The ring holds
+ * a day of samples when there is PSRAM, two hours otherwise.
+ *
+ * With CONFIG_HEAP_TASK_TRACKING (which needs heap poisoning) each sample
+ * also records the heap held by the tasks of the bigger subsystems: MQTT,
+ * the web server, telnet and the UI task.
+ *
+ * The ring is available as CSV from the web /heap page and the console
+ * "Heap csv" command. measure-heap.sh fetches it.
+ *
+ * After each sample the internal heap is checked for:
+ *   - a leak: the highest free level in the newer half of the last
+ *     HEAP_LEAK_WINDOW samples is lower than in the older half by more
+ *     than HEAP_LEAK_RATE per hour. Transient allocations only pull the
+ *     free level down for a moment, so they don't move the peaks.
+ *   - running low: less than HEAP_LOW_FREE free
+ *   - fragmentation: the largest free block is under HEAP_FRAGMENTED
+ *     percent of the free heap
+ * Each alert is raised once, when it starts: it is logged, counted in
+ * systemErrors and published on the MQTT alert topic. It can be raised
+ * again once the condition has cleared.
+ *
+ */
+
+#include "thermostat.hpp"
+#include "esp_heap_caps.h"
+#ifdef CONFIG_HEAP_TASK_TRACKING
+#include "esp_heap_task_info.h"
+#endif
+#include <stdlib.h>
+
+#define HEAP_SAMPLES_PSRAM      (1440)    // 24 hours
+#define HEAP_SAMPLES_INTERNAL   (120)     // 2 hours
+#define HEAP_TASKS_MAX          (32)
+
+#define min(x, y) ((x < y) ? x : y)
+#define max(x, y) ((x > y) ? x : y)
+
+typedef enum
+{
+  REGION_INTERNAL = 0,
+  REGION_DMA,
+  REGION_SPIRAM,
+  NR_HEAP_REGIONS
+} HEAP_REGION;
+
+typedef enum
+{
+  ALERT_LEAK = 0,
+  ALERT_LOW,
+  ALERT_FRAGMENTED,
+  NR_HEAP_ALERTS
+} HEAP_ALERT;
+
+#ifdef CONFIG_HEAP_TASK_TRACKING
+typedef enum
+{
+  SUBSYS_MQTT = 0,
+  SUBSYS_HTTPD,
+  SUBSYS_TELNET,
+  SUBSYS_UI,
+  NR_SUBSYSTEMS
+} HEAP_SUBSYSTEM;
+#endif
+
+typedef struct
+{
+  uint32_t uptime;                        // Seconds
+  uint32_t free[NR_HEAP_REGIONS];
+  uint32_t minFree[NR_HEAP_REGIONS];
+  uint32_t largest[NR_HEAP_REGIONS];
+  uint32_t lvglUsed;                      // Bytes of the LVGL pool in use
+#ifdef CONFIG_HEAP_TASK_TRACKING
+  uint32_t subsystem[NR_SUBSYSTEMS];      // Bytes held by the subsystem's tasks
+#endif
+} HEAP_SAMPLE;
+
+static const char *TAG = "HEAPMON";
+
+static const struct
+{
+  const char *name;
+  uint32_t caps;
+} heapRegions[NR_HEAP_REGIONS] = {
+    {"internal", MALLOC_CAP_INTERNAL},
+    {"dma", MALLOC_CAP_DMA},
+    {"spiram", MALLOC_CAP_SPIRAM},
+};
+
+static const char *heapAlerts[NR_HEAP_ALERTS] = {"heap_leak", "heap_low", "heap_fragmented"};
+
+#ifdef CONFIG_HEAP_TASK_TRACKING
+// Tasks are matched to a subsystem by the start of their name
+static const struct
+{
+  const char *name;
+  const char *tasks[3];
+} heapSubsystems[NR_SUBSYSTEMS] = {
+    {"mqtt", {"mqtt_task", "MQTT Log", NULL}},
+    {"httpd", {"httpd", "Radar Stream", "Log Stream"}},
+    {"telnet", {"TelnetTask", NULL, NULL}},
+    {"ui", {"Touch Screen UI", NULL, NULL}},
+};
+#endif
+
+static HEAP_SAMPLE *heapRing;
+static uint32_t heapRingSize;
+static uint32_t heapSamples;              // Taken since boot
+static bool heapAlertActive[NR_HEAP_ALERTS];
+static int32_t heapLeakRate;              // Bytes/hour, from the last check
+static int64_t lastSample;
+static portMUX_TYPE heapLock = portMUX_INITIALIZER_UNLOCKED;
+
+static bool heap_init()
+{
+  heapRing = (HEAP_SAMPLE *)heap_caps_calloc(HEAP_SAMPLES_PSRAM, sizeof(HEAP_SAMPLE), MALLOC_CAP_SPIRAM);
+  heapRingSize = HEAP_SAMPLES_PSRAM;
+  if (heapRing == NULL)
+  {
+    heapRing = (HEAP_SAMPLE *)heap_caps_calloc(HEAP_SAMPLES_INTERNAL, sizeof(HEAP_SAMPLE), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    heapRingSize = HEAP_SAMPLES_INTERNAL;
+  }
+  if (heapRing == NULL)
+  {
+    ESP_LOGE(TAG, "No memory for the heap monitor");
+    OperatingParameters.Errors.systemErrors++;
+    heapRingSize = 0;
+    return false;
+  }
+  ESP_LOGI(TAG, "Heap monitor: %lu samples (%u bytes)", heapRingSize, heapRingSize * sizeof(HEAP_SAMPLE));
+  return true;
+}
+
+// Copy sample 'back' (0 = newest); false if there isn't one
+static bool heap_get_sample(uint32_t back, HEAP_SAMPLE *sample)
+{
+  bool ok = false;
+
+  portENTER_CRITICAL(&heapLock);
+  if ((back < heapSamples) && (back < heapRingSize))
+  {
+    *sample = heapRing[(heapSamples - 1 - back) % heapRingSize];
+    ok = true;
+  }
+  portEXIT_CRITICAL(&heapLock);
+  return ok;
+}
+
+#ifdef CONFIG_HEAP_TASK_TRACKING
+static int heap_subsystem_of(const char *task)
+{
+  for (int s = 0; s < NR_SUBSYSTEMS; s++)
+    for (int t = 0; t < 3; t++)
+      if ((heapSubsystems[s].tasks[t] != NULL) &&
+          (strncmp(task, heapSubsystems[s].tasks[t], strlen(heapSubsystems[s].tasks[t])) == 0))
+        return s;
+  return -1;
+}
+
+//
+// Sum the heap held by the tasks of each subsystem. The tracking totals
+// also cover tasks that have exited, so only handles of live tasks (from
+// uxTaskGetSystemState) are ever looked at.
+//
+static void heap_sample_subsystems(HEAP_SAMPLE *sample)
+{
+  UBaseType_t count = uxTaskGetNumberOfTasks() + 2;
+  TaskStatus_t *status = (TaskStatus_t *)malloc(count * sizeof(TaskStatus_t));
+  heap_task_totals_t *totals = (heap_task_totals_t *)malloc(HEAP_TASKS_MAX * sizeof(heap_task_totals_t));
+  heap_task_info_params_t params = {};
+  size_t numTotals = 0;
+
+  if ((status == NULL) || (totals == NULL))
+  {
+    free(status);
+    free(totals);
+    return;
+  }
+
+  params.caps[0] = MALLOC_CAP_INTERNAL;
+  params.mask[0] = MALLOC_CAP_INTERNAL;
+  params.caps[1] = MALLOC_CAP_SPIRAM;
+  params.mask[1] = MALLOC_CAP_SPIRAM;
+  params.totals = totals;
+  params.num_totals = &numTotals;
+  params.max_totals = HEAP_TASKS_MAX;
+  heap_caps_get_per_task_info(&params);
+
+  count = uxTaskGetSystemState(status, count, NULL);
+  for (UBaseType_t i = 0; i < count; i++)
+  {
+    int s = heap_subsystem_of(status[i].pcTaskName);
+
+    if (s < 0)
+      continue;
+    for (size_t t = 0; t < numTotals; t++)
+      if (totals[t].task == status[i].xHandle)
+        sample->subsystem[s] += totals[t].size[0] + totals[t].size[1];
+  }
+  free(status);
+  free(totals);
+}
+#endif
+
+//
+// Raise or clear one alert. Raising logs it, counts it and tells MQTT.
+//
+static void heap_alert(HEAP_ALERT alert, bool active, const char *detail)
+{
+  if (active == heapAlertActive[alert])
+    return;
+  heapAlertActive[alert] = active;
+  if (!active)
+  {
+    ESP_LOGI(TAG, "Cleared: %s", heapAlerts[alert]);
+    return;
+  }
+
+  ESP_LOGW(TAG, "Alert: %s (%s)", heapAlerts[alert], detail);
+  OperatingParameters.Errors.systemErrors++;
+#ifdef MQTT_ENABLED
+  MqttAlert(heapAlerts[alert], detail);
+#endif
+}
+
+static void heap_check(const HEAP_SAMPLE *now)
+{
+  char detail[80];
+  uint32_t freeNow = now->free[REGION_INTERNAL];
+  uint32_t largest = now->largest[REGION_INTERNAL];
+
+  snprintf(detail, sizeof(detail), "%lu bytes free", (unsigned long)freeNow);
+  heap_alert(ALERT_LOW, freeNow < HEAP_LOW_FREE, detail);
+
+  snprintf(detail, sizeof(detail), "largest block %lu of %lu bytes free", (unsigned long)largest, (unsigned long)freeNow);
+  heap_alert(ALERT_FRAGMENTED, (uint64_t)largest * 100 < (uint64_t)freeNow * HEAP_FRAGMENTED, detail);
+
+  // Compare the best free level of the two halves of the window
+  if (min(heapSamples, heapRingSize) < HEAP_LEAK_WINDOW)
+    return;
+
+  uint32_t newerPeak = 0, olderPeak = 0;
+  HEAP_SAMPLE sample;
+
+  for (uint32_t back = 0; back < HEAP_LEAK_WINDOW; back++)
+  {
+    if (!heap_get_sample(back, &sample))
+      return;
+    if (back < HEAP_LEAK_WINDOW / 2)
+      newerPeak = max(newerPeak, sample.free[REGION_INTERNAL]);
+    else
+      olderPeak = max(olderPeak, sample.free[REGION_INTERNAL]);
+  }
+
+  // The halves are HEAP_LEAK_WINDOW/2 samples apart
+  heapLeakRate = (int32_t)(((int64_t)olderPeak - newerPeak) * 3600000 / ((int64_t)HEAP_SAMPLE_INTERVAL * (HEAP_LEAK_WINDOW / 2)));
+  snprintf(detail, sizeof(detail), "losing %ld bytes/hour", (long)heapLeakRate);
+  heap_alert(ALERT_LEAK, heapLeakRate > HEAP_LEAK_RATE, detail);
+}
+
+//
+// Called from the state machine loop; takes a sample every HEAP_SAMPLE_INTERVAL.
+//
+void heapMonitorLoop()
+{
+  HEAP_SAMPLE sample = {};
+  int64_t now = millis();
+
+  if ((lastSample != 0) && (now - lastSample < HEAP_SAMPLE_INTERVAL))
+    return;
+  lastSample = now;
+  if ((heapRing == NULL) && !heap_init())
+    return;
+
+  sample.uptime = (uint32_t)(now / 1000);
+  for (int r = 0; r < NR_HEAP_REGIONS; r++)
+  {
+    sample.free[r] = heap_caps_get_free_size(heapRegions[r].caps);
+    sample.minFree[r] = heap_caps_get_minimum_free_size(heapRegions[r].caps);
+    sample.largest[r] = heap_caps_get_largest_free_block(heapRegions[r].caps);
+  }
+  sample.lvglUsed = tftLvglMemoryUsed();
+#ifdef CONFIG_HEAP_TASK_TRACKING
+  heap_sample_subsystems(&sample);
+#endif
+
+  portENTER_CRITICAL(&heapLock);
+  heapRing[heapSamples % heapRingSize] = sample;
+  heapSamples++;
+  portEXIT_CRITICAL(&heapLock);
+
+  heap_check(&sample);
+}
+
+static bool heap_region_present(int r)
+{
+  return heap_caps_get_total_size(heapRegions[r].caps) > 0;
+}
+
+//
+// Write the newest 'lines' samples (0 = all there are) as CSV, oldest first.
+//
+void heapMonitorWriteCsv(int lines, METRICS_OUTPUT output, void *ctx)
+{
+  char line[256];
+  int n = 0;
+  uint32_t count;
+
+  n += snprintf(&line[n], sizeof(line) - n, "uptime");
+  for (int r = 0; r < NR_HEAP_REGIONS; r++)
+    if (heap_region_present(r))
+      n += snprintf(&line[n], sizeof(line) - n, ",%s_free,%s_min_free,%s_largest",
+                    heapRegions[r].name, heapRegions[r].name, heapRegions[r].name);
+  n += snprintf(&line[n], sizeof(line) - n, ",lvgl_used");
+#ifdef CONFIG_HEAP_TASK_TRACKING
+  for (int s = 0; s < NR_SUBSYSTEMS; s++)
+    n += snprintf(&line[n], sizeof(line) - n, ",%s_held", heapSubsystems[s].name);
+#endif
+  snprintf(&line[n], sizeof(line) - n, "\n");
+  output(ctx, line);
+
+  portENTER_CRITICAL(&heapLock);
+  count = min(heapSamples, heapRingSize);
+  portEXIT_CRITICAL(&heapLock);
+  if ((lines > 0) && ((uint32_t)lines < count))
+    count = lines;
+
+  for (uint32_t back = count; back-- > 0;)
+  {
+    HEAP_SAMPLE sample;
+
+    if (!heap_get_sample(back, &sample))
+      continue;
+    n = snprintf(line, sizeof(line), "%lu", (unsigned long)sample.uptime);
+    for (int r = 0; r < NR_HEAP_REGIONS; r++)
+      if (heap_region_present(r))
+        n += snprintf(&line[n], sizeof(line) - n, ",%lu,%lu,%lu", (unsigned long)sample.free[r],
+                      (unsigned long)sample.minFree[r], (unsigned long)sample.largest[r]);
+    n += snprintf(&line[n], sizeof(line) - n, ",%lu", (unsigned long)sample.lvglUsed);
+#ifdef CONFIG_HEAP_TASK_TRACKING
+    for (int s = 0; s < NR_SUBSYSTEMS; s++)
+      n += snprintf(&line[n], sizeof(line) - n, ",%lu", (unsigned long)sample.subsystem[s]);
+#endif
+    snprintf(&line[n], sizeof(line) - n, "\n");
+    output(ctx, line);
+  }
+}
+
+//
+// The newest sample, the leak trend and any active alerts, for the console
+//
+void heapMonitorWriteStatus(METRICS_OUTPUT output, void *ctx)
+{
+  char line[128];
+  HEAP_SAMPLE sample;
+
+  if (!heap_get_sample(0, &sample))
+  {
+    output(ctx, "No heap samples yet\n");
+    return;
+  }
+
+  snprintf(line, sizeof(line), "Sampled at %lu s uptime, every %d s (%lu kept)\n\n",
+           (unsigned long)sample.uptime, HEAP_SAMPLE_INTERVAL / 1000, (unsigned long)heapRingSize);
+  output(ctx, line);
+  output(ctx, "Region         free  min free   largest\n");
+  for (int r = 0; r < NR_HEAP_REGIONS; r++)
+  {
+    if (!heap_region_present(r))
+      continue;
+    snprintf(line, sizeof(line), "%-10s %8lu  %8lu  %8lu\n", heapRegions[r].name, (unsigned long)sample.free[r],
+             (unsigned long)sample.minFree[r], (unsigned long)sample.largest[r]);
+    output(ctx, line);
+  }
+  snprintf(line, sizeof(line), "\nLVGL pool in use: %lu bytes\n", (unsigned long)sample.lvglUsed);
+  output(ctx, line);
+#ifdef CONFIG_HEAP_TASK_TRACKING
+  for (int s = 0; s < NR_SUBSYSTEMS; s++)
+  {
+    snprintf(line, sizeof(line), "Held by %-7s %lu bytes\n", heapSubsystems[s].name, (unsigned long)sample.subsystem[s]);
+    output(ctx, line);
+  }
+#endif
+
+  if (min(heapSamples, heapRingSize) >= HEAP_LEAK_WINDOW)
+    snprintf(line, sizeof(line), "Internal heap trend: %ld bytes/hour lost (alert above %d)\n",
+             (long)heapLeakRate, HEAP_LEAK_RATE);
+  else
+    snprintf(line, sizeof(line), "Internal heap trend: needs %d samples\n", HEAP_LEAK_WINDOW);
+  output(ctx, line);
+
+  for (int a = 0; a < NR_HEAP_ALERTS; a++)
+  {
+    if (!heapAlertActive[a])
+      continue;
+    snprintf(line, sizeof(line), "ALERT: %s\n", heapAlerts[a]);
+    output(ctx, line);
+  }
+}
@@ -0,0 +1,375 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * hvac_control.cpp
+ *
+ * Control algorithms used by the state machine to decide when a heat or
+ * cool stage should run:
+ *
+ *   Hysteresis:  The original bang-bang controller (implemented directly in
+ *                hvacStateUpdate()).
+ *   Predictive:  Learns how fast the house heats/cools while a stage runs,
+ *                how far the temperature keeps going after the stage stops
+ *                (coast), the dead time before a started stage has an effect
+ *                (lag) and how fast the temperature drifts while idle. The
+ *                stage is started early enough that the lag doesn't undershoot
+ *                the band and stopped early enough that coasting lands on the
+ *                band edge instead of overshooting it.
+ *   Time proportional: Runs the stage for a fraction of a fixed cycle
+ *                (OperatingParameters.hvacCyclesPerHour) proportional to how
+ *                far the temperature is from the set point.
+ *
+ * Notes:
+ *   The thermal model is kept in degrees Celsius so it survives a change of
+ *   display units. It is learned from the smoothed temperature reading and
+ *   persisted to NVS at most once per RUNTIME_SAVE_INTERVAL.
+ *
+ *   Neither algorithm cycles less than Hysteresis. Hysteresis lets the
+ *   temperature drop below the band while the furnace warms up, so it
+ *   swings wider than the band; staying in the band takes more, shorter
+ *   cycles. test/host/hvac_sim.cpp measures all three on a simulated house
+ *   (16, 18 and 96 cycles a day, ~0.6F, 0.13F and 0F outside the band).
+ *
+ */
+
+#include "thermostat.hpp"
+
+#define CONTROL_LEARN_ALPHA       (0.25)  // EWMA weight of a new observation
+#define CONTROL_MIN_SAMPLES       (2)     // Cycles learned before predictions are trusted
+#define CONTROL_MIN_RUN_MS        (3 * 60 * 1000)
+#define CONTROL_MIN_OFF_MS        (3 * 60 * 1000)
+#define CONTROL_COAST_TIMEOUT_MS  (15 * 60 * 1000)
+#define CONTROL_COAST_TURN_C      (0.1)   // Drop from peak that ends the coast phase
+#define CONTROL_MIN_IDLE_MS       (5 * 60 * 1000)
+#define CONTROL_DEF_COAST_C       (0.28)  // ~0.5F, the legacy overshoot allowance
+#define NO_STAGE                  (NR_HVAC_STAGES)
+
+static const char *TAG = "CONTROL";
+
+typedef enum
+{
+  LEARN_NONE = 0,
+  LEARN_RUNNING,
+  LEARN_COASTING,
+  LEARN_IDLE
+} LEARN_PHASE;
+
+// Observation of the cycle in progress. All temperatures are "progress"
+// values in Celsius: positive direction is the direction the stage drives.
+typedef struct
+{
+  LEARN_PHASE phase;
+  int stage;
+  int64_t phaseStart;
+  float phaseStartTemp;
+  float extremeTemp;        // Lowest while running (lag), highest while coasting
+  int64_t extremeTime;
+  float stopTemp;
+} CONTROL_OBSERVATION;
+
+static HVAC_THERMAL_MODEL thermalModel[NR_CONTROL_STAGES];
+static CONTROL_OBSERVATION obs = { .phase = LEARN_NONE, .stage = NO_STAGE };
+static HVAC_MODE lastOpMode = OFF;
+static int64_t lastStageChange = 0;
+static int64_t tpiCycleStart = 0;
+static int64_t tpiOnMs = 0;
+static bool tpiCycleValid = false;
+static bool modelDirty = false;
+static int64_t lastModelSave = 0;
+
+static const char *control_mode_str[NR_CONTROL_MODES] = { "Hysteresis", "Predictive", "TimeProportional" };
+
+const char *hvacControlModeToString(HVAC_CONTROL_MODE mode)
+{
+  if (mode >= NR_CONTROL_MODES)
+    return "Unknown";
+  return control_mode_str[mode];
+}
+
+HVAC_CONTROL_MODE strToHvacControlMode(const char *str)
+{
+  if (!strncasecmp(str, "hyst", 4))
+    return CONTROL_HYSTERESIS;
+  if (!strncasecmp(str, "pred", 4))
+    return CONTROL_PREDICTIVE;
+  if (!strncasecmp(str, "tpi", 3) || !strncasecmp(str, "time", 4))
+    return CONTROL_TIME_PROPORTIONAL;
+  return NR_CONTROL_MODES;
+}
+
+// Degrees in the configured units -> degrees Celsius (deltas only)
+static inline float to_celsius_delta(float delta)
+{
+  return (OperatingParameters.tempUnits == 'F') ? delta * 5.0 / 9.0 : delta;
+}
+
+static inline float from_celsius_delta(float delta)
+{
+  return (OperatingParameters.tempUnits == 'F') ? delta * 9.0 / 5.0 : delta;
+}
+
+// Temperature seen from the stage's point of view: rises while it runs
+static inline float stage_progress(int stage, float temp)
+{
+  float c = to_celsius_delta(temp);
+  return (stage == STAGE_HEAT) ? c : -c;
+}
+
+static inline int mode_to_control_stage(HVAC_MODE mode)
+{
+  switch (mode) {
+  case HEAT:
+  case AUX_HEAT:
+    return STAGE_HEAT;
+  case COOL:
+    return STAGE_COOL;
+  default:
+    return NO_STAGE;
+  }
+}
+
+static inline float clampf(float value, float lo, float hi)
+{
+  return (value < lo) ? lo : (value > hi) ? hi : value;
+}
+
+static void learn(float *estimate, float sample, uint16_t samples)
+{
+  if (samples == 0)
+    *estimate = sample;
+  else
+    *estimate += CONTROL_LEARN_ALPHA * (sample - *estimate);
+}
+
+//
+// Close out the running phase: heating/cooling rate measured from the point
+// where the temperature turned around (end of lag) to the stop.
+//
+static void learn_run(HVAC_THERMAL_MODEL *m, int64_t now, float p)
+{
+  float minutes = (now - obs.extremeTime) / 60000.0;
+  float lag = (obs.extremeTime - obs.phaseStart) / 60000.0;
+
+  if (now - obs.phaseStart < CONTROL_MIN_RUN_MS || minutes <= 0 || p - obs.extremeTemp < 0.1)
+    return;
+
+  learn(&m->rate, clampf((p - obs.extremeTemp) / minutes, 0.005, 1.0), m->samples);
+  learn(&m->lag, clampf(lag, 0.0, 20.0), m->samples);
+}
+
+static void learn_coast(HVAC_THERMAL_MODEL *m)
+{
+  learn(&m->coast, clampf(obs.extremeTemp - obs.stopTemp, 0.0, 3.0), m->samples);
+  if (m->samples < UINT16_MAX)
+    m->samples++;
+  modelDirty = true;
+  ESP_LOGI(TAG, "%s model: rate %.3f C/min  coast %.2f C  lag %.1f min  drift %.3f C/min (%u cycles)",
+           hvacStageToString((HVAC_STAGE)obs.stage), m->rate, m->coast, m->lag, m->drift, m->samples);
+}
+
+static void learn_idle(HVAC_THERMAL_MODEL *m, int64_t now, float p)
+{
+  float minutes = (now - obs.phaseStart) / 60000.0;
+
+  if (now - obs.phaseStart < CONTROL_MIN_IDLE_MS)
+    return;
+  // Positive drift: temperature moving away from where the stage drives it
+  learn(&m->drift, clampf((obs.phaseStartTemp - p) / minutes, -0.5, 0.5), m->samples);
+  modelDirty = true;
+}
+
+static void start_phase(LEARN_PHASE phase, int stage, int64_t now, float p)
+{
+  obs.phase = phase;
+  obs.stage = stage;
+  obs.phaseStart = now;
+  obs.phaseStartTemp = p;
+  obs.extremeTemp = p;
+  obs.extremeTime = now;
+}
+
+static void save_model(bool force)
+{
+  if (!modelDirty)
+    return;
+  if (!force && (millis() - lastModelSave < RUNTIME_SAVE_INTERVAL))
+    return;
+  if (eepromUpdateThermalModel(thermalModel))
+    modelDirty = false;
+  lastModelSave = millis();
+}
+
+//
+// Called on every pass of hvacStateUpdate() with the mode actually driven
+// and the corrected temperature. Tracks stage changes for the minimum
+// on/off times and feeds the learner.
+//
+void hvacControlObserve(HVAC_MODE opMode, float currentTemp)
+{
+  int64_t now = millis();
+  int stage = mode_to_control_stage(opMode);
+
+  if (opMode != lastOpMode) {
+    lastStageChange = now;
+    lastOpMode = opMode;
+  }
+
+  if (stage != NO_STAGE) {
+    float p = stage_progress(stage, currentTemp);
+
+    if (obs.phase != LEARN_RUNNING || obs.stage != stage) {
+      if (obs.phase == LEARN_IDLE && obs.stage == stage)
+        learn_idle(&thermalModel[stage], now, p);
+      start_phase(LEARN_RUNNING, stage, now, p);
+    } else if (p < obs.extremeTemp) {
+      // Still falling: the stage hasn't had an effect yet
+      obs.extremeTemp = p;
+      obs.extremeTime = now;
+    }
+  } else if (obs.stage != NO_STAGE) {
+    HVAC_THERMAL_MODEL *m = &thermalModel[obs.stage];
+    float p = stage_progress(obs.stage, currentTemp);
+
+    switch (obs.phase) {
+    case LEARN_RUNNING:
+      learn_run(m, now, p);
+      start_phase(LEARN_COASTING, obs.stage, now, p);
+      obs.stopTemp = p;
+      break;
+    case LEARN_COASTING:
+      if (p > obs.extremeTemp) {
+        obs.extremeTemp = p;
+        obs.extremeTime = now;
+      } else if ((obs.extremeTemp - p >= CONTROL_COAST_TURN_C) ||
+                 (now - obs.phaseStart > CONTROL_COAST_TIMEOUT_MS)) {
+        learn_coast(m);
+        start_phase(LEARN_IDLE, obs.stage, now, p);
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  save_model(false);
+}
+
+static bool predictive_demand(int stage, bool running, float pNow, float pLo, float pHi)
+{
+  const HVAC_THERMAL_MODEL *m = &thermalModel[stage];
+  bool trusted = (m->samples >= CONTROL_MIN_SAMPLES);
+  float coast = trusted ? m->coast : CONTROL_DEF_COAST_C;
+  float lead = trusted ? m->drift * m->lag : 0.0;
+
+  // Never let the band collapse: stop no earlier than the middle of it
+  coast = clampf(coast, 0.0, (pHi - pLo) / 2.0);
+  lead = clampf(lead, 0.0, (pHi - pLo) / 2.0);
+
+  if (running)
+    return (pNow + coast < pHi);
+  return (pNow - lead <= pLo);
+}
+
+static bool time_proportional_demand(int stage, bool running, float pNow, float pLo, float pHi)
+{
+  int64_t now = millis();
+  int64_t periodMs = 3600000 / (OperatingParameters.hvacCyclesPerHour ? OperatingParameters.hvacCyclesPerHour : 1);
+
+  // Outside the band the answer is obvious
+  if (pNow <= pLo) {
+    tpiCycleValid = false;
+    return true;
+  }
+  if (pNow >= pHi) {
+    tpiCycleValid = false;
+    return false;
+  }
+
+  if (!tpiCycleValid || (now - tpiCycleStart >= periodMs)) {
+    float duty = clampf((pHi - pNow) / (pHi - pLo), 0.0, 1.0);
+
+    tpiCycleStart = now;
+    tpiCycleValid = true;
+    tpiOnMs = (int64_t)(duty * periodMs);
+    if (tpiOnMs < CONTROL_MIN_RUN_MS)
+      tpiOnMs = 0;
+    else if (periodMs - tpiOnMs < CONTROL_MIN_OFF_MS)
+      tpiOnMs = periodMs;
+    ESP_LOGD(TAG, "%s duty %.0f%% for the next %d min", hvacStageToString((HVAC_STAGE)stage),
+             duty * 100.0, (int)(periodMs / 60000));
+  }
+  return (now - tpiCycleStart < tpiOnMs);
+}
+
+//
+// Decide whether the given stage should be running. minTemp/maxTemp are the
+// limits of the hysteresis band in the configured units. Minimum on and off
+// times are enforced to protect compressors and igniters.
+//
+bool hvacControlDemand(HVAC_STAGE stage, bool running, float currentTemp, float minTemp, float maxTemp)
+{
+  int64_t sinceChange = millis() - lastStageChange;
+  float pNow, pLo, pHi;
+  bool demand;
+
+  if (stage != STAGE_HEAT && stage != STAGE_COOL)
+    return false;
+
+  pNow = stage_progress(stage, currentTemp);
+  pLo = stage_progress(stage, (stage == STAGE_HEAT) ? minTemp : maxTemp);
+  pHi = stage_progress(stage, (stage == STAGE_HEAT) ? maxTemp : minTemp);
+
+  if (OperatingParameters.hvacControlMode == CONTROL_TIME_PROPORTIONAL)
+    demand = time_proportional_demand(stage, running, pNow, pLo, pHi);
+  else
+    demand = predictive_demand(stage, running, pNow, pLo, pHi);
+
+  if (running && !demand && sinceChange < CONTROL_MIN_RUN_MS && pNow < pHi)
+    demand = true;
+  else if (!running && demand && sinceChange < CONTROL_MIN_OFF_MS && lastStageChange != 0)
+    demand = false;
+
+  return demand;
+}
+
+// Switch algorithms without saving; the caller saves the settings
+bool hvacControlApplyMode(HVAC_CONTROL_MODE mode, uint16_t cyclesPerHour)
+{
+  if (mode >= NR_CONTROL_MODES)
+    return false;
+  if (cyclesPerHour < 1 || cyclesPerHour > 12)
+    cyclesPerHour = OperatingParameters.hvacCyclesPerHour;
+
+  OperatingParameters.hvacControlMode = mode;
+  OperatingParameters.hvacCyclesPerHour = cyclesPerHour;
+  tpiCycleValid = false;
+  ESP_LOGI(TAG, "Control mode set to %s (%u cycles/hour)", hvacControlModeToString(mode), cyclesPerHour);
+  return true;
+}
+
+void hvacControlSetMode(HVAC_CONTROL_MODE mode, uint16_t cyclesPerHour)
+{
+  if (hvacControlApplyMode(mode, cyclesPerHour))
+    eepromUpdateHvacControl();
+}
+
+// Model in the configured units for display
+void hvacControlGetModel(HVAC_STAGE stage, HVAC_THERMAL_MODEL *model)
+{
+  memset(model, 0, sizeof(HVAC_THERMAL_MODEL));
+  if (stage >= NR_CONTROL_STAGES)
+    return;
+
+  *model = thermalModel[stage];
+  model->rate = from_celsius_delta(model->rate);
+  model->coast = from_celsius_delta(model->coast);
+  model->drift = from_celsius_delta(model->drift);
+}
+
+void hvacControlInit()
+{
+  eepromGetThermalModel(thermalModel);
+  lastModelSave = millis();
+  ESP_LOGI(TAG, "Control mode: %s (heat model %u cycles, cool model %u cycles)",
+           hvacControlModeToString(OperatingParameters.hvacControlMode),
+           thermalModel[STAGE_HEAT].samples, thermalModel[STAGE_COOL].samples);
+}
@@ -35,6 +35,7 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include "i2cdev.h"
 
 #define CONFIG_I2CDEV_TIMEOUT 200
@@ -51,6 +52,19 @@ typedef struct {
 
 static i2c_port_state_t states[I2C_NUM_MAX];
 
+// Implemented in metrics.cpp
+void metricI2cTransaction(int64_t start, bool ok);
+
+// Run a read or write transaction, timing it for the metrics
+static esp_err_t i2c_dev_cmd_begin(i2c_port_t port, i2c_cmd_handle_t cmd)
+{
+    int64_t start = esp_timer_get_time();
+    esp_err_t res = i2c_master_cmd_begin(port, cmd, pdMS_TO_TICKS(CONFIG_I2CDEV_TIMEOUT));
+
+    metricI2cTransaction(start, res == ESP_OK);
+    return res;
+}
+
 #if CONFIG_I2CDEV_NOLOCK
 #define SEMAPHORE_TAKE(port)
 #else
@@ -302,7 +316,7 @@ esp_err_t i2c_dev_read(const i2c_dev_t *dev, const void *out_data, size_t out_si
         i2c_master_read(cmd, in_data, in_size, I2C_MASTER_LAST_NACK);
         i2c_master_stop(cmd);
 
-        res = i2c_master_cmd_begin(dev->port, cmd, pdMS_TO_TICKS(CONFIG_I2CDEV_TIMEOUT));
+        res = i2c_dev_cmd_begin(dev->port, cmd);
         if (res != ESP_OK)
             ESP_LOGE(TAG, "Could not read from device [0x%02x at %d]: %d (%s)", dev->addr, dev->port, res, esp_err_to_name(res));
 
@@ -329,7 +343,7 @@ esp_err_t i2c_dev_write(const i2c_dev_t *dev, const void *out_reg, size_t out_re
             i2c_master_write(cmd, (void *)out_reg, out_reg_size, true);
         i2c_master_write(cmd, (void *)out_data, out_size, true);
         i2c_master_stop(cmd);
-        res = i2c_master_cmd_begin(dev->port, cmd, pdMS_TO_TICKS(CONFIG_I2CDEV_TIMEOUT));
+        res = i2c_dev_cmd_begin(dev->port, cmd);
         if (res != ESP_OK)
             ESP_LOGE(TAG, "Could not write to device [0x%02x at %d]: %d (%s)", dev->addr, dev->port, res, esp_err_to_name(res));
         i2c_cmd_link_delete(cmd);
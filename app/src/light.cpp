@@ -0,0 +1,221 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * light.cpp
+ *
+ * Ambient light sensor (LDR to ground through a fixed resistor, read on
+ * LIGHT_SENS_PIN). The ADC runs in continuous (DMA) mode at 1 kHz. Each
+ * conversion frame holds 100 ms of samples, which is a whole number of
+ * 50 and 60 Hz mains cycles, so averaging a frame both decimates and
+ * removes lamp flicker. Frame averages are converted to millivolts with
+ * the eFuse calibration (adc_cali) and then smoothed with an exponential
+ * filter before being turned into a lux estimate.
+ *
+ * OperatingParameters.lightDetected keeps its 0-4095 scale (now filtered)
+ * and OperatingParameters.lightLux holds the estimate.
+ *
+ */
+
+#include <math.h>
+#include "thermostat.hpp"
+#include "esp_adc/adc_continuous.h"
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
+
+#define LIGHT_SAMPLE_HZ       (1000)
+#define LIGHT_FRAME_SAMPLES   (100)     // 100 ms: 5 cycles at 50 Hz, 6 at 60 Hz
+#define LIGHT_FRAME_BYTES     (LIGHT_FRAME_SAMPLES * SOC_ADC_DIGI_RESULT_BYTES)
+#define LIGHT_FILTER_ALPHA    (0.1)     // Per frame; ~1 s time constant
+#define LIGHT_FULL_SCALE      (4095)
+#define LIGHT_FULL_SCALE_MV   (3100)    // Input range at 12 dB attenuation
+
+// LDR model (GL55xx class): R = LIGHT_R10 * (10 lux / lux) ^ LIGHT_GAMMA
+#define LIGHT_SUPPLY_MV       (3300)
+#define LIGHT_R_FIXED         (10000.0) // Ohms, divider resistor to ground
+#define LIGHT_R10             (10000.0) // LDR resistance at 10 lux
+#define LIGHT_GAMMA           (0.7)
+#define LIGHT_MAX_LUX         (100000.0)
+
+#if CONFIG_IDF_TARGET_ESP32 || CONFIG_IDF_TARGET_ESP32S2
+#define LIGHT_OUTPUT_FORMAT   ADC_DIGI_OUTPUT_FORMAT_TYPE1
+#define LIGHT_GET_CHANNEL(p)  ((p)->type1.channel)
+#define LIGHT_GET_DATA(p)     ((p)->type1.data)
+#else
+#define LIGHT_OUTPUT_FORMAT   ADC_DIGI_OUTPUT_FORMAT_TYPE2
+#define LIGHT_GET_CHANNEL(p)  ((p)->type2.channel)
+#define LIGHT_GET_DATA(p)     ((p)->type2.data)
+#endif
+
+static const char *TAG = "LIGHT";
+
+static adc_continuous_handle_t adcHandle = NULL;
+static adc_cali_handle_t caliHandle = NULL;
+static adc_unit_t adcUnit;
+static adc_channel_t adcChannel;
+static TaskHandle_t lightTaskHandle = NULL;
+
+static float filteredRaw = -1.0;
+static float filteredMv = -1.0;
+
+static bool IRAM_ATTR light_conv_done(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata, void *user_data)
+{
+  BaseType_t mustYield = pdFALSE;
+
+  vTaskNotifyGiveFromISR(lightTaskHandle, &mustYield);
+  return (mustYield == pdTRUE);
+}
+
+static bool light_cali_init()
+{
+  esp_err_t ret = ESP_FAIL;
+
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+  adc_cali_curve_fitting_config_t cali_config = {
+    .unit_id = adcUnit,
+    .chan = adcChannel,
+    .atten = ADC_ATTEN_DB_12,
+    .bitwidth = ADC_BITWIDTH_12,
+  };
+  ret = adc_cali_create_scheme_curve_fitting(&cali_config, &caliHandle);
+#elif ADC_CALI_SCHEME_LINE_FITTING_SUPPORTED
+  adc_cali_line_fitting_config_t cali_config = {
+    .unit_id = adcUnit,
+    .atten = ADC_ATTEN_DB_12,
+    .bitwidth = ADC_BITWIDTH_12,
+  };
+  ret = adc_cali_create_scheme_line_fitting(&cali_config, &caliHandle);
+#endif
+
+  if (ret != ESP_OK)
+  {
+    ESP_LOGW(TAG, "ADC calibration unavailable (%s); using nominal scale", esp_err_to_name(ret));
+    caliHandle = NULL;
+    return false;
+  }
+  return true;
+}
+
+//
+// Estimate illuminance from the divider voltage. The LDR sits between the
+// supply and the ADC input, so more light means a higher voltage.
+//
+static float light_mv_to_lux(float mv)
+{
+  float rLdr;
+
+  if (mv <= 1.0)
+    return 0.0;
+  if (mv >= LIGHT_SUPPLY_MV - 1)
+    return LIGHT_MAX_LUX;
+  rLdr = LIGHT_R_FIXED * (LIGHT_SUPPLY_MV - mv) / mv;
+  return fminf(10.0 * powf(LIGHT_R10 / rLdr, 1.0 / LIGHT_GAMMA), LIGHT_MAX_LUX);
+}
+
+//
+// Fold one frame average into the filter. The first frame seeds it so
+// the display doesn't ramp up from zero at boot.
+//
+static void light_filter_update(float raw, float mv)
+{
+  if (filteredRaw < 0.0)
+  {
+    filteredRaw = raw;
+    filteredMv = mv;
+  }
+  else
+  {
+    filteredRaw += LIGHT_FILTER_ALPHA * (raw - filteredRaw);
+    filteredMv += LIGHT_FILTER_ALPHA * (mv - filteredMv);
+  }
+  OperatingParameters.lightDetected = (int)(filteredRaw + 0.5);
+  OperatingParameters.lightLux = light_mv_to_lux(filteredMv);
+}
+
+static void light_process_frame(uint8_t *frame, uint32_t len)
+{
+  uint32_t sum = 0;
+  uint32_t count = 0;
+  int mv;
+
+  for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= len; i += SOC_ADC_DIGI_RESULT_BYTES)
+  {
+    adc_digi_output_data_t *p = (adc_digi_output_data_t *)&frame[i];
+
+    if (LIGHT_GET_CHANNEL(p) != adcChannel)
+      continue;
+    sum += LIGHT_GET_DATA(p);
+    count++;
+  }
+  if (count == 0)
+    return;
+
+  float raw = (float)sum / count;
+  if (caliHandle == NULL || adc_cali_raw_to_voltage(caliHandle, (int)(raw + 0.5), &mv) != ESP_OK)
+    mv = (int)(raw * LIGHT_FULL_SCALE_MV / LIGHT_FULL_SCALE);
+
+  light_filter_update(raw, (float)mv);
+  ESP_LOGV(TAG, "Frame: %lu samples, raw %.1f, %d mV, filtered %d (%.1f lux)",
+           count, raw, mv, OperatingParameters.lightDetected, OperatingParameters.lightLux);
+}
+
+static void lightTask(void *parameter)
+{
+  static uint8_t frame[LIGHT_FRAME_BYTES];
+  uint32_t len;
+  esp_err_t ret;
+
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    // Drain every frame that is ready
+    while ((ret = adc_continuous_read(adcHandle, frame, sizeof(frame), &len, 0)) == ESP_OK)
+      light_process_frame(frame, len);
+    if (ret != ESP_ERR_TIMEOUT)
+    {
+      ESP_LOGE(TAG, "ADC read failed: %s", esp_err_to_name(ret));
+      OperatingParameters.Errors.hardwareErrors++;
+    }
+  }
+}
+
+void initLightSensor()
+{
+  adc_continuous_io_to_channel(LIGHT_SENS_PIN, &adcUnit, &adcChannel);
+
+  adc_continuous_handle_cfg_t handle_config = {
+    .max_store_buf_size = LIGHT_FRAME_BYTES * 4,
+    .conv_frame_size = LIGHT_FRAME_BYTES,
+  };
+  ESP_ERROR_CHECK(adc_continuous_new_handle(&handle_config, &adcHandle));
+
+  adc_digi_pattern_config_t pattern = {
+    .atten = ADC_ATTEN_DB_12,
+    .channel = (uint8_t)(adcChannel & 0x7),
+    .unit = (uint8_t)adcUnit,
+    .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH,
+  };
+  adc_continuous_config_t config = {
+    .pattern_num = 1,
+    .adc_pattern = &pattern,
+    .sample_freq_hz = LIGHT_SAMPLE_HZ,
+    .conv_mode = (adcUnit == ADC_UNIT_1) ? ADC_CONV_SINGLE_UNIT_1 : ADC_CONV_SINGLE_UNIT_2,
+    .format = LIGHT_OUTPUT_FORMAT,
+  };
+  ESP_ERROR_CHECK(adc_continuous_config(adcHandle, &config));
+
+  light_cali_init();
+
+  xTaskCreate(
+      lightTask,
+      "Light Sensor",
+      3072,
+      NULL,
+      tskIDLE_PRIORITY + 1,
+      &lightTaskHandle);
+
+  adc_continuous_evt_cbs_t callbacks = {
+    .on_conv_done = light_conv_done,
+  };
+  ESP_ERROR_CHECK(adc_continuous_register_event_callbacks(adcHandle, &callbacks, NULL));
+  ESP_ERROR_CHECK(adc_continuous_start(adcHandle));
+  ESP_LOGI(TAG, "ADC%d channel %d sampling at %d Hz", adcUnit + 1, adcChannel, LIGHT_SAMPLE_HZ);
+}
@@ -0,0 +1,579 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * logging.cpp
+ *
+ * Log ring. logInit() hooks esp_log so that every ESP_LOGx line is written
+ * into a ring of fixed size slots instead of straight to the UART. The hook
+ * never waits: a writer claims the next slot with an atomic increment,
+ * formats into it and publishes it by updating the slot's sequence number
+ * (a per-slot seqlock). When the ring is full the oldest lines are simply
+ * overwritten.
+ *
+ * Consumers (the UART task below, telnet sessions, the /log web stream and
+ * MQTT) each keep a LOG_CURSOR and read at their own pace. A consumer that
+ * falls more than a ring behind skips ahead; the lines it missed are
+ * counted in its cursor so it can report them.
+ *
+ * Lines logged with the BLOGx macros (binlog.hpp) are stored as binary
+ * records (format and tag addresses plus raw arguments) and only turned
+ * into text by logRead(), i.e. on the reader's task. logReadRaw() hands
+ * them over as they are.
+ *
+ * Nothing is written to the UART by the task that logs a line, so logging
+ * never waits on the UART. Once a restart or an abort has started
+ * (logPanic()), the UART task may never run again: what it hadn't got to
+ * is written out, and from then on every line also goes straight to the
+ * UART, after it is in the ring.
+ *
+ * The ring goes in PSRAM when there is some, otherwise a smaller ring is
+ * taken from internal RAM.
+ *
+ */
+
+#include "thermostat.hpp"
+#include "binlog.hpp"
+#include "esp_heap_caps.h"
+
+#define LOG_SLOT_SIZE         (160)
+#define LOG_SLOTS_PSRAM       (1024)
+#define LOG_SLOTS_INTERNAL    (128)
+#define LOG_UART_BATCH        (16)      // Lines per wakeup of the UART task
+
+#define min(x, y) ((x < y) ? x : y)
+
+typedef struct
+{
+  uint32_t seq;       // 2n+1 while line n is being written, 2n+2 once done
+  uint16_t len;
+  char level;         // 'E', 'W', 'I', 'D' or 'V'
+  uint8_t binary;     // text holds a binlog record rather than a line
+  char text[LOG_SLOT_SIZE - 8];
+} LOG_SLOT;
+
+static_assert(LOG_RECORD_MAX <= sizeof(((LOG_SLOT *)0)->text), "binlog records must fit a slot");
+
+typedef struct
+{
+  char type;          // 'i', 'I', 'f', 'd' or 's'
+  int64_t i;
+  double d;
+  char s[LOG_RECORD_MAX];
+} LOG_ARG;
+
+static const char *TAG = "LOG";
+
+static LOG_SLOT *logSlots = NULL;
+static uint32_t logSlotCount = 0;
+static uint32_t logWriteSeq = 0;        // Sequence number of the next line
+static vprintf_like_t OrigEsplogger = NULL;
+static TaskHandle_t logUartTaskHandle = NULL;
+static uint32_t logUartDropped = 0;
+static LOG_CURSOR logUartCursor;
+static volatile bool logPanicking = false;    // Set by logPanic(); lines go straight to the UART
+
+//
+// Level letter of a formatted line, skipping the colour escape that
+// CONFIG_LOG_COLORS puts in front of it
+//
+static char log_level(const char *text)
+{
+  if (text[0] == '\033')
+  {
+    const char *m = strchr(text, 'm');
+    if (m != NULL)
+      text = m + 1;
+  }
+  return text[0];
+}
+
+// Write to the UART with the original esp_log output function
+static int log_uart_printf(const char *fmt, ...)
+{
+  va_list list;
+  int n;
+
+  va_start(list, fmt);
+  n = OrigEsplogger(fmt, list);
+  va_end(list);
+  return n;
+}
+
+//
+// End a line that was cut to 'len' characters (in a buffer of len + 1)
+// the way it would have ended: with the colour reset, if it had colour,
+// and the newline, so it doesn't run into the next one
+//
+static void log_end_line(char *line, size_t len)
+{
+  const char *end = "\n";
+
+#if CONFIG_LOG_COLORS
+  if (line[0] == '\033')
+    end = LOG_RESET_COLOR "\n";
+#endif
+  if (len >= strlen(end))
+    strcpy(&line[len - strlen(end)], end);
+}
+
+//
+// Claim the next slot for writing, and publish it once it is filled in
+//
+static LOG_SLOT *log_slot_claim(uint32_t *seq)
+{
+  *seq = __atomic_fetch_add(&logWriteSeq, 1, __ATOMIC_RELAXED);
+
+  LOG_SLOT *slot = &logSlots[*seq % logSlotCount];
+  __atomic_store_n(&slot->seq, *seq * 2 + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  return slot;
+}
+
+static void log_slot_publish(LOG_SLOT *slot, uint32_t seq)
+{
+  __atomic_store_n(&slot->seq, seq * 2 + 2, __ATOMIC_RELEASE);
+
+  if (logUartTaskHandle != NULL)
+    xTaskNotifyGive(logUartTaskHandle);
+}
+
+//
+// esp_log vprintf hook; may run on any task. Only once logPanic() has
+// been called does the line go to the UART as well, and only after it is
+// published.
+//
+static int log_vprintf(const char *fmt, va_list list)
+{
+  uint32_t seq;
+  LOG_SLOT *slot = log_slot_claim(&seq);
+  va_list copy;
+  int n;
+
+  va_copy(copy, list);
+  n = vsnprintf(slot->text, sizeof(slot->text), fmt, list);
+  if (n < 0)
+    n = 0;
+  slot->len = min(n, (int)sizeof(slot->text) - 1);
+  if (n > slot->len)
+    log_end_line(slot->text, slot->len);
+  slot->level = log_level(slot->text);
+  slot->binary = false;
+  log_slot_publish(slot, seq);
+
+  if (logPanicking)
+    OrigEsplogger(fmt, copy);
+  va_end(copy);
+  return n;
+}
+
+//
+// Pull the next argument out of a binlog record
+//
+static bool log_next_arg(const uint8_t *rec, size_t len, size_t *pos, LOG_ARG *arg)
+{
+  int32_t i32;
+  float f;
+
+  if (*pos >= len)
+    return false;
+  arg->type = rec[(*pos)++];
+  arg->i = 0;
+  arg->d = 0.0;
+  arg->s[0] = '\0';
+
+  switch (arg->type)
+  {
+  case 'i':
+    if (*pos + sizeof(i32) > len)
+      return false;
+    memcpy(&i32, &rec[*pos], sizeof(i32));
+    *pos += sizeof(i32);
+    arg->i = i32;
+    arg->d = i32;
+    return true;
+  case 'I':
+    if (*pos + sizeof(arg->i) > len)
+      return false;
+    memcpy(&arg->i, &rec[*pos], sizeof(arg->i));
+    *pos += sizeof(arg->i);
+    arg->d = arg->i;
+    return true;
+  case 'f':
+    if (*pos + sizeof(f) > len)
+      return false;
+    memcpy(&f, &rec[*pos], sizeof(f));
+    *pos += sizeof(f);
+    arg->d = f;
+    arg->i = (int64_t)f;
+    return true;
+  case 'd':
+    if (*pos + sizeof(arg->d) > len)
+      return false;
+    memcpy(&arg->d, &rec[*pos], sizeof(arg->d));
+    *pos += sizeof(arg->d);
+    arg->i = (int64_t)arg->d;
+    return true;
+  case 's':
+  {
+    if (*pos >= len)
+      return false;
+    size_t n = rec[(*pos)++];
+
+    n = min(n, len - *pos);
+    memcpy(arg->s, &rec[*pos], n);
+    arg->s[n] = '\0';
+    *pos += n;
+    return true;
+  }
+  }
+  return false;
+}
+
+//
+// printf() for a binlog record: each conversion in the format is handed to
+// snprintf() on its own with the matching stored argument
+//
+static size_t log_format_message(const char *fmt, const uint8_t *rec, size_t len, char *out, size_t outLen)
+{
+  size_t pos = LOG_RECORD_HEADER;
+  size_t used = 0;
+  LOG_ARG arg;
+
+  while (*fmt && (used < outLen - 1))
+  {
+    char spec[32];
+    size_t s = 0;
+    char conv;
+    int n;
+
+    if ((fmt[0] != '%') || (fmt[1] == '%'))
+    {
+      out[used++] = *fmt;
+      fmt += (fmt[0] == '%') ? 2 : 1;
+      continue;
+    }
+
+    // Rebuild the conversion without its length modifier, filling in any '*'
+    spec[s++] = *fmt++;
+    while (*fmt && strchr("-+ #0", *fmt) && (s < 8))
+      spec[s++] = *fmt++;
+    for (int part = 0; part < 2; part++)
+    {
+      if (part == 1)
+      {
+        if (*fmt != '.')
+          break;
+        spec[s++] = *fmt++;
+      }
+      if (*fmt == '*')
+      {
+        fmt++;
+        if (!log_next_arg(rec, len, &pos, &arg))
+          break;
+        s += snprintf(&spec[s], sizeof(spec) - s - 4, "%d", (int)arg.i);
+      }
+      while ((*fmt >= '0') && (*fmt <= '9') && (s < sizeof(spec) - 4))
+        spec[s++] = *fmt++;
+    }
+    while (*fmt && strchr("hlLqjzt", *fmt))
+      fmt++;
+    if ((conv = *fmt) == '\0')
+      break;
+    fmt++;
+
+    if (!log_next_arg(rec, len, &pos, &arg))
+    {
+      n = snprintf(&out[used], outLen - used, "<?>");
+    }
+    else if (strchr("diouxX", conv))
+    {
+      // 32 bit arguments were stored signed; unsigned conversions need them back
+      if ((arg.type == 'i') && strchr("ouxX", conv))
+        arg.i = (uint32_t)arg.i;
+      spec[s++] = 'l';
+      spec[s++] = 'l';
+      spec[s++] = conv;
+      spec[s] = '\0';
+      n = snprintf(&out[used], outLen - used, spec, (long long)arg.i);
+    }
+    else if (conv == 'c')
+    {
+      spec[s++] = conv;
+      spec[s] = '\0';
+      n = snprintf(&out[used], outLen - used, spec, (int)arg.i);
+    }
+    else if (strchr("fFeEgGaA", conv))
+    {
+      spec[s++] = conv;
+      spec[s] = '\0';
+      n = snprintf(&out[used], outLen - used, spec, arg.d);
+    }
+    else if (conv == 's')
+    {
+      spec[s++] = conv;
+      spec[s] = '\0';
+      n = snprintf(&out[used], outLen - used, spec, (arg.type == 's') ? arg.s : "<?>");
+    }
+    else if (conv == 'p')
+    {
+      n = snprintf(&out[used], outLen - used, "%p", (void *)(uintptr_t)arg.i);
+    }
+    else
+    {
+      n = snprintf(&out[used], outLen - used, "<%%%c?>", conv);
+    }
+    if (n > 0)
+      used = min(used + n, outLen - 1);
+  }
+  out[used] = '\0';
+  return used;
+}
+
+//
+// Expand a binlog record into the same text ESP_LOGx would have produced
+//
+static int log_format_record(const uint8_t *rec, size_t len, char *out, size_t outLen)
+{
+  uint32_t timestamp;
+  uint32_t tag;
+  uint32_t fmt;
+  const char *color = "";
+  const char *reset = "";
+  size_t used;
+
+  if (len < LOG_RECORD_HEADER)
+    return 0;
+  memcpy(&timestamp, &rec[1], sizeof(timestamp));
+  memcpy(&tag, &rec[5], sizeof(tag));
+  memcpy(&fmt, &rec[9], sizeof(fmt));
+
+#if CONFIG_LOG_COLORS
+  switch (rec[0])
+  {
+  case 'E':
+    color = LOG_COLOR_E;
+    break;
+  case 'W':
+    color = LOG_COLOR_W;
+    break;
+  case 'I':
+    color = LOG_COLOR_I;
+    break;
+  }
+  if (*color)
+    reset = LOG_RESET_COLOR;
+#endif
+
+  // The colour reset and newline always fit; the message is cut instead
+  size_t room = outLen - strlen(reset) - 1;
+
+  used = snprintf(out, room, "%s%c (%lu) %s: ", color, rec[0], (unsigned long)timestamp, (const char *)(uintptr_t)tag);
+  used = min(used, room - 1);
+  used += log_format_message((const char *)(uintptr_t)fmt, rec, len, &out[used], room - used);
+  used += snprintf(&out[used], outLen - used, "%s\n", reset);
+  return min(used, outLen - 1);
+}
+
+//
+// Store a record built by logBinary(). Until the ring exists the record
+// is expanded and printed right away.
+//
+void logWriteRecord(char level, const uint8_t *record, size_t len)
+{
+  if (logSlots == NULL)
+  {
+    char line[LOG_LINE_MAX];
+
+    log_format_record(record, len, line, sizeof(line));
+    printf("%s", line);
+    return;
+  }
+
+  uint32_t seq;
+  LOG_SLOT *slot = log_slot_claim(&seq);
+
+  slot->len = min(len, sizeof(slot->text));
+  memcpy(slot->text, record, slot->len);
+  slot->level = level;
+  slot->binary = true;
+  log_slot_publish(slot, seq);
+
+  if (logPanicking)
+  {
+    char line[LOG_LINE_MAX];
+
+    log_format_record(record, len, line, sizeof(line));
+    log_uart_printf("%s", line);
+  }
+}
+
+void logCursorInit(LOG_CURSOR *cursor, uint32_t backlog)
+{
+  uint32_t head = __atomic_load_n(&logWriteSeq, __ATOMIC_ACQUIRE);
+
+  backlog = min(backlog, min(head, logSlotCount));
+  cursor->next = head - backlog;
+  cursor->dropped = 0;
+}
+
+int logReadRaw(LOG_CURSOR *cursor, char *buf, size_t len, char *level, bool *binary)
+{
+  if (logSlots == NULL)
+    return 0;
+
+  for (;;)
+  {
+    uint32_t head = __atomic_load_n(&logWriteSeq, __ATOMIC_ACQUIRE);
+
+    if (cursor->next == head)
+      return 0;
+
+    // Lapped by the writers: skip to the oldest line still in the ring
+    if (head - cursor->next > logSlotCount)
+    {
+      cursor->dropped += head - logSlotCount - cursor->next;
+      cursor->next = head - logSlotCount;
+    }
+
+    LOG_SLOT *slot = &logSlots[cursor->next % logSlotCount];
+    uint32_t want = cursor->next * 2 + 2;
+    uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+    if ((int32_t)(seq - want) < 0)
+      return 0;                 // Still being written
+    if (seq == want)
+    {
+      bool isBinary = slot->binary;
+      // Text is cut to fit (and NUL terminated); records must fit whole
+      size_t n = min((size_t)slot->len, isBinary ? len : len - 1);
+
+      memcpy(buf, slot->text, n);
+      if (!isBinary)
+        buf[n] = '\0';
+      if (level != NULL)
+        *level = slot->level;
+      *binary = isBinary;
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == want)
+      {
+        cursor->next++;
+        return n;
+      }
+    }
+    // Overwritten before (or while) we read it
+    cursor->dropped++;
+    cursor->next++;
+  }
+}
+
+int logRead(LOG_CURSOR *cursor, char *line, size_t len, char *level)
+{
+  uint8_t record[LOG_RECORD_MAX];
+  bool binary;
+  int n;
+
+  n = logReadRaw(cursor, (char *)record, sizeof(record), level, &binary);
+  if (n <= 0)
+    return n;
+  if (!binary)
+  {
+    bool cut = ((size_t)n > len - 1);
+
+    n = min((size_t)n, len - 1);
+    memcpy(line, record, n);
+    line[n] = '\0';
+    if (cut)
+      log_end_line(line, n);
+    return n;
+  }
+  return log_format_record(record, n, line, len);
+}
+
+void logGetStats(uint32_t *lines, uint32_t *uartDropped)
+{
+  *lines = __atomic_load_n(&logWriteSeq, __ATOMIC_RELAXED);
+  *uartDropped = logUartDropped;
+}
+
+//
+// Copies the ring to the serial console with the original esp_log output
+// function. Runs at idle priority so a slow UART never delays anyone else.
+// Once logPanic() has taken over it leaves the UART alone.
+//
+static void logUartTask(void *parameter)
+{
+  static char line[LOG_LINE_MAX];
+  char level;
+  int n;
+
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+    for (int i = 0; (i < LOG_UART_BATCH) && !logPanicking &&
+         ((n = logRead(&logUartCursor, line, sizeof(line), &level)) > 0); i++)
+      log_uart_printf("%.*s", n, line);
+    if (logUartCursor.dropped && !logPanicking)
+    {
+      logUartDropped += logUartCursor.dropped;
+      log_uart_printf("[%lu log lines dropped]\n", logUartCursor.dropped);
+      logUartCursor.dropped = 0;
+    }
+    // More waiting? Come straight back without another notification.
+    if (!logPanicking && (logUartCursor.next != __atomic_load_n(&logWriteSeq, __ATOMIC_RELAXED)))
+      xTaskNotifyGive(xTaskGetCurrentTaskHandle());
+  }
+}
+
+//
+// A restart or an abort has started, and the UART task may never run
+// again. Write out what it hadn't got to, and from here on have every
+// line written to the UART by the task that logs it. Registered as a
+// shutdown handler, so esp_restart() calls it; code about to abort calls
+// it first.
+//
+void logPanic()
+{
+  static char line[LOG_LINE_MAX];
+  char level;
+  int n;
+
+  if (logPanicking || (logSlots == NULL))
+    return;
+  logPanicking = true;
+  while ((n = logRead(&logUartCursor, line, sizeof(line), &level)) > 0)
+    log_uart_printf("%.*s", n, line);
+}
+
+void logInit()
+{
+  size_t bytes = LOG_SLOTS_PSRAM * sizeof(LOG_SLOT);
+
+  logSlots = (LOG_SLOT *)heap_caps_calloc(1, bytes, MALLOC_CAP_SPIRAM);
+  logSlotCount = LOG_SLOTS_PSRAM;
+  if (logSlots == NULL)
+  {
+    bytes = LOG_SLOTS_INTERNAL * sizeof(LOG_SLOT);
+    logSlots = (LOG_SLOT *)heap_caps_calloc(1, bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    logSlotCount = LOG_SLOTS_INTERNAL;
+  }
+  if (logSlots == NULL)
+  {
+    ESP_LOGE(TAG, "No memory for the log ring; logging straight to the UART");
+    OperatingParameters.Errors.systemErrors++;
+    return;
+  }
+
+  // Start with whatever was logged before the UART task got going
+  logCursorInit(&logUartCursor, logSlotCount);
+  OrigEsplogger = esp_log_set_vprintf(log_vprintf);
+  esp_register_shutdown_handler(logPanic);
+
+  xTaskCreate(
+      logUartTask,
+      "Log UART",
+      3072,
+      NULL,
+      tskIDLE_PRIORITY,
+      &logUartTaskHandle);
+
+  ESP_LOGI(TAG, "Log ring: %lu lines (%u bytes)", logSlotCount, bytes);
+}
@@ -34,28 +34,91 @@ const char *VersionBuildDateTime = VERSION_BUILD_DATE_TIME;
 
 int64_t millis() { return esp_timer_get_time() / 1000;}
 
+//
+// Startup phases that get a task of their own (see boot.cpp). The
+// dependencies are passed to bootRun() in app_main().
+//
+static bool boot_sensors()
+{
+  sensorsInit();
+  // Don't let the HVAC decide anything before there is a temperature
+  return bootWait(BOOT_BIT(BOOT_FIRST_READING), BOOT_READING_WAIT);
+}
+
+static bool boot_indicators()
+{
+  indicatorsInit();
+  return true;
+}
+
+static bool boot_wifi()
+{
+  // Connected or not, the wifi manager keeps trying from here on.
+  // SNTP is started by WifiStart() once it has connected.
+  ESP_LOGI (TAG, "Starting wifi (\"%s\", \"%s\")", WifiCreds.ssid, WifiCreds.password);
+  OperatingParameters.wifiConnected =
+    WifiStart(OperatingParameters.DeviceName, WifiCreds.ssid, WifiCreds.password);
+  WifiManagerStart();
+  // <name>.local, before MQTT discovery hands out the web UI address
+  mdnsStart();
+  // Nothing set up yet: offer the setup page on our own access point
+  if (strlen(WifiCreds.ssid) == 0)
+    WifiProvisionStart();
+  return OperatingParameters.wifiConnected;
+}
+
+#ifdef MQTT_ENABLED
+static bool boot_mqtt()
+{
+  MqttInit();
+  return true;
+}
+#endif
+
+static bool boot_web()
+{
+  webStart();
+  return true;
+}
+
+#ifdef TELNET_ENABLED
+static bool boot_telnet()
+{
+  return telnetStart() == ESP_OK;
+}
+#endif
+
+static bool boot_control()
+{
+  stateCreateTask();
+  return true;
+}
+
 void app_main()
 {
   // Set default log level for all components
   esp_log_level_set("*", ESP_LOG_WARN);
 
+  // Route logging through the log ring before anything else logs
+  logInit();
+  bootInit();
+
   ESP_LOGI (TAG, "IDF version: %s", esp_get_idf_version());
   ESP_LOGD (TAG, "- Free memory: %d bytes", esp_get_free_heap_size());
 
-  // Load configuration from EEPROM
-  ESP_LOGI (TAG, "Reading EEPROM");
+  // Load configuration from EEPROM; everything else needs it
+  bootStart(BOOT_NVS);
   eepromInit();
+  // Before web, telnet and MQTT can send it commands
+  scheduleInit();
+  bootEnd(BOOT_NVS, true);
 
-  // Initialize the TFT display
-  ESP_LOGI (TAG, "Initializing TFT");
-  tftInit();
-  // Create the RTOS task to drive the touchscreen
-  ESP_LOGI (TAG, "Starting TFT task");
-  tftCreateTask();
+  // Relays off before anything else happens
+  bootStart(BOOT_RELAYS);
+  initRelays();
+  bootEnd(BOOT_RELAYS, true);
 
-  // Initialize sensors (temp, humidity, motion, etc)
-  ESP_LOGI (TAG, "Initializing sensors");
-  sensorsInit();
+  ESP_ERROR_CHECK(esp_netif_init());
 
 #ifdef MATTER_ENABLED
   // Start Matter
@@ -63,41 +126,45 @@ void app_main()
   OperatingParameters.MatterStarted = MatterInit();
 #endif
 
-  // Start wifi
-  ESP_LOGI (TAG, "Starting wifi (\"%s\", \"%s\")", WifiCreds.ssid, WifiCreds.password);
-  ESP_ERROR_CHECK(esp_netif_init());
-  OperatingParameters.wifiConnected = 
-    // wifiStart(WifiCreds.hostname, WifiCreds.ssid, WifiCreds.password);
-    WifiStart(OperatingParameters.DeviceName, WifiCreds.ssid, WifiCreds.password);
-
+  //
+  // Everything that doesn't touch LVGL runs alongside the display setup.
+  // The web server does (the settings handlers update the UI), so it
+  // waits for it. The state machine drives the LEDs, so it waits for
+  // the indicator start up dance to finish.
+  //
+  bootRun(BOOT_SENSORS, BOOT_BIT(BOOT_NVS), boot_sensors, BOOT_TASK_STACK);
+  bootRun(BOOT_INDICATORS, BOOT_BIT(BOOT_NVS), boot_indicators, 3072);
+  bootRun(BOOT_WIFI, BOOT_BIT(BOOT_NVS), boot_wifi, 6144);
 #ifdef MQTT_ENABLED
-  // Start Matter
-  ESP_LOGI (TAG, "Starting MQTT");
-  MqttInit();
+  bootRun(BOOT_MQTT, BOOT_BIT(BOOT_WIFI), boot_mqtt, 3072);
 #endif
-
-  // Start SNTP connection to get local time
-  initTimeSntp();
-
-  // Initialize indicators (relays, LEDs, buzzer)
-  ESP_LOGI (TAG, "Initializing indicators");
-  indicatorsInit();
-  initRelays();
-
-  // Start web server
-  ESP_LOGI (TAG, "Starting web server");
-  webStart();
-
+  bootRun(BOOT_WEB, BOOT_BIT(BOOT_WIFI) | BOOT_BIT(BOOT_UI), boot_web, BOOT_TASK_STACK);
 #ifdef TELNET_ENABLED
-  // Start telnet server
-  telnetStart();
+  bootRun(BOOT_TELNET, BOOT_BIT(BOOT_WIFI), boot_telnet, 3072);
 #endif
+  bootRun(BOOT_CONTROL, BOOT_BIT(BOOT_RELAYS) | BOOT_BIT(BOOT_SENSORS) | BOOT_BIT(BOOT_INDICATORS),
+          boot_control, 3072);
 
-  // Create the RTOS task to drive the state machine
-  ESP_LOGI (TAG, "Starting state machine task");
-  stateCreateTask();
+  // The display is built here, on the main task
+  bootStart(BOOT_UI);
+  tftInit();
+  tftCreateTask();
+  bootEnd(BOOT_UI, true);
 
-  // Play the startup sound
+  // Play the startup sound once everything is up
+  bootWait(BOOT_BIT(BOOT_WEB) | BOOT_BIT(BOOT_CONTROL)
+#ifdef MQTT_ENABLED
+           | BOOT_BIT(BOOT_MQTT)
+#endif
+#ifdef TELNET_ENABLED
+           | BOOT_BIT(BOOT_TELNET)
+#endif
+           , 0);
   audioStartupBeep();
-  ESP_LOGI (TAG, "Startup done");
+
+  BOOT_TIMES frame, decision;
+  bootGetTimes(BOOT_FIRST_FRAME, &frame);
+  bootGetTimes(BOOT_FIRST_DECISION, &decision);
+  ESP_LOGI (TAG, "Startup done at %lld ms: first frame %lld ms, first control decision %lld ms",
+            millis(), frame.endUs / 1000, decision.endUs / 1000);
 }
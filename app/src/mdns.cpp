@@ -0,0 +1,211 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * mdns.cpp
+ *
+ * Finding the thermostat without knowing its address. The device name,
+ * cut down to a valid DNS label, answers as <name>.local and three
+ * DNS-SD services are advertised under the device name:
+ *   _http._tcp         the web UI
+ *   _telnet._tcp       the console (with TELNET_ENABLED)
+ *   _thermostat._tcp   for apps looking for thermostats. Its TXT record
+ *                      has the firmware "version", the set "mode" and
+ *                      the temperature "units".
+ *
+ * The responder is the ESP-IDF mdns component (src/idf_component.yml),
+ * which follows the station and access point interfaces by itself.
+ * Every MDNS_CHECK_INTERVAL the state machine calls mdnsLoop(), which
+ * announces again when the station address changes (a new DHCP lease or
+ * another network) and updates the host name and TXT record when the
+ * device name, mode or units change.
+ *
+ * The responder hangs off the default event loop and the wifi
+ * interfaces, so a wifi restart that deletes them (WifiReconnect(),
+ * WifiDeinit()) stops it first with mdnsStop() and starts it again
+ * after.
+ *
+ */
+
+#include "thermostat.hpp"
+#include "version.h"
+#include <mdns.h>
+#include <ctype.h>
+
+static const char *TAG = "MDNS";
+
+static volatile bool mdnsRunning;
+static char mdnsHost[MDNS_HOSTNAME_MAX + 1];
+static portMUX_TYPE mdnsLock = portMUX_INITIALIZER_UNLOCKED;
+
+// What was last advertised; only touched by mdnsStart() and mdnsLoop()
+// (mdnsStart() again after mdnsStop())
+static char lastName[sizeof(OperatingParameters.DeviceName)];
+static char lastAddress[16];
+static HVAC_MODE lastMode;
+static char lastUnits;
+static int64_t lastCheck;
+
+//
+// Turn a device name into a host name: letters and digits, lower case,
+// anything else becomes a single '-'. "thermostat" if nothing is left.
+//
+static void mdns_hostname_from(const char *name, char *host, size_t len)
+{
+  size_t n = 0;
+
+  for (; (*name != '\0') && (n + 1 < len); name++)
+  {
+    if (isalnum((unsigned char)*name))
+      host[n++] = tolower((unsigned char)*name);
+    else if ((n > 0) && (host[n - 1] != '-'))
+      host[n++] = '-';
+  }
+  while ((n > 0) && (host[n - 1] == '-'))
+    n--;
+  host[n] = '\0';
+  if (n == 0)
+    strlcpy(host, "thermostat", len);
+}
+
+static void mdns_set_hostname()
+{
+  char host[MDNS_HOSTNAME_MAX + 1];
+  esp_err_t err;
+
+  strlcpy(lastName, OperatingParameters.DeviceName, sizeof(lastName));
+  mdns_hostname_from(lastName, host, sizeof(host));
+  portENTER_CRITICAL(&mdnsLock);
+  strlcpy(mdnsHost, host, sizeof(mdnsHost));
+  portEXIT_CRITICAL(&mdnsLock);
+
+  err = mdns_hostname_set(host);
+  if (err == ESP_OK)
+    err = mdns_instance_name_set(lastName);
+  if (err != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Could not set the host name to %s (%s)", host, esp_err_to_name(err));
+    OperatingParameters.Errors.systemErrors++;
+    return;
+  }
+  ESP_LOGI(TAG, "Host name %s.local", host);
+}
+
+static void mdns_add_service(const char *type, uint16_t port, mdns_txt_item_t *txt, size_t count)
+{
+  esp_err_t err = mdns_service_add(NULL, type, "_tcp", port, txt, count);
+
+  if (err != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Could not advertise %s._tcp (%s)", type, esp_err_to_name(err));
+    OperatingParameters.Errors.systemErrors++;
+  }
+}
+
+//
+// Start answering for the host name and advertise the services. The
+// station interface doesn't need to be up yet.
+//
+bool mdnsStart()
+{
+  char units[2] = {OperatingParameters.tempUnits, '\0'};
+  esp_err_t err;
+
+  if (mdnsRunning)
+    return true;
+
+  err = mdns_init();
+  if (err != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Could not start mDNS (%s)", esp_err_to_name(err));
+    OperatingParameters.Errors.systemErrors++;
+    return false;
+  }
+  mdns_set_hostname();
+
+  lastMode = OperatingParameters.hvacSetMode;
+  lastUnits = OperatingParameters.tempUnits;
+  mdns_txt_item_t txt[] = {
+    {"version", VersionString},
+    {"mode", hvacModeToString(lastMode)},
+    {"units", units}};
+
+  mdns_add_service("_http", WEB_PORT, NULL, 0);
+#ifdef TELNET_ENABLED
+  mdns_add_service("_telnet", TELNET_PORT, NULL, 0);
+#endif
+  mdns_add_service("_thermostat", WEB_PORT, txt, sizeof(txt) / sizeof(txt[0]));
+
+  lastAddress[0] = '\0';
+  lastCheck = millis();
+  mdnsRunning = true;
+  return true;
+}
+
+//
+// Take the responder down, before the event loop and interfaces it uses
+// go. True if it was running.
+//
+bool mdnsStop()
+{
+  if (!mdnsRunning)
+    return false;
+  mdnsRunning = false;
+  mdns_free();
+  ESP_LOGI(TAG, "mDNS stopped");
+  return true;
+}
+
+void mdnsLoop()
+{
+  const char *address;
+
+  if (!mdnsRunning || (millis() - lastCheck < MDNS_CHECK_INTERVAL))
+    return;
+  lastCheck = millis();
+
+  if (strcmp(lastName, OperatingParameters.DeviceName) != 0)
+    mdns_set_hostname();
+
+  if ((lastMode != OperatingParameters.hvacSetMode) || (lastUnits != OperatingParameters.tempUnits))
+  {
+    char units[2] = {OperatingParameters.tempUnits, '\0'};
+
+    lastMode = OperatingParameters.hvacSetMode;
+    lastUnits = OperatingParameters.tempUnits;
+    if ((mdns_service_txt_item_set("_thermostat", "_tcp", "mode", hvacModeToString(lastMode)) != ESP_OK) ||
+        (mdns_service_txt_item_set("_thermostat", "_tcp", "units", units) != ESP_OK))
+    {
+      ESP_LOGW(TAG, "Could not update the _thermostat._tcp TXT record");
+      OperatingParameters.Errors.systemErrors++;
+    }
+  }
+
+  // Let everyone with the old address cached know about the new one
+  address = WifiConnected() ? WifiAddress() : "";
+  if (strcmp(lastAddress, address) != 0)
+  {
+    strlcpy(lastAddress, address, sizeof(lastAddress));
+    if (lastAddress[0] != '\0')
+    {
+      esp_netif_t *sta = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+
+      ESP_LOGI(TAG, "Announcing %s.local at %s", mdnsHost, lastAddress);
+      if ((sta == NULL) || (mdns_netif_action(sta, MDNS_EVENT_ANNOUNCE_IP4) != ESP_OK))
+        ESP_LOGW(TAG, "Could not announce the new address");
+    }
+  }
+}
+
+//
+// Copy the host name (without ".local") into 'host'. False, and 'host'
+// empty, if mDNS isn't running.
+//
+bool mdnsGetHostname(char *host, size_t len)
+{
+  host[0] = '\0';
+  if (!mdnsRunning)
+    return false;
+  portENTER_CRITICAL(&mdnsLock);
+  strlcpy(host, mdnsHost, len);
+  portEXIT_CRITICAL(&mdnsLock);
+  return true;
+}
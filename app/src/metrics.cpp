@@ -0,0 +1,552 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * metrics.cpp
+ *
+ * Small fixed registry of performance metrics. Every metric is declared
+ * in the METRIC_ID enum (thermostat.hpp) and described in metricDesc[]
+ * below; there is no run time registration. A metric is one of:
+ *
+ *   histogram  Durations in microseconds, counted in fixed buckets
+ *              (metricBounds[]) along with their sum and maximum
+ *   counter    Only goes up (metricInc)
+ *   gauge      Set to or moved by a value (metricSet, metricAdd)
+ *
+ * Updating a metric is a few additions under a spinlock, so it can be
+ * done from any task on either core.
+ *
+ * Heap usage per memory capability, the free stack of every task and
+ * the wifi power save figures are not kept here; they are sampled when
+ * the metrics are written out.
+ *
+ * metricsWrite() produces either the Prometheus text format (web
+ * /metrics, which also carries the task profiler's CPU figures) or a
+ * short table for the console Stats command; both include the action
+ * counts from actions.cpp. MQTT builds
+ * its diagnostics payload from metricGetSummary() and metricsGetTasks().
+ *
+ */
+
+#include "thermostat.hpp"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include <stdlib.h>
+
+#define METRIC_PREFIX "thermostat_"
+
+typedef enum
+{
+  METRIC_HISTOGRAM = 0,
+  METRIC_COUNTER,
+  METRIC_GAUGE
+} METRIC_TYPE;
+
+typedef struct
+{
+  const char *name;
+  const char *help;
+  METRIC_TYPE type;
+} METRIC_DESC;
+
+typedef struct
+{
+  uint32_t count;
+  uint32_t max;
+  uint64_t sum;
+  int32_t value;
+  uint32_t buckets[METRIC_BUCKETS];
+} METRIC_DATA;
+
+typedef struct
+{
+  const char *name;
+  uint32_t caps;
+} METRIC_HEAP;
+
+// Upper bound (inclusive) of each histogram bucket in microseconds;
+// the last bucket takes everything longer
+static const uint32_t metricBounds[METRIC_BUCKETS - 1] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000,
+    2500000, 5000000, 10000000, 30000000};
+
+static const METRIC_DESC metricDesc[NR_METRICS] = {
+    {"state_loop", "State machine loop pass", METRIC_HISTOGRAM},
+    {"lvgl_render", "LVGL timer handler passes that redrew the screen", METRIC_HISTOGRAM},
+    {"lvgl_flush", "Display area flush to the panel", METRIC_HISTOGRAM},
+    {"web_xml", "Web UI /xml request", METRIC_HISTOGRAM},
+    {"mqtt_publish", "MQTT publish call", METRIC_HISTOGRAM},
+    {"mqtt_puback", "MQTT publish until acknowledged by the broker", METRIC_HISTOGRAM},
+    {"nvs_commit", "NVS commit", METRIC_HISTOGRAM},
+    {"i2c_transaction", "I2C bus transaction", METRIC_HISTOGRAM},
+    {"wifi_connect", "Wifi connect attempt until an IP address was assigned", METRIC_HISTOGRAM},
+    {"wifi_outage", "Wifi connection lost until it was back", METRIC_HISTOGRAM},
+    {"i2c_errors", "Failed I2C transactions", METRIC_COUNTER},
+    {"nvs_errors", "Failed NVS commits", METRIC_COUNTER},
+    {"mqtt_publish_errors", "MQTT publishes the client refused", METRIC_COUNTER},
+    {"wifi_retries", "Wifi reconnect attempts", METRIC_COUNTER},
+    {"wifi_fast_misses", "Fast reconnects to the cached access point that needed a full scan", METRIC_COUNTER},
+    {"mqtt_inflight", "MQTT publishes waiting for an acknowledgement", METRIC_GAUGE},
+};
+
+static const METRIC_HEAP metricHeaps[] = {
+    {"internal", MALLOC_CAP_INTERNAL},
+    {"default", MALLOC_CAP_DEFAULT},
+    {"dma", MALLOC_CAP_DMA},
+    {"spiram", MALLOC_CAP_SPIRAM},
+};
+
+#define NR_METRIC_HEAPS ((int)(sizeof(metricHeaps) / sizeof(metricHeaps[0])))
+
+// Sampled for every capability above
+static const struct
+{
+  const char *name;
+  const char *help;
+  size_t (*get)(uint32_t caps);
+} heapGauges[] = {
+    {"heap_free_bytes", "Free heap per memory capability", heap_caps_get_free_size},
+    {"heap_min_free_bytes", "Lowest free heap since boot per memory capability", heap_caps_get_minimum_free_size},
+    {"heap_largest_free_block_bytes", "Largest allocatable block per memory capability", heap_caps_get_largest_free_block},
+};
+
+#define NR_HEAP_GAUGES ((int)(sizeof(heapGauges) / sizeof(heapGauges[0])))
+
+static const char *TAG = "METRICS";
+
+static METRIC_DATA metricData[NR_METRICS];
+static portMUX_TYPE metricLock = portMUX_INITIALIZER_UNLOCKED;
+
+void metricObserve(METRIC_ID id, uint32_t us)
+{
+  int b = 0;
+
+  if ((id < 0) || (id >= NR_METRICS))
+    return;
+  while ((b < METRIC_BUCKETS - 1) && (us > metricBounds[b]))
+    b++;
+
+  portENTER_CRITICAL(&metricLock);
+  metricData[id].count++;
+  metricData[id].sum += us;
+  if (us > metricData[id].max)
+    metricData[id].max = us;
+  metricData[id].buckets[b]++;
+  portEXIT_CRITICAL(&metricLock);
+}
+
+void metricObserveSince(METRIC_ID id, int64_t start)
+{
+  int64_t us = esp_timer_get_time() - start;
+
+  metricObserve(id, (us > UINT32_MAX) ? UINT32_MAX : (uint32_t)us);
+}
+
+void metricInc(METRIC_ID id)
+{
+  if ((id < 0) || (id >= NR_METRICS))
+    return;
+  portENTER_CRITICAL(&metricLock);
+  metricData[id].count++;
+  portEXIT_CRITICAL(&metricLock);
+}
+
+void metricSet(METRIC_ID id, int32_t value)
+{
+  if ((id < 0) || (id >= NR_METRICS))
+    return;
+  portENTER_CRITICAL(&metricLock);
+  metricData[id].value = value;
+  portEXIT_CRITICAL(&metricLock);
+}
+
+void metricAdd(METRIC_ID id, int32_t delta)
+{
+  if ((id < 0) || (id >= NR_METRICS))
+    return;
+  portENTER_CRITICAL(&metricLock);
+  metricData[id].value += delta;
+  portEXIT_CRITICAL(&metricLock);
+}
+
+extern "C" void metricI2cTransaction(int64_t start, bool ok)
+{
+  metricObserveSince(METRIC_I2C, start);
+  if (!ok)
+    metricInc(METRIC_I2C_ERRORS);
+}
+
+const char *metricName(METRIC_ID id)
+{
+  if ((id < 0) || (id >= NR_METRICS))
+    return "?";
+  return metricDesc[id].name;
+}
+
+static void metric_snapshot(METRIC_ID id, METRIC_DATA *data)
+{
+  portENTER_CRITICAL(&metricLock);
+  *data = metricData[id];
+  portEXIT_CRITICAL(&metricLock);
+}
+
+//
+// Estimate the q-quantile (0-1) of a histogram by finding the bucket it
+// falls in and interpolating linearly between the bucket's bounds. The
+// result never exceeds the largest value actually seen.
+//
+static uint32_t metric_quantile(const METRIC_DATA *data, float q)
+{
+  float rank = q * data->count;
+  uint32_t seen = 0;
+
+  if (data->count == 0)
+    return 0;
+
+  for (int b = 0; b < METRIC_BUCKETS; b++)
+  {
+    if ((data->buckets[b] == 0) || (seen + data->buckets[b] < rank))
+    {
+      seen += data->buckets[b];
+      continue;
+    }
+    uint32_t lower = (b == 0) ? 0 : metricBounds[b - 1];
+    uint32_t upper = (b == METRIC_BUCKETS - 1) ? data->max : metricBounds[b];
+    uint32_t value = lower + (uint32_t)((upper - lower) * ((rank - seen) / data->buckets[b]));
+
+    return (value > data->max) ? data->max : value;
+  }
+  return data->max;
+}
+
+void metricGetSummary(METRIC_ID id, METRIC_SUMMARY *summary)
+{
+  METRIC_DATA data;
+
+  memset(summary, 0, sizeof(*summary));
+  if ((id < 0) || (id >= NR_METRICS))
+    return;
+
+  metric_snapshot(id, &data);
+  summary->count = data.count;
+  summary->value = data.value;
+  if (data.count > 0)
+    summary->avg = (uint32_t)(data.sum / data.count);
+  summary->p50 = metric_quantile(&data, 0.50);
+  summary->p90 = metric_quantile(&data, 0.90);
+  summary->p99 = metric_quantile(&data, 0.99);
+  summary->max = data.max;
+}
+
+#if configUSE_TRACE_FACILITY
+static int metric_task_compare(const void *a, const void *b)
+{
+  return (int)((const TaskStatus_t *)a)->usStackHighWaterMark - (int)((const TaskStatus_t *)b)->usStackHighWaterMark;
+}
+#endif
+
+//
+// Fill 'tasks' with the free stack of up to 'max' tasks, the ones closest
+// to overflowing first. Returns the number filled in, or 0 if the kernel
+// was built without the trace facility.
+//
+int metricsGetTasks(METRIC_TASK *tasks, int max)
+{
+#if configUSE_TRACE_FACILITY
+  UBaseType_t count = uxTaskGetNumberOfTasks() + 2;     // Room for tasks created meanwhile
+  TaskStatus_t *status = (TaskStatus_t *)malloc(count * sizeof(TaskStatus_t));
+  int n = 0;
+
+  if (status == NULL)
+  {
+    ESP_LOGE(TAG, "No memory for the task list");
+    OperatingParameters.Errors.systemErrors++;
+    return 0;
+  }
+
+  count = uxTaskGetSystemState(status, count, NULL);
+  qsort(status, count, sizeof(TaskStatus_t), metric_task_compare);
+  for (UBaseType_t i = 0; (i < count) && (n < max); i++, n++)
+  {
+    strlcpy(tasks[n].name, status[i].pcTaskName, sizeof(tasks[n].name));
+    tasks[n].stackFree = status[i].usStackHighWaterMark;
+    tasks[n].priority = status[i].uxCurrentPriority;
+  }
+  free(status);
+  return n;
+#else
+  return 0;
+#endif
+}
+
+//
+// Prometheus label values may not contain '"', '\' or newlines; task
+// names come from all over, so replace anything odd.
+//
+static void metric_label(char *dst, const char *src, size_t len)
+{
+  size_t i;
+
+  for (i = 0; (i < len - 1) && (src[i] != '\0'); i++)
+    dst[i] = ((src[i] == '"') || (src[i] == '\\') || (src[i] < ' ')) ? '_' : src[i];
+  dst[i] = '\0';
+}
+
+//
+// CPU usage from the task profiler (profiler.cpp), as of its last sample
+//
+static void metrics_write_profile(METRICS_OUTPUT output, void *ctx)
+{
+  PROFILE_TASK *tasks = (PROFILE_TASK *)malloc(METRIC_MAX_TASKS * sizeof(PROFILE_TASK));
+  int n = (tasks == NULL) ? 0 : profilerGetTasks(tasks, METRIC_MAX_TASKS);
+  PROFILE_LOAD load;
+  char line[160];
+
+  profilerGetLoad(&load);
+  if ((n == 0) || (load.valid == 0))
+  {
+    free(tasks);
+    return;
+  }
+
+  output(ctx, "# HELP " METRIC_PREFIX "cpu_load_percent Busy time per core over the last profiler interval\n"
+              "# TYPE " METRIC_PREFIX "cpu_load_percent gauge\n");
+  for (int core = 0; core < portNUM_PROCESSORS; core++)
+  {
+    snprintf(line, sizeof(line), METRIC_PREFIX "cpu_load_percent{core=\"%d\"} %.1f\n", core, load.busy[core][0] / 10.0);
+    output(ctx, line);
+  }
+
+  output(ctx, "# HELP " METRIC_PREFIX "task_cpu_percent Share of one core per task over the last profiler interval\n"
+              "# TYPE " METRIC_PREFIX "task_cpu_percent gauge\n");
+  for (int i = 0; i < n; i++)
+  {
+    char name[sizeof(tasks[i].name)];
+
+    metric_label(name, tasks[i].name, sizeof(name));
+    snprintf(line, sizeof(line), METRIC_PREFIX "task_cpu_percent{task=\"%s\"} %.1f\n", name, tasks[i].cpu[0] / 10.0);
+    output(ctx, line);
+  }
+
+  output(ctx, "# HELP " METRIC_PREFIX "task_cpu_seconds_total CPU time per task since the profiler first saw it\n"
+              "# TYPE " METRIC_PREFIX "task_cpu_seconds_total counter\n");
+  for (int i = 0; i < n; i++)
+  {
+    char name[sizeof(tasks[i].name)];
+
+    metric_label(name, tasks[i].name, sizeof(name));
+    snprintf(line, sizeof(line), METRIC_PREFIX "task_cpu_seconds_total{task=\"%s\"} %.3f\n", name, tasks[i].runTimeUs / 1e6);
+    output(ctx, line);
+  }
+  free(tasks);
+}
+
+//
+// Wifi time per power save mode and the radio on time estimated from it
+// (wifi.cpp)
+//
+static void metrics_write_wifi_power(METRICS_OUTPUT output, void *ctx)
+{
+  WIFI_POWER_STATS stats;
+  char line[160];
+
+  WifiGetPowerStats(&stats);
+  snprintf(line, sizeof(line), "# HELP " METRIC_PREFIX "wifi_power_save Configured power save mode\n"
+           "# TYPE " METRIC_PREFIX "wifi_power_save gauge\n"
+           METRIC_PREFIX "wifi_power_save{mode=\"%s\",active=\"%s\"} 1\n",
+           wifiPowerModeToString(stats.mode), wifiPowerModeToString(stats.active));
+  output(ctx, line);
+
+  output(ctx, "# HELP " METRIC_PREFIX "wifi_seconds_total Time with wifi started per power save mode in effect, or down\n"
+              "# TYPE " METRIC_PREFIX "wifi_seconds_total counter\n");
+  for (int m = 0; m < NR_WIFI_POWER_MODES; m++)
+  {
+    snprintf(line, sizeof(line), METRIC_PREFIX "wifi_seconds_total{mode=\"%s\"} %.3f\n",
+             wifiPowerModeToString((WIFI_POWER_MODE)m), stats.connectedMs[m] / 1e3);
+    output(ctx, line);
+  }
+  snprintf(line, sizeof(line), METRIC_PREFIX "wifi_seconds_total{mode=\"down\"} %.3f\n", stats.downMs / 1e3);
+  output(ctx, line);
+
+  snprintf(line, sizeof(line), "# HELP " METRIC_PREFIX "wifi_radio_on_seconds_total Radio on time estimated from the power save modes\n"
+           "# TYPE " METRIC_PREFIX "wifi_radio_on_seconds_total counter\n"
+           METRIC_PREFIX "wifi_radio_on_seconds_total %.3f\n", stats.radioOnMs / 1e3);
+  output(ctx, line);
+  snprintf(line, sizeof(line), "# HELP " METRIC_PREFIX "wifi_power_boosts_total Times web or telnet use lifted max power save\n"
+           "# TYPE " METRIC_PREFIX "wifi_power_boosts_total counter\n"
+           METRIC_PREFIX "wifi_power_boosts_total %lu\n", (unsigned long)stats.boosts);
+  output(ctx, line);
+}
+
+static void metrics_write_prometheus(METRICS_OUTPUT output, void *ctx)
+{
+  static const char *types[] = {"histogram", "counter", "gauge"};
+  char line[160];
+
+  for (int id = 0; id < NR_METRICS; id++)
+  {
+    const METRIC_DESC *desc = &metricDesc[id];
+    const char *suffix = (desc->type == METRIC_HISTOGRAM) ? "_seconds" :
+                         (desc->type == METRIC_COUNTER) ? "_total" : "";
+    METRIC_DATA data;
+
+    metric_snapshot((METRIC_ID)id, &data);
+    snprintf(line, sizeof(line), "# HELP " METRIC_PREFIX "%s%s %s\n# TYPE " METRIC_PREFIX "%s%s %s\n",
+             desc->name, suffix, desc->help, desc->name, suffix, types[desc->type]);
+    output(ctx, line);
+
+    if (desc->type == METRIC_COUNTER)
+    {
+      snprintf(line, sizeof(line), METRIC_PREFIX "%s_total %lu\n", desc->name, (unsigned long)data.count);
+      output(ctx, line);
+      continue;
+    }
+    if (desc->type == METRIC_GAUGE)
+    {
+      snprintf(line, sizeof(line), METRIC_PREFIX "%s %ld\n", desc->name, (long)data.value);
+      output(ctx, line);
+      continue;
+    }
+
+    // Prometheus buckets are cumulative
+    uint32_t cumulative = 0;
+    for (int b = 0; b < METRIC_BUCKETS; b++)
+    {
+      cumulative += data.buckets[b];
+      if (b < METRIC_BUCKETS - 1)
+        snprintf(line, sizeof(line), METRIC_PREFIX "%s_seconds_bucket{le=\"%g\"} %lu\n",
+                 desc->name, metricBounds[b] / 1e6, (unsigned long)cumulative);
+      else
+        snprintf(line, sizeof(line), METRIC_PREFIX "%s_seconds_bucket{le=\"+Inf\"} %lu\n",
+                 desc->name, (unsigned long)cumulative);
+      output(ctx, line);
+    }
+    snprintf(line, sizeof(line), METRIC_PREFIX "%s_seconds_sum %.6f\n" METRIC_PREFIX "%s_seconds_count %lu\n",
+             desc->name, data.sum / 1e6, desc->name, (unsigned long)data.count);
+    output(ctx, line);
+  }
+
+  for (int g = 0; g < NR_HEAP_GAUGES; g++)
+  {
+    snprintf(line, sizeof(line), "# HELP " METRIC_PREFIX "%s %s\n# TYPE " METRIC_PREFIX "%s gauge\n",
+             heapGauges[g].name, heapGauges[g].help, heapGauges[g].name);
+    output(ctx, line);
+    for (int i = 0; i < NR_METRIC_HEAPS; i++)
+    {
+      if (heap_caps_get_total_size(metricHeaps[i].caps) == 0)
+        continue;
+      snprintf(line, sizeof(line), METRIC_PREFIX "%s{caps=\"%s\"} %u\n", heapGauges[g].name,
+               metricHeaps[i].name, (unsigned)heapGauges[g].get(metricHeaps[i].caps));
+      output(ctx, line);
+    }
+  }
+
+  metrics_write_profile(output, ctx);
+  metrics_write_wifi_power(output, ctx);
+  actionsWrite(true, output, ctx);
+
+  METRIC_TASK *tasks = (METRIC_TASK *)malloc(METRIC_MAX_TASKS * sizeof(METRIC_TASK));
+  int n = (tasks == NULL) ? 0 : metricsGetTasks(tasks, METRIC_MAX_TASKS);
+
+  if (n == 0)
+  {
+    free(tasks);
+    return;
+  }
+  output(ctx, "# HELP " METRIC_PREFIX "task_stack_free_bytes Task stack never used since the task started\n"
+              "# TYPE " METRIC_PREFIX "task_stack_free_bytes gauge\n");
+  for (int i = 0; i < n; i++)
+  {
+    char name[sizeof(tasks[i].name)];
+
+    metric_label(name, tasks[i].name, sizeof(name));
+    snprintf(line, sizeof(line), METRIC_PREFIX "task_stack_free_bytes{task=\"%s\"} %lu\n",
+             name, (unsigned long)tasks[i].stackFree);
+    output(ctx, line);
+  }
+  free(tasks);
+}
+
+static void metrics_write_text(METRICS_OUTPUT output, void *ctx)
+{
+  char line[128];
+
+  output(ctx, "Timing (us)          count      avg      p50      p90      p99      max\n");
+  for (int id = 0; id < NR_METRICS; id++)
+  {
+    METRIC_SUMMARY s;
+
+    if (metricDesc[id].type != METRIC_HISTOGRAM)
+      continue;
+    metricGetSummary((METRIC_ID)id, &s);
+    snprintf(line, sizeof(line), "%-16s %9lu %8lu %8lu %8lu %8lu %8lu\n", metricDesc[id].name,
+             (unsigned long)s.count, (unsigned long)s.avg, (unsigned long)s.p50,
+             (unsigned long)s.p90, (unsigned long)s.p99, (unsigned long)s.max);
+    output(ctx, line);
+  }
+
+  output(ctx, "\n");
+  for (int id = 0; id < NR_METRICS; id++)
+  {
+    METRIC_SUMMARY s;
+
+    if (metricDesc[id].type == METRIC_HISTOGRAM)
+      continue;
+    metricGetSummary((METRIC_ID)id, &s);
+    snprintf(line, sizeof(line), "%-20s %ld\n", metricDesc[id].name,
+             (metricDesc[id].type == METRIC_GAUGE) ? (long)s.value : (long)s.count);
+    output(ctx, line);
+  }
+  actionsWrite(false, output, ctx);
+
+  output(ctx, "\nHeap (bytes)         free  min free  largest\n");
+  for (int i = 0; i < NR_METRIC_HEAPS; i++)
+  {
+    if (heap_caps_get_total_size(metricHeaps[i].caps) == 0)
+      continue;
+    snprintf(line, sizeof(line), "%-16s %8u %9u %8u\n", metricHeaps[i].name,
+             (unsigned)heap_caps_get_free_size(metricHeaps[i].caps),
+             (unsigned)heap_caps_get_minimum_free_size(metricHeaps[i].caps),
+             (unsigned)heap_caps_get_largest_free_block(metricHeaps[i].caps));
+    output(ctx, line);
+  }
+
+  WIFI_POWER_STATS power;
+  uint64_t wifiMs = 0;
+
+  WifiGetPowerStats(&power);
+  for (int m = 0; m < NR_WIFI_POWER_MODES; m++)
+    wifiMs += power.connectedMs[m];
+  wifiMs += power.downMs;
+  snprintf(line, sizeof(line), "\nWifi power save %s (%s in effect), radio on ~%.1f%%\n",
+           wifiPowerModeToString(power.mode), wifiPowerModeToString(power.active),
+           (wifiMs == 0) ? 0.0 : power.radioOnMs * 100.0 / wifiMs);
+  output(ctx, line);
+
+  METRIC_TASK *tasks = (METRIC_TASK *)malloc(METRIC_MAX_TASKS * sizeof(METRIC_TASK));
+  int n = (tasks == NULL) ? 0 : metricsGetTasks(tasks, METRIC_MAX_TASKS);
+
+  if (n == 0)
+  {
+    output(ctx, "\nTask stacks unavailable\n");
+    free(tasks);
+    return;
+  }
+  output(ctx, "\nTask             stack free  prio\n");
+  for (int i = 0; i < n; i++)
+  {
+    snprintf(line, sizeof(line), "%-16s %10lu %5u\n", tasks[i].name,
+             (unsigned long)tasks[i].stackFree, (unsigned)tasks[i].priority);
+    output(ctx, line);
+  }
+  free(tasks);
+}
+
+//
+// Write every metric, a line (or a few) per call of 'output'.
+//
+void metricsWrite(bool prometheus, METRICS_OUTPUT output, void *ctx)
+{
+  if (prometheus)
+    metrics_write_prometheus(output, ctx);
+  else
+    metrics_write_text(output, ctx);
+}
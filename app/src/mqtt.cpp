@@ -24,12 +24,15 @@
 
 #include <string> // for string class
 #include "thermostat.hpp"
+#include "binlog.hpp"
 #include "version.h"
 #include <stdint.h>
 #include <stddef.h>
 #include "freertos/semphr.h"
 #include "freertos/queue.h"
 #include "mqtt_client.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
 #include <ArduinoJson.h>
 
 static const char *TAG = "MQTT";
@@ -42,6 +45,12 @@ std::string         g_deviceName;                             // Device Name
 std::string         g_friendlyName;
 std::string         g_mqttStatusTopic;                        // MQTT Topic
 std::string         g_mqttSensorStatusTopic;
+std::string         g_mqttRuntimeTopic;
+std::string         g_mqttScheduleTopic;
+std::string         g_mqttOccupancyTopic;
+std::string         g_mqttLogTopic;
+std::string         g_mqttDiagnosticsTopic;
+std::string         g_mqttAlertTopic;
 
 void MqttSubscribeTopic(esp_mqtt_client_handle_t client, std::string topic);
 
@@ -65,9 +74,96 @@ void MqttSubscribeTopic(esp_mqtt_client_handle_t client, std::string topic);
 #define MQTT_EVENT_DISCONNECTED_BIT BIT1
 #define MQTT_EVENT_PUB_BIT BIT2
 #define MQTT_ERROR_BIT BIT3
+
+#define MQTT_LOG_INTERVAL   1000      // ms between log publishes
+#define MQTT_LOG_PAYLOAD    1024
+#define MQTT_PUBACK_SLOTS   8         // Publishes timed until their PUBACK
+#define MQTT_PUBACK_EXPIRE  30000000  // us before an unanswered publish is forgotten
+#define MQTT_COMMAND_SIZE   64        // Schedule and radar commands, as the web UI takes them
 static EventGroupHandle_t s_mqtt_event_group = NULL;
 const TickType_t xTicksToWait = 11000 / portTICK_PERIOD_MS;
 
+//
+// Publishes waiting for their PUBACK, for the mqtt_puback metric. An ack
+// that arrives before MqttPublish() got to note its msg_id just isn't
+// timed; entries that never get an answer expire.
+//
+static struct
+{
+  int msgId;                  // 0 = free
+  int64_t sent;
+} pubacks[MQTT_PUBACK_SLOTS];
+static portMUX_TYPE pubackLock = portMUX_INITIALIZER_UNLOCKED;
+
+static void puback_update_gauge()
+{
+  int inflight = 0;
+
+  for (int i = 0; i < MQTT_PUBACK_SLOTS; i++)
+    if (pubacks[i].msgId != 0)
+      inflight++;
+  metricSet(METRIC_MQTT_INFLIGHT, inflight);
+}
+
+static void puback_sent(int msgId, int64_t sent)
+{
+  int slot = 0;
+
+  portENTER_CRITICAL(&pubackLock);
+  for (int i = 0; i < MQTT_PUBACK_SLOTS; i++)
+  {
+    if ((pubacks[i].msgId != 0) && (sent - pubacks[i].sent > MQTT_PUBACK_EXPIRE))
+      pubacks[i].msgId = 0;
+    // Use a free slot, or failing that the oldest one
+    if ((pubacks[slot].msgId != 0) &&
+        ((pubacks[i].msgId == 0) || (pubacks[i].sent < pubacks[slot].sent)))
+      slot = i;
+  }
+  pubacks[slot].msgId = msgId;
+  pubacks[slot].sent = sent;
+  puback_update_gauge();
+  portEXIT_CRITICAL(&pubackLock);
+}
+
+static void puback_received(int msgId)
+{
+  portENTER_CRITICAL(&pubackLock);
+  for (int i = 0; i < MQTT_PUBACK_SLOTS; i++)
+  {
+    if (pubacks[i].msgId == msgId)
+    {
+      metricObserveSince(METRIC_MQTT_PUBACK, pubacks[i].sent);
+      pubacks[i].msgId = 0;
+      break;
+    }
+  }
+  puback_update_gauge();
+  portEXIT_CRITICAL(&pubackLock);
+}
+
+static void puback_clear()
+{
+  portENTER_CRITICAL(&pubackLock);
+  for (int i = 0; i < MQTT_PUBACK_SLOTS; i++)
+    pubacks[i].msgId = 0;
+  puback_update_gauge();
+  portEXIT_CRITICAL(&pubackLock);
+}
+
+// Terminated copy of a command payload; longer ones are turned away
+static bool mqtt_command(esp_mqtt_event_handle_t event, char *cmd, size_t len)
+{
+  if (event->data_len >= (int)len)
+  {
+    ESP_LOGE(TAG, "Command on %.*s too long (%d bytes)", event->topic_len, event->topic, event->data_len);
+    OperatingParameters.Errors.mqttProtocolErrors++;
+    return false;
+  }
+  memcpy(cmd, event->data, event->data_len);
+  cmd[event->data_len] = '\0';
+  return true;
+}
+
 static void MqttEventHandler(void* handler_args, esp_event_base_t base, int32_t event_id, void* event_data)
 {
 	esp_mqtt_event_handle_t event = (esp_mqtt_event_handle_t)event_data;
@@ -86,6 +182,7 @@ static void MqttEventHandler(void* handler_args, esp_event_base_t base, int32_t
     case MQTT_EVENT_DISCONNECTED:
       ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
       OperatingParameters.MqttConnected = false;
+      puback_clear();
       xEventGroupSetBits(s_mqtt_event_group, MQTT_EVENT_DISCONNECTED_BIT);
 #ifdef TELNET_ENABLED
 //@@@
@@ -100,6 +197,7 @@ static void MqttEventHandler(void* handler_args, esp_event_base_t base, int32_t
       break;
     case MQTT_EVENT_PUBLISHED:
       ESP_LOGD(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+      puback_received(event->msg_id);
       // xEventGroupSetBits(s_mqtt_event_group, MQTT_EVENT_PUB_BIT); //@@@ Can this be removed?
       break;
     case MQTT_EVENT_ERROR:
@@ -122,7 +220,7 @@ static void MqttEventHandler(void* handler_args, esp_event_base_t base, int32_t
         HVAC_MODE mode = strToHvacMode(m);
         if (mode == ERROR)
           ESP_LOGW(TAG, "Mode %s invalid", m);
-        else
+        else if (!actionRun(actionForMode(mode), ACTION_SRC_MQTT))
           updateHvacMode (mode);
       }
       else if (strnstr(event->topic, "/set/temp", event->topic_len) != NULL)
@@ -137,6 +235,32 @@ static void MqttEventHandler(void* handler_args, esp_event_base_t base, int32_t
           OperatingParameters.Errors.mqttProtocolErrors++;
         }
       }
+      else if (strnstr(event->topic, "/set/schedule", event->topic_len) != NULL)
+      {
+        static char reply[1200];
+        char cmd[MQTT_COMMAND_SIZE];
+        if (mqtt_command(event, cmd, sizeof(cmd)) && !scheduleCommand(cmd, reply, sizeof(reply)))
+        {
+          ESP_LOGE(TAG, "Schedule command \"%s\" rejected: %s", cmd, reply);
+          OperatingParameters.Errors.mqttProtocolErrors++;
+        }
+      }
+      else if (strnstr(event->topic, "/set/radar", event->topic_len) != NULL)
+      {
+        static char reply[1200];
+        char cmd[MQTT_COMMAND_SIZE];
+        if (mqtt_command(event, cmd, sizeof(cmd)) && !radarCommand(cmd, reply, sizeof(reply)))
+        {
+          ESP_LOGE(TAG, "Radar command \"%s\" rejected: %s", cmd, reply);
+          OperatingParameters.Errors.mqttProtocolErrors++;
+        }
+      }
+      else if (strnstr(event->topic, "/set/action", event->topic_len) != NULL)
+      {
+        // Same names as the web UI buttons, less the System Info ones
+        if (!actionDispatch(event->data, event->data_len, ACTION_SRC_MQTT))
+          OperatingParameters.Errors.mqttProtocolErrors++;
+      }
       else if (strnstr(event->topic, "fan", event->topic_len) != NULL)
       {
         // if (strlen(event->data) > 0)
@@ -144,13 +268,13 @@ static void MqttEventHandler(void* handler_args, esp_event_base_t base, int32_t
         {
           if (strncmp("on", event->data, event->data_len) == 0)
           {
-            updateHvacMode (FAN_ONLY);
+            actionRun(ACTION_MODE_FAN, ACTION_SRC_MQTT);
           }
           else
           {
             if (OperatingParameters.hvacOpMode == FAN_ONLY)
             {
-              updateHvacMode (OFF);
+              actionRun(ACTION_MODE_OFF, ACTION_SRC_MQTT);
             }
           }
         }
@@ -167,6 +291,7 @@ static void MqttEventHandler(void* handler_args, esp_event_base_t base, int32_t
 void MqttPublish(const char *topic, const char *payload, bool retain)
 {
   int msg_id;
+  int64_t start;
 
   if (!OperatingParameters.MqttConnected)
   {
@@ -175,8 +300,14 @@ void MqttPublish(const char *topic, const char *payload, bool retain)
     return;
   }
 
+  start = esp_timer_get_time();
   msg_id = esp_mqtt_client_publish(
       (esp_mqtt_client_handle_t)(OperatingParameters.MqttClient), topic, payload, 0, 1, (retain ? 1 : 0));
+  metricObserveSince(METRIC_MQTT_PUBLISH, start);
+  if (msg_id < 0)
+    metricInc(METRIC_MQTT_PUBLISH_ERRORS);
+  else if (msg_id > 0)
+    puback_sent(msg_id, start);
   ESP_LOGV(TAG, "Sent MQTT publish -- msg_id=%d", msg_id);
   xEventGroupSetBits(s_mqtt_event_group, MQTT_EVENT_PUB_BIT);
 }
@@ -219,7 +350,9 @@ void MqttUpdateStatusTopic()
 
     std::string strPayload;
     serializeJson(payload, strPayload);
-    ESP_LOGI (TAG, "%s", strPayload.c_str());
+    // The payload doesn't fit a binlog record; its text is only for debugging
+    BLOGI(TAG, "Status: %d bytes to %s", (int)strPayload.size(), g_mqttStatusTopic.c_str());
+    ESP_LOGD(TAG, "%s", strPayload.c_str());
 
     std::string topic;
     topic = g_mqttStatusTopic;
@@ -233,6 +366,236 @@ void MqttMotionUpdate(bool state)
   MqttPublish(g_mqttSensorStatusTopic.c_str(), (state == true) ? "ON" : "OFF", false);
 }
 
+//
+// Publish the HVAC runtime statistics. Home Assistant picks the individual
+// values out of this JSON payload via the templates sent in MqttRuntimeDiscovery().
+//
+void MqttRuntimeUpdate()
+{
+  if (!OperatingParameters.MqttEnabled || !OperatingParameters.MqttConnected)
+    return;
+
+  JsonDocument payload;
+  HVAC_RUNTIME_STATS stats;
+
+  for (int s = 0; s < NR_HVAC_STAGES; s++)
+  {
+    std::string stage = hvacStageToString((HVAC_STAGE)s);
+    hvacGetRuntimeStats((HVAC_STAGE)s, &stats);
+    payload[stage + "Today"] = stats.todaySeconds / 60;
+    payload[stage + "Cycles"] = stats.todayCycles;
+    payload[stage + "AvgCycle"] = stats.avgCycleSeconds / 60;
+    payload[stage + "DutyHour"] = roundf(stats.dutyHour * 10.0) / 10.0;
+    payload[stage + "DutyDay"] = roundf(stats.dutyDay * 10.0) / 10.0;
+    payload[stage + "Total"] = stats.lifetime.onSeconds / 60;
+  }
+
+  std::string strPayload;
+  serializeJson(payload, strPayload);
+  ESP_LOGD(TAG, "%s", strPayload.c_str());
+  MqttPublish(g_mqttRuntimeTopic.c_str(), strPayload.c_str(), false);
+}
+
+//
+// Publish the performance metrics (see metrics.cpp) for whoever wants to
+// keep an eye on the thermostat's health. Nothing is announced to Home
+// Assistant; the full set is also on the web /metrics page.
+//
+void MqttDiagnosticsUpdate()
+{
+  if (!OperatingParameters.MqttEnabled || !OperatingParameters.MqttConnected)
+    return;
+
+  JsonDocument payload;
+  METRIC_SUMMARY summary;
+
+  for (int id = 0; id < NR_METRICS; id++)
+  {
+    metricGetSummary((METRIC_ID)id, &summary);
+    if (id == METRIC_MQTT_INFLIGHT)
+    {
+      payload[metricName((METRIC_ID)id)] = summary.value;
+    }
+    else if (!METRIC_IS_HISTOGRAM(id))
+    {
+      payload[metricName((METRIC_ID)id)] = summary.count;
+    }
+    else
+    {
+      JsonObject h = payload[metricName((METRIC_ID)id)].to<JsonObject>();
+      h["Count"] = summary.count;
+      h["Avg"] = summary.avg;
+      h["P90"] = summary.p90;
+      h["Max"] = summary.max;
+    }
+  }
+
+  JsonObject heap = payload["heap"].to<JsonObject>();
+  heap["Free"] = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+  heap["MinFree"] = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+  heap["Largest"] = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+
+  WIFI_POWER_STATS power;
+  WifiGetPowerStats(&power);
+  JsonObject wifi = payload["wifiPower"].to<JsonObject>();
+  wifi["Mode"] = wifiPowerModeToString(power.mode);
+  wifi["Active"] = wifiPowerModeToString(power.active);
+  wifi["Boosts"] = power.boosts;
+  wifi["DownSecs"] = power.downMs / 1000;
+  wifi["RadioOnSecs"] = power.radioOnMs / 1000;
+
+  // Only the tasks closest to running out of stack
+  METRIC_TASK tasks[4];
+  int n = metricsGetTasks(tasks, sizeof(tasks) / sizeof(tasks[0]));
+  JsonObject stacks = payload["stackFree"].to<JsonObject>();
+  for (int i = 0; i < n; i++)
+    stacks[tasks[i].name] = tasks[i].stackFree;
+
+  std::string strPayload;
+  serializeJson(payload, strPayload);
+  ESP_LOGD(TAG, "%s", strPayload.c_str());
+  MqttPublish(g_mqttDiagnosticsTopic.c_str(), strPayload.c_str(), false);
+}
+
+//
+// Tell whoever is listening that something needs attention (e.g. the heap
+// monitor has seen a leak). Not retained; an alert is only news once.
+//
+void MqttAlert(const char *alert, const char *detail)
+{
+  if (!OperatingParameters.MqttEnabled || !OperatingParameters.MqttConnected)
+    return;
+
+  JsonDocument payload;
+  payload["Alert"] = alert;
+  payload["Detail"] = detail;
+
+  std::string strPayload;
+  serializeJson(payload, strPayload);
+  ESP_LOGW(TAG, "Alert: %s", strPayload.c_str());
+  MqttPublish(g_mqttAlertTopic.c_str(), strPayload.c_str(), false);
+}
+
+//
+// Publish the schedule state. "Text" carries the same listing shown by
+// telnet and the web UI so it can be displayed as-is.
+//
+void MqttScheduleUpdate()
+{
+  if (!OperatingParameters.MqttEnabled || !OperatingParameters.MqttConnected)
+    return;
+
+  static char listing[1200];
+  JsonDocument payload;
+  std::string state = scheduleStateToString(scheduleGetState());
+
+  makeLower(state.c_str());
+  payload["State"] = state;
+  payload["NextChange"] = scheduleSecondsToNext() / 60;
+  payload["Setpoint"] = OperatingParameters.tempSet;
+  scheduleFormat(listing, sizeof(listing));
+  payload["Text"] = listing;
+
+  std::string strPayload;
+  serializeJson(payload, strPayload);
+  ESP_LOGD(TAG, "%s", strPayload.c_str());
+  MqttPublish(g_mqttScheduleTopic.c_str(), strPayload.c_str(), true);
+}
+
+//
+// Publish the radar based occupancy and the distance to the closest target
+//
+void MqttOccupancyUpdate()
+{
+  if (!OperatingParameters.MqttEnabled || !OperatingParameters.MqttConnected)
+    return;
+
+  JsonDocument payload;
+
+  payload["Occupancy"] = OperatingParameters.occupied ? "ON" : "OFF";
+  payload["Distance"] = OperatingParameters.targetDistance;
+
+  std::string strPayload;
+  serializeJson(payload, strPayload);
+  ESP_LOGD(TAG, "%s", strPayload.c_str());
+  MqttPublish(g_mqttOccupancyTopic.c_str(), strPayload.c_str(), false);
+}
+
+//
+// Forward warnings and errors from the log ring to <device>/log, batched
+// into one message a second. This runs in its own task and only queues
+// the message in the MQTT outbox, so a slow broker can't hold up logging.
+//
+static void mqtt_strip_colors(char *line)
+{
+  char *out = line;
+
+  for (char *in = line; *in; in++)
+  {
+    if (*in == '\033')
+    {
+      while (*in && (*in != 'm'))
+        in++;
+      if (!*in)
+        break;
+      continue;
+    }
+    *out++ = *in;
+  }
+  *out = '\0';
+}
+
+static void MqttLogTask(void *parameter)
+{
+  static char payload[MQTT_LOG_PAYLOAD];
+  char line[LOG_LINE_MAX];
+  char level;
+  LOG_CURSOR cursor;
+  size_t used;
+  int n;
+
+  // Include the warnings logged since boot that are still in the ring
+  logCursorInit(&cursor, UINT32_MAX);
+  for (;;)
+  {
+    vTaskDelay(pdMS_TO_TICKS(MQTT_LOG_INTERVAL));
+    if (!OperatingParameters.MqttConnected)
+      continue;
+
+    used = 0;
+    if (cursor.dropped)
+    {
+      used = snprintf(payload, sizeof(payload), "[%lu log lines dropped]\n", cursor.dropped);
+      cursor.dropped = 0;
+    }
+    while ((sizeof(payload) - used > sizeof(line)) &&
+           ((n = logRead(&cursor, line, sizeof(line), &level)) > 0))
+    {
+      if ((level != 'E') && (level != 'W'))
+        continue;
+      mqtt_strip_colors(line);
+      n = strlen(line);
+      memcpy(payload + used, line, n);
+      used += n;
+    }
+    if (used == 0)
+      continue;
+
+    esp_mqtt_client_enqueue((esp_mqtt_client_handle_t)(OperatingParameters.MqttClient),
+                            g_mqttLogTopic.c_str(), payload, used, 0, 0, true);
+  }
+}
+
+// The web UI for the discovery "cu": by name, so it survives a new DHCP lease
+static std::string mqtt_config_url()
+{
+  char host[MDNS_HOSTNAME_MAX + 1];
+
+  if (mdnsGetHostname(host, sizeof(host)))
+    return std::string("http://") + host + ".local";
+  return std::string("http://") + WifiAddress();
+}
+
 void MqttHomeAssistantStatDiscovery()
 {
   // CustomWriter writer;
@@ -315,14 +678,14 @@ void MqttHomeAssistantStatDiscovery()
     payload["device"]["mdl"] = g_deviceModel;
     payload["device"]["sw"] = g_swVersion;
     payload["device"]["mf"] = g_manufacturer;
-    std::string ip = WifiAddress();
-    payload["device"]["cu"] = "http://" + ip;     //@@@ Must be updated if dhcp address changes
+    payload["device"]["cu"] = mqtt_config_url();
 
     payload["device"]["identifiers"] = mac;
 
     // serializeJsonPretty(payload, writer);
     serializeJson(payload, strPayload);
-    ESP_LOGI (TAG, "MQTT Payload: %s", strPayload.c_str());
+    BLOGI(TAG, "Discovery: %d bytes to %s", (int)strPayload.size(), discoveryTopic.c_str());
+    ESP_LOGD(TAG, "MQTT Payload: %s", strPayload.c_str());
 
     xEventGroupClearBits (s_mqtt_event_group, MQTT_EVENT_PUB_BIT | MQTT_ERROR_BIT);
 
@@ -343,9 +706,12 @@ void MqttHomeAssistantStatDiscovery()
 }
 
 // Public API to resend MQTT discovery (like when enabled modes change)
+void MqttRuntimeDiscovery();
+
 void updateEnabledHvacModes()
 {
   MqttHomeAssistantStatDiscovery();
+  MqttRuntimeDiscovery();
 }
 
 void MqttSensorDiscovery()
@@ -387,13 +753,13 @@ void MqttSensorDiscovery()
   sensorPayload["device"]["mdl"] = "Thermostat Motion Sensor";
   sensorPayload["device"]["sw"] = g_swVersion;
   sensorPayload["device"]["mf"] = g_manufacturer;
-  std::string ip = WifiAddress();
-  sensorPayload["device"]["cu"] = "http://" + ip;     //@@@ Must be updated if dhcp address changes
+  sensorPayload["device"]["cu"] = mqtt_config_url();
   sensorPayload["device"]["identifiers"] = mac;
 
   // serializeJsonPretty(sensorPayload, writer);
   serializeJson(sensorPayload, strPayload);
-  ESP_LOGI (TAG, "Sensor Payload: %s", strPayload.c_str());
+  BLOGI(TAG, "Discovery: %d bytes to %s", (int)strPayload.size(), discoveryTopic.c_str());
+  ESP_LOGD(TAG, "Sensor Payload: %s", strPayload.c_str());
 
   xEventGroupClearBits (s_mqtt_event_group, MQTT_EVENT_PUB_BIT | MQTT_ERROR_BIT);
 
@@ -415,6 +781,121 @@ void MqttSensorDiscovery()
   MqttMotionUpdate(false);
 }
 
+//
+// Send the discovery packet for a single Home Assistant entity (component is
+// "sensor", "binary_sensor", ...) that belongs to the thermostat device
+// (same identifiers as the climate entity).
+//
+void MqttEntityDiscovery(const char *component, const char *objectId, const char *name,
+                         const std::string &stateTopic, const char *valueTemplate, const char *unit,
+                         const char *deviceClass, const char *stateClass)
+{
+  static char mac[24];
+  std::string discoveryTopic;
+  std::string strPayload;
+  JsonDocument payload;
+
+  snprintf (mac, sizeof(mac), "%02x%02x%02x%02x%02x%02x",
+      OperatingParameters.mac[0],
+      OperatingParameters.mac[1],
+      OperatingParameters.mac[2],
+      OperatingParameters.mac[3],
+      OperatingParameters.mac[4],
+      OperatingParameters.mac[5]);
+
+  discoveryTopic = "homeassistant/" + std::string(component) + "/" + g_deviceName + "/" + objectId + "/config";
+
+  payload["name"] = name;
+  payload["uniq_id"] = std::string(mac) + "_" + objectId;
+  payload["stat_t"] = stateTopic;
+  payload["val_tpl"] = valueTemplate;
+  if (unit)
+    payload["unit_of_meas"] = unit;
+  if (deviceClass)
+    payload["dev_cla"] = deviceClass;
+  if (stateClass)
+    payload["stat_cla"] = stateClass;
+  payload["device"]["identifiers"] = mac;
+
+  serializeJson(payload, strPayload);
+  BLOGI(TAG, "Discovery: %d bytes to %s", (int)strPayload.size(), discoveryTopic.c_str());
+  ESP_LOGD(TAG, "Sensor Payload: %s", strPayload.c_str());
+
+  xEventGroupClearBits (s_mqtt_event_group, MQTT_EVENT_PUB_BIT | MQTT_ERROR_BIT);
+
+  MqttPublish(discoveryTopic.c_str(), strPayload.c_str(), true);
+
+  EventBits_t bits = xEventGroupWaitBits(s_mqtt_event_group,
+      MQTT_EVENT_PUB_BIT | MQTT_ERROR_BIT,
+      pdFALSE,
+      pdFALSE,
+      xTicksToWait);
+
+  if (bits & MQTT_ERROR_BIT)
+  {
+    ESP_LOGE(TAG, "Sensor %s Publish failed", objectId);
+    OperatingParameters.Errors.mqttProtocolErrors++;
+  }
+}
+
+void MqttSensorEntityDiscovery(const char *objectId, const char *name, const std::string &stateTopic,
+                               const char *valueTemplate, const char *unit,
+                               const char *deviceClass, const char *stateClass)
+{
+  MqttEntityDiscovery("sensor", objectId, name, stateTopic, valueTemplate, unit, deviceClass, stateClass);
+}
+
+void MqttRuntimeDiscovery()
+{
+  if (!OperatingParameters.MqttEnabled || !OperatingParameters.MqttConnected)
+  {
+    ESP_LOGE(TAG, "RuntimeDiscovery: MQTT not enabled or not connected!");
+    OperatingParameters.Errors.mqttConnectErrors++;
+    return;
+  }
+
+  ESP_LOGI(TAG, "Send Home Assistant Runtime Discovery...");
+
+  for (int s = 0; s < NR_HVAC_STAGES; s++)
+  {
+    if ((s == STAGE_COOL) && !OperatingParameters.hvacCoolEnable)
+      continue;
+    if ((s == STAGE_FAN) && !OperatingParameters.hvacFanEnable)
+      continue;
+
+    std::string stage = hvacStageToString((HVAC_STAGE)s);
+    std::string id, name, tpl;
+
+    id = stage + "_runtime_today"; makeLower(id.c_str());
+    name = stage + " runtime today";
+    tpl = "{{ value_json." + stage + "Today }}";
+    MqttSensorEntityDiscovery(id.c_str(), name.c_str(), g_mqttRuntimeTopic, tpl.c_str(), "min", "duration", "total_increasing");
+
+    id = stage + "_cycles_today"; makeLower(id.c_str());
+    name = stage + " cycles today";
+    tpl = "{{ value_json." + stage + "Cycles }}";
+    MqttSensorEntityDiscovery(id.c_str(), name.c_str(), g_mqttRuntimeTopic, tpl.c_str(), NULL, NULL, "total_increasing");
+
+    id = stage + "_avg_cycle"; makeLower(id.c_str());
+    name = stage + " average cycle";
+    tpl = "{{ value_json." + stage + "AvgCycle }}";
+    MqttSensorEntityDiscovery(id.c_str(), name.c_str(), g_mqttRuntimeTopic, tpl.c_str(), "min", "duration", "measurement");
+
+    id = stage + "_duty_hour"; makeLower(id.c_str());
+    name = stage + " duty cycle (hour)";
+    tpl = "{{ value_json." + stage + "DutyHour }}";
+    MqttSensorEntityDiscovery(id.c_str(), name.c_str(), g_mqttRuntimeTopic, tpl.c_str(), "%", NULL, "measurement");
+
+    id = stage + "_duty_day"; makeLower(id.c_str());
+    name = stage + " duty cycle (day)";
+    tpl = "{{ value_json." + stage + "DutyDay }}";
+    MqttSensorEntityDiscovery(id.c_str(), name.c_str(), g_mqttRuntimeTopic, tpl.c_str(), "%", NULL, "measurement");
+  }
+
+  // Send the current values right away
+  MqttRuntimeUpdate();
+}
+
 void MqttHomeAssistantDiscovery()
 {
   ESP_LOGI(TAG, "Sending thermostat discovery packet");
@@ -422,6 +903,20 @@ void MqttHomeAssistantDiscovery()
 
   ESP_LOGI(TAG, "Sending sensor discovery packet");
   MqttSensorDiscovery();
+
+  ESP_LOGI(TAG, "Sending runtime discovery packets");
+  MqttRuntimeDiscovery();
+
+  ESP_LOGI(TAG, "Sending occupancy discovery packets");
+  MqttEntityDiscovery("binary_sensor", "occupancy", "Occupancy", g_mqttOccupancyTopic,
+                      "{{ value_json.Occupancy }}", NULL, "occupancy", NULL);
+  MqttSensorEntityDiscovery("target_distance", "Target distance", g_mqttOccupancyTopic,
+                            "{{ value_json.Distance }}", "cm", "distance", "measurement");
+  MqttOccupancyUpdate();
+
+  ESP_LOGI(TAG, "Sending schedule discovery packet");
+  MqttSensorEntityDiscovery("schedule_state", "Schedule", g_mqttScheduleTopic, "{{ value_json.State }}", NULL, NULL, NULL);
+  MqttScheduleUpdate();
 }
 
 
@@ -465,6 +960,10 @@ bool MqttConnect(void)
   // Make MQTT subsystem auto reconnect when disconnects happen
   mqtt_cfg.network.disable_auto_reconnect = false;
 
+  // Fewer pings for the radio to wake up for when saving the most power
+  mqtt_cfg.session.keepalive = (OperatingParameters.wifiPowerSave == WIFI_POWER_MAX) ?
+    MQTT_KEEPALIVE_POWER_SAVE : MQTT_KEEPALIVE;
+
   esp_mqtt_client_handle_t client = esp_mqtt_client_init(&mqtt_cfg);
   if (client == NULL)
   {
@@ -548,6 +1047,12 @@ void MqttInit()
     g_friendlyName = OperatingParameters.FriendlyName;
     g_mqttStatusTopic = g_deviceName + "/status";
     g_mqttSensorStatusTopic = g_deviceName + "/motion";
+    g_mqttRuntimeTopic = g_deviceName + "/runtime";
+    g_mqttScheduleTopic = g_deviceName + "/schedule";
+    g_mqttOccupancyTopic = g_deviceName + "/occupancy";
+    g_mqttLogTopic = g_deviceName + "/log";
+    g_mqttDiagnosticsTopic = g_deviceName + "/diagnostics";
+    g_mqttAlertTopic = g_deviceName + "/alert";
     OperatingParameters.MqttConnected = false;
 
     if (OperatingParameters.MqttEnabled == false)
@@ -562,6 +1067,14 @@ void MqttInit()
         ESP_LOGW(TAG, "*** WARNING: Starting MQTT when wifi connection down!! ***");
         OperatingParameters.Errors.mqttConnectErrors++;
     }
+
+    xTaskCreate(
+        MqttLogTask,
+        "MQTT Log",
+        3072,
+        NULL,
+        tskIDLE_PRIORITY,
+        NULL);
 }
 
 #endif  // #ifdef MQTT_ENABLED
@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * occupancy.cpp
+ *
+ * Occupancy model built from the LD2410 presence radar. The radar reports
+ * presence (moving and/or stationary target) and target distance about
+ * once a second. Presence has to be seen for OCCUPANCY_DEBOUNCE consecutive
+ * samples before the room is considered occupied, so a single spurious
+ * reflection doesn't count. The room becomes vacant once no presence has
+ * been reported for OperatingParameters.vacancyTimeout minutes.
+ *
+ * While vacant, the state machine applies OperatingParameters.ecoSetback
+ * (heat to a lower, cool to a higher temperature). A setback of 0 disables
+ * this.
+ *
+ */
+
+#include "thermostat.hpp"
+
+#define OCCUPANCY_DEBOUNCE          (3)       // Consecutive presence samples to become occupied
+#define OCCUPANCY_MAX_DISTANCE      (600)     // cm; targets beyond this are ignored
+#define OCCUPANCY_PUBLISH_INTERVAL  (10000)   // Rate limit for distance-only updates
+#define OCCUPANCY_DISTANCE_DELTA    (25)      // cm change worth publishing
+
+static const char *TAG = "OCCUPANCY";
+
+static int presenceCount = 0;
+static int64_t lastPresence = 0;
+static int64_t lastPublish = 0;
+static uint16_t lastPublishedDistance = 0;
+static bool occupancyKnown = false;
+
+static void occupancy_publish(bool force)
+{
+#ifdef MQTT_ENABLED
+  int delta = (int)OperatingParameters.targetDistance - (int)lastPublishedDistance;
+
+  if (!force)
+  {
+    if (millis() - lastPublish < OCCUPANCY_PUBLISH_INTERVAL)
+      return;
+    if (abs(delta) < OCCUPANCY_DISTANCE_DELTA)
+      return;
+  }
+  lastPublish = millis();
+  lastPublishedDistance = OperatingParameters.targetDistance;
+  MqttOccupancyUpdate();
+#endif
+}
+
+static void occupancy_set(bool occupied)
+{
+  if (occupancyKnown && OperatingParameters.occupied == occupied)
+    return;
+
+  occupancyKnown = true;
+  OperatingParameters.occupied = occupied;
+  ESP_LOGI(TAG, "%s", occupied ? "Occupied" : "Vacant");
+  if (OperatingParameters.ecoSetback > 0.0)
+    ESP_LOGI(TAG, "Eco setback of %.1f %s", OperatingParameters.ecoSetback, occupied ? "removed" : "applied");
+  occupancy_publish(true);
+}
+
+//
+// Feed one radar sample. Distances are in cm; 0 means no target of that kind.
+//
+void occupancyUpdate(bool presence, uint16_t movingDistance, uint16_t stationaryDistance)
+{
+  uint16_t distance = 0;
+
+  if (presence)
+  {
+    // Closest target that is within range
+    if (movingDistance && movingDistance <= OCCUPANCY_MAX_DISTANCE)
+      distance = movingDistance;
+    if (stationaryDistance && stationaryDistance <= OCCUPANCY_MAX_DISTANCE &&
+        (distance == 0 || stationaryDistance < distance))
+      distance = stationaryDistance;
+    presence = (distance != 0);
+  }
+  OperatingParameters.targetDistance = distance;
+
+  if (presence)
+  {
+    lastPresence = millis();
+    if (presenceCount < OCCUPANCY_DEBOUNCE)
+      presenceCount++;
+    if (presenceCount >= OCCUPANCY_DEBOUNCE)
+      occupancy_set(true);
+  }
+  else
+  {
+    presenceCount = 0;
+    if (millis() - lastPresence > (int64_t)OperatingParameters.vacancyTimeout * 60000)
+      occupancy_set(false);
+  }
+
+  occupancy_publish(false);
+}
+
+// Degrees to set back the set point by right now (0 when occupied)
+float occupancySetback()
+{
+  if (!occupancyKnown || OperatingParameters.occupied)
+    return 0.0;
+  return OperatingParameters.ecoSetback;
+}
+
+void occupancyInit()
+{
+  // Assume occupied at boot until the vacancy timeout proves otherwise
+  lastPresence = millis();
+  OperatingParameters.occupied = true;
+  OperatingParameters.targetDistance = 0;
+}
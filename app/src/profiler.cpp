@@ -0,0 +1,167 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * profiler.cpp
+ *
+ * Per-task CPU usage. Every PROFILE_INTERVAL the state machine calls
+ * profilerLoop(), which reads the FreeRTOS run time counters of all tasks
+ * (uxTaskGetSystemState(), counting microseconds of esp_timer) and works
+ * out how much of one core each task used since the previous sample. The
+ * idle task of each core gives that core's load. The last PROFILE_HISTORY
+ * samples are kept for every task, along with its stack high-water mark.
+ *
+ * The results are shown on the Info screen, by the console Tasks command
+ * and on the web /metrics page.
+ *
+ * Needs CONFIG_FREERTOS_USE_TRACE_FACILITY and
+ * CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS; without them nothing is
+ * sampled and the readers get empty tables.
+ *
+ */
+
+#include "thermostat.hpp"
+#include "esp_timer.h"
+#include <stdlib.h>
+
+#define min(x, y) ((x < y) ? x : y)
+
+static const char *TAG = "PROFILER";
+
+// Written only by profilerLoop(); readers copy them under profileLock.
+// The tasks are kept busiest first.
+static PROFILE_TASK profileTasks[METRIC_MAX_TASKS];
+static int profileCount;
+static PROFILE_LOAD profileLoad;
+static portMUX_TYPE profileLock = portMUX_INITIALIZER_UNLOCKED;
+
+static int64_t lastSample;
+
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+static const PROFILE_TASK *profile_find(uint32_t number)
+{
+  for (int i = 0; i < profileCount; i++)
+    if (profileTasks[i].number == number)
+      return &profileTasks[i];
+  return NULL;
+}
+
+static int profile_compare(const void *a, const void *b)
+{
+  const PROFILE_TASK *ta = (const PROFILE_TASK *)a;
+  const PROFILE_TASK *tb = (const PROFILE_TASK *)b;
+
+  if (ta->cpu[0] != tb->cpu[0])
+    return (int)tb->cpu[0] - (int)ta->cpu[0];
+  return strcmp(ta->name, tb->name);
+}
+
+// Push a new sample onto the front of a history
+static void profile_push(uint16_t *history, uint16_t value)
+{
+  memmove(&history[1], &history[0], (PROFILE_HISTORY - 1) * sizeof(history[0]));
+  history[0] = value;
+}
+
+static void profile_sample(int64_t elapsed)
+{
+  static PROFILE_TASK next[METRIC_MAX_TASKS];
+  uint16_t idle[portNUM_PROCESSORS] = {0};
+  UBaseType_t count = uxTaskGetNumberOfTasks() + 2;     // Room for tasks created meanwhile
+  TaskStatus_t *status = (TaskStatus_t *)malloc(count * sizeof(TaskStatus_t));
+  int n = 0;
+
+  if (status == NULL)
+  {
+    ESP_LOGE(TAG, "No memory for the task list");
+    OperatingParameters.Errors.systemErrors++;
+    return;
+  }
+  count = uxTaskGetSystemState(status, count, NULL);
+
+  for (UBaseType_t i = 0; (i < count) && (n < METRIC_MAX_TASKS); i++)
+  {
+    PROFILE_TASK *t = &next[n];
+    const PROFILE_TASK *prev = profile_find(status[i].xTaskNumber);
+    uint32_t used;
+    uint16_t cpu;
+
+    if (prev != NULL)
+    {
+      *t = *prev;
+      used = status[i].ulRunTimeCounter - prev->counter;  // Unsigned, so wrapping is fine
+      cpu = (elapsed > 0) ? (uint16_t)min((uint64_t)used * 1000 / elapsed, (uint64_t)1000) : 0;
+      t->runTimeUs += used;
+      profile_push(t->cpu, cpu);
+      if (t->valid < PROFILE_HISTORY)
+        t->valid++;
+    }
+    else
+    {
+      // First time seen; its CPU use starts with the next sample
+      memset(t, 0, sizeof(*t));
+      t->number = status[i].xTaskNumber;
+      strlcpy(t->name, status[i].pcTaskName, sizeof(t->name));
+      cpu = 0;
+    }
+    t->priority = status[i].uxCurrentPriority;
+    t->stackFree = status[i].usStackHighWaterMark;
+    t->counter = status[i].ulRunTimeCounter;
+
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+      if (status[i].xHandle == xTaskGetIdleTaskHandleForCore(core))
+        idle[core] = cpu;
+    n++;
+  }
+  free(status);
+  qsort(next, n, sizeof(PROFILE_TASK), profile_compare);
+
+  // Tasks that have gone away are dropped simply by not being copied
+  portENTER_CRITICAL(&profileLock);
+  memcpy(profileTasks, next, n * sizeof(PROFILE_TASK));
+  if (profileCount > 0)
+  {
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+      profile_push(profileLoad.busy[core], 1000 - idle[core]);
+    if (profileLoad.valid < PROFILE_HISTORY)
+      profileLoad.valid++;
+  }
+  profileCount = n;
+  portEXIT_CRITICAL(&profileLock);
+}
+#endif
+
+//
+// Called from the state machine loop; takes a sample every PROFILE_INTERVAL.
+//
+void profilerLoop()
+{
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+  int64_t now = esp_timer_get_time();
+
+  if ((lastSample != 0) && (now - lastSample < PROFILE_INTERVAL * 1000LL))
+    return;
+  profile_sample((lastSample == 0) ? 0 : now - lastSample);
+  lastSample = now;
+#endif
+}
+
+//
+// Copy up to 'max' tasks, busiest (in the last sample) first. Returns
+// the number copied.
+//
+int profilerGetTasks(PROFILE_TASK *tasks, int max)
+{
+  int n;
+
+  portENTER_CRITICAL(&profileLock);
+  n = min(profileCount, max);
+  memcpy(tasks, profileTasks, n * sizeof(PROFILE_TASK));
+  portEXIT_CRITICAL(&profileLock);
+  return n;
+}
+
+void profilerGetLoad(PROFILE_LOAD *load)
+{
+  portENTER_CRITICAL(&profileLock);
+  *load = profileLoad;
+  portEXIT_CRITICAL(&profileLock);
+}
@@ -0,0 +1,567 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * provision.cpp
+ *
+ * Headless setup. A thermostat with no wifi network set up (or told to
+ * with the console "Provision" command) also runs an open access point,
+ * PROVISION_AP_PREFIX followed by the end of its MAC address (wifi.cpp).
+ * Every DNS name looked up by anything that joins it resolves to the
+ * thermostat, so phones and laptops pop up their captive portal sign in
+ * window, which the web server (web.cpp) sends to /setup. There, a
+ * network is picked from the background scan and its password entered;
+ * the credentials are saved with setWifiCreds() and the station
+ * connects straight away, no reboot. The access point closes once the
+ * station has been connected for PROVISION_LINGER, long enough for the
+ * setup page to show the new address.
+ *
+ * The saved networks (wifi.cpp tries them best first) are listed and
+ * edited on /networks, linked from the setup page. Like /setup it is
+ * only there while provisioning; on a thermostat that is already set up,
+ * the console "Provision start" brings the access point up.
+ *
+ * The DNS responder answers every A query with the access point's
+ * address and every other query with no records. The setup page and
+ * form handling don't depend on the http server; web.cpp hands them the
+ * request body and an output function.
+ *
+ */
+
+#include "thermostat.hpp"
+#include <lwip/sockets.h>
+#include <errno.h>
+
+#ifndef DNS_PORT
+#define DNS_PORT          53        // The host tests use another
+#endif
+#define DNS_PACKET_MAX    512       // Plain UDP DNS, no EDNS
+#define DNS_HEADER_LEN    12
+#define DNS_ANSWER_LEN    16        // Name pointer, type, class, TTL, length, address
+#define DNS_TTL           60        // Seconds
+
+static const char *TAG = "PROVISION";
+
+static TaskHandle_t dnsTask = NULL;
+static volatile bool dnsRunning;
+static uint32_t dnsAddress;         // Access point address, network order
+static portMUX_TYPE dnsLock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t submittedAt;         // millis() of the last accepted form; 0 if none
+
+//
+// Build the reply to one query in 'reply' (room for 'max'). Only the
+// header and the question are copied, anything after them (EDNS) is
+// dropped. Returns the reply length, 0 if the packet isn't a query we
+// answer.
+//
+static int dns_captive_reply(const uint8_t *query, int len, uint32_t ip, uint8_t *reply, int max)
+{
+  int pos = DNS_HEADER_LEN;
+  bool answer;
+
+  if (len < DNS_HEADER_LEN)
+    return 0;
+  if ((query[2] & 0x80) || (((query[2] >> 3) & 0x0f) != 0))
+    return 0;                                       // A response, or not a standard query
+  if ((query[4] != 0) || (query[5] != 1))
+    return 0;                                       // Exactly one question
+
+  while ((pos < len) && (query[pos] != 0))
+  {
+    if (query[pos] & 0xc0)
+      return 0;                                     // No compression in a question
+    pos += query[pos] + 1;
+  }
+  if (pos + 5 > len)
+    return 0;
+  pos += 5;                                         // Root label, type and class
+  if (pos + DNS_ANSWER_LEN > max)
+    return 0;
+
+  // Type A, class IN
+  answer = (query[pos - 4] == 0) && (query[pos - 3] == 1) && (query[pos - 2] == 0) && (query[pos - 1] == 1);
+
+  memcpy(reply, query, pos);
+  reply[2] = 0x84 | (query[2] & 0x01);              // Response, authoritative, copy RD
+  reply[3] = 0x80;                                  // RA, no error
+  reply[6] = 0;
+  reply[7] = answer ? 1 : 0;
+  memset(&reply[8], 0, 4);                          // No authority or additional records
+  if (!answer)
+    return pos;
+
+  const uint8_t record[DNS_ANSWER_LEN - 4] = {
+    0xc0, DNS_HEADER_LEN,                           // The name in the question
+    0, 1, 0, 1,                                     // A, IN
+    0, 0, (DNS_TTL >> 8) & 0xff, DNS_TTL & 0xff,
+    0, 4};
+  memcpy(&reply[pos], record, sizeof(record));
+  memcpy(&reply[pos + sizeof(record)], &ip, 4);     // Already in network order
+  return pos + DNS_ANSWER_LEN;
+}
+
+static void dns_captive_task(void *parameter)
+{
+  uint8_t *query = (uint8_t *)malloc(DNS_PACKET_MAX);
+  uint8_t *reply = (uint8_t *)malloc(DNS_PACKET_MAX);
+  struct sockaddr_in addr;
+  struct timeval timeout = {1, 0};
+  int sock = -1;
+
+  if ((query == NULL) || (reply == NULL))
+  {
+    ESP_LOGE(TAG, "Out of memory for the DNS responder");
+    OperatingParameters.Errors.systemErrors++;
+    goto done;
+  }
+
+  sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock < 0)
+  {
+    ESP_LOGE(TAG, "Could not create the DNS socket: %d (%s)", errno, strerror(errno));
+    OperatingParameters.Errors.systemErrors++;
+    goto done;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(DNS_PORT);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    ESP_LOGE(TAG, "Could not bind the DNS socket: %d (%s)", errno, strerror(errno));
+    OperatingParameters.Errors.systemErrors++;
+    goto done;
+  }
+  // Wake up now and then to see if we've been stopped
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  ESP_LOGI(TAG, "Captive DNS running");
+
+  for (;;)
+  {
+    struct sockaddr_in from;
+    socklen_t fromLen = sizeof(from);
+    int n;
+
+    n = recvfrom(sock, query, DNS_PACKET_MAX, 0, (struct sockaddr *)&from, &fromLen);
+    if (n > 0)
+    {
+      n = dns_captive_reply(query, n, dnsAddress, reply, DNS_PACKET_MAX);
+      if (n > 0)
+        sendto(sock, reply, n, 0, (struct sockaddr *)&from, fromLen);
+    }
+
+    // Started again while on the way out: carry on
+    portENTER_CRITICAL(&dnsLock);
+    if (!dnsRunning)
+    {
+      dnsTask = NULL;
+      portEXIT_CRITICAL(&dnsLock);
+      break;
+    }
+    portEXIT_CRITICAL(&dnsLock);
+  }
+
+  ESP_LOGI(TAG, "Captive DNS stopped");
+  closesocket(sock);
+  free(query);
+  free(reply);
+  vTaskDelete(NULL);
+  return;
+
+done:
+  if (sock >= 0)
+    closesocket(sock);
+  free(query);
+  free(reply);
+  portENTER_CRITICAL(&dnsLock);
+  dnsRunning = false;
+  dnsTask = NULL;
+  portEXIT_CRITICAL(&dnsLock);
+  vTaskDelete(NULL);
+}
+
+//
+// Answer every name with 'ip' (network order) until provisionDnsStop()
+//
+void provisionDnsStart(uint32_t ip)
+{
+  bool running;
+
+  portENTER_CRITICAL(&dnsLock);
+  dnsAddress = ip;
+  dnsRunning = true;
+  running = (dnsTask != NULL);
+  portEXIT_CRITICAL(&dnsLock);
+  if (running)
+    return;
+
+  if (xTaskCreate(dns_captive_task, "Captive DNS", 3072, NULL, 1, &dnsTask) != pdPASS)
+  {
+    ESP_LOGE(TAG, "Could not start the DNS responder");
+    OperatingParameters.Errors.systemErrors++;
+    dnsRunning = false;
+    dnsTask = NULL;
+  }
+}
+
+// The task notices within a second and goes away
+void provisionDnsStop()
+{
+  dnsRunning = false;
+}
+
+//
+// Decode the 'n' byte x-www-form-urlencoded value at 'src' into 'dst'.
+// False if it doesn't fit in 'len' (with its terminator).
+//
+static bool form_decode(const char *src, size_t n, char *dst, size_t len)
+{
+  size_t out = 0;
+
+  for (size_t i = 0; i < n; i++)
+  {
+    char c = src[i];
+
+    if (c == '+')
+      c = ' ';
+    else if ((c == '%') && (i + 2 < n) && isxdigit((unsigned char)src[i + 1]) && isxdigit((unsigned char)src[i + 2]))
+    {
+      char hex[3] = {src[i + 1], src[i + 2], '\0'};
+
+      c = (char)strtol(hex, NULL, 16);
+      i += 2;
+    }
+    if (out + 1 >= len)
+      return false;
+    dst[out++] = c;
+  }
+  dst[out] = '\0';
+  return true;
+}
+
+//
+// Find field 'name' in a form body and decode its value into 'dst'.
+// 1 if found, 0 if missing (dst empty), -1 if it doesn't fit in 'len'.
+//
+static int form_field(const char *body, const char *name, char *dst, size_t len)
+{
+  const char *p = body;
+  size_t nameLen = strlen(name);
+
+  dst[0] = '\0';
+  while (*p != '\0')
+  {
+    const char *end = strchr(p, '&');
+    const char *eq;
+
+    if (end == NULL)
+      end = p + strlen(p);
+    eq = (const char *)memchr(p, '=', end - p);
+    if ((eq != NULL) && ((size_t)(eq - p) == nameLen) && !strncmp(p, name, nameLen))
+      return form_decode(eq + 1, end - eq - 1, dst, len) ? 1 : -1;
+    p = (*end == '&') ? end + 1 : end;
+  }
+  return 0;
+}
+
+//
+// Pull the "ssid" and "pass" fields out of a setup form body. Missing
+// fields come back empty; false if either is too long.
+//
+bool provisionParseForm(const char *body, char *ssid, size_t ssidLen, char *pass, size_t passLen)
+{
+  bool ok = (form_field(body, "ssid", ssid, ssidLen) >= 0);
+
+  return (form_field(body, "pass", pass, passLen) >= 0) && ok;
+}
+
+//
+// Save the network in a submitted setup form and connect to it.
+// 'message' gets what to tell the user either way.
+//
+bool provisionSubmit(const char *body, char *message, size_t len)
+{
+  char ssid[sizeof(WifiCreds.ssid)];
+  char pass[sizeof(WifiCreds.password)];
+
+  if (!provisionParseForm(body, ssid, sizeof(ssid), pass, sizeof(pass)))
+  {
+    snprintf(message, len, "The network name or password is too long.");
+    return false;
+  }
+  if (ssid[0] == '\0')
+  {
+    snprintf(message, len, "Enter the name of the network.");
+    return false;
+  }
+  // The station only joins WPA2 networks
+  if (strlen(pass) < 8)
+  {
+    snprintf(message, len, "The password has 8 to 63 characters.");
+    return false;
+  }
+
+  ESP_LOGI(TAG, "Setup: joining \"%s\"", ssid);
+  strlcpy(WifiCreds.ssid, ssid, sizeof(WifiCreds.ssid));
+  strlcpy(WifiCreds.password, pass, sizeof(WifiCreds.password));
+  setWifiCreds();
+  // The wifi manager connects with the new settings right away
+  WifiDisconnect();
+
+  submittedAt = millis();
+  snprintf(message, len, "Saved. Connecting to %s...", ssid);
+  return true;
+}
+
+// Send 'text' with the HTML special characters escaped
+static void html_escaped(const char *text, METRICS_OUTPUT output, void *ctx)
+{
+  char buf[64];
+  size_t n = 0;
+
+  for (; *text != '\0'; text++)
+  {
+    const char *entity = NULL;
+
+    switch (*text)
+    {
+      case '&':  entity = "&amp;";  break;
+      case '<':  entity = "&lt;";   break;
+      case '>':  entity = "&gt;";   break;
+      case '"':  entity = "&quot;"; break;
+      case '\'': entity = "&#39;";  break;
+    }
+    if (n + 7 > sizeof(buf))
+    {
+      buf[n] = '\0';
+      output(ctx, buf);
+      n = 0;
+    }
+    if (entity != NULL)
+    {
+      strcpy(&buf[n], entity);
+      n += strlen(entity);
+    }
+    else
+      buf[n++] = *text;
+  }
+  buf[n] = '\0';
+  if (n > 0)
+    output(ctx, buf);
+}
+
+//
+// The setup page: where the station stands, 'message' (if any) and the
+// form, with the networks found so far to pick from. Reloads itself
+// every few seconds for as long as the station could still be connecting
+// to a network that has just been submitted.
+//
+void provisionWritePage(const char *message, METRICS_OUTPUT output, void *ctx)
+{
+  WIFI_NETWORK *networks = (WIFI_NETWORK *)malloc(WIFI_SCAN_MAX * sizeof(WIFI_NETWORK));
+  char line[128];
+  int n = 0;
+
+  output(ctx, "<!DOCTYPE html><html><head><meta charset=\"utf-8\">"
+              "<meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">");
+  if ((submittedAt != 0) && !WifiConnected() && (millis() - submittedAt < 2 * WIFI_ATTEMPT_TIMEOUT))
+    output(ctx, "<meta http-equiv=\"refresh\" content=\"5; url=/setup\">");
+  output(ctx, "<title>Thermostat setup</title>"
+              "<style>body{font-family:sans-serif;margin:1em;max-width:24em}"
+              "input{width:100%;box-sizing:border-box;padding:.5em;margin:.3em 0 1em}"
+              ".msg{font-weight:bold}</style></head><body><h2>");
+  html_escaped(OperatingParameters.DeviceName, output, ctx);
+  output(ctx, "</h2><p>");
+
+  if (WifiConnected())
+  {
+    output(ctx, "Connected to ");
+    html_escaped(WifiConnectedSsid(), output, ctx);
+    snprintf(line, sizeof(line), " as <a href=\"http://%s/\">%s</a>.", WifiAddress(), WifiAddress());
+    output(ctx, line);
+  }
+  else if (WifiCreds.ssid[0] != '\0')
+  {
+    output(ctx, "Not connected to ");
+    html_escaped(WifiCreds.ssid, output, ctx);
+    output(ctx, " yet.");
+  }
+  else
+    output(ctx, "No wifi network set up.");
+  output(ctx, "</p>");
+
+  if ((message != NULL) && (message[0] != '\0'))
+  {
+    output(ctx, "<p class=\"msg\">");
+    html_escaped(message, output, ctx);
+    output(ctx, "</p>");
+  }
+
+  output(ctx, "<form method=\"post\" action=\"/setup\">"
+              "<label>Network<input name=\"ssid\" list=\"networks\" maxlength=\"32\" required></label>"
+              "<label>Password<input name=\"pass\" type=\"password\" minlength=\"8\" maxlength=\"63\" required></label>"
+              "<input type=\"submit\" value=\"Connect\"></form><datalist id=\"networks\">");
+  if (networks != NULL)
+    n = WifiScanResults(networks, WIFI_SCAN_MAX);
+  for (int i = 0; i < n; i++)
+  {
+    // Open networks can't be joined (see provisionSubmit())
+    if (!networks[i].secure)
+      continue;
+    output(ctx, "<option value=\"");
+    html_escaped(networks[i].ssid, output, ctx);
+    snprintf(line, sizeof(line), "\">%d dBm</option>", networks[i].rssi);
+    output(ctx, line);
+  }
+  free(networks);
+  snprintf(line, sizeof(line), "</datalist><p>%d networks found%s. <a href=\"/setup?scan=1\">Scan again</a></p>",
+           n, WifiScanRunning() ? " so far, still scanning" : "");
+  output(ctx, line);
+  output(ctx, "<p><a href=\"/networks\">Saved networks</a></p></body></html>");
+}
+
+//
+// Apply a submitted /networks form: "action" is add, remove or up, on
+// network "ssid" ("pass" too for add). Saved straight away.
+//
+bool provisionNetworksSubmit(const char *body, char *message, size_t len)
+{
+  char action[8];
+  char ssid[sizeof(WifiCreds.ssid)];
+  char pass[sizeof(WifiCreds.password)];
+  bool ok;
+
+  if ((form_field(body, "action", action, sizeof(action)) <= 0) || (form_field(body, "ssid", ssid, sizeof(ssid)) < 0) ||
+      (form_field(body, "pass", pass, sizeof(pass)) < 0))
+  {
+    snprintf(message, len, "The network name or password is too long.");
+    return false;
+  }
+  if (ssid[0] == '\0')
+  {
+    snprintf(message, len, "Enter the name of the network.");
+    return false;
+  }
+
+  if (!strcmp(action, "add"))
+  {
+    if (strlen(pass) < 8)
+    {
+      snprintf(message, len, "The password has 8 to 63 characters.");
+      return false;
+    }
+    ok = WifiNetworkAdd(ssid, pass, -1);
+    snprintf(message, len, ok ? "Saved %s." : "Could not save %s.", ssid);
+  }
+  else if (!strcmp(action, "remove"))
+  {
+    ok = WifiNetworkRemove(ssid);
+    // Nothing to stay connected to
+    if (ok && !strcmp(WifiConnectedSsid(), ssid))
+      WifiDisconnect();
+    snprintf(message, len, ok ? "Removed %s." : "%s isn't saved.", ssid);
+  }
+  else if (!strcmp(action, "up"))
+  {
+    WIFI_SAVED_NETWORK *networks = (WIFI_SAVED_NETWORK *)malloc(WIFI_NETWORKS_MAX * sizeof(WIFI_SAVED_NETWORK));
+    int n = 0;
+    int pos = -1;
+
+    if (networks != NULL)
+      n = WifiNetworksGet(networks, WIFI_NETWORKS_MAX);
+    for (int i = 0; i < n; i++)
+      if (!strcmp(networks[i].ssid, ssid))
+        pos = i;
+    free(networks);
+    ok = (pos > 0) && WifiNetworkMove(ssid, pos - 1);
+    snprintf(message, len, ok ? "Moved %s up." : "Could not move %s.", ssid);
+  }
+  else
+  {
+    snprintf(message, len, "Unknown action.");
+    return false;
+  }
+
+  if (ok)
+  {
+    ESP_LOGI(TAG, "Networks: %s \"%s\"", action, ssid);
+    setWifiCreds();
+  }
+  return ok;
+}
+
+// One button posting 'action' for network 'ssid'
+static void networks_button(const char *action, const char *label, const char *ssid, METRICS_OUTPUT output, void *ctx)
+{
+  char line[96];
+
+  snprintf(line, sizeof(line), "<form method=\"post\" action=\"/networks\"><input type=\"hidden\" name=\"action\" value=\"%s\">"
+                               "<input type=\"hidden\" name=\"ssid\" value=\"", action);
+  output(ctx, line);
+  html_escaped(ssid, output, ctx);
+  snprintf(line, sizeof(line), "\"><input type=\"submit\" value=\"%s\"></form>", label);
+  output(ctx, line);
+}
+
+//
+// The saved networks page: the list in the order they're preferred,
+// with their connection history, and a form to add one. Passwords are
+// never sent back.
+//
+void provisionNetworksWritePage(const char *message, METRICS_OUTPUT output, void *ctx)
+{
+  WIFI_SAVED_NETWORK *networks = (WIFI_SAVED_NETWORK *)malloc(WIFI_NETWORKS_MAX * sizeof(WIFI_SAVED_NETWORK));
+  char line[128];
+  int n = 0;
+
+  output(ctx, "<!DOCTYPE html><html><head><meta charset=\"utf-8\">"
+              "<meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">"
+              "<title>Wifi networks</title>"
+              "<style>body{font-family:sans-serif;margin:1em;max-width:36em}"
+              "td,th{padding:.2em .5em;text-align:left}form{display:inline}"
+              "label input{width:100%;box-sizing:border-box;padding:.5em;margin:.3em 0 1em}"
+              ".msg{font-weight:bold}</style></head><body><h2>Wifi networks</h2><p>");
+  if (WifiConnected())
+  {
+    output(ctx, "Connected to ");
+    html_escaped(WifiConnectedSsid(), output, ctx);
+    snprintf(line, sizeof(line), ", signal %u%%. %lu roams.", WifiSignal(), (unsigned long)WifiRoamCount());
+    output(ctx, line);
+  }
+  else
+    output(ctx, "Not connected.");
+  output(ctx, "</p>");
+
+  if ((message != NULL) && (message[0] != '\0'))
+  {
+    output(ctx, "<p class=\"msg\">");
+    html_escaped(message, output, ctx);
+    output(ctx, "</p>");
+  }
+
+  if (networks != NULL)
+    n = WifiNetworksGet(networks, WIFI_NETWORKS_MAX);
+  output(ctx, "<table><tr><th></th><th>Network</th><th>OK</th><th>Failed</th><th>Last RSSI</th><th></th></tr>");
+  for (int i = 0; i < n; i++)
+  {
+    snprintf(line, sizeof(line), "<tr><td>%d</td><td>", i + 1);
+    output(ctx, line);
+    html_escaped(networks[i].ssid, output, ctx);
+    snprintf(line, sizeof(line), "%s</td><td>%u</td><td>%u</td><td>%d</td><td>",
+             strcmp(WifiConnectedSsid(), networks[i].ssid) ? "" : " (connected)", networks[i].successes,
+             networks[i].failures, networks[i].lastRssi);
+    output(ctx, line);
+    if (i > 0)
+      networks_button("up", "Up", networks[i].ssid, output, ctx);
+    networks_button("remove", "Remove", networks[i].ssid, output, ctx);
+    output(ctx, "</td></tr>");
+  }
+  free(networks);
+  output(ctx, "</table>");
+
+  if (n < WIFI_NETWORKS_MAX)
+    output(ctx, "<h3>Add a network</h3><form method=\"post\" action=\"/networks\">"
+                "<input type=\"hidden\" name=\"action\" value=\"add\">"
+                "<label>Network<input name=\"ssid\" maxlength=\"32\" required></label>"
+                "<label>Password<input name=\"pass\" type=\"password\" minlength=\"8\" maxlength=\"63\" required></label>"
+                "<input type=\"submit\" value=\"Add\"></form>");
+  output(ctx, "<p><a href=\"/setup\">Back</a></p></body></html>");
+}
@@ -0,0 +1,738 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * radar.cpp
+ *
+ * LD2410 uWave human presence radar. The radar streams a data frame about
+ * ten times a second over a 256000 baud UART. A dedicated task sleeps until
+ * the UART event task (Stream.cpp) signals that bytes have arrived, hands
+ * them to the ld2410 library and feeds the occupancy model once a second.
+ *
+ * The library only decodes the basic target data, so every byte it reads
+ * is also run through a small frame parser here. When the radar is in
+ * engineering mode that parser extracts the per-gate moving and stationary
+ * energies, which are shown as a histogram against the gate thresholds
+ * (telnet "Radar", and streamed by the web server at /radar/events).
+ *
+ * Anything that talks to the radar (engineering mode, applying settings)
+ * is queued to the radar task so only one task ever reads the UART. If
+ * the module can't be started the task ends, and requests fail at once.
+ *
+ * Gate thresholds, max gates and the idle time are kept in NVS. A command
+ * that changes them updates and saves them on the calling task, under
+ * configLock, then queues only the apply. At startup and on every apply
+ * they are compared with what the module reports and only written (and
+ * the module restarted) when something differs.
+ *
+ */
+
+#include "thermostat.hpp"
+#include "esp_timer.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include <ld2410.h>
+
+#define RADAR_IDLE_WAIT       (250)     // ms to wait for data before checking requests
+#define RADAR_REQUEST_TIMEOUT (3000)    // ms for the radar task to carry out a request
+#define RADAR_FRAME_MAX       (64)      // Largest data frame payload (engineering mode is 35)
+#define RADAR_BAR_WIDTH       (20)
+
+static const char *TAG = "RADAR";
+
+typedef enum
+{
+  RADAR_ENGINEERING_ON,
+  RADAR_ENGINEERING_OFF,
+  RADAR_APPLY_CONFIG
+} RADAR_REQUEST_TYPE;
+
+typedef struct
+{
+  RADAR_REQUEST_TYPE type;
+} RADAR_REQUEST;
+
+static Stream RadarPort;
+static ld2410 radar;
+static QueueHandle_t radarQueue = NULL;
+static QueueHandle_t resultQueue = NULL;
+static SemaphoreHandle_t requestLock = NULL;
+static SemaphoreHandle_t gatesLock = NULL;
+static SemaphoreHandle_t configLock = NULL;
+static volatile bool radarRunning = false;  // radar_start() succeeded and the task is serving requests
+static RADAR_GATES gates = {};
+static RADAR_STATS radarStats = {};
+static int64_t lastReading = 0;
+static RADAR_CONFIG radarConfig;        // What the module should be set to; kept in NVS
+
+//
+// The LD2410 module has multiple gates, one per each 0.75m of distance. So gate 0 will specify the sensitivity
+// for 0 - 0.75m, gate 1 will specify sensitivity for 0.75 - 1.5m, etc. The max gates specify the max distance
+// based on the number of gates enabled. For example, specifying 1 for max gates will allow 1.5m (0 & 1).
+// Moving targets are limited to gate 1 (1.5m) and stationary targets to gate 0 (0.75m). Gates beyond
+// those keep the module's factory thresholds.
+//
+static const RADAR_CONFIG radarDefaults = {
+  1,                          // maxMovingGate
+  0,                          // maxStationaryGate
+  MOTION_TIMEOUT / 2000,      // idleTime
+  {50, 50, 40, 30, 20, 15, 15, 15, 15},
+  {30, 30, 40, 40, 30, 30, 20, 20, 20}
+};
+
+static void IRAM_ATTR MotionDetect_ISR(void *arg)
+{
+  tftMotionTrigger = true;
+}
+
+//
+// Data frame parser. Frames look like:
+//   F4 F3 F2 F1 <len lo> <len hi> <type> AA <target data> [engineering data] 55 00 F8 F7 F6 F5
+// Command acknowledgements use a different header and are skipped.
+//
+static const uint8_t frameHeader[] = {0xF4, 0xF3, 0xF2, 0xF1};
+static const uint8_t frameTail[] = {0xF8, 0xF7, 0xF6, 0xF5};
+
+static void parse_engineering(const uint8_t *data, size_t len)
+{
+  // Basic target data occupies data[0..8], then the gate counts and energies
+  uint8_t maxMoving = data[9];
+  uint8_t maxStationary = data[10];
+
+  if (len < 11 || maxMoving >= RADAR_MAX_GATES || maxStationary >= RADAR_MAX_GATES ||
+      (size_t)(11 + maxMoving + 1 + maxStationary + 1) > len)
+    return;
+
+  xSemaphoreTake(gatesLock, portMAX_DELAY);
+  gates.engineering = true;
+  for (int g = 0; g < RADAR_MAX_GATES; g++)
+  {
+    gates.moving[g] = (g <= maxMoving) ? data[11 + g] : 0;
+    gates.stationary[g] = (g <= maxStationary) ? data[12 + maxMoving + g] : 0;
+    if (gates.moving[g] > gates.movingPeak[g])
+      gates.movingPeak[g] = gates.moving[g];
+    if (gates.stationary[g] > gates.stationaryPeak[g])
+      gates.stationaryPeak[g] = gates.stationary[g];
+  }
+  gates.frames++;
+  xSemaphoreGive(gatesLock);
+}
+
+static void radar_monitor(const uint8_t *buf, size_t len)
+{
+  static uint8_t data[RADAR_FRAME_MAX];
+  static size_t pos = 0;        // Bytes of the current frame seen so far
+  static size_t dataLen = 0;
+
+  for (size_t i = 0; i < len; i++)
+  {
+    uint8_t ch = buf[i];
+
+    if (pos < sizeof(frameHeader))
+    {
+      if (ch == frameHeader[pos])
+        pos++;
+      else
+        pos = (ch == frameHeader[0]) ? 1 : 0;
+      continue;
+    }
+    if (pos == 4)
+    {
+      dataLen = ch;
+      pos++;
+      continue;
+    }
+    if (pos == 5)
+    {
+      dataLen |= ch << 8;
+      pos = (dataLen > 0 && dataLen <= RADAR_FRAME_MAX) ? pos + 1 : 0;
+      continue;
+    }
+    if (pos < 6 + dataLen)
+    {
+      data[pos - 6] = ch;
+      pos++;
+      continue;
+    }
+    if (ch != frameTail[pos - 6 - dataLen])
+    {
+      pos = (ch == frameHeader[0]) ? 1 : 0;
+      continue;
+    }
+    if (++pos == 6 + dataLen + sizeof(frameTail))
+    {
+      if (data[0] == 0x01 && data[1] == 0xAA)
+        parse_engineering(&data[2], dataLen - 2);
+      else if (data[0] == 0x02 && gates.engineering)
+      {
+        xSemaphoreTake(gatesLock, portMAX_DELAY);
+        gates.engineering = false;
+        xSemaphoreGive(gatesLock);
+      }
+      pos = 0;
+    }
+  }
+}
+
+static bool radar_read_config()
+{
+  if (!radar.requestCurrentConfiguration())
+  {
+    ESP_LOGE(TAG, "LD2410: Failed to read configuration");
+    OperatingParameters.Errors.hardwareErrors++;
+    return false;
+  }
+
+  ESP_LOGI(TAG, "LD2410: Maximum gate ID: %d", radar.max_gate);
+  ESP_LOGI(TAG, "LD2410: Maximum gate for moving targets: %d", radar.max_moving_gate);
+  ESP_LOGI(TAG, "LD2410: Maximum gate for stationary targets: %d", radar.max_stationary_gate);
+  ESP_LOGI(TAG, "LD2410: Idle time for targets: %d", radar.sensor_idle_time);
+  ESP_LOGI(TAG, "LD2410: Gate sensitivity");
+
+  xSemaphoreTake(gatesLock, portMAX_DELAY);
+  gates.maxGate = (radar.max_gate < RADAR_MAX_GATES) ? radar.max_gate : RADAR_MAX_GATES - 1;
+  gates.maxMovingGate = radar.max_moving_gate;
+  gates.maxStationaryGate = radar.max_stationary_gate;
+  gates.idleTime = radar.sensor_idle_time;
+  for (uint8_t gate = 0; gate <= gates.maxGate; gate++)
+  {
+    ESP_LOGI(TAG, "  Gate %d moving targets: %d stationary targets: %d",
+      gate, radar.motion_sensitivity[gate], radar.stationary_sensitivity[gate]);
+    gates.movingThreshold[gate] = radar.motion_sensitivity[gate];
+    gates.stationaryThreshold[gate] = radar.stationary_sensitivity[gate];
+  }
+  xSemaphoreGive(gatesLock);
+  return true;
+}
+
+// Hand a request to the radar task and wait for it to be carried out
+static bool radar_request(RADAR_REQUEST_TYPE type)
+{
+  RADAR_REQUEST req = {type};
+  bool result = false;
+
+  // Nobody is there to carry it out
+  if (radarQueue == NULL || !radarRunning)
+    return false;
+
+  // One request at a time, so a late result can't be taken for the next one
+  xSemaphoreTake(requestLock, portMAX_DELAY);
+  xQueueReset(resultQueue);
+  if (xQueueSend(radarQueue, &req, pdMS_TO_TICKS(RADAR_REQUEST_TIMEOUT)) == pdTRUE)
+  {
+    if (xQueueReceive(resultQueue, &result, pdMS_TO_TICKS(RADAR_REQUEST_TIMEOUT)) != pdTRUE)
+    {
+      ESP_LOGW(TAG, "LD2410: Request %d timed out", type);
+      result = false;
+    }
+  }
+  xSemaphoreGive(requestLock);
+  return result;
+}
+
+static void radar_process()
+{
+  static RADAR_STATS acc = {};
+  static uint32_t lastBytes = 0;
+  int64_t start = esp_timer_get_time();
+
+  // The library parses one byte per call; drain everything buffered so
+  // whole frames are handled per wakeup
+  while (RadarPort.available() > 0)
+  {
+    if (radar.read())
+      acc.frames++;
+  }
+
+  if (radar.isConnected() && millis() - lastReading > 1000)  //Report every 1000ms
+  {
+    lastReading = millis();
+    occupancyUpdate(radar.presenceDetected(),
+                    radar.movingTargetDetected() ? radar.movingTargetDistance() : 0,
+                    radar.stationaryTargetDetected() ? radar.stationaryTargetDistance() : 0);
+    if (radar.presenceDetected())
+    {
+      ESP_LOGD (TAG, "LD2410: Presence detected");
+      if (radar.stationaryTargetDetected())
+        ESP_LOGD (TAG, "LD2410: Stationary target: %d in", (int)((float)(radar.stationaryTargetDistance()) / 2.54));
+      if (radar.movingTargetDetected())
+        ESP_LOGD (TAG, "LD2410: Moving target: %d in", (int)((float)(radar.movingTargetDistance()) / 2.54));
+    }
+
+    acc.bytes = RadarPort.bytesReceived() - lastBytes;
+    lastBytes = RadarPort.bytesReceived();
+    acc.overflows = RadarPort.overflows();
+    radarStats = acc;
+    ESP_LOGD (TAG, "LD2410: %lu us/s, %lu frames, %lu bytes, %lu overflows",
+              radarStats.cpuUs, radarStats.frames, radarStats.bytes, radarStats.overflows);
+    acc.cpuUs = 0;
+    acc.frames = 0;
+  }
+  acc.cpuUs += (uint32_t)(esp_timer_get_time() - start);
+}
+
+//
+// Bring the module's settings in line with radarConfig, touching only what
+// differs. Writing settings (and the restart that follows) is skipped
+// entirely when the module already matches, which is the normal case.
+//
+static bool radar_apply_config()
+{
+  RADAR_CONFIG config;
+  bool changed = false;
+  bool ok = true;
+
+  // A copy, so a command on another task can't change it halfway
+  xSemaphoreTake(configLock, portMAX_DELAY);
+  config = radarConfig;
+  xSemaphoreGive(configLock);
+
+  if (!radar_read_config())
+    return false;
+
+  for (int g = 0; g <= gates.maxGate; g++)
+  {
+    if (gates.movingThreshold[g] == config.movingThreshold[g] &&
+        gates.stationaryThreshold[g] == config.stationaryThreshold[g])
+      continue;
+    ESP_LOGI(TAG, "LD2410: Gate %d thresholds %d/%d -> %d/%d", g,
+             gates.movingThreshold[g], gates.stationaryThreshold[g],
+             config.movingThreshold[g], config.stationaryThreshold[g]);
+    ok &= radar.setGateSensitivityThreshold(g, config.movingThreshold[g], config.stationaryThreshold[g]);
+    changed = true;
+  }
+
+  if (gates.maxMovingGate != config.maxMovingGate ||
+      gates.maxStationaryGate != config.maxStationaryGate ||
+      gates.idleTime != config.idleTime)
+  {
+    ESP_LOGI(TAG, "LD2410: Max gates %d/%d idle %d -> %d/%d idle %d",
+             gates.maxMovingGate, gates.maxStationaryGate, gates.idleTime,
+             config.maxMovingGate, config.maxStationaryGate, config.idleTime);
+    ok &= radar.setMaxValues(config.maxMovingGate, config.maxStationaryGate, config.idleTime);
+    changed = true;
+  }
+
+  if (!changed)
+  {
+    ESP_LOGI(TAG, "LD2410: Configuration matches, nothing to apply");
+    return true;
+  }
+  if (!ok)
+  {
+    ESP_LOGE(TAG, "LD2410: FAILED to apply configuration");
+    OperatingParameters.Errors.hardwareErrors++;
+  }
+  radar_read_config();
+
+  //
+  // Now request a restart to enable all the setting specified above
+  //
+  if (radar.requestRestart())
+  {
+    ESP_LOGW(TAG, "LD2410: Restart requested");
+  }
+  else
+  {
+    ESP_LOGE(TAG, "LD2410: FAILED requesting restart");
+    OperatingParameters.Errors.hardwareErrors++;
+  }
+  return ok;
+}
+
+static bool radar_execute(RADAR_REQUEST *req)
+{
+  bool ok = false;
+
+  switch (req->type)
+  {
+    case RADAR_ENGINEERING_ON:
+      ok = radar.requestStartEngineeringMode();
+      break;
+    case RADAR_ENGINEERING_OFF:
+      ok = radar.requestEndEngineeringMode();
+      break;
+    case RADAR_APPLY_CONFIG:
+      // Logs and counts its own failures
+      return radar_apply_config();
+  }
+
+  if (!ok)
+  {
+    ESP_LOGE(TAG, "LD2410: Request %d failed", req->type);
+    OperatingParameters.Errors.hardwareErrors++;
+  }
+  return ok;
+}
+
+//
+// Everything that talks to the module happens here, off the boot path
+//
+static bool radar_start()
+{
+  vTaskDelay(pdMS_TO_TICKS(500));
+  if (!radar.begin(RadarPort))
+  {
+    ESP_LOGE(TAG, "LD2410: Sensor not connected");
+    OperatingParameters.Errors.hardwareErrors++;
+    return false;
+  }
+
+  ESP_LOGI(TAG, "LD2410: Sensor started");
+
+  if (radar.requestFirmwareVersion())
+  {
+    ESP_LOGI(TAG, "LD2410: Firmware: v%u.%02u.%08x",
+      radar.firmware_major_version,
+      radar.firmware_minor_version,
+      radar.firmware_bugfix_version
+      );
+    snprintf (OperatingParameters.ld2410FirmWare, sizeof(OperatingParameters.ld2410FirmWare),
+      "%u.%02u.%08x",
+      radar.firmware_major_version,
+      radar.firmware_minor_version,
+      radar.firmware_bugfix_version
+      );
+  }
+  else
+  {
+    ESP_LOGE(TAG, "LD2410: Failed to read firmware version\n");
+    OperatingParameters.Errors.hardwareErrors++;
+    snprintf (OperatingParameters.ld2410FirmWare,
+      sizeof(OperatingParameters.ld2410FirmWare),
+      "-.--.--------");
+  }
+
+  radar_apply_config();
+  return true;
+}
+
+static void radarTask(void *parameter)
+{
+  RADAR_REQUEST req;
+
+  if (!radar_start())
+  {
+    // radarRunning stays false, so requests fail without waiting
+    vTaskDelete(NULL);
+    return;
+  }
+  radarRunning = true;
+
+  for (;;)
+  {
+    while (xQueueReceive(radarQueue, &req, 0) == pdTRUE)
+    {
+      bool ok = radar_execute(&req);
+      xQueueOverwrite(resultQueue, &ok);
+    }
+
+    RadarPort.waitForData(pdMS_TO_TICKS(RADAR_IDLE_WAIT));
+    radar_process();
+  }
+}
+
+void ld2410_init()
+{
+  gpio_install_isr_service(0);
+
+  gpio_config_t io_conf;
+  io_conf.intr_type = GPIO_INTR_POSEDGE;
+  io_conf.mode = GPIO_MODE_INPUT;
+  io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
+  io_conf.pull_up_en = GPIO_PULLUP_DISABLE;
+  io_conf.pin_bit_mask = (1ULL<<MOTION_PIN);
+  gpio_config(&io_conf);
+
+  //attach isr handler
+  gpio_isr_handler_add((gpio_num_t)MOTION_PIN, MotionDetect_ISR, nullptr);
+
+  if (!eepromGetRadarConfig(&radarConfig))
+    radarConfig = radarDefaults;
+
+  gatesLock = xSemaphoreCreateMutex();
+  configLock = xSemaphoreCreateMutex();
+  requestLock = xSemaphoreCreateMutex();
+  radarQueue = xQueueCreate(4, sizeof(RADAR_REQUEST));
+  resultQueue = xQueueCreate(1, sizeof(bool));
+
+  RadarPort.setMonitor(radar_monitor);
+  RadarPort.begin(UART_NUM_2, 256000, LD_RX, LD_TX); //UART for monitoring the radar
+
+  xTaskCreate(
+      radarTask,
+      "Radar",
+      4096,
+      NULL,
+      tskIDLE_PRIORITY + 2,   // Above the state machine so frames don't back up
+      NULL);
+}
+
+void ld2410GetStats(RADAR_STATS *stats)
+{
+  *stats = radarStats;
+}
+
+void radarGetGates(RADAR_GATES *out)
+{
+  if (gatesLock == NULL)
+  {
+    memset(out, 0, sizeof(*out));
+    return;
+  }
+  xSemaphoreTake(gatesLock, portMAX_DELAY);
+  *out = gates;
+  xSemaphoreGive(gatesLock);
+}
+
+bool radarSetEngineeringMode(bool enable)
+{
+  bool ok = radar_request(enable ? RADAR_ENGINEERING_ON : RADAR_ENGINEERING_OFF);
+
+  if (ok)
+    ESP_LOGI(TAG, "LD2410: Engineering mode %s", enable ? "on" : "off");
+  return ok;
+}
+
+static void format_bar(char *bar, uint8_t energy, uint8_t threshold)
+{
+  int fill = (energy * RADAR_BAR_WIDTH + 50) / 100;
+  int mark = (threshold * RADAR_BAR_WIDTH + 50) / 100;
+
+  for (int i = 0; i < RADAR_BAR_WIDTH; i++)
+    bar[i] = (i < fill) ? '#' : '.';
+  if (mark < RADAR_BAR_WIDTH)
+    bar[mark] = '|';
+  bar[RADAR_BAR_WIDTH] = '\0';
+}
+
+//
+// Text histogram of gate energies; '|' marks each gate's threshold
+//
+int radarFormatGates(char *buf, size_t len)
+{
+  RADAR_GATES g;
+  char moving[RADAR_BAR_WIDTH + 1];
+  char stationary[RADAR_BAR_WIDTH + 1];
+  int n;
+
+  radarGetGates(&g);
+  if (!g.engineering)
+    return snprintf(buf, len, "Engineering mode off (Radar eng on)\n");
+
+  n = snprintf(buf, len, "Gate  Range   %-*s Mov/Thr  %-*s Sta/Thr\n",
+               RADAR_BAR_WIDTH, "Moving", RADAR_BAR_WIDTH, "Stationary");
+  for (int i = 0; i <= g.maxGate && n < (int)len; i++)
+  {
+    format_bar(moving, g.moving[i], g.movingThreshold[i]);
+    format_bar(stationary, g.stationary[i], g.stationaryThreshold[i]);
+    n += snprintf(buf + n, len - n, " %d   %4.2fm  %s %3d/%-3d  %s %3d/%d\n",
+                  i, (i + 1) * RADAR_GATE_SIZE, moving, g.moving[i], g.movingThreshold[i],
+                  stationary, g.stationary[i], g.stationaryThreshold[i]);
+  }
+  return (n < (int)len) ? n : (int)len - 1;
+}
+
+static int format_array(char *buf, size_t len, const char *name, const uint8_t *values, int count)
+{
+  int n = snprintf(buf, len, "\"%s\":[", name);
+
+  for (int i = 0; i < count && n < (int)len; i++)
+    n += snprintf(buf + n, len - n, "%s%d", i ? "," : "", values[i]);
+  if (n < (int)len)
+    n += snprintf(buf + n, len - n, "]");
+  return n;
+}
+
+//
+// JSON snapshot of gate energies for the web event stream
+//
+int radarFormatGatesJson(char *buf, size_t len)
+{
+  RADAR_GATES g;
+  int count;
+  int n;
+
+  radarGetGates(&g);
+  count = g.maxGate + 1;
+  n = snprintf(buf, len, "{\"engineering\":%s,\"frames\":%lu,", g.engineering ? "true" : "false", g.frames);
+  if (n < (int)len)
+    n += format_array(buf + n, len - n, "moving", g.moving, count);
+  if (n < (int)len)
+    n += snprintf(buf + n, len - n, ",");
+  if (n < (int)len)
+    n += format_array(buf + n, len - n, "stationary", g.stationary, count);
+  if (n < (int)len)
+    n += snprintf(buf + n, len - n, ",");
+  if (n < (int)len)
+    n += format_array(buf + n, len - n, "movingThreshold", g.movingThreshold, count);
+  if (n < (int)len)
+    n += snprintf(buf + n, len - n, ",");
+  if (n < (int)len)
+    n += format_array(buf + n, len - n, "stationaryThreshold", g.stationaryThreshold, count);
+  if (n < (int)len)
+    n += snprintf(buf + n, len - n, "}");
+  return (n < (int)len) ? n : (int)len - 1;
+}
+
+static int format_config(char *buf, size_t len)
+{
+  RADAR_CONFIG config;
+  RADAR_GATES g;
+  int n;
+
+  xSemaphoreTake(configLock, portMAX_DELAY);
+  config = radarConfig;
+  xSemaphoreGive(configLock);
+  radarGetGates(&g);
+  n = snprintf(buf, len, "Max gate moving %d, stationary %d, idle %d s (radar: %d, %d, %d s)\n",
+               config.maxMovingGate, config.maxStationaryGate, config.idleTime,
+               g.maxMovingGate, g.maxStationaryGate, g.idleTime);
+  if (n < (int)len)
+    n += snprintf(buf + n, len - n, "Gate  Saved mov/sta  Radar mov/sta\n");
+  for (int i = 0; i < RADAR_MAX_GATES && n < (int)len; i++)
+    n += snprintf(buf + n, len - n, " %d      %3d/%-3d      %3d/%d\n", i,
+                  config.movingThreshold[i], config.stationaryThreshold[i],
+                  g.movingThreshold[i], g.stationaryThreshold[i]);
+  return (n < (int)len) ? n : (int)len - 1;
+}
+
+// Save radarConfig after a command changed it; called holding configLock
+static bool config_save()
+{
+  if (eepromUpdateRadarConfig(&radarConfig))
+    return true;
+  ESP_LOGE(TAG, "LD2410: Unable to save configuration");
+  OperatingParameters.Errors.systemErrors++;
+  return false;
+}
+
+// Have the radar task apply the new settings, and say what happened
+static bool config_reply(bool saved, char *reply, size_t len)
+{
+  const char *nvs = saved ? "Saved" : "Not saved (NVS error)";
+
+  if (!radarRunning)
+  {
+    snprintf(reply, len, "%s, but the radar is not running, nothing applied\n", nvs);
+    return false;
+  }
+  if (!radar_request(RADAR_APPLY_CONFIG))
+  {
+    snprintf(reply, len, "%s, but the radar did not accept the new settings\n", nvs);
+    return false;
+  }
+  if (!saved)
+  {
+    snprintf(reply, len, "Applied, but not saved (NVS error)\n");
+    return false;
+  }
+  format_config(reply, len);
+  return true;
+}
+
+//
+// Commands shared by telnet, the web server and MQTT:
+//   (empty)                       gate energy histogram
+//   eng on|off                    engineering mode
+//   config                        saved settings and what the radar reports
+//   gate <n> <moving> <stationary> set a gate's thresholds (0-100)
+//   max <moving> <stationary> <idle s> set the farthest gates and idle time
+//   defaults                      restore the default settings
+//   peak                          show and reset the per-gate peak energies
+// Settings are saved to NVS and applied to the radar.
+//
+bool radarCommand(const char *cmd, char *reply, size_t len)
+{
+  int a0, a1, a2;
+  bool saved;
+
+  while (*cmd == ' ')
+    cmd++;
+
+  if (configLock == NULL)
+  {
+    snprintf(reply, len, "Radar not started yet\n");
+    return false;
+  }
+
+  if (*cmd == '\0')
+  {
+    radarFormatGates(reply, len);
+  }
+  else if (!strncasecmp(cmd, "eng", 3))
+  {
+    const char *arg = strchr(cmd, ' ');
+    bool enable = (arg == NULL) || strncasecmp(arg + 1, "off", 3);
+
+    if (!radarSetEngineeringMode(enable))
+    {
+      snprintf(reply, len, radarRunning ? "Radar did not accept the request\n" : "Radar is not running\n");
+      return false;
+    }
+    snprintf(reply, len, "Engineering mode %s\n", enable ? "on" : "off");
+  }
+  else if (!strncasecmp(cmd, "config", 6))
+  {
+    format_config(reply, len);
+  }
+  else if (!strncasecmp(cmd, "gate", 4))
+  {
+    if (sscanf(cmd + 4, "%d %d %d", &a0, &a1, &a2) != 3 ||
+        a0 < 0 || a0 >= RADAR_MAX_GATES || a1 < 0 || a1 > 100 || a2 < 0 || a2 > 100)
+    {
+      snprintf(reply, len, "Usage: gate <0-%d> <moving 0-100> <stationary 0-100>\n", RADAR_MAX_GATES - 1);
+      return false;
+    }
+    xSemaphoreTake(configLock, portMAX_DELAY);
+    radarConfig.movingThreshold[a0] = a1;
+    radarConfig.stationaryThreshold[a0] = a2;
+    saved = config_save();
+    xSemaphoreGive(configLock);
+    return config_reply(saved, reply, len);
+  }
+  else if (!strncasecmp(cmd, "max", 3))
+  {
+    if (sscanf(cmd + 3, "%d %d %d", &a0, &a1, &a2) != 3 ||
+        a0 < 0 || a0 >= RADAR_MAX_GATES || a1 < 0 || a1 >= RADAR_MAX_GATES || a2 < 0 || a2 > 65535)
+    {
+      snprintf(reply, len, "Usage: max <moving gate 0-%d> <stationary gate 0-%d> <idle seconds>\n",
+               RADAR_MAX_GATES - 1, RADAR_MAX_GATES - 1);
+      return false;
+    }
+    xSemaphoreTake(configLock, portMAX_DELAY);
+    radarConfig.maxMovingGate = a0;
+    radarConfig.maxStationaryGate = a1;
+    radarConfig.idleTime = a2;
+    saved = config_save();
+    xSemaphoreGive(configLock);
+    return config_reply(saved, reply, len);
+  }
+  else if (!strncasecmp(cmd, "defaults", 8))
+  {
+    xSemaphoreTake(configLock, portMAX_DELAY);
+    radarConfig = radarDefaults;
+    saved = config_save();
+    xSemaphoreGive(configLock);
+    return config_reply(saved, reply, len);
+  }
+  else if (!strncasecmp(cmd, "peak", 4))
+  {
+    RADAR_GATES g;
+    int n;
+
+    xSemaphoreTake(gatesLock, portMAX_DELAY);
+    g = gates;
+    memset(gates.movingPeak, 0, sizeof(gates.movingPeak));
+    memset(gates.stationaryPeak, 0, sizeof(gates.stationaryPeak));
+    xSemaphoreGive(gatesLock);
+
+    n = snprintf(reply, len, "Gate  Peak moving/stationary (reset)\n");
+    for (int i = 0; i <= g.maxGate && n < (int)len; i++)
+      n += snprintf(reply + n, len - n, " %d    %3d/%d\n", i, g.movingPeak[i], g.stationaryPeak[i]);
+  }
+  else
+  {
+    snprintf(reply, len, "Unknown radar command: %s\n", cmd);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,541 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * schedule.cpp
+ *
+ * Weekly setpoint schedule with away and vacation overrides.
+ *
+ * The schedule is a list of up to SCHEDULE_MAX_ENTRIES transitions, each
+ * a minute-of-week (Sunday 00:00 = 0), a set temperature and optionally a
+ * mode. It is kept sorted by minute-of-week and stored as a single blob in
+ * NVS. Whenever the schedule, the timezone or the clock changes, the wall
+ * clock time of the next transition is computed once; the state machine
+ * then only compares time(NULL) against it on every pass.
+ *
+ * The same text commands are accepted from telnet ("sched ..."), the web
+ * UI (PUT /schedule) and MQTT (<device>/set/schedule):
+ *
+ *   list | on | off | clear
+ *   add <day> <hh:mm> <temp> [mode]   day: sun..sat, daily, weekdays, weekends
+ *   del <n>
+ *   away <temp> | home
+ *   vacation <days> <temp>           days: 1..365
+ *
+ * Temperatures are in the current display units and limited to the range
+ * of the display's arc. scheduleInit() runs from app_main() before any of
+ * the front ends start; commands are turned away until it has.
+ *
+ */
+
+#include "thermostat.hpp"
+#include "freertos/semphr.h"
+#include <math.h>
+
+#define SCHEDULE_KEEP_MODE    (0xff)
+#define SCHEDULE_VERSION      (1)
+#define MINUTES_PER_DAY       (24 * 60)
+#define CLOCK_RETRY_INTERVAL  (60000)
+#define CLOCK_JUMP_SECONDS    (120)
+#define VACATION_MAX_DAYS     (365)
+
+static const char *TAG = "SCHEDULE";
+
+typedef struct
+{
+  uint16_t minuteOfWeek;    // Sunday 00:00 == 0
+  int16_t setTemp;          // Tenths of a degree in 'units'
+  uint8_t mode;             // HVAC_MODE or SCHEDULE_KEEP_MODE
+} SCHEDULE_ENTRY;
+
+typedef struct
+{
+  uint8_t version;
+  uint8_t state;            // SCHEDULE_STATE
+  uint8_t nrEntries;
+  char units;               // Units the temperatures were entered in
+  int16_t awayTemp;         // Tenths of a degree in 'units'
+  uint32_t vacationEnd;     // time_t when vacation mode ends
+  SCHEDULE_ENTRY entries[SCHEDULE_MAX_ENTRIES];
+} SCHEDULE_CONFIG;
+
+static SCHEDULE_CONFIG schedule;
+static SemaphoreHandle_t scheduleLock = NULL;
+static time_t nextTransition = 0;
+static int nextEntry = -1;
+static int64_t lastClockRetry = 0;
+static time_t lastWallClock = 0;
+static int64_t lastWallClockMs = 0;
+
+static const char *day_str[7] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char *schedule_state_str[NR_SCHEDULE_STATES] = { "Off", "Run", "Away", "Vacation" };
+
+static const struct
+{
+  const char *name;
+  HVAC_MODE mode;
+} schedule_modes[] = {
+  { "off", OFF }, { "heat", HEAT }, { "cool", COOL }, { "auto", AUTO }, { "fan", FAN_ONLY }, { "aux", AUX_HEAT },
+};
+
+const char *scheduleStateToString(SCHEDULE_STATE state)
+{
+  if (state >= NR_SCHEDULE_STATES)
+    return "Unknown";
+  return schedule_state_str[state];
+}
+
+// Schedule temperatures are kept in the units they were entered in
+static float to_current_units(int16_t tenths)
+{
+  float temp = tenths / 10.0;
+
+  if (schedule.units == OperatingParameters.tempUnits)
+    return temp;
+  if (OperatingParameters.tempUnits == 'F')
+    return roundValue((temp * 9.0 / 5.0) + 32.0, 0);
+  return roundValue((temp - 32.0) * 5.0 / 9.0, 1);
+}
+
+// Convert the stored temperatures after a change of display units so new
+// entries and old ones share the same units
+static void normalize_units()
+{
+  if (schedule.units == OperatingParameters.tempUnits)
+    return;
+  for (int i = 0; i < schedule.nrEntries; i++)
+    schedule.entries[i].setTemp = (int16_t)(to_current_units(schedule.entries[i].setTemp) * 10);
+  schedule.awayTemp = (int16_t)(to_current_units(schedule.awayTemp) * 10);
+  schedule.units = OperatingParameters.tempUnits;
+}
+
+// Set temperatures are limited as on the display's arc, in the current units
+static float temp_min()
+{
+  return (OperatingParameters.tempUnits == 'C') ? SET_TEMP_MIN_C : SET_TEMP_MIN_F;
+}
+
+static float temp_max()
+{
+  return (OperatingParameters.tempUnits == 'C') ? SET_TEMP_MAX_C : SET_TEMP_MAX_F;
+}
+
+static bool temp_valid(float temp)
+{
+  return isfinite(temp) && (temp >= temp_min()) && (temp <= temp_max());
+}
+
+static void set_away_temp(float temp)
+{
+  schedule.awayTemp = (int16_t)(temp * 10);
+  updateHvacSetTemp(temp);
+}
+
+static void schedule_save()
+{
+  if (!eepromUpdateSchedule(&schedule, sizeof(schedule)))
+  {
+    ESP_LOGE(TAG, "Failed to save schedule");
+    OperatingParameters.Errors.systemErrors++;
+  }
+}
+
+static bool clock_valid(time_t now)
+{
+  struct tm tm;
+
+  localtime_r(&now, &tm);
+  return (tm.tm_year > (2016 - 1900));
+}
+
+static int minute_of_week(const struct tm *tm)
+{
+  return (tm->tm_wday * MINUTES_PER_DAY) + (tm->tm_hour * 60) + tm->tm_min;
+}
+
+// Index of the entry in effect at minute-of-week 'mow' (the last one at or
+// before it, wrapping to the end of the week)
+static int entry_in_effect(int mow)
+{
+  int idx = schedule.nrEntries - 1;
+
+  for (int i = 0; i < schedule.nrEntries; i++) {
+    if (schedule.entries[i].minuteOfWeek > mow)
+      break;
+    idx = i;
+  }
+  return idx;
+}
+
+// Local wall clock time of entry 'idx' at or after 'now'
+static time_t entry_time(int idx, time_t now)
+{
+  struct tm tm;
+  int mowNow, mowEntry, days;
+
+  localtime_r(&now, &tm);
+  mowNow = minute_of_week(&tm);
+  mowEntry = schedule.entries[idx].minuteOfWeek;
+  days = (mowEntry / MINUTES_PER_DAY) - tm.tm_wday;
+  if (mowEntry <= mowNow)
+    days += 7;
+
+  // Let mktime() normalize the date and pick the right DST offset
+  tm.tm_mday += days;
+  tm.tm_hour = (mowEntry % MINUTES_PER_DAY) / 60;
+  tm.tm_min = mowEntry % 60;
+  tm.tm_sec = 0;
+  tm.tm_isdst = -1;
+  return mktime(&tm);
+}
+
+//
+// Work out when the next transition happens. Called whenever the schedule,
+// timezone or clock changes; never on the regular tick.
+//
+static void schedule_compile(time_t now)
+{
+  struct tm tm;
+
+  nextTransition = 0;
+  nextEntry = -1;
+
+  switch (schedule.state) {
+  case SCHEDULE_VACATION:
+    nextTransition = schedule.vacationEnd;
+    break;
+  case SCHEDULE_RUN:
+    if (schedule.nrEntries == 0 || !clock_valid(now))
+      break;
+    localtime_r(&now, &tm);
+    nextEntry = (entry_in_effect(minute_of_week(&tm)) + 1) % schedule.nrEntries;
+    nextTransition = entry_time(nextEntry, now);
+    break;
+  default:
+    break;
+  }
+  lastWallClock = now;
+  lastWallClockMs = millis();
+}
+
+static void apply_entry(int idx)
+{
+  const SCHEDULE_ENTRY *e = &schedule.entries[idx];
+
+  ESP_LOGI(TAG, "Applying %s %02d:%02d: %.1f", day_str[e->minuteOfWeek / MINUTES_PER_DAY],
+           (e->minuteOfWeek % MINUTES_PER_DAY) / 60, e->minuteOfWeek % 60, e->setTemp / 10.0);
+  if (e->mode != SCHEDULE_KEEP_MODE && e->mode != OperatingParameters.hvacSetMode)
+    updateHvacMode((HVAC_MODE)e->mode);
+  updateHvacSetTemp(to_current_units(e->setTemp));
+}
+
+static void apply_current_entry(time_t now)
+{
+  struct tm tm;
+
+  if (schedule.nrEntries == 0 || !clock_valid(now))
+    return;
+  localtime_r(&now, &tm);
+  apply_entry(entry_in_effect(minute_of_week(&tm)));
+}
+
+//
+// Called on every pass of the state machine loop. Nothing but a time
+// comparison unless a transition is due or the clock jumped.
+//
+void scheduleLoop()
+{
+  time_t now;
+  int64_t ms = millis();
+
+  if (schedule.state == SCHEDULE_OFF || schedule.state == SCHEDULE_AWAY)
+    return;
+
+  now = time(NULL);
+  if (nextTransition == 0) {
+    // Clock not set yet (or empty schedule); try again later
+    if (ms - lastClockRetry < CLOCK_RETRY_INTERVAL)
+      return;
+    lastClockRetry = ms;
+    xSemaphoreTake(scheduleLock, portMAX_DELAY);
+    schedule_compile(now);
+    xSemaphoreGive(scheduleLock);
+    return;
+  }
+
+  // SNTP sync or manual clock change: recompute from scratch
+  if (llabs((int64_t)(now - lastWallClock) - (ms - lastWallClockMs) / 1000) > CLOCK_JUMP_SECONDS) {
+    ESP_LOGI(TAG, "Clock changed, recomputing next transition");
+    xSemaphoreTake(scheduleLock, portMAX_DELAY);
+    schedule_compile(now);
+    xSemaphoreGive(scheduleLock);
+  }
+
+  if (now < nextTransition) {
+    lastWallClock = now;
+    lastWallClockMs = ms;
+    return;
+  }
+
+  xSemaphoreTake(scheduleLock, portMAX_DELAY);
+  if (schedule.state == SCHEDULE_VACATION) {
+    ESP_LOGI(TAG, "Vacation over, resuming schedule");
+    schedule.state = SCHEDULE_RUN;
+    schedule_save();
+    apply_current_entry(now);
+  } else if (nextEntry >= 0) {
+    apply_entry(nextEntry);
+  }
+  schedule_compile(now);
+  xSemaphoreGive(scheduleLock);
+#ifdef MQTT_ENABLED
+  MqttScheduleUpdate();
+#endif
+}
+
+void scheduleRecompile()
+{
+  if (scheduleLock == NULL)
+    return;
+  xSemaphoreTake(scheduleLock, portMAX_DELAY);
+  schedule_compile(time(NULL));
+  xSemaphoreGive(scheduleLock);
+}
+
+SCHEDULE_STATE scheduleGetState()
+{
+  return (SCHEDULE_STATE)schedule.state;
+}
+
+// Seconds until the next transition, or -1 if none is pending
+int32_t scheduleSecondsToNext()
+{
+  time_t now = time(NULL);
+
+  if (nextTransition == 0 || nextTransition < now)
+    return -1;
+  return (int32_t)(nextTransition - now);
+}
+
+////////////////////////////////////////////////////////////////////////////
+//
+//      Command interface shared by telnet, web and MQTT
+//
+////////////////////////////////////////////////////////////////////////////
+
+static int parse_days(const char *str)
+{
+  if (!strcasecmp(str, "daily"))
+    return 0x7f;
+  if (!strcasecmp(str, "weekdays"))
+    return 0x3e;
+  if (!strcasecmp(str, "weekends"))
+    return 0x41;
+  for (int d = 0; d < 7; d++)
+    if (!strncasecmp(str, day_str[d], 3))
+      return 1 << d;
+  return 0;
+}
+
+static int parse_mode(const char *str)
+{
+  for (size_t m = 0; m < sizeof(schedule_modes) / sizeof(schedule_modes[0]); m++)
+    if (!strcasecmp(str, schedule_modes[m].name))
+      return schedule_modes[m].mode;
+  return -1;
+}
+
+static const char *mode_name(uint8_t mode)
+{
+  for (size_t m = 0; m < sizeof(schedule_modes) / sizeof(schedule_modes[0]); m++)
+    if (schedule_modes[m].mode == mode)
+      return schedule_modes[m].name;
+  return "-";
+}
+
+static bool add_entry(uint16_t mow, int16_t temp, uint8_t mode)
+{
+  int i;
+
+  // Replace an existing entry at the same time
+  for (i = 0; i < schedule.nrEntries; i++) {
+    if (schedule.entries[i].minuteOfWeek == mow) {
+      schedule.entries[i].setTemp = temp;
+      schedule.entries[i].mode = mode;
+      return true;
+    }
+  }
+  if (schedule.nrEntries >= SCHEDULE_MAX_ENTRIES)
+    return false;
+
+  // Insertion keeps the table sorted
+  for (i = schedule.nrEntries; i > 0 && schedule.entries[i - 1].minuteOfWeek > mow; i--)
+    schedule.entries[i] = schedule.entries[i - 1];
+  schedule.entries[i].minuteOfWeek = mow;
+  schedule.entries[i].setTemp = temp;
+  schedule.entries[i].mode = mode;
+  schedule.nrEntries++;
+  return true;
+}
+
+// Number of the entries at 'minute' on 'days' that add_entry() would have to insert
+static int new_entries(int days, int minute)
+{
+  int n = 0;
+
+  for (int d = 0; d < 7; d++) {
+    if (!(days & (1 << d)))
+      continue;
+    n++;
+    for (int i = 0; i < schedule.nrEntries; i++)
+      if (schedule.entries[i].minuteOfWeek == d * MINUTES_PER_DAY + minute) {
+        n--;
+        break;
+      }
+  }
+  return n;
+}
+
+// Listing of the schedule; returns the number of characters written
+int scheduleFormat(char *buf, size_t len)
+{
+  int n = 0;
+
+  n += snprintf(buf + n, len - n, "Schedule: %s", scheduleStateToString((SCHEDULE_STATE)schedule.state));
+  if (schedule.state == SCHEDULE_AWAY || schedule.state == SCHEDULE_VACATION)
+    n += snprintf(buf + n, len - n, " (%.1f)", to_current_units(schedule.awayTemp));
+  if (schedule.state == SCHEDULE_VACATION) {
+    struct tm tm;
+    time_t end = schedule.vacationEnd;
+    localtime_r(&end, &tm);
+    n += strftime(buf + n, len - n, " until %a %d-%b %H:%M", &tm);
+  }
+  if (nextTransition)
+    n += snprintf(buf + n, len - n, ", next change in %ld min", (long)(scheduleSecondsToNext() / 60));
+  n += snprintf(buf + n, len - n, "\n");
+
+  for (int i = 0; i < schedule.nrEntries && n < (int)len; i++) {
+    const SCHEDULE_ENTRY *e = &schedule.entries[i];
+    n += snprintf(buf + n, len - n, "%2d: %s %02d:%02d  %5.1f  %s\n", i, day_str[e->minuteOfWeek / MINUTES_PER_DAY],
+                  (e->minuteOfWeek % MINUTES_PER_DAY) / 60, e->minuteOfWeek % 60,
+                  to_current_units(e->setTemp), mode_name(e->mode));
+  }
+  return (n < (int)len) ? n : (int)len - 1;
+}
+
+//
+// Execute a schedule command. The reply (or error message) is written to
+// 'reply'. Returns false if the command was rejected.
+//
+bool scheduleCommand(const char *cmd, char *reply, size_t len)
+{
+  char buf[64];
+  char *argv[6];
+  char *save;
+  int argc = 0;
+  bool changed = true;
+  bool ok = true;
+  time_t now = time(NULL);
+
+  strncpy(buf, cmd, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = '\0';
+  for (char *tok = strtok_r(buf, " \t\r\n", &save); tok && argc < 6; tok = strtok_r(NULL, " \t\r\n", &save))
+    argv[argc++] = tok;
+
+  if (scheduleLock == NULL) {
+    snprintf(reply, len, "Schedule not started yet\n");
+    return false;
+  }
+  if (argc == 0 || !strcasecmp(argv[0], "list")) {
+    scheduleFormat(reply, len);
+    return true;
+  }
+
+  xSemaphoreTake(scheduleLock, portMAX_DELAY);
+  normalize_units();
+  if (!strcasecmp(argv[0], "on")) {
+    schedule.state = SCHEDULE_RUN;
+  } else if (!strcasecmp(argv[0], "off")) {
+    schedule.state = SCHEDULE_OFF;
+  } else if (!strcasecmp(argv[0], "clear")) {
+    schedule.nrEntries = 0;
+  } else if (!strcasecmp(argv[0], "add")) {
+    int days = (argc >= 4) ? parse_days(argv[1]) : 0;
+    int hour, min, mode = SCHEDULE_KEEP_MODE;
+    float temp = (argc >= 4) ? atof(argv[3]) : 0;
+
+    if (argc >= 5)
+      mode = parse_mode(argv[4]);
+    if (!days || sscanf(argv[2], "%d:%d", &hour, &min) != 2 || hour < 0 || hour > 23 ||
+        min < 0 || min > 59 || !temp_valid(temp) || mode < 0) {
+      snprintf(reply, len, "Usage: add <day|daily|weekdays|weekends> <hh:mm> <%.0f-%.0f> [off|heat|cool|auto|fan|aux]\n",
+               temp_min(), temp_max());
+      ok = false;
+    } else if (schedule.nrEntries + new_entries(days, hour * 60 + min) > SCHEDULE_MAX_ENTRIES) {
+      // All of the days or none of them
+      snprintf(reply, len, "Schedule full (%d entries)\n", SCHEDULE_MAX_ENTRIES);
+      ok = false;
+    } else {
+      for (int d = 0; d < 7; d++)
+        if (days & (1 << d))
+          add_entry(d * MINUTES_PER_DAY + hour * 60 + min, (int16_t)(temp * 10), (uint8_t)mode);
+    }
+  } else if (!strcasecmp(argv[0], "del") && argc >= 2) {
+    int idx = atoi(argv[1]);
+    if (idx < 0 || idx >= schedule.nrEntries) {
+      snprintf(reply, len, "No entry %d\n", idx);
+      ok = false;
+    } else {
+      memmove(&schedule.entries[idx], &schedule.entries[idx + 1],
+              (schedule.nrEntries - idx - 1) * sizeof(SCHEDULE_ENTRY));
+      schedule.nrEntries--;
+    }
+  } else if (!strcasecmp(argv[0], "away") && argc >= 2 && temp_valid(atof(argv[1]))) {
+    schedule.state = SCHEDULE_AWAY;
+    set_away_temp(atof(argv[1]));
+  } else if (!strcasecmp(argv[0], "away")) {
+    snprintf(reply, len, "Usage: away <%.0f-%.0f>\n", temp_min(), temp_max());
+    changed = ok = false;
+  } else if (!strcasecmp(argv[0], "vacation") && argc >= 3 && atoi(argv[1]) > 0 &&
+             atoi(argv[1]) <= VACATION_MAX_DAYS && temp_valid(atof(argv[2]))) {
+    schedule.state = SCHEDULE_VACATION;
+    schedule.vacationEnd = (uint32_t)(now + (time_t)atoi(argv[1]) * 86400);
+    set_away_temp(atof(argv[2]));
+  } else if (!strcasecmp(argv[0], "vacation")) {
+    snprintf(reply, len, "Usage: vacation <1-%d days> <%.0f-%.0f>\n", VACATION_MAX_DAYS, temp_min(), temp_max());
+    changed = ok = false;
+  } else if (!strcasecmp(argv[0], "home")) {
+    schedule.state = SCHEDULE_RUN;
+    apply_current_entry(now);
+  } else {
+    snprintf(reply, len, "Unknown schedule command: %s\n", argv[0]);
+    changed = ok = false;
+  }
+
+  if (changed && ok) {
+    schedule_compile(now);
+    schedule_save();
+  }
+  xSemaphoreGive(scheduleLock);
+
+  if (ok) {
+    scheduleFormat(reply, len);
+#ifdef MQTT_ENABLED
+    MqttScheduleUpdate();
+#endif
+  }
+  return ok;
+}
+
+void scheduleInit()
+{
+  scheduleLock = xSemaphoreCreateMutex();
+
+  if (!eepromGetSchedule(&schedule, sizeof(schedule)) || schedule.version != SCHEDULE_VERSION ||
+      schedule.nrEntries > SCHEDULE_MAX_ENTRIES || schedule.state >= NR_SCHEDULE_STATES) {
+    memset(&schedule, 0, sizeof(schedule));
+    schedule.version = SCHEDULE_VERSION;
+    schedule.state = SCHEDULE_OFF;
+    schedule.units = OperatingParameters.tempUnits;
+  }
+  schedule_compile(time(NULL));
+  ESP_LOGI(TAG, "Schedule %s with %d entries", scheduleStateToString((SCHEDULE_STATE)schedule.state), schedule.nrEntries);
+}
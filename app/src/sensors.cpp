@@ -3,8 +3,8 @@
  * sensors.cpp
  *
  * This module supports all the sensor devices included with the thermostat. This includes
- * includes the AHT20, the LDR light detector, LD2410 uWave human presence detector and
- * the SNTP provided time.
+ * includes the AHT20 and the SNTP provided time. The LD2410 uWave human presence
+ * detector is in radar.cpp and the LDR light detector in light.cpp.
  *
  * Copyright (c) 2023 Steve Meisner (steve@meisners.net)
  * 
@@ -19,17 +19,12 @@
  */
 
 #include "thermostat.hpp"
+#include "binlog.hpp"
 #include "esp_intr_alloc.h"
-#include "esp_adc/adc_continuous.h"
-#include "soc/adc_channel.h"
 #include "esp_sntp.h"
 #include <aht.h>
 #include <timezonedb_lookup.h>
-#include <ld2410.h>
 #include <Smoothed.h>
-#include "esp_adc/adc_oneshot.h"
-#include "esp_adc/adc_cali.h"
-#include "esp_adc/adc_cali_scheme.h"
 
 static const char *TAG = "SENSORS";
 
@@ -43,17 +38,10 @@ const char *gmt_timezones[] =
 
 int64_t lastTimeUpdate = 0;
 
-Stream RadarPort;
-ld2410 radar;
-uint64_t last_ld2410_Reading = 0;
 
 Smoothed<float> sensorTemp;
 Smoothed<float> sensorHumidity;
 
-adc_unit_t adcUnit;
-adc_channel_t adcChannel;
-adc_oneshot_unit_handle_t adcHandle;
-
 void updateHvacMode(HVAC_MODE mode)
 {
   OperatingParameters.hvacSetMode = mode;
@@ -73,38 +61,6 @@ void updateHvacSetTemp(float setTemp)
 #endif
 }
 
-/*---------------------------------------------------------------
-        ADC Code (for light sensor)
----------------------------------------------------------------*/
-void initLightSensor()
-{
-  adc_oneshot_io_to_channel(LIGHT_SENS_PIN, &adcUnit, &adcChannel);
-
-  adc_oneshot_unit_init_cfg_t init_config = {
-    .unit_id = adcUnit,
-    .clk_src = ADC_RTC_CLK_SRC_DEFAULT,
-    .ulp_mode = ADC_ULP_MODE_DISABLE
-  };
-  ESP_ERROR_CHECK(adc_oneshot_new_unit(&init_config, &adcHandle));
-
-  adc_oneshot_chan_cfg_t config = {
-    .atten = ADC_ATTEN_DB_12,
-    .bitwidth = ADC_BITWIDTH_DEFAULT,
-  };
-  ESP_ERROR_CHECK(adc_oneshot_config_channel(adcHandle, adcChannel, &config));
-}
-
-int readLightSensor(void)
-{
-  static int voltage;
-
-  ESP_ERROR_CHECK(adc_oneshot_read(adcHandle, adcChannel, &voltage));
-  ESP_LOGV(TAG, "ADC%d Channel[%d] Raw Data: %d", adcUnit + 1, adcChannel, voltage);
-  ESP_LOGV(TAG, "Light Sensor: %d mV", (int)voltage);
-
-  return (int)voltage;
-}
-
 /*---------------------------------------------------------------
         Functions to convert temp values
 ---------------------------------------------------------------*/
@@ -132,144 +88,6 @@ float roundValue(float value, int places)
   return r;
 }
 
-//////////////////////////////////////////////////////////////////////////////////////
-//
-//    LD2410 support code
-//
-//////////////////////////////////////////////////////////////////////////////////////
-
-static void IRAM_ATTR MotionDetect_ISR(void *arg)
-{
-  tftMotionTrigger = true;
-}
-
-
-bool ld2410_init()
-{
-  bool rc;
-
-  gpio_install_isr_service(0);
-
-  gpio_config_t io_conf;
-  io_conf.intr_type = GPIO_INTR_POSEDGE;
-  io_conf.mode = GPIO_MODE_INPUT;
-  io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
-  io_conf.pull_up_en = GPIO_PULLUP_DISABLE;
-  io_conf.pin_bit_mask = (1ULL<<MOTION_PIN);
-  gpio_config(&io_conf);
-
-  //attach isr handler
-  gpio_isr_handler_add((gpio_num_t)MOTION_PIN, MotionDetect_ISR, nullptr);
-
-  RadarPort.begin(UART_NUM_2, 256000, LD_RX, LD_TX); //UART for monitoring the radar
-  vTaskDelay(pdMS_TO_TICKS(500));
-
-  if (radar.begin(RadarPort))
-  {
-    ESP_LOGI(TAG, "LD2410: Sensor started");
-    rc = true;
-
-    if (radar.requestFirmwareVersion())
-    {
-      ESP_LOGI(TAG, "LD2410: Firmware: v%u.%02u.%08x",
-        radar.firmware_major_version,
-        radar.firmware_minor_version,
-        radar.firmware_bugfix_version
-        );
-      snprintf (OperatingParameters.ld2410FirmWare, sizeof(OperatingParameters.ld2410FirmWare),
-        "%u.%02u.%08x",
-        radar.firmware_major_version,
-        radar.firmware_minor_version,
-        radar.firmware_bugfix_version
-        );
-    }
-    else
-    {
-      ESP_LOGE(TAG, "LD2410: Failed to read firmware version\n");
-      OperatingParameters.Errors.hardwareErrors++;
-      snprintf (OperatingParameters.ld2410FirmWare,
-        sizeof(OperatingParameters.ld2410FirmWare),
-        "-.--.--------");
-    }
-
-    if (radar.requestCurrentConfiguration())
-    {
-      ESP_LOGI(TAG, "LD2410: Maximum gate ID: %d", radar.max_gate);
-      ESP_LOGI(TAG, "LD2410: Maximum gate for moving targets: %d", radar.max_moving_gate);
-      ESP_LOGI(TAG, "LD2410: Maximum gate for stationary targets: %d", radar.max_stationary_gate);
-      ESP_LOGI(TAG, "LD2410: Idle time for targets: %d", radar.sensor_idle_time);
-      ESP_LOGI(TAG, "LD2410: Gate sensitivity");
-      for (uint8_t gate = 0; gate <= radar.max_gate; gate++)
-      {
-        ESP_LOGI(TAG, "  Gate %d moving targets: %d stationary targets: %d",
-          gate, radar.motion_sensitivity[gate], radar.stationary_sensitivity[gate]);
-      }
-    }
-
-    //
-    // The LD2410 module has multiple gates, one per each 0.75m of distance. So gate 0 will specify the sensitivity
-    // for 0 - 0.75m, gate 1 will specify sensitivity for 0.75 - 1.5m, etc. Setting MaxValues (below) specifies
-    // max distance based on the number of gates enabled. For example, specifying 1 for max gates will allow 1.5m (0 & 1).
-    //
-    //bool setGateSensitivityThreshold(uint8_t gate, uint8_t moving, uint8_t stationary);
-    radar.setGateSensitivityThreshold(0, 50, 30); // Default values (50 & 30)
-    radar.setGateSensitivityThreshold(1, 50, 30);
-    //
-    // Each gate is ~0.75m, therefore moving gate should be limited to gate 1 (1.5m) and stationary gate should be
-    // limited to 0 (0.75m). Use this to also change the inactivity timer.
-    //
-    //bool setMaxValues(uint16_t moving, uint16_t stationary, uint16_t inactivityTimer);
-    if (radar.setMaxValues(1, 0, (MOTION_TIMEOUT / 2000)))
-    {
-      ESP_LOGI(TAG, "LD2410: Max gate values set");
-    }
-    else
-    {
-      ESP_LOGE(TAG, "LD2410: FAILED to set max gate values");
-      OperatingParameters.Errors.hardwareErrors++;
-    }
-    //
-    // Now request a restart to enable all the setting specified above
-    //
-    if (radar.requestRestart()) 
-    {
-      ESP_LOGW(TAG, "LD2410: Restart requested");
-    }
-    else
-    {
-      ESP_LOGE(TAG, "LD2410: FAILED requesting restart");
-      OperatingParameters.Errors.hardwareErrors++;
-    }
-  }
-  else
-  {
-    ESP_LOGE(TAG, "LD2410: Sensor not connected");
-    OperatingParameters.Errors.hardwareErrors++;
-    rc = false;
-  }
-  return rc;
-}
-
-void ld2410_loop()
-{
-  if (!radar.isConnected())
-    return;
-
-  radar.read();
-  if (radar.isConnected() && millis() - last_ld2410_Reading > 1000)  //Report every 1000ms
-  {
-    last_ld2410_Reading = millis();
-    if (radar.presenceDetected())
-    {
-      ESP_LOGD (TAG, "LD2410: Presence detected");
-      if (radar.stationaryTargetDetected())
-        ESP_LOGD (TAG, "LD2410: Stationary target: %d in", (int)((float)(radar.stationaryTargetDistance()) / 2.54));
-      if (radar.movingTargetDetected())
-        ESP_LOGD (TAG, "LD2410: Moving target: %d in", (int)((float)(radar.movingTargetDistance()) / 2.54));
-    }
-  }
-}
-
 /*---------------------------------------------------------------
   Function to reset variable controlled by call Smoothed library
 ---------------------------------------------------------------*/
@@ -320,15 +138,16 @@ void updateAht(void *parameter)
       if (OperatingParameters.tempUnits == 'F')
         temperature = (temperature * 9.0 / 5.0) + 32;
 
-      ESP_LOGD(TAG, "Temperature: %.1f°C, Humidity: %.2f%%", temperature, humidity);
+      BLOGD(TAG, "Temperature: %.1f°C, Humidity: %.2f%%", temperature, humidity);
 
       sensorTemp.add(temperature);
       sensorHumidity.add(humidity);
 
       OperatingParameters.tempCurrent = sensorTemp.get();
       OperatingParameters.humidCurrent = sensorHumidity.get();
+      bootMilestone(BOOT_FIRST_READING);
 
-      ESP_LOGI(TAG, "Temp: %0.1f (raw: %0.2f %c)  Humidity: %0.1f (raw: %0.2f)",
+      BLOGI(TAG, "Temp: %0.1f (raw: %0.2f %c)  Humidity: %0.1f (raw: %0.2f)",
              sensorTemp.get() + OperatingParameters.tempCorrection,
              temperature, OperatingParameters.tempUnits,
              sensorHumidity.get() + OperatingParameters.humidityCorrection,
@@ -404,6 +223,7 @@ void updateTimezoneFromConfig()
   }
   setenv("TZ", tz, 1);
   tzset();
+  scheduleRecompile();
 }
 
 void updateTimezone(char *zone)
@@ -429,6 +249,7 @@ void updateTimezone(char *zone)
   }
   setenv("TZ", tz, 1);
   tzset();
+  scheduleRecompile();
 }
 
 
@@ -697,6 +518,7 @@ void sensorsInit()
   sensorHumidity.clear();
 
   startAht();
+  occupancyInit();
   ld2410_init();
   initLightSensor();
 }
@@ -19,11 +19,12 @@
  */
 #include <stdbool.h>
 #include "thermostat.hpp"
+#include "binlog.hpp"
 #include "driver/gpio.h"
+#include "esp_timer.h"
 
 OPERATING_PARAMETERS OperatingParameters;
 extern int64_t lastTimeUpdate;
-int64_t lastWifiReconnect;
 static bool MqttConnectCalled = false;
 
 struct gpio_pin_desc {
@@ -59,6 +60,244 @@ const struct gpio_pin_desc hvac_mode_gpio[NR_HVAC_MODES][NR_GPIO_PINS] = {
                  PIN(HVAC_STAGE2_PIN, LOW)),
 };
 
+//////////////////////////////////////////////////////////////////////////////////////
+//
+//    HVAC runtime & cycle accounting
+//
+//    On-time is credited to the running stage on every pass of the state machine
+//    loop (runtime_accumulate()), and when the stage changes. Minute buckets give
+//    the duty cycle over the last hour and hour buckets the duty cycle over the
+//    last day; time is split across every bucket it covers. Only the lifetime
+//    totals are persisted.
+//
+//////////////////////////////////////////////////////////////////////////////////////
+
+#define RUNTIME_MINUTE_BUCKETS  (60)
+#define RUNTIME_HOUR_BUCKETS    (24)
+#define NO_STAGE                (NR_HVAC_STAGES)
+
+typedef struct
+{
+  uint16_t minuteMs[RUNTIME_MINUTE_BUCKETS];  // On-time (ms) per minute, last hour
+  uint32_t hourMs[RUNTIME_HOUR_BUCKETS];      // On-time (ms) per hour, last day
+  uint32_t todayMs;
+  uint32_t todayCycles;
+  uint32_t lifetimeMs;                        // Sub-second remainder of lifetime on-time
+  HVAC_STAGE_TOTALS lifetime;
+} HVAC_STAGE_RUNTIME;
+
+static HVAC_STAGE_RUNTIME hvacRuntime[NR_HVAC_STAGES];
+static int activeStage = NO_STAGE;
+static int64_t lastRuntimeAccount = 0;
+static int64_t lastRuntimeMinute = 0;
+static int64_t lastRuntimeHour = 0;
+static int lastRuntimeDay = -1;
+static int64_t lastRuntimeSave = 0;
+static bool runtimeDirty = false;
+
+static const char *hvac_stage_str[NR_HVAC_STAGES] = { "Heat", "Cool", "Fan" };
+
+const char *hvacStageToString(HVAC_STAGE stage)
+{
+  if (stage >= NR_HVAC_STAGES)
+    return "Unknown";
+  return hvac_stage_str[stage];
+}
+
+static inline int mode_to_stage(HVAC_MODE mode)
+{
+  switch (mode) {
+  case HEAT:
+  case AUX_HEAT:
+    return STAGE_HEAT;
+  case COOL:
+    return STAGE_COOL;
+  case FAN_ONLY:
+    return STAGE_FAN;
+  default:
+    return NO_STAGE;
+  }
+}
+
+// Day number used to reset the "today" counters. Local midnight when the
+// clock is set, otherwise fall back to days of uptime.
+static int runtime_day_number(int64_t now)
+{
+  struct tm info;
+  time_t t = time(NULL);
+
+  localtime_r(&t, &info);
+  if (info.tm_year > (2016 - 1900))
+    return (info.tm_year * 366) + info.tm_yday;
+  return (int)(now / (24LL * 3600000LL));
+}
+
+// Advance the minute/hour/day windows, clearing any buckets that were skipped
+static void runtime_roll_windows(int64_t now)
+{
+  int64_t minute = now / 60000;
+  int64_t hour = now / 3600000;
+
+  if (minute != lastRuntimeMinute) {
+    int64_t n = minute - lastRuntimeMinute;
+    if (n > RUNTIME_MINUTE_BUCKETS) n = RUNTIME_MINUTE_BUCKETS;
+    for (int s = 0; s < NR_HVAC_STAGES; s++)
+      for (int64_t m = 1; m <= n; m++)
+        hvacRuntime[s].minuteMs[(lastRuntimeMinute + m) % RUNTIME_MINUTE_BUCKETS] = 0;
+    lastRuntimeMinute = minute;
+
+    // Only look at the wall clock once a minute
+    int day = runtime_day_number(now);
+    if (day != lastRuntimeDay) {
+      if (lastRuntimeDay != -1) {
+        ESP_LOGI(__FUNCTION__, "New day - clearing daily runtime counters");
+        for (int s = 0; s < NR_HVAC_STAGES; s++) {
+          hvacRuntime[s].todayMs = 0;
+          hvacRuntime[s].todayCycles = 0;
+        }
+      }
+      lastRuntimeDay = day;
+    }
+  }
+
+  if (hour != lastRuntimeHour) {
+    int64_t n = hour - lastRuntimeHour;
+    if (n > RUNTIME_HOUR_BUCKETS) n = RUNTIME_HOUR_BUCKETS;
+    for (int s = 0; s < NR_HVAC_STAGES; s++)
+      for (int64_t h = 1; h <= n; h++)
+        hvacRuntime[s].hourMs[(lastRuntimeHour + h) % RUNTIME_HOUR_BUCKETS] = 0;
+    lastRuntimeHour = hour;
+  }
+}
+
+// Credit on-time since the last call to the stage that is currently running,
+// a minute at a time so it lands in the minute and hour buckets it belongs to
+static void runtime_accumulate(int64_t now)
+{
+  int64_t start = lastRuntimeAccount;
+  uint32_t delta = (uint32_t)(now - start);
+  lastRuntimeAccount = now;
+
+  runtime_roll_windows(now);
+
+  if (activeStage == NO_STAGE || delta == 0)
+    return;
+
+  HVAC_STAGE_RUNTIME *rt = &hvacRuntime[activeStage];
+
+  // Anything older than the day window has no bucket left
+  if (start < now - RUNTIME_HOUR_BUCKETS * 3600000LL)
+    start = now - RUNTIME_HOUR_BUCKETS * 3600000LL;
+  while (start < now) {
+    int64_t end = (start / 60000 + 1) * 60000;
+    uint32_t ms;
+
+    if (end > now)
+      end = now;
+    ms = (uint32_t)(end - start);
+
+    if (now / 60000 - start / 60000 < RUNTIME_MINUTE_BUCKETS) {
+      uint16_t *minuteMs = &rt->minuteMs[(start / 60000) % RUNTIME_MINUTE_BUCKETS];
+      *minuteMs = (*minuteMs + ms > 60000) ? 60000 : *minuteMs + ms;
+    }
+    if (now / 3600000 - start / 3600000 < RUNTIME_HOUR_BUCKETS)
+      rt->hourMs[(start / 3600000) % RUNTIME_HOUR_BUCKETS] += ms;
+    start = end;
+  }
+
+  rt->todayMs += delta;
+  rt->lifetimeMs += delta;
+  if (rt->lifetimeMs >= 1000) {
+    rt->lifetime.onSeconds += rt->lifetimeMs / 1000;
+    rt->lifetimeMs %= 1000;
+    runtimeDirty = true;
+  }
+}
+
+// Called from set_hvac_mode(); credits the stage that was running and
+// counts a cycle when the stage changes
+static void runtime_track_mode(HVAC_MODE mode)
+{
+  int stage = mode_to_stage(mode);
+  int64_t now = millis();
+
+  runtime_accumulate(now);
+
+  if (stage == activeStage)
+    return;
+
+  if (stage != NO_STAGE) {
+    hvacRuntime[stage].todayCycles++;
+    hvacRuntime[stage].lifetime.cycles++;
+    runtimeDirty = true;
+  }
+  activeStage = stage;
+#ifdef MQTT_ENABLED
+  MqttRuntimeUpdate();
+#endif
+}
+
+static void runtime_init()
+{
+  HVAC_STAGE_TOTALS totals[NR_HVAC_STAGES];
+  int64_t now = millis();
+
+  memset(hvacRuntime, 0, sizeof(hvacRuntime));
+  eepromGetHvacRuntime(totals);
+  for (int s = 0; s < NR_HVAC_STAGES; s++)
+    hvacRuntime[s].lifetime = totals[s];
+
+  lastRuntimeAccount = now;
+  lastRuntimeMinute = now / 60000;
+  lastRuntimeHour = now / 3600000;
+  lastRuntimeSave = now;
+  lastRuntimeDay = -1;
+  activeStage = NO_STAGE;
+}
+
+// Persist the lifetime totals, but no more than once per RUNTIME_SAVE_INTERVAL
+static void runtime_save(bool force)
+{
+  HVAC_STAGE_TOTALS totals[NR_HVAC_STAGES];
+
+  if (!runtimeDirty)
+    return;
+  if (!force && (millis() - lastRuntimeSave < RUNTIME_SAVE_INTERVAL))
+    return;
+
+  for (int s = 0; s < NR_HVAC_STAGES; s++)
+    totals[s] = hvacRuntime[s].lifetime;
+  if (eepromUpdateHvacRuntime(totals))
+    runtimeDirty = false;
+  lastRuntimeSave = millis();
+}
+
+void hvacGetRuntimeStats(HVAC_STAGE stage, HVAC_RUNTIME_STATS *stats)
+{
+  const HVAC_STAGE_RUNTIME *rt;
+  uint32_t hourMs = 0;
+  uint64_t dayMs = 0;
+
+  memset(stats, 0, sizeof(HVAC_RUNTIME_STATS));
+  if (stage >= NR_HVAC_STAGES)
+    return;
+
+  rt = &hvacRuntime[stage];
+  for (int m = 0; m < RUNTIME_MINUTE_BUCKETS; m++)
+    hourMs += rt->minuteMs[m];
+  for (int h = 0; h < RUNTIME_HOUR_BUCKETS; h++)
+    dayMs += rt->hourMs[h];
+
+  stats->active = (activeStage == stage);
+  stats->todaySeconds = rt->todayMs / 1000;
+  stats->todayCycles = rt->todayCycles;
+  stats->lifetime = rt->lifetime;
+  if (rt->lifetime.cycles)
+    stats->avgCycleSeconds = rt->lifetime.onSeconds / rt->lifetime.cycles;
+  stats->dutyHour = (float)hourMs * 100.0 / 3600000.0;
+  stats->dutyDay = (float)dayMs * 100.0 / (24.0 * 3600000.0);
+}
+
 static inline bool is_invalid_desc(const struct gpio_pin_desc desc)
 {
   struct gpio_pin_desc inv = INVALID_PIN();
@@ -80,13 +319,14 @@ static void set_hvac_mode(HVAC_MODE mode)
     gpio_set_level((gpio_num_t)desc[i].pin, (uint32_t)desc[i].level);
   }
 
+  runtime_track_mode(mode);
   OperatingParameters.hvacOpMode = mode;
 }
 
 #define COND_LOG(cond, log_msg, ...) ({           \
   int __ret_on_cond = !!(cond);                   \
   if (__ret_on_cond) {                            \
-    ESP_LOGI(__FUNCTION__, log_msg, __VA_ARGS__); \
+    BLOGI(__FUNCTION__, log_msg, __VA_ARGS__);    \
   }                                               \
   (__ret_on_cond);                                \
 })
@@ -114,6 +354,7 @@ void hvacStateUpdate()
   float currentTemp;
   float minTemp, maxTemp;
   float autoMinTemp, autoMaxTemp;
+  float setback;
   HVAC_MODE prev_mode = OperatingParameters.hvacOpMode;
 
   currentTemp = OperatingParameters.tempCurrent + OperatingParameters.tempCorrection;
@@ -122,6 +363,19 @@ void hvacStateUpdate()
   autoMinTemp = get_min_temp(&OperatingParameters, true);
   autoMaxTemp = get_max_temp(&OperatingParameters, true);
 
+  // Eco setback while nobody is home: heat to a lower and cool to a
+  // higher temperature
+  setback = occupancySetback();
+  if (OperatingParameters.hvacSetMode == COOL) {
+    minTemp += setback;
+    maxTemp += setback;
+  } else {
+    minTemp -= setback;
+    maxTemp -= setback;
+  }
+  autoMinTemp -= setback;
+  autoMaxTemp += setback;
+
   switch (OperatingParameters.hvacSetMode) {
   case OFF:
     set_hvac_mode(OFF);
@@ -132,6 +386,14 @@ void hvacStateUpdate()
     COND_LOG(prev_mode != FAN_ONLY, "Entering fan only mode: Current: %.2f", currentTemp);
     break;
   case HEAT:
+    if (OperatingParameters.hvacControlMode != CONTROL_HYSTERESIS) {
+      bool run = hvacControlDemand(STAGE_HEAT, prev_mode == HEAT, currentTemp, minTemp, maxTemp);
+      set_hvac_mode(run ? HEAT : IDLE);
+      COND_LOG(prev_mode != OperatingParameters.hvacOpMode, "%s heat mode (%s): Current: %.2f  Lo Limit: %.2f  Hi Limit: %.2f",
+               run ? "Entering" : "Stopping", hvacControlModeToString(OperatingParameters.hvacControlMode),
+               currentTemp, minTemp, maxTemp);
+      break;
+    }
     if (currentTemp < minTemp) {
       set_hvac_mode(HEAT);
       COND_LOG(prev_mode != HEAT, "Entering heat mode: Current: %.2f  Lo Limit: %.2f", currentTemp, minTemp);
@@ -160,6 +422,14 @@ void hvacStateUpdate()
     }
     break;
   case COOL:
+    if (OperatingParameters.hvacControlMode != CONTROL_HYSTERESIS) {
+      bool run = hvacControlDemand(STAGE_COOL, prev_mode == COOL, currentTemp, minTemp, maxTemp);
+      set_hvac_mode(run ? COOL : IDLE);
+      COND_LOG(prev_mode != OperatingParameters.hvacOpMode, "%s cool mode (%s): Current: %.2f  Lo Limit: %.2f  Hi Limit: %.2f",
+               run ? "Entering" : "Stopping", hvacControlModeToString(OperatingParameters.hvacControlMode),
+               currentTemp, minTemp, maxTemp);
+      break;
+    }
     if (currentTemp > maxTemp) {
       set_hvac_mode(COOL);
       COND_LOG(prev_mode != COOL, "Entering cool mode: Current: %.2f  Hi Limit: %.2f", currentTemp, maxTemp);
@@ -181,16 +451,9 @@ void hvacStateUpdate()
     }
     break;
   }
-}
 
-static inline bool wifi_reconnect_check(OPERATING_PARAMETERS *params)
-{
-  bool ret = ( !(params->wifiConnected) && strlen(WifiCreds.ssid) && WifiStarted() ) ||
-                WifiRestartPending();
-#ifdef MATTER_ENABLED
-  ret = ret && !(params->MatterStarted);
-#endif
-return ret;
+  // Learn the thermal response from whatever was actually driven
+  hvacControlObserve(OperatingParameters.hvacOpMode, currentTemp);
 }
 
 static inline bool is_mqtt_enabled(OPERATING_PARAMETERS *params)
@@ -213,30 +476,43 @@ static inline bool is_mqtt_connected(OPERATING_PARAMETERS *params)
 
 void stateMachine(void *parameter)
 {
+  int64_t lastRuntimePublish;
+
   lastTimeUpdate = millis();
-  lastWifiReconnect = millis();
+  lastRuntimePublish = millis();
+  runtime_init();
+  hvacControlInit();
 
   for (;;) {
-    // Update sensor readings
-    OperatingParameters.lightDetected = readLightSensor();
+    int64_t loopStart = esp_timer_get_time();
+
+    // Scheduled set point changes
+    scheduleLoop();
+
+    // Per-task CPU usage
+    profilerLoop();
 
-    // Update state of motion sensor
-    ld2410_loop();
+    // Heap levels, leak & fragmentation alerts
+    heapMonitorLoop();
+
+    // mDNS address, host name & TXT record updates
+    mdnsLoop();
 
     // Update HVAC State machine
     hvacStateUpdate();
+    bootMilestone(BOOT_FIRST_DECISION);
+
+    // Runtime of whatever is running, and the duty cycle windows, even
+    // while hvacStateUpdate() leaves the outputs alone
+    runtime_accumulate(millis());
 
-    // Check and Update wifi connection status
+    // Update wifi connection status; the wifi manager reconnects
     OperatingParameters.wifiConnected = WifiConnected();
-    if ((millis() > lastWifiReconnect + WIFI_CONNECT_INTERVAL) &&
-        (wifi_reconnect_check(&OperatingParameters)))
-    {
-      lastWifiReconnect = millis();
-      startReconnectTask();
-    }
 
+    // Until their boot phases are done, telnet & MQTT are still being
+    // started by app_main()
     if (OperatingParameters.wifiConnected) {
-      if (!telnetServiceRunning())
+      if (!telnetServiceRunning() && bootDone(BOOT_TELNET))
         telnetStart();
 
       //
@@ -245,7 +521,7 @@ void stateMachine(void *parameter)
       // NB: We never set MqttConnectCalled to false so it is only ever
       // called once at startup. The MQTT subsystem handles reconnects.
       //
-      if (is_mqtt_enabled(&OperatingParameters) &&
+      if (is_mqtt_enabled(&OperatingParameters) && bootDone(BOOT_MQTT) &&
           !is_mqtt_connected(&OperatingParameters) && !MqttConnectCalled) {
         MqttConnectCalled = true;
         MqttConnect();
@@ -260,6 +536,19 @@ void stateMachine(void *parameter)
       updateTimeSntp();
     }
 
+    // Keep the runtime counters in NVS reasonably current without
+    // wearing out the flash
+    runtime_save(false);
+#ifdef MQTT_ENABLED
+    if (millis() - lastRuntimePublish > RUNTIME_PUBLISH_INTERVAL) {
+      lastRuntimePublish = millis();
+      MqttRuntimeUpdate();
+      MqttDiagnosticsUpdate();
+    }
+#endif
+
+    metricObserveSince(METRIC_STATE_LOOP, loopStart);
+
     // Pause the task again for 40ms
     vTaskDelay(pdMS_TO_TICKS(40));
   }
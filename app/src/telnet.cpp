@@ -16,9 +16,21 @@
  * Copyright (c) 2023 Steve Meisner (steve@meisners.net)
  *
  * Notes:
- * - Currently, this implementation handles only 1 connected user. This
- *   means once someone is connected via telnet, they cannot be interrupted.
- *   If this feels like a potential security concern, that's because it is (DoS)!
+ * - A single task services the listening socket and up to
+ *   TELNET_MAX_SESSIONS clients with select(). Sockets are non-blocking;
+ *   each session has its own libtelnet state, input line buffer and
+ *   output queue, so an idle or slow client never holds up the others.
+ * - Output that doesn't fit in a session's queue is dropped (and counted)
+ *   rather than waited for. Log monitoring reads the log ring (logging.cpp)
+ *   through a per-session cursor and only takes what fits in the queue.
+ *   "Monitor b" sends BLOGx records undecoded, as "#B<base64>" lines for
+ *   decode-log.py to expand on the host.
+ * - Command lines are run by the shared console (console.cpp); only the
+ *   session commands (Config, Monitor, History, Quit) live here. Clients
+ *   that accept WILL ECHO get character at a time line editing with tab
+ *   completion and history.
+ * - Sessions idle for TELNET_IDLE_TIMEOUT_MS are closed, unless they are
+ *   monitoring the log.
  *
  * History
  *   4-Nov-2023: Steve Meisner (steve@meisners.net) - Initial version
@@ -49,83 +61,203 @@
 #include <errno.h>
 
 #include "thermostat.hpp"
+#include "binlog.hpp"
 #include "esp_event.h"
 #include "string.h"
 #include "telnet.h"
-#include "version.h"
 
-#include <esp_heap_caps.h>
-
-// Implemented in web.cpp
-float doTempUp(void);
-float doTempDown(void);
+#include "mbedtls/base64.h"
+#include <fcntl.h>
 
 static char tag[] = "telnet";
 
+#define TELNET_LINE_SIZE        (256)
+#define TELNET_OUTQ_SIZE        (4096)      // Per session; a full STATUS is ~2k
+#define TELNET_RECV_SIZE        (512)
+#define TELNET_SELECT_MS        (100)       // Also the log drain interval
+#define TELNET_IDLE_TIMEOUT_MS  (30 * 60 * 1000)
+#define TELNET_STOP_TIMEOUT_MS  (1000)
+#define TELNET_LOG_LINE_SIZE    LOG_LINE_MAX
+#define TELNET_PROMPT           "> "
+
 typedef enum {
   NOT_LISTENING = 0,
   STARTING,
   LISTENING
 } TELNET_STATE;
 
-static vprintf_like_t OrigEsplogger = NULL;
-static bool telnetLoggerActive = false;
-static bool disconnectPending = false;
-static TELNET_STATE telnetState = NOT_LISTENING;
+typedef struct
+{
+  int sockfd;                   // -1 when the slot is free
+  telnet_t *tnHandle;
+  char line[TELNET_LINE_SIZE];  // Input assembled until end of line
+  size_t lineLen;
+  uint8_t *outq;                // Output waiting for the socket to drain
+  size_t outStart;
+  size_t outLen;
+  uint32_t outDropped;
+  bool monitor;                 // Receiving log output
+  bool monitorBinary;           // ... with binlog records left undecoded
+  bool echo;                    // Client agreed to let us echo: edit lines here
+  bool lastCr;                  // Last character was a CR
+  uint8_t escape;               // Position in an escape sequence
+  CONSOLE_HISTORY history;
+  int historyPos;               // History line being shown, 0 for a new one
+  LOG_CURSOR logCursor;
+  bool closing;                 // Close once outq has drained
+  int configStep;               // Step of the Config dialog, -1 if none
+  uint32_t lastActivity;
+} TELNET_SESSION;
+
+static TELNET_SESSION sessions[TELNET_MAX_SESSIONS];
+
+// Session whose command is being run; all telnet_esp32_printf() output
+// goes there. Only ever set on the telnet task.
+static TELNET_SESSION *currentSession = NULL;
+
+// Only one session may run the Config dialog at a time
+static TELNET_SESSION *configSession = NULL;
+
+// Networks entered in the Config dialog; added to the saved list only
+// when the changes are saved
+typedef struct
+{
+  char ssid[sizeof(WifiCreds.ssid)];
+  char password[sizeof(WifiCreds.password)];
+} CONFIG_NETWORK;
+static CONFIG_NETWORK configNetwork;                          // First choice
+static CONFIG_NETWORK configFallbacks[WIFI_NETWORKS_MAX - 1];
+static int configFallbackCount;                               // Entered in full; the next may be half done
 
-// The global tnHandle ... since we are only processing ONE telnet
-// client at a time, this can be a global static.
-static telnet_t *tnHandle;
+static TELNET_STATE telnetState = NOT_LISTENING;
+static volatile bool stopRequested = false;
+static SemaphoreHandle_t telnetStopped = NULL;
 
 // Task handle for the telnet RTOS service task
 static TaskHandle_t telnetTaskHandle = NULL;
 
-// Func declaration for the callback when data is received on telnet session
-static void (*receivedDataCallback)(int sock, uint8_t *buffer, size_t size);
+// Func declaration for the callback when a line is received on a telnet session
+static void (*receivedDataCallback)(char *buffer, size_t size);
 
 // Primary descriptor for the listening telnet socket
-static int serverSocket=0;
+static int serverSocket = -1;
 
-// All valid commands as enums
-typedef enum
-{
-  HELP = 0,
-  HELP_2,
-  CONFIG,
-  TEMP_UP,
-  TEMP_DOWN,
-  TEMP_SET,
-  LOG_LEVEL,
-  MODE_SET,
-  MONITOR_LOG,
-  STATUS,
-  ERROR_COUNTS,
-  REBOOT,
-  QUIT,
-  UNKNOWN
-} CMD;
-
-// List of valid command strings
-const char *cmdStrings[] = {"HELP", "?", "CONFIG", "UP", "DOWN", "TEMP", "LOG", "MODE", "MONITOR", "STATUS", "ERROR", "REBOOT", "QUIT", NULL};
+static void session_flush(TELNET_SESSION *s);
 
 #define min(x, y) ((x > y) ? y : x)
 
-typedef struct 
+
+//
+// Append raw (already telnet encoded) bytes to a session's output queue.
+// If the queue is full, try to push some of it out first; whatever still
+// doesn't fit is dropped.
+//
+static void session_queue(TELNET_SESSION *s, const char *data, size_t size)
 {
-  int sockfd;
-} TELNET_USER_DATA;
+  if ((s->sockfd == -1) || (s->outq == NULL))
+    return;
+
+  if (TELNET_OUTQ_SIZE - s->outLen < size)
+    session_flush(s);
+  if (TELNET_OUTQ_SIZE - s->outLen < size)
+  {
+    s->outDropped += size;
+    return;
+  }
 
+  size_t tail = (s->outStart + s->outLen) % TELNET_OUTQ_SIZE;
+  size_t chunk = min(size, (size_t)(TELNET_OUTQ_SIZE - tail));
 
-void revertTelnetLogger()
+  memcpy(&s->outq[tail], data, chunk);
+  memcpy(s->outq, data + chunk, size - chunk);
+  s->outLen += size;
+}
+
+//
+// Send as much queued output as the socket will take without blocking.
+// A send error marks the session for closing; it is never closed here
+// since this may be running inside a libtelnet callback.
+//
+static void session_flush(TELNET_SESSION *s)
 {
-  // Shutdown the telnet logger, if active;
-  if (telnetLoggerActive == true)
+  while ((s->sockfd != -1) && (s->outLen > 0))
+  {
+    size_t chunk = min(s->outLen, (size_t)(TELNET_OUTQ_SIZE - s->outStart));
+    ssize_t rc = send(s->sockfd, &s->outq[s->outStart], chunk, 0);
+
+    if (rc < 0)
+    {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        return;
+      ESP_LOGE(tag, "send: %d (%s)", errno, strerror(errno));
+      OperatingParameters.Errors.telnetNetworkErrors++;
+      s->outLen = 0;
+      s->closing = true;
+      return;
+    }
+    s->outStart = (s->outStart + rc) % TELNET_OUTQ_SIZE;
+    s->outLen -= rc;
+  }
+
+  if ((s->outLen == 0) && (s->outDropped > 0))
   {
-    telnetLoggerActive = false;
-    esp_log_set_vprintf(OrigEsplogger);
+    char note[48];
+    int n = snprintf(note, sizeof(note), "\r\n[%lu bytes of output dropped]\r\n", s->outDropped);
+
+    s->outDropped = 0;
+    session_queue(s, note, n);
   }
 }
 
+int telnetSessionCount()
+{
+  int n = 0;
+
+  for (int i = 0; i < TELNET_MAX_SESSIONS; i++)
+    if (sessions[i].sockfd != -1)
+      n++;
+  return n;
+}
+
+/**
+ * Send data to the telnet partner.
+ */
+void telnet_esp32_sendData(uint8_t *buffer, size_t size)
+{
+  if ((currentSession != NULL) && (currentSession->tnHandle != NULL))
+  {
+    telnet_send(currentSession->tnHandle, (char *)buffer, size);
+  }
+} // telnet_esp32_sendData
+
+/**
+ * Send a vprintf formatted output to the telnet partner.
+ */
+int telnet_esp32_vprintf(const char *fmt, va_list va)
+{
+  if ((currentSession == NULL) || (currentSession->tnHandle == NULL))
+  {
+    return 0;
+  }
+  return telnet_vprintf(currentSession->tnHandle, fmt, va);
+} // telnet_esp32_vprintf
+
+/**
+ * Send a vprintf formatted output to the telnet partner.
+ */
+int telnet_esp32_printf(const char *fmt, ...)
+{
+  va_list va;
+  int rs;
+
+  va_start(va, fmt);
+  rs = telnet_esp32_vprintf(fmt, va);
+  va_end(va);
+
+  return rs;
+} // telnet_esp32_vprintf
+
+
 /**
  * Convert a telnet event type to its string representation.
  */
@@ -167,380 +299,409 @@ static char *eventToString(telnet_event_type_t type)
   return (char *)"Unknown type";
 } // eventToString
 
-/**
- * Send data to the telnet partner.
- */
-void telnet_esp32_sendData(uint8_t *buffer, size_t size)
-{
-  if (tnHandle != NULL)
-  {
-    telnet_send(tnHandle, (char *)buffer, size);
-  }
-} // telnet_esp32_sendData
-
-/**
- * Send a vprintf formatted output to the telnet partner.
- */
-int telnet_esp32_vprintf(const char *fmt, va_list va)
-{
-  if (tnHandle == NULL)
-  {
-    return 0;
-  }
-  return telnet_vprintf(tnHandle, fmt, va);
-} // telnet_esp32_vprintf
-
-/**
- * Send a vprintf formatted output to the telnet partner.
- */
-int telnet_esp32_printf(const char *fmt, ...)
-{
-  va_list va;
-  int rs;
-
-  va_start(va, fmt);
-  rs = telnet_vprintf(tnHandle, fmt, va);
-  va_end(va);
-
-  return rs;
-} // telnet_esp32_vprintf
-
-void DisplayErrors()
+//
+// The Config dialog. Each step prints a prompt showing the current value;
+// the next line received on the session answers it. An empty answer keeps
+// the current value.
+//
+typedef enum
 {
-  telnet_esp32_printf("Current Error Counts:\n");
-  telnet_esp32_printf("--------------------------------------------------------\n");
-
-  telnet_esp32_printf("System errors: %d\n", OperatingParameters.Errors.systemErrors);
-  telnet_esp32_printf("Hardware errors: %d\n", OperatingParameters.Errors.hardwareErrors);
-  telnet_esp32_printf("Wifi errors: %d\n", OperatingParameters.Errors.wifiErrors);
-
-#ifdef MQTT_ENABLED
-  telnet_esp32_printf("MQTT Connect errors: %d\n", OperatingParameters.Errors.mqttConnectErrors);
-  telnet_esp32_printf("MQTT Protocol errors: %d\n", OperatingParameters.Errors.mqttProtocolErrors);
-#endif
-#ifdef MATTER_ENABLED
-  telnet_esp32_printf("Matter Connect errors: %d\n", OperatingParameters.Errors.matterConnectErrors);
+  CFG_DEVICE_NAME = 0,
+  CFG_FRIENDLY_NAME,
+  CFG_WIFI_SSID,
+  CFG_WIFI_PASSWORD,
+  CFG_WIFI_FALLBACK_SSID,
+  CFG_WIFI_FALLBACK_PASSWORD,
+  CFG_SWING,
+  CFG_TEMP_CORRECTION,
+  CFG_HUMIDITY_CORRECTION,
+  CFG_SLEEP_TIME,
+  CFG_TIMEZONE,
+  CFG_BEEP,
+#ifdef MATTER
+  CFG_MATTER,
 #endif
-#ifdef TELNET_ENABLED
-  telnet_esp32_printf("Telnet network errors: %d\n", OperatingParameters.Errors.telnetNetworkErrors);
+#ifdef MQTT_ENABLED
+  CFG_MQTT_ENABLE,
+  CFG_MQTT_HOST,
+  CFG_MQTT_PORT,
+  CFG_MQTT_USERNAME,
+  CFG_MQTT_PASSWORD,
 #endif
-}
+  CFG_SAVE,
+  CFG_DONE
+} CONFIG_STEP;
 
-void DisplayStatus()
+static void configPrompt(int step)
 {
-  telnet_esp32_printf("Current Status:\n");
-  telnet_esp32_printf("--------------------------------------------------------\n");
-
-  telnet_esp32_printf("Firmware version: %s\n", VersionString);
-  telnet_esp32_printf("Firmware build date: %s\n", VersionBuildDateTime);
-
-  telnet_esp32_printf("LD2410 Firmware: %s\n", OperatingParameters.ld2410FirmWare);
-
-  telnet_esp32_printf("Device name: %s\n", OperatingParameters.DeviceName);
-  telnet_esp32_printf("Friendly name: %s\n", OperatingParameters.FriendlyName);
-
+  switch (step)
   {
-    int64_t uptime = millis();
-    telnet_esp32_printf("Uptime: %d days, %02d:%02d:%02d\n",
-                        (int)(uptime / (1000L * 60L * 60L * 24L)), // days
-                        (int)(uptime / (1000L * 60L * 60L)) % 24,  // hours
-                        (int)(uptime / (1000L * 60L)) % 60,        // mins
-                        (int)(uptime / 1000L) % 60);               // seconds
-  }
-
-  uint32_t freeHeapBytes = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
-  uint32_t totalHeapBytes = heap_caps_get_total_size(MALLOC_CAP_DEFAULT);
-  float percentageHeapFree = freeHeapBytes * 100.0f / (float)totalHeapBytes;
-  telnet_esp32_printf ("Free Heap size: %d\n", esp_get_free_heap_size());
-  telnet_esp32_printf ("[Memory] %.1f%% free - %d of %d bytes free\n", percentageHeapFree, freeHeapBytes, totalHeapBytes);
-
-  telnet_esp32_printf("MAC Address: %02x:%02x:%02x:%02x:%02x:%02x\n",
-                      OperatingParameters.mac[0],
-                      OperatingParameters.mac[1],
-                      OperatingParameters.mac[2],
-                      OperatingParameters.mac[3],
-                      OperatingParameters.mac[4],
-                      OperatingParameters.mac[5]);
-  telnet_esp32_printf("Wifi SSID: %s\n", WifiCreds.ssid);
-  telnet_esp32_printf("Wifi connected: %s\n", OperatingParameters.wifiConnected ? "Yes" : "No");
-  telnet_esp32_printf("Wifi signal: %d%%\n", WifiSignal());
-  telnet_esp32_printf("Wifi IP address: %s\n", WifiAddress());
-
-  {
-    struct tm local_time;
-    char buffer[16];
+  case CFG_DEVICE_NAME:
+    telnet_esp32_printf("Device name [%s]: ", OperatingParameters.DeviceName);
+    break;
+  case CFG_FRIENDLY_NAME:
+    telnet_esp32_printf("Friendly name [%s]: ", OperatingParameters.FriendlyName);
+    break;
+  case CFG_WIFI_SSID:
+    telnet_esp32_printf("WIFI Network name [%s]: ", configNetwork.ssid);
+    break;
+  case CFG_WIFI_PASSWORD:
+    telnet_esp32_printf("WIFI Password or PSK [%s]: ", configNetwork.password);
+    break;
+  case CFG_WIFI_FALLBACK_SSID:
+    telnet_esp32_printf("Add a fallback WIFI network (%d of %d saved, %d to add) []: ",
+                        WifiCreds.count, WIFI_NETWORKS_MAX, configFallbackCount);
+    break;
+  case CFG_WIFI_FALLBACK_PASSWORD:
+    telnet_esp32_printf("WIFI Password or PSK for %s: ", configFallbacks[configFallbackCount].ssid);
+    break;
+  case CFG_SWING:
+    telnet_esp32_printf("Swing temperature [%.1f]: ", OperatingParameters.tempSwing);
+    break;
+  case CFG_TEMP_CORRECTION:
+    telnet_esp32_printf("Temperature correction [%+.1f]: ", OperatingParameters.tempCorrection);
+    break;
+  case CFG_HUMIDITY_CORRECTION:
+    telnet_esp32_printf("Humidity correction [%+.1f]: ", OperatingParameters.humidityCorrection);
+    break;
+  case CFG_SLEEP_TIME:
+    telnet_esp32_printf("Display Sleep time [%d]: ", OperatingParameters.thermostatSleepTime);
+    break;
+  case CFG_TIMEZONE:
+    telnet_esp32_printf("Timezone [%s]: ", OperatingParameters.timezone);
+    break;
+  case CFG_BEEP:
+    telnet_esp32_printf("Touchscreen Beep [%s]: ", (OperatingParameters.thermostatBeepEnable) ? "Yes" : "No");
+    break;
 
-    getLocalTime(&local_time, 1);
-    strftime(buffer, sizeof(buffer), "%H:%M:%S", &local_time);
-    telnet_esp32_printf("Current time: %s", buffer);
-  }
-  telnet_esp32_printf("    Timezone: %s\n", OperatingParameters.timezone);
+    //@@@	HVAC modes
+    // 2-stage heat
+    // Reverse valve
 
-#ifdef MQTT_ENABLED
-  telnet_esp32_printf("MQTT Enabled: %s\n", (OperatingParameters.MqttEnabled) ? "Yes" : "No");
-  telnet_esp32_printf("MQTT Connected: %s\n", (OperatingParameters.MqttConnected) ? "Yes" : "No");
-  telnet_esp32_printf("MQTT Broker: %s  Port: %d\n", OperatingParameters.MqttBrokerHost, OperatingParameters.MqttBrokerPort);
-  telnet_esp32_printf("MQTT Username:  %s\n", OperatingParameters.MqttBrokerUsername);
-  telnet_esp32_printf("MQTT Password:  %s\n", OperatingParameters.MqttBrokerPassword);
+#ifdef MATTER
+  case CFG_MATTER:
+    telnet_esp32_printf("Enable Matter [%s]: ", (OperatingParameters.Matter) ? "Yes" : "No");
+    break;
 #endif
-
-#ifdef MATTER_ENABLED
-  telnet_esp32_printf("Matter Enabled: %s\n", (OperatingParameters.MatterEnabled) ? "Yes" : "No");
-  telnet_esp32_printf("Matter Started: %s\n", (OperatingParameters.MatterStarted) ? "Yes" : "No");
+#ifdef MQTT_ENABLED
+  case CFG_MQTT_ENABLE:
+    telnet_esp32_printf("Enable MQTT [%s]: ", (OperatingParameters.MqttEnabled) ? "Yes" : "No");
+    break;
+  case CFG_MQTT_HOST:
+    telnet_esp32_printf("MQTT Broker Hostname [%s]: ", OperatingParameters.MqttBrokerHost);
+    break;
+  case CFG_MQTT_PORT:
+    telnet_esp32_printf("MQTT Broker Port [%d]: ", OperatingParameters.MqttBrokerPort);
+    break;
+  case CFG_MQTT_USERNAME:
+    telnet_esp32_printf("MQTT Broker Username [%s]: ", OperatingParameters.MqttBrokerUsername);
+    break;
+  case CFG_MQTT_PASSWORD:
+    telnet_esp32_printf("MQTT Broker Password [%s]: ", OperatingParameters.MqttBrokerPassword);
+    break;
 #endif
-
-  telnet_esp32_printf("Current temp: %.1f %c (Correction: %+.1f)\n",
-                      OperatingParameters.tempCurrent + OperatingParameters.tempCorrection,
-                      OperatingParameters.tempUnits,
-                      OperatingParameters.tempCorrection);
-  telnet_esp32_printf("Current humidity: %.1f%% (Correction: %+.1f)\n",
-                      OperatingParameters.humidCurrent + OperatingParameters.humidityCorrection,
-                      OperatingParameters.humidityCorrection);
-  telnet_esp32_printf("Target temp: %.1f %c\n", OperatingParameters.tempSet);
-  telnet_esp32_printf("Swing temp: %.1f %c\n", OperatingParameters.tempSwing);
-
-  telnet_esp32_printf("Light detected: %d\n", OperatingParameters.lightDetected);
-  telnet_esp32_printf("Motion detected: %s\n", OperatingParameters.motionDetected ? "Yes" : "No");
-  telnet_esp32_printf("Display sleep time: %d\n", OperatingParameters.thermostatSleepTime);
-  telnet_esp32_printf("Touch screen beep: %s\n", OperatingParameters.thermostatBeepEnable ? "Enabled" : "Disabled");
-
-  telnet_esp32_printf("Current HVAC mode set: %s (Currently: %s)\n",
-                      hvacModeToString(OperatingParameters.hvacSetMode),
-                      hvacModeToString(OperatingParameters.hvacOpMode));
-
-  telnet_esp32_printf("HVAC modes enabled:\n");
-  telnet_esp32_printf("  Heat: %s  Cool: %s  Fan: %s\n",
-                      "True", OperatingParameters.hvacCoolEnable ? "True" : "False",
-                      OperatingParameters.hvacFanEnable ? "True" : "False");
-  telnet_esp32_printf("  2-stage heating enabled: %s\n",
-                      OperatingParameters.hvac2StageHeatEnable ? "True" : "False");
-  telnet_esp32_printf("  Reversing valve (heat pumps): %s\n",
-                      OperatingParameters.hvacReverseValveEnable ? "True" : "False");
+  case CFG_SAVE:
+    telnet_esp32_printf("Save changes? [no]: ");
+    break;
+  }
 }
 
-void doConfiguration(int sock)
+//
+// Apply the answer to a step and return the next step
+//
+static int configAnswer(int step, char *buffer, size_t len)
 {
-  char buffer[128];
-  ssize_t len;
-
-  telnet_esp32_printf("Configuration\n");
-
-  telnet_esp32_printf("Device name [%s]: ", OperatingParameters.DeviceName);
-  len = recv(sock, buffer, sizeof(buffer), 0);
-  len -= 2;
-  buffer[len] = '\0';
-  if ((len) && (len < sizeof(buffer)))
-    strcpy(OperatingParameters.DeviceName, buffer);
-
-  telnet_esp32_printf("Friendly name [%s]: ", OperatingParameters.FriendlyName);
-  len = recv(sock, buffer, sizeof(buffer), 0);
-  len -= 2;
-  buffer[len] = '\0';
-  if ((len) && (len < sizeof(buffer)))
-    strcpy(OperatingParameters.FriendlyName, buffer);
-
-  telnet_esp32_printf("WIFI Network name [%s]: ", WifiCreds.ssid);
-  len = recv(sock, buffer, sizeof(buffer), 0);
-  len -= 2;
-  buffer[len] = '\0';
-  if ((len) && (len < sizeof(buffer)))
-    strcpy(WifiCreds.ssid, buffer);
-
-  telnet_esp32_printf("WIFI Password or PSK [%s]: ", WifiCreds.password);
-  len = recv(sock, buffer, sizeof(buffer), 0);
-  len -= 2;
-  buffer[len] = '\0';
-  if ((len) && (len < sizeof(buffer)))
-    strcpy(WifiCreds.password, buffer);
-
-  telnet_esp32_printf("Swing temperature [%.1f]: ", OperatingParameters.tempSwing);
-  len = recv(sock, buffer, sizeof(buffer), 0);
-  len -= 2;
-  buffer[len] = '\0';
-  if ((len) && (len < sizeof(buffer)))
-    OperatingParameters.tempSwing = atof(buffer);
-
-  telnet_esp32_printf("Temperature correction [%+.1f]: ", OperatingParameters.tempCorrection);
-  len = recv(sock, buffer, sizeof(buffer), 0);
-  len -= 2;
-  buffer[len] = '\0';
-  if ((len) && (len < sizeof(buffer)))
-    OperatingParameters.tempCorrection = atof(buffer);
-
-  telnet_esp32_printf("Humidity correction [%+.1f]: ", OperatingParameters.humidityCorrection);
-  len = recv(sock, buffer, sizeof(buffer), 0);
-  len -= 2;
-  buffer[len] = '\0';
-  if ((len) && (len < sizeof(buffer)))
-    OperatingParameters.humidityCorrection = atof(buffer);
-
-  telnet_esp32_printf("Display Sleep time [%d]: ", OperatingParameters.thermostatSleepTime);
-  len = recv(sock, buffer, sizeof(buffer), 0);
-  len -= 2;
-  buffer[len] = '\0';
-  if ((len) && (len < sizeof(buffer)))
-    OperatingParameters.thermostatSleepTime = atoi(buffer);
-
-  telnet_esp32_printf("Timezone [%s]: ", OperatingParameters.timezone);
-  len = recv(sock, buffer, sizeof(buffer), 0);
-  len -= 2;
-  buffer[len] = '\0';
-  if ((len) && (len < sizeof(buffer)))
+  switch (step)
   {
-    int i = 0;
-    while ((strcmp(gmt_timezones[i], (const char *)buffer) != 0) && (i < 24))
-      i++;
-    if (i < 24)
+  case CFG_DEVICE_NAME:
+    if (len)
+      strlcpy(OperatingParameters.DeviceName, buffer, sizeof(OperatingParameters.DeviceName));
+    break;
+  case CFG_FRIENDLY_NAME:
+    if (len)
+      strlcpy(OperatingParameters.FriendlyName, buffer, sizeof(OperatingParameters.FriendlyName));
+    break;
+  case CFG_WIFI_SSID:
+    if (len >= sizeof(configNetwork.ssid))
     {
-      OperatingParameters.timezone_sel = i;
-      OperatingParameters.timezone = (char *)(gmt_timezones[OperatingParameters.timezone_sel]);
+      telnet_esp32_printf("Network name too long\n");
+      return step;
     }
-    else
+    if (len)
+      strlcpy(configNetwork.ssid, buffer, sizeof(configNetwork.ssid));
+    break;
+  case CFG_WIFI_PASSWORD:
+    if (len >= sizeof(configNetwork.password))
     {
-      telnet_esp32_printf("Invalid timezone (example GMT+10)\n");
+      telnet_esp32_printf("Password too long\n");
+      return step;
     }
-  }
-
-  telnet_esp32_printf("Touchscreen Beep [%s]: ", (OperatingParameters.thermostatBeepEnable) ? "Yes" : "No");
-  len = recv(sock, buffer, sizeof(buffer), 0);
-  len -= 2;
-  buffer[len] = '\0';
-  if ((len) && (len < sizeof(buffer)))
-    if (lwip_stricmp("yes", buffer) == 0)
-      OperatingParameters.thermostatBeepEnable = true;
-    else
-      OperatingParameters.thermostatBeepEnable = false;
-
-      //@@@	HVAC modes
-      // 2-stage heat
-      // Reverse valve
-      // timezone
-
+    if (len)
+      strlcpy(configNetwork.password, buffer, sizeof(configNetwork.password));
+    break;
+  case CFG_WIFI_FALLBACK_SSID:
+    if (!len || (configFallbackCount >= WIFI_NETWORKS_MAX - 1))
+      return CFG_SWING;
+    if (len >= sizeof(configFallbacks[0].ssid))
+    {
+      telnet_esp32_printf("Network name too long\n");
+      return step;
+    }
+    strlcpy(configFallbacks[configFallbackCount].ssid, buffer, sizeof(configFallbacks[0].ssid));
+    break;
+  case CFG_WIFI_FALLBACK_PASSWORD:
+    if (len >= sizeof(configFallbacks[0].password))
+    {
+      telnet_esp32_printf("Password too long\n");
+      return step;
+    }
+    strlcpy(configFallbacks[configFallbackCount].password, buffer, sizeof(configFallbacks[0].password));
+    configFallbackCount++;
+    // Ask for another
+    return CFG_WIFI_FALLBACK_SSID;
+  case CFG_SWING:
+    if (len)
+      OperatingParameters.tempSwing = atof(buffer);
+    break;
+  case CFG_TEMP_CORRECTION:
+    if (len)
+      OperatingParameters.tempCorrection = atof(buffer);
+    break;
+  case CFG_HUMIDITY_CORRECTION:
+    if (len)
+      OperatingParameters.humidityCorrection = atof(buffer);
+    break;
+  case CFG_SLEEP_TIME:
+    if (len)
+      OperatingParameters.thermostatSleepTime = atoi(buffer);
+    break;
+  case CFG_TIMEZONE:
+    if (len)
+    {
+      int i = 0;
+      while ((i < 24) && (strcmp(gmt_timezones[i], (const char *)buffer) != 0))
+        i++;
+      if (i < 24)
+      {
+        OperatingParameters.timezone_sel = i;
+        OperatingParameters.timezone = (char *)(gmt_timezones[OperatingParameters.timezone_sel]);
+      }
+      else
+      {
+        telnet_esp32_printf("Invalid timezone (example GMT+10)\n");
+      }
+    }
+    break;
+  case CFG_BEEP:
+    if (len)
+      OperatingParameters.thermostatBeepEnable = (lwip_stricmp("yes", buffer) == 0);
+    break;
 #ifdef MATTER
-  telnet_esp32_printf("Enable Matter [%s]: ", (OperatingParameters.Matter) ? "Yes" : "No");
-  len = recv(sock, buffer, sizeof(buffer), 0);
-  len -= 2;
-  buffer[len] = '\0';
-  if ((len) && (len < sizeof(buffer)))
-    if (lwip_stricmp("yes", buffer) == 0)
-      OperatingParameters.Matter = true;
-    else
-      OperatingParameters.Matter = false;
+  case CFG_MATTER:
+    if (len)
+      OperatingParameters.Matter = (lwip_stricmp("yes", buffer) == 0);
+    break;
 #endif
-
 #ifdef MQTT_ENABLED
-  telnet_esp32_printf("Enable MQTT [%s]: ", (OperatingParameters.MqttEnabled) ? "Yes" : "No");
-  len = recv(sock, buffer, sizeof(buffer), 0);
-  len -= 2;
-  buffer[len] = '\0';
-  if ((len) && (len < sizeof(buffer)))
-    if (lwip_stricmp("yes", buffer) == 0)
-      OperatingParameters.MqttEnabled = true;
-    else
-      OperatingParameters.MqttEnabled = false;
-  if (OperatingParameters.MqttEnabled)
-  {
-    telnet_esp32_printf("MQTT Broker Hostname [%s]: ", OperatingParameters.MqttBrokerHost);
-    len = recv(sock, buffer, sizeof(buffer), 0);
-    len -= 2;
-    buffer[len] = '\0';
-    if ((len) && (len < sizeof(buffer)))
-      strcpy(OperatingParameters.MqttBrokerHost, buffer);
-
-    telnet_esp32_printf("MQTT Broker Port [%d]: ", OperatingParameters.MqttBrokerPort);
-    len = recv(sock, buffer, sizeof(buffer), 0);
-    len -= 2;
-    buffer[len] = '\0';
-    if ((len) && (len < sizeof(buffer)))
+  case CFG_MQTT_ENABLE:
+    if (len)
+      OperatingParameters.MqttEnabled = (lwip_stricmp("yes", buffer) == 0);
+    if (!OperatingParameters.MqttEnabled)
+      return CFG_SAVE;
+    break;
+  case CFG_MQTT_HOST:
+    if (len)
+      strlcpy(OperatingParameters.MqttBrokerHost, buffer, sizeof(OperatingParameters.MqttBrokerHost));
+    break;
+  case CFG_MQTT_PORT:
+    if (len)
       OperatingParameters.MqttBrokerPort = atoi(buffer);
-
-    telnet_esp32_printf("MQTT Broker Username [%s]: ", OperatingParameters.MqttBrokerUsername);
-    len = recv(sock, buffer, sizeof(buffer), 0);
-    len -= 2;
-    buffer[len] = '\0';
-    if ((len) && (len < sizeof(buffer)))
-      strcpy(OperatingParameters.MqttBrokerUsername, buffer);
-
-    telnet_esp32_printf("MQTT Broker Password [%s]: ", OperatingParameters.MqttBrokerPassword);
-    len = recv(sock, buffer, sizeof(buffer), 0);
-    len -= 2;
-    buffer[len] = '\0';
-    if ((len) && (len < sizeof(buffer)))
-      strcpy(OperatingParameters.MqttBrokerPassword, buffer);
-  }
+    break;
+  case CFG_MQTT_USERNAME:
+    if (len)
+      strlcpy(OperatingParameters.MqttBrokerUsername, buffer, sizeof(OperatingParameters.MqttBrokerUsername));
+    break;
+  case CFG_MQTT_PASSWORD:
+    if (len)
+      strlcpy(OperatingParameters.MqttBrokerPassword, buffer, sizeof(OperatingParameters.MqttBrokerPassword));
+    break;
 #endif
-
-  telnet_esp32_printf("Save changes? [no]: ");
-  len = recv(sock, buffer, sizeof(buffer), 0);
-  len -= 2;
-  buffer[len] = '\0';
-  if ((len) && (len < sizeof(buffer)))
-    if (lwip_strnicmp("yes", buffer, len) == 0)
+  case CFG_SAVE:
+    if ((len) && (lwip_strnicmp("yes", buffer, len) == 0))
     {
       telnet_esp32_printf("Resetting NVS\n");
       // nvs_flash_init();
       clearNVS();
+      // First in the list, ahead of the fallbacks
+      if (strlen(configNetwork.ssid))
+        WifiNetworkAdd(configNetwork.ssid, configNetwork.password, 0);
+      for (int i = 0; i < configFallbackCount; i++)
+        if (!WifiNetworkAdd(configFallbacks[i].ssid, configFallbacks[i].password, -1))
+          telnet_esp32_printf("Could not add %s\n", configFallbacks[i].ssid);
       /* Rewrite the wifi credentials after resetting NVS storage */
       telnet_esp32_printf("Rewriting wifi credentials\n");
       setWifiCreds();
       telnet_esp32_printf("Saving thermostat config\n");
       updateThermostatParams();
     }
+    telnet_esp32_printf("Config complete. If changes made, consider restarting (with 'Reboot')\n");
+    break;
+  }
+  return step + 1;
+}
 
-  telnet_esp32_printf("Config complete. If changes made, consider restarting (with 'Reboot')\n");
+static void doConfiguration(TELNET_SESSION *s)
+{
+  if ((configSession != NULL) && (configSession != s))
+  {
+    telnet_esp32_printf("Configuration is already in progress in another session\n");
+    return;
+  }
+  configSession = s;
+  s->configStep = CFG_DEVICE_NAME;
+  strlcpy(configNetwork.ssid, WifiCreds.ssid, sizeof(configNetwork.ssid));
+  strlcpy(configNetwork.password, WifiCreds.password, sizeof(configNetwork.password));
+  configFallbackCount = 0;
+  telnet_esp32_printf("Configuration\n");
+  configPrompt(s->configStep);
 }
 
-static CMD lookupCommnd(char *buffer, size_t len)
+static void configReceive(TELNET_SESSION *s, char *buffer, size_t len)
 {
-  int n = 0;
-  while (cmdStrings[n] != NULL)
+  s->configStep = configAnswer(s->configStep, buffer, len);
+  if (s->configStep >= CFG_DONE)
   {
-    if (lwip_strnicmp(cmdStrings[n], buffer, min(strlen(cmdStrings[n]), len)) == 0)
-    {
-      ESP_LOGI(tag, "Received telnet command: %s", cmdStrings[n]);
-      return (CMD)n;
-    }
-    n++;
+    s->configStep = -1;
+    configSession = NULL;
+    return;
   }
-  return UNKNOWN;
+  configPrompt(s->configStep);
 }
 
-static int telnetLogger(const char *fmt, va_list list)
+//
+// Read the next log line for a session. In binary mode records are sent
+// base64 encoded; text lines go out as they are.
+//
+static int telnet_log_read(TELNET_SESSION *s, char *line, size_t len)
 {
-  static char telnetBuffer[256];
+  uint8_t record[LOG_RECORD_MAX];
+  size_t olen;
+  bool binary;
+  int n;
+
+  if (!s->monitorBinary)
+    return logRead(&s->logCursor, line, len, NULL);
 
-  if (telnetLoggerActive == false)
+  n = logReadRaw(&s->logCursor, (char *)record, sizeof(record), NULL, &binary);
+  if ((n <= 0) || !binary)
   {
-    printf("telnetLogger: Telnet logger is not enabled!! Restoring original\n");
-    if (OrigEsplogger == NULL)
+    if (n > 0)
+      memcpy(line, record, n);
+    return n;
+  }
+  line[0] = '#';
+  line[1] = 'B';
+  if (mbedtls_base64_encode((unsigned char *)&line[2], len - 3, &olen, record, n) != 0)
+    return snprintf(line, len, "[binlog record too large]\n");
+  line[2 + olen] = '\n';
+  return olen + 3;
+}
+
+//
+// Copy new log lines to the sessions monitoring the log. A session only
+// takes what fits in its output queue; the rest waits in the log ring.
+//
+static void telnet_log_drain()
+{
+  char line[TELNET_LOG_LINE_SIZE];
+  int n;
+
+  for (int i = 0; i < TELNET_MAX_SESSIONS; i++)
+  {
+    TELNET_SESSION *s = &sessions[i];
+
+    if ((s->sockfd == -1) || !s->monitor || s->closing)
+      continue;
+    // Leave room for the \n -> \r\n expansion
+    while ((TELNET_OUTQ_SIZE - s->outLen > 2 * sizeof(line)) &&
+           ((n = telnet_log_read(s, line, sizeof(line))) > 0))
+      telnet_printf(s->tnHandle, "%.*s", n, line);
+    if (s->logCursor.dropped)
     {
-      printf("telnetLogger: No original logger defined - Restarting...\n");
-      esp_restart();
+      telnet_printf(s->tnHandle, "[%lu log lines dropped]\n", s->logCursor.dropped);
+      s->logCursor.dropped = 0;
     }
-    esp_log_set_vprintf(OrigEsplogger);
-    return ESP_OK;
   }
+}
 
-  OrigEsplogger(fmt, list);
+//
+// Commands that only make sense on a telnet session; the rest are shared
+// with other consoles (console.cpp)
+//
+static void cmd_config(CONSOLE *con, int argc, char *argv[])
+{
+  doConfiguration(currentSession);
+}
 
-  int res = vsprintf(telnetBuffer, fmt, list);
-  telnet_esp32_printf(telnetBuffer);
+static void cmd_monitor(CONSOLE *con, int argc, char *argv[])
+{
+  TELNET_SESSION *s = currentSession;
 
-  return res;
+  if (s->monitor)
+  {
+    telnet_esp32_printf("Error: log monitoring already active\n");
+    return;
+  }
+  telnet_esp32_printf("Enable log monitoring (CR to exit)\n");
+  logCursorInit(&s->logCursor, 0);
+  s->monitorBinary = (argc > 1) && (toupper(argv[1][0]) == 'B');
+  s->monitor = true;
+  ESP_LOGI(tag, "Log monitoring via telnet enabled");
+}
+
+static void cmd_history(CONSOLE *con, int argc, char *argv[])
+{
+  CONSOLE_HISTORY *history = &currentSession->history;
+
+  for (int i = history->count; i >= 1; i--)
+    telnet_esp32_printf("%3d  %s\n", i, consoleHistoryGet(history, i));
+}
+
+static void cmd_quit(CONSOLE *con, int argc, char *argv[])
+{
+  telnet_esp32_printf("Quiting telnet session\n");
+  ESP_LOGI(tag, "Telnet session terminated");
+  currentSession->closing = true;
 }
 
-static void recvData(int sock, uint8_t *buffer, size_t _size)
+static void telnet_flush()
+{
+  if (currentSession != NULL)
+    session_flush(currentSession);
+}
+
+static const CONSOLE_CMD telnetCommands[] = {
+    {"Config", "", "", 0, 0, cmd_config, "Change configuration"},
+    {"Monitor", "[b]", "s", 0, 1, cmd_monitor, "Monitor log output (b: binary, for decode-log.py)"},
+    {"History", "", "", 0, 0, cmd_history, "Recent commands (up/down arrows recall them)"},
+    {"Quit", "", "", 0, 0, cmd_quit, "Close telnet session"},
+    {NULL}};
+
+static CONSOLE telnetConsole = {telnetCommands, telnet_esp32_printf, telnet_flush};
+
+//
+// Run one command line (without its line ending) for currentSession
+//
+static void recvData(char *buffer, size_t size)
 {
-  size_t size = _size - 2; // Every line will end with \r\n
-  char *ptr;
-  int i;
+  TELNET_SESSION *s = currentSession;
 
   if (size == 0)
   {
-    if (telnetLoggerActive)
+    if (s->monitor)
     {
       telnet_esp32_printf("Log monitoring disabled\n");
-      revertTelnetLogger();
+      s->monitor = false;
       ESP_LOGI(tag, "Log monitoring via telnet disabled");
     }
     return;
@@ -553,210 +714,184 @@ static void recvData(int sock, uint8_t *buffer, size_t _size)
     return;
   }
 
-  buffer[size] = '\0';
+  ESP_LOGD(tag, "We received: %.*s", (int)size, buffer);
+  consoleExecute(&telnetConsole, buffer);
+}
+
+//
+// Show the line being edited again after the prompt
+//
+static void session_redraw(TELNET_SESSION *s)
+{
+  telnet_printf(s->tnHandle, "\r" TELNET_PROMPT "%.*s\x1b[K", (int)s->lineLen, s->line);
+}
+
+//
+// Replace the line being edited with one from the history
+//
+static void session_recall(TELNET_SESSION *s, int step)
+{
+  const char *line;
+  int pos = s->historyPos + step;
+
+  if ((pos < 0) || (pos > s->history.count))
+    return;
+  s->historyPos = pos;
+  line = (pos == 0) ? "" : consoleHistoryGet(&s->history, pos);
+  s->lineLen = strlcpy(s->line, line, sizeof(s->line));
+  session_redraw(s);
+}
 
-  ESP_LOGD(tag, "We received: %.*s", size, buffer);
-  switch (lookupCommnd((char *)buffer, size))
+static void session_complete(TELNET_SESSION *s)
+{
+  size_t before = s->lineLen;
+  int matches;
+
+  s->line[s->lineLen] = '\0';
+  matches = consoleComplete(&telnetConsole, s->line, &s->lineLen, sizeof(s->line));
+  if (s->lineLen > before)
+    telnet_send(s->tnHandle, &s->line[before], s->lineLen - before);
+  else if (matches > 1)
+    session_redraw(s);     // The candidates were listed
+}
+
+//
+// Assemble received characters into lines and run each complete line.
+// Once the client has agreed to let us echo (character at a time mode)
+// this is also the line editor: echo, backspace, Ctrl-U, tab completion
+// and up/down arrow history.
+//
+static void session_input(TELNET_SESSION *s, const char *data, size_t size)
+{
+  for (size_t i = 0; (i < size) && (s->sockfd != -1) && !s->closing; i++)
   {
-  case HELP:
-  case HELP_2:
-    telnet_esp32_printf("Valid commands:\n");
-    telnet_esp32_printf("  Config:      Change configuration\n");
-    telnet_esp32_printf("  Help:        This!\n");
-    telnet_esp32_printf("  Up:          Increase set temp\n");
-    telnet_esp32_printf("  Down:        Decrease set temp\n");
-    telnet_esp32_printf("  Temp <temp>: Set arbitrary temp\n");
-    telnet_esp32_printf("  Log <level>: Set log level for serial console\n");
-    telnet_esp32_printf("  Mode <mode>: Set operating mode\n");
-    telnet_esp32_printf("  Monitor:     Monitor log output\n");
-    telnet_esp32_printf("  Status:      Dump status counters\n");
-    telnet_esp32_printf("  Error:       Dump error counters\n");
-    telnet_esp32_printf("  Quit:        Close telnet session\n");
-    telnet_esp32_printf("  Reboot:      Reboot the ESP32\n");
-    break;
-  case CONFIG:
-    doConfiguration(sock);
-    break;
-  case TEMP_UP:
-    telnet_esp32_printf("Temperature up\n");
-    telnet_esp32_printf("New set temp: %.1f\n", doTempUp());
-    break;
-  case TEMP_DOWN:
-    telnet_esp32_printf("Temperature down\n");
-    telnet_esp32_printf("New set temp: %.1f\n", doTempDown());
-    break;
-  case TEMP_SET:
-    ptr = strchr((char *)buffer, (int)' ');
-    ptr++; // Move past ' '
-    i = atoi(ptr);
-    telnet_esp32_printf("Set temperature to %d\n", i);
-    updateHvacSetTemp((float)i);
-    break;
-  case LOG_LEVEL:
-    ptr = strchr((char *)buffer, (int)' ');
-    if (ptr == NULL)
+    char c = data[i];
+    bool editing = s->echo && (s->configStep < 0);
+
+    // ESC [ A / ESC O A (up) and ESC [ B (down); anything else is ignored
+    if (s->escape == 1)
     {
-      telnet_esp32_printf("Invalid Log Level: Please specify [E]rror, [W]arn, [I]nfo or [D]ebug\n");
-      break;
+      s->escape = ((c == '[') || (c == 'O')) ? 2 : 0;
+      continue;
     }
-    ptr++; // Move past ' '
-    switch (*ptr)
+    if (s->escape == 2)
     {
-      case 'E':
-      case 'e':
-        esp_log_level_set("*", ESP_LOG_ERROR);
-        telnet_esp32_printf("Log level set to ERROR\n");
-        break;
-      case 'W':
-      case 'w':
-        esp_log_level_set("*", ESP_LOG_WARN);
-        telnet_esp32_printf("Log level set to WARN\n");
-        break;
-      case 'I':
-      case 'i':
-        esp_log_level_set("*", ESP_LOG_INFO);
-        telnet_esp32_printf("Log level set to INFO\n");
-        break;
-      case 'D':
-      case 'd':
-        esp_log_level_set("*", ESP_LOG_DEBUG);
-        telnet_esp32_printf("Log level set to DEBUG\n");
-        break;
-      default:
-        telnet_esp32_printf("Invalid Log Level: %c - Log level unchanged\n", *ptr);
-        break;
+      if (((c >= '0') && (c <= '9')) || (c == ';'))
+        continue;
+      s->escape = 0;
+      if (editing && (c == 'A'))
+        session_recall(s, 1);
+      else if (editing && (c == 'B'))
+        session_recall(s, -1);
+      continue;
     }
-    break;
-  case MODE_SET:
-  {
-    HVAC_MODE mode = ERROR;
-    telnet_esp32_printf("Set mode\n");
-    ptr = strchr((char *)buffer, (int)' ');
-    ptr++; // Move past ' '
-    ptr[0] = toupper(ptr[0]);
-    ESP_LOGI(tag, "Looking up %s", ptr);
-    mode = strToHvacMode(ptr);
-    if (mode == ERROR)
+    if (c == 0x1b)
     {
-      telnet_esp32_printf("Invalid mode: %s\n", ptr);
+      s->escape = 1;
+      continue;
     }
-    else
+
+    // A line ends with CR LF, CR NUL, CR or LF
+    if (((c == '\n') && s->lastCr) || (c == '\0'))
     {
-      updateHvacMode(mode);
-      telnet_esp32_printf("Mode now set to: %s\n", ptr);
+      s->lastCr = false;
+      continue;
     }
-  }
-  break;
-  case MONITOR_LOG:
-    if (telnetLoggerActive == false)
+    s->lastCr = (c == '\r');
+
+    if ((c == '\b') || (c == 0x7f))
+    {
+      if (s->lineLen > 0)
+      {
+        s->lineLen--;
+        if (s->echo)
+          telnet_send(s->tnHandle, "\b \b", 3);
+      }
+      continue;
+    }
+    if ((c == '\t') && editing)
+    {
+      session_complete(s);
+      continue;
+    }
+    if ((c == 0x15) && s->echo)     // Ctrl-U
+    {
+      s->lineLen = 0;
+      session_redraw(s);
+      continue;
+    }
+    if ((c != '\r') && (c != '\n'))
     {
-      telnet_esp32_printf("Enable log monitoring (CR to exit)\n");
-      ESP_LOGI(tag, "Log monitoring via telnet enabled");
-      telnetLoggerActive = true;
-      OrigEsplogger = esp_log_set_vprintf(telnetLogger);
+      if (((unsigned char)c >= ' ') || (c == '\t'))
+      {
+        if (s->lineLen < sizeof(s->line) - 1)
+        {
+          s->line[s->lineLen++] = c;
+          if (s->echo)
+            telnet_send(s->tnHandle, &c, 1);
+        }
+      }
+      continue;
+    }
+
+    if (s->echo)
+      telnet_send(s->tnHandle, "\r\n", 2);
+    s->line[s->lineLen] = '\0';
+    ESP_LOGD(tag, "received line, len=%d", (int)s->lineLen);
+    if (s->configStep >= 0)
+    {
+      configReceive(s, s->line, s->lineLen);
     }
     else
     {
-      telnet_esp32_printf("Error: log monitoring already active\n");
+      consoleHistoryAdd(&s->history, s->line);
+      if (receivedDataCallback != NULL)
+        receivedDataCallback(s->line, s->lineLen);
     }
-    break;
-  case STATUS:
-    DisplayStatus();
-    break;
-  case ERROR_COUNTS:
-    telnet_esp32_printf("Dump error stats\n");
-    DisplayErrors();
-    break;
-  case REBOOT:
-    telnet_esp32_printf("Restarting the ESP32...\n");
-    vTaskDelay(pdMS_TO_TICKS(1500));
-    esp_restart();
-    break;
-  case QUIT:
-    telnet_esp32_printf("Quiting telnet session\n");
-    ESP_LOGI(tag, "Telnet session terminated");
-    disconnectPending = true;
-    break;
-  case UNKNOWN:
-  default:
-    ESP_LOGW(tag, "Unknown command: %.*s", size, buffer);
-    telnet_esp32_printf("Unknown command: %.*s\n", size, buffer);
-    break;
+    s->lineLen = 0;
+    s->historyPos = 0;
+
+    if (!s->closing && (s->configStep < 0))
+      telnet_esp32_printf(TELNET_PROMPT);
   }
 }
 
 /**
- * Telnet callback handler. Called when remote telnet client issues a command.
+ * Telnet callback handler. Called by libtelnet with data to send to, or
+ * received from, the session passed as userData.
  */
 static void telnetCallbackHandler(
     telnet_t *thisTelnet,
     telnet_event_t *event,
     void *userData)
 {
-  int rc;
-  TELNET_USER_DATA *telnetUserData = (TELNET_USER_DATA *)userData;
+  TELNET_SESSION *s = (TELNET_SESSION *)userData;
 
   ESP_LOGD(tag, "telnet event: %s", eventToString(event->type));
 
   switch (event->type)
   {
   case TELNET_EV_SEND:
-    if (!WifiConnected())
-    {
-      if (telnetUserData->sockfd != -1)
-      {
-        revertTelnetLogger();
-        ESP_LOGW(tag, "wifi detected down! Dropping telnet connection");
-        closesocket(telnetUserData->sockfd);
-        telnetUserData->sockfd = -1;
-        OperatingParameters.Errors.wifiErrors++;
-      }
-    }
-    else
-    {
-      if (telnetUserData->sockfd != -1)
-      {
-        rc = send(telnetUserData->sockfd, event->data.buffer, event->data.size, 0);
-        if (rc < 0)
-        {
-          revertTelnetLogger();
-          ESP_LOGE(tag, "send: %d (%s)", errno, strerror(errno));
-          closesocket(telnetUserData->sockfd);
-          telnetUserData->sockfd = -1;
-          OperatingParameters.Errors.telnetNetworkErrors++;
-        }
-      }
-    }
+    session_queue(s, event->data.buffer, event->data.size);
     break;
 
   case TELNET_EV_DATA:
     ESP_LOGD(tag, "received data, len=%d", event->data.size);
-    if (!WifiConnected())
-    {
-      if (telnetUserData->sockfd != -1)
-      {
-        ESP_LOGW(tag, "wifi detected down! Ignoring telnet data");
-        closesocket(telnetUserData->sockfd);
-        telnetUserData->sockfd = -1;
-        OperatingParameters.Errors.wifiErrors++;
-      }
-    }
-    else
-    {
-      /**
-       * Here is where we would want to handle newly received data.
-       * The data receive is in event->data.buffer of size
-       * event->data.size.
-       */
-      if (telnetUserData->sockfd != -1)
-        if (receivedDataCallback != NULL)
-        {
-          receivedDataCallback(telnetUserData->sockfd, (uint8_t *)event->data.buffer, (size_t)event->data.size);
-          // Clear the prior contents
-          memset((void *)(event->data.buffer), 0, sizeof((void *)(event->data.buffer)));
-          event->data.size = 0;
-        }
-    }
+    session_input(s, event->data.buffer, event->data.size);
+    break;
+
+  case TELNET_EV_DO:
+  case TELNET_EV_DONT:
+    // Character at a time mode: the client stops echoing and we edit lines
+    if (event->neg.telopt == TELNET_TELOPT_ECHO)
+      s->echo = (event->type == TELNET_EV_DO);
+    break;
+
+  case TELNET_EV_ERROR:
+    ESP_LOGE(tag, "telnet error: %s", event->error.msg);
+    OperatingParameters.Errors.telnetNetworkErrors++;
+    s->outLen = 0;
+    s->closing = true;
     break;
 
   default:
@@ -765,187 +900,195 @@ static void telnetCallbackHandler(
   } // End of switch event type
 }
 
-void telnet_esp32_CloseSocket()
+static void session_open(int sock)
 {
-  if (serverSocket <= 0)
+  static const telnet_telopt_t my_telopts[] = {
+      {TELNET_TELOPT_ECHO, TELNET_WILL, TELNET_DONT},
+      {TELNET_TELOPT_SGA, TELNET_WILL, TELNET_DO},
+      {TELNET_TELOPT_TTYPE, TELNET_WILL, TELNET_DONT},
+      {TELNET_TELOPT_COMPRESS2, TELNET_WONT, TELNET_DO},
+      {TELNET_TELOPT_ZMP, TELNET_WONT, TELNET_DO},
+      {TELNET_TELOPT_MSSP, TELNET_WONT, TELNET_DO},
+      {TELNET_TELOPT_BINARY, TELNET_WILL, TELNET_DO},
+      {TELNET_TELOPT_NAWS, TELNET_WILL, TELNET_DONT},
+      {-1, 0, 0}};
+  TELNET_SESSION *s = NULL;
+
+  for (int i = 0; i < TELNET_MAX_SESSIONS; i++)
+  {
+    if (sessions[i].sockfd == -1)
+    {
+      s = &sessions[i];
+      break;
+    }
+  }
+
+  if (s == NULL)
   {
+    static const char busy[] = "Too many telnet sessions\r\n";
+
+    ESP_LOGW(tag, "Rejecting telnet client: %d sessions active", TELNET_MAX_SESSIONS);
+    send(sock, busy, sizeof(busy) - 1, MSG_DONTWAIT);
+    closesocket(sock);
     return;
   }
 
-  int rc = closesocket(serverSocket);
-  if (rc < 0)
+  memset(s, 0, sizeof(*s));
+  s->configStep = -1;
+  s->outq = (uint8_t *)malloc(TELNET_OUTQ_SIZE);
+  s->tnHandle = telnet_init(my_telopts, telnetCallbackHandler, 0, s);
+  if ((s->outq == NULL) || (s->tnHandle == NULL))
   {
-    ESP_LOGE(tag, "closesocket(%d) : %d (%s)", serverSocket, errno, strerror(errno));
-    OperatingParameters.Errors.telnetNetworkErrors++;
+    ESP_LOGE(tag, "Out of memory for telnet session");
+    OperatingParameters.Errors.systemErrors++;
+    if (s->tnHandle != NULL)
+      telnet_free(s->tnHandle);
+    free(s->outq);
+    s->sockfd = -1;
+    closesocket(sock);
     return;
   }
+
+  fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+  s->sockfd = sock;
+  s->lastActivity = millis();
+  WifiPowerBoost();
+
+  ESP_LOGI(tag, "We have a new client connection (session %d)!", (int)(s - sessions));
+  telnet_negotiate(s->tnHandle, TELNET_WILL, TELNET_TELOPT_ECHO);
+  telnet_negotiate(s->tnHandle, TELNET_WILL, TELNET_TELOPT_SGA);
+  currentSession = s;
+  telnet_esp32_printf(TELNET_PROMPT);
+  currentSession = NULL;
 }
 
-void terminateTelnetSession()
+static void session_close(TELNET_SESSION *s)
 {
-  // On first invocation, this routine will only close the
-  // active telnet session, if there is one...then return. On
-  // the next invocation, since the first closed the active
-  // session, the task that handles incoming connect requests
-  // will be terminated and restarted.
+  if (s->sockfd == -1)
+    return;
+
+  closesocket(s->sockfd);
+  s->sockfd = -1;
+  telnet_free(s->tnHandle);
+  s->tnHandle = NULL;
+  free(s->outq);
+  s->outq = NULL;
+  if (configSession == s)
+    configSession = NULL;
+  s->monitor = false;
+  s->monitorBinary = false;
+  ESP_LOGI(tag, "Telnet client finished (session %d)", (int)(s - sessions));
+}
 
-  ESP_LOGI(tag, "Telnet session termination requested");
+static void session_read(TELNET_SESSION *s)
+{
+  char buffer[TELNET_RECV_SIZE];
+  ssize_t len = recv(s->sockfd, buffer, sizeof(buffer), 0);
 
-  if ((tnHandle == NULL) && (telnetTaskHandle == NULL))
+  if (len == 0)
   {
-    ESP_LOGW(tag, "No action taken - no telnet connection and telnet task not started");
+    s->outLen = 0;
+    s->closing = true;
     return;
   }
-
-  if (tnHandle != NULL)
+  if (len < 0)
   {
-    ESP_LOGW(tag, "Active telnet session -- waiting for it to terminate");
-
-    revertTelnetLogger();
-
-    // Set the flag to start exiting telnet task
-    disconnectPending = true;
-    while (tnHandle != NULL)
-      vTaskDelay(pdMS_TO_TICKS(50));
-
-    // First step completed; Stop active telnet session.
-    // On a subsequent call, the socket will be closed and task restarted
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+      return;
+    ESP_LOGE(tag, "recv: %d (%s)", errno, strerror(errno));
+    OperatingParameters.Errors.telnetNetworkErrors++;
+    s->outLen = 0;
+    s->closing = true;
     return;
   }
 
-  // Close the listener socket
-  telnet_esp32_CloseSocket();
+  ESP_LOGD(tag, "received %d bytes", len);
+  s->lastActivity = millis();
+  WifiPowerBoost();
+  currentSession = s;
+  telnet_recv(s->tnHandle, buffer, len);
+  currentSession = NULL;
+}
 
-  // telnet session is now aborted and listening socket is closed. Now restart the task.
-  if (telnetTaskHandle != NULL)
+void telnet_esp32_CloseSocket()
+{
+  if (serverSocket < 0)
   {
-    ESP_LOGD(tag, "Active telnet sessions stopped and socket closed. Now stopping telnet RTOS task.");
-    telnetState = NOT_LISTENING;
-    vTaskDelete(telnetTaskHandle);
-    telnetTaskHandle = NULL;
+    return;
   }
 
-  // ESP_LOGI(tag, "Starting new telnet service instance");
-  // vTaskDelay(pdMS_TO_TICKS(125));
-  // telnetStart();
+  int rc = closesocket(serverSocket);
+  serverSocket = -1;
+  if (rc < 0)
+  {
+    ESP_LOGE(tag, "closesocket : %d (%s)", errno, strerror(errno));
+    OperatingParameters.Errors.telnetNetworkErrors++;
+    return;
+  }
 }
 
-static void doTelnet(int partnerSocket)
+//
+// Ask the telnet task to close every session and stop, without waiting
+// for it; for callers that mustn't block, like the wifi event handler.
+// The task sees the request within TELNET_SELECT_MS.
+//
+void telnetRequestStop()
 {
-  // ESP_LOGD(tag, ">> doTelnet");
-  static const telnet_telopt_t my_telopts[] = {
-      {TELNET_TELOPT_ECHO, TELNET_WILL, TELNET_DONT},
-      {TELNET_TELOPT_TTYPE, TELNET_WILL, TELNET_DONT},
-      {TELNET_TELOPT_COMPRESS2, TELNET_WONT, TELNET_DO},
-      {TELNET_TELOPT_ZMP, TELNET_WONT, TELNET_DO},
-      {TELNET_TELOPT_MSSP, TELNET_WONT, TELNET_DO},
-      {TELNET_TELOPT_BINARY, TELNET_WILL, TELNET_DO},
-      {TELNET_TELOPT_NAWS, TELNET_WILL, TELNET_DONT},
-      {-1, 0, 0}};
-
-  TELNET_USER_DATA *pTelnetUserData = (TELNET_USER_DATA *)malloc(sizeof(TELNET_USER_DATA));
-  static uint8_t buffer[1024];
-  struct timeval to;
+  stopRequested = true;
+}
 
-  pTelnetUserData->sockfd = partnerSocket;
-  disconnectPending = false;
+void terminateTelnetSession()
+{
+  // Close every telnet session and the listening socket, and stop the
+  // telnet task. The state machine starts it again once wifi is up.
 
-  tnHandle = telnet_init(my_telopts, telnetCallbackHandler, 0, pTelnetUserData);
+  ESP_LOGI(tag, "Telnet service termination requested");
 
-  to.tv_sec = 1;
-  to.tv_usec = 0;
-  if (setsockopt(pTelnetUserData->sockfd, SOL_SOCKET, SO_RCVTIMEO, &to, sizeof(to)) < 0)
+  if (telnetTaskHandle == NULL)
   {
-    ESP_LOGE(tag, "Unable to set read timeout on socket!");
-    // return false;
+    ESP_LOGW(tag, "No action taken - telnet task not started");
+    return;
   }
 
-  // Primary loop for telnet "server"
-  while (/*wifiConnected() && */ (pTelnetUserData->sockfd != -1))
+  telnetRequestStop();
+  if (xSemaphoreTake(telnetStopped, pdMS_TO_TICKS(TELNET_STOP_TIMEOUT_MS)) != pdTRUE)
   {
-    if ((disconnectPending) /*|| (!wifiConnected()) */)
-    {
-      ESP_LOGI(tag, "telnet disconect requested");
-      disconnectPending = false;
-      revertTelnetLogger();
-      closesocket(pTelnetUserData->sockfd);
-      pTelnetUserData->sockfd = -1;
-      break;
-    }
-
-    ssize_t len = recv(partnerSocket, (char *)buffer, sizeof(buffer), 0);
-
-    if ((len == 0) && (telnetLoggerActive == true))
-    {
-      ESP_LOGI(tag, "Terminating logging");
-      break;    //@@@ break or continue???
-    }
-
-    if ((len > sizeof(buffer)) || (len < 0)) //(len != EWOULDBLOCK))
-    {
-      // Got an error receiving data; just delay and then wait for more
-      vTaskDelay(pdMS_TO_TICKS(250));
-      continue;
-    }
-
-    if (/*wifiConnected() &&*/ (pTelnetUserData->sockfd != -1))
-    {
-      ESP_LOGD(tag, "received %d bytes", len);
-
-      // Disable timeout on socket to allow for interaction (like doing a config)
-      to.tv_sec = 0;
-      setsockopt(pTelnetUserData->sockfd, SOL_SOCKET, SO_RCVTIMEO, &to, sizeof(to));
-
-      // Process the received data
-      telnet_recv(tnHandle, (char *)buffer, len);
-
-      // Reenable the socket timeout option
-      to.tv_sec = 1;
-      setsockopt(pTelnetUserData->sockfd, SOL_SOCKET, SO_RCVTIMEO, &to, sizeof(to));
-    }
-    telnet_esp32_printf("> ");
-    vTaskDelay(pdMS_TO_TICKS(50));
+    ESP_LOGW(tag, "Telnet task did not stop within %d ms", TELNET_STOP_TIMEOUT_MS);
   }
-  revertTelnetLogger();
-  ESP_LOGI(tag, "Telnet client finished");
-  telnet_free(tnHandle);
-  free (pTelnetUserData);
-  tnHandle = NULL;
 }
 
 /**
- * Listen for telnet clients and handle them.
+ * Listen for telnet clients and service them until asked to stop.
  */
-void telnet_esp32_listenForClients(void (*callbackParam)(int sock, uint8_t *buffer, size_t size))
+void telnet_esp32_listenForClients(void (*callbackParam)(char *buffer, size_t size))
 {
-  // ESP_LOGD(tag, ">> telnet_listenForClients");
   receivedDataCallback = callbackParam;
+
+  for (int i = 0; i < TELNET_MAX_SESSIONS; i++)
+    sessions[i].sockfd = -1;
+
   serverSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
   if (serverSocket == -1)
   {
     ESP_LOGE(tag, "socket: Failed to allocate new socket");
     OperatingParameters.Errors.telnetNetworkErrors++;
-    telnetState = NOT_LISTENING;
-    telnetTaskHandle = NULL;
     return;
   }
 
-  BaseType_t xTrueValue = pdTRUE;
-  setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, (void *)&xTrueValue, sizeof(xTrueValue));
+  int trueValue = 1;
+  setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, (void *)&trueValue, sizeof(trueValue));
 
   struct sockaddr_in serverAddr;
+  memset(&serverAddr, 0, sizeof(serverAddr));
   serverAddr.sin_family = AF_INET;
   serverAddr.sin_addr.s_addr = htonl(INADDR_ANY);
-  serverAddr.sin_port = htons(23);
+  serverAddr.sin_port = htons(TELNET_PORT);
 
   int rc = bind(serverSocket, (struct sockaddr *)&serverAddr, sizeof(serverAddr));
   if (rc < 0)
   {
     ESP_LOGE(tag, "bind: %d (%s)", errno, strerror(errno));
     OperatingParameters.Errors.telnetNetworkErrors++;
-    telnetState = NOT_LISTENING;
-    telnetTaskHandle = NULL;
-    close(serverSocket);
     return;
   }
 
@@ -954,34 +1097,114 @@ void telnet_esp32_listenForClients(void (*callbackParam)(int sock, uint8_t *buff
   {
     ESP_LOGE(tag, "listen: %d (%s)", errno, strerror(errno));
     OperatingParameters.Errors.telnetNetworkErrors++;
-    telnetState = NOT_LISTENING;
-    telnetTaskHandle = NULL;
-    close(serverSocket);
     return;
   }
 
   telnetState = LISTENING;
 
-  while (1)
+  while (!stopRequested)
   {
-    socklen_t len = sizeof(serverAddr);
-    rc = accept(serverSocket, (struct sockaddr *)&serverAddr, &len);
+    fd_set readFds;
+    fd_set writeFds;
+    struct timeval to;
+    int maxFd = serverSocket;
+
+    FD_ZERO(&readFds);
+    FD_ZERO(&writeFds);
+    FD_SET(serverSocket, &readFds);
+    for (int i = 0; i < TELNET_MAX_SESSIONS; i++)
+    {
+      TELNET_SESSION *s = &sessions[i];
+
+      if (s->sockfd == -1)
+        continue;
+      FD_SET(s->sockfd, &readFds);
+      if (s->outLen > 0)
+        FD_SET(s->sockfd, &writeFds);
+      if (s->sockfd > maxFd)
+        maxFd = s->sockfd;
+    }
+
+    to.tv_sec = 0;
+    to.tv_usec = TELNET_SELECT_MS * 1000;
+    rc = select(maxFd + 1, &readFds, &writeFds, NULL, &to);
     if (rc < 0)
     {
-      ESP_LOGE(tag, "accept: %d (%s)", errno, strerror(errno));
+      if (errno == EINTR)
+        continue;
+      ESP_LOGE(tag, "select: %d (%s)", errno, strerror(errno));
       OperatingParameters.Errors.telnetNetworkErrors++;
-      telnetState = NOT_LISTENING;
-      telnetTaskHandle = NULL;
-      close(serverSocket);
-      return;
+      break;
+    }
+
+    if (!WifiConnected())
+    {
+      for (int i = 0; i < TELNET_MAX_SESSIONS; i++)
+      {
+        if (sessions[i].sockfd != -1)
+        {
+          ESP_LOGW(tag, "wifi detected down! Dropping telnet connection");
+          OperatingParameters.Errors.wifiErrors++;
+          session_close(&sessions[i]);
+        }
+      }
+      continue;
     }
 
-    ESP_LOGI(tag, "We have a new client connection!");
-    // This call is blocking, so only 1 telnet session at a time!
-    doTelnet(rc);
+    if ((rc > 0) && FD_ISSET(serverSocket, &readFds))
+    {
+      socklen_t len = sizeof(serverAddr);
+      int sock = accept(serverSocket, (struct sockaddr *)&serverAddr, &len);
+      if (sock < 0)
+      {
+        ESP_LOGE(tag, "accept: %d (%s)", errno, strerror(errno));
+        OperatingParameters.Errors.telnetNetworkErrors++;
+      }
+      else
+      {
+        session_open(sock);
+      }
+    }
+
+    for (int i = 0; (rc > 0) && (i < TELNET_MAX_SESSIONS); i++)
+    {
+      TELNET_SESSION *s = &sessions[i];
+
+      if (s->sockfd == -1)
+        continue;
+      if (FD_ISSET(s->sockfd, &readFds) && !s->closing)
+        session_read(s);
+      if (FD_ISSET(s->sockfd, &writeFds))
+        session_flush(s);
+    }
+
+    telnet_log_drain();
+
+    for (int i = 0; i < TELNET_MAX_SESSIONS; i++)
+    {
+      TELNET_SESSION *s = &sessions[i];
+
+      if (s->sockfd == -1)
+        continue;
+      if (!s->closing && !s->monitor && (millis() - s->lastActivity > TELNET_IDLE_TIMEOUT_MS))
+      {
+        ESP_LOGI(tag, "Closing idle telnet session %d", i);
+        currentSession = s;
+        telnet_esp32_printf("\nIdle timeout\n");
+        currentSession = NULL;
+        s->closing = true;
+      }
+      if (s->closing)
+      {
+        session_flush(s);
+        if (s->outLen == 0)
+          session_close(s);
+      }
+    }
   }
 
-  telnetState = NOT_LISTENING;
+  for (int i = 0; i < TELNET_MAX_SESSIONS; i++)
+    session_close(&sessions[i]);
 }
 
 static void telnetListenTask(void *data)
@@ -990,18 +1213,17 @@ static void telnetListenTask(void *data)
   if (!WifiConnected())
   {
     ESP_LOGW(tag, "*** WARNING: Failed to start telnet listener due to wifi down!! ***");
-    telnetState = NOT_LISTENING;
-    telnetTaskHandle = NULL;
-    vTaskDelete(NULL);
-    return;
   }
-
-  telnet_esp32_listenForClients(recvData);
+  else
+  {
+    telnet_esp32_listenForClients(recvData);
+  }
 
   ESP_LOGI(tag, "Stopping telnetTask()");
   telnet_esp32_CloseSocket();
   telnetState = NOT_LISTENING;
   telnetTaskHandle = NULL;
+  xSemaphoreGive(telnetStopped);
   vTaskDelete(NULL);
 }
 
@@ -1013,6 +1235,15 @@ bool telnetServiceRunning()
 
 esp_err_t telnetStart()
 {
+  if (telnetTaskHandle != NULL)
+    return ESP_OK;
+
+  if (telnetStopped == NULL)
+    telnetStopped = xSemaphoreCreateBinary();
+  // Discard a stop acknowledgement nobody waited for
+  xSemaphoreTake(telnetStopped, 0);
+
+  stopRequested = false;
   telnetState = STARTING;
 
   // xTaskCreatePinnedToCore (&telnetTask, "telnetTask", 8048, NULL, 5, NULL, 0);
@@ -24,8 +24,12 @@
  *  04-Dec-2023: Michael Burke (michaelburke2000@gmail.com) - Add screen brightness auto-adjustment
  */
 
+#include <math.h>
+#include <stdlib.h>
 #include "thermostat.hpp"
+#include "esp_timer.h"
 #include "tft.hpp"
+#include "driver/ledc.h"
 
 #define OFF_BRIGHTNESS 0
 #define MIN_BRIGHTNESS 5
@@ -93,33 +97,222 @@ void tftHideDisplayItems()
 }
 
 
-int sensorToScreenBrightness(int sensor)
+//
+// Backlight. The LEDC channel is driven here instead of through LovyanGFX
+// so that transitions run on the LEDC hardware fade engine and cost no CPU.
+// Brightness levels (0-255) are perceptual; a gamma table turns them into
+// PWM duty between backlightMin and backlightMax percent.
+//
+#define BACKLIGHT_MODE        LEDC_LOW_SPEED_MODE
+#define BACKLIGHT_TIMER       LEDC_TIMER_3
+#define BACKLIGHT_CHANNEL     LEDC_CHANNEL_7
+#define BACKLIGHT_RESOLUTION  LEDC_TIMER_10_BIT
+#define BACKLIGHT_MAX_DUTY    ((1 << 10) - 1)
+#define BACKLIGHT_FREQ        44100
+#define BACKLIGHT_GAMMA       2.2
+#define FADE_MS_PER_LEVEL     4       // Auto brightness; whole range in ~1 s
+#define WAKE_FADE_MS          250
+#define DIM_FADE_MS           1000
+
+static uint16_t backlightTable[FULL_BRIGHTNESS + 1];
+static int backlightLevel = OFF_BRIGHTNESS;     // Where the current fade ends
+static portMUX_TYPE backlightLock = portMUX_INITIALIZER_UNLOCKED;
+static volatile bool backlightRangeChanged = false;
+static portMUX_TYPE tempUnitsLock = portMUX_INITIALIZER_UNLOCKED;
+static volatile bool tempUnitsChanged = false;
+
+static void backlight_build_table(int minPercent, int maxPercent)
 {
-  // THIS 4095 IS THE MAX BRIGHTNESS READING OF THE LIGHT SENSOR.
-  int conversionFactor =  4095 / FULL_BRIGHTNESS;
-  return sensor / conversionFactor;
+  float minDuty = BACKLIGHT_MAX_DUTY * minPercent / 100.0;
+  float maxDuty = BACKLIGHT_MAX_DUTY * maxPercent / 100.0;
+
+  backlightTable[OFF_BRIGHTNESS] = 0;
+  for (int level = 1; level <= FULL_BRIGHTNESS; level++)
+  {
+    float x = (float)(level - 1) / (FULL_BRIGHTNESS - 1);
+    backlightTable[level] = (uint16_t)(minDuty + (maxDuty - minDuty) * powf(x, BACKLIGHT_GAMMA) + 0.5);
+  }
 }
 
-#define CLAMP(x, min, max) (x < min ? min : (x > max ? max : x))
-#define BRIGHTNESS_STEP_SIZE 2
-void tftAutoBrightness()
+static void backlight_init()
 {
-  int curBrightness = tft.getBrightness();
-  int convertedLightLevel = sensorToScreenBrightness(OperatingParameters.lightDetected);
-  int adjustment;
-  // Screen will only adjust brightness if difference between intended and current brightnesses is large enough.
-  // (this difference threshold is arbitrarily chosen to be FULL_BRIGHTNESS >> 5, or 1/32nd of the range of
-  // possible brightnesses)
-  // Also adjust brightness if screen is currently brightness 0 (just now waking up from sleep). Without this
-  // `OR`, the screen won't turn back on in very low ambient light.
-  if ((abs(convertedLightLevel - curBrightness) > FULL_BRIGHTNESS >> 5) || curBrightness == 0)
-    adjustment = BRIGHTNESS_STEP_SIZE;
-  else
+  ledc_timer_config_t ledc_timer = {
+      .speed_mode = BACKLIGHT_MODE,
+      .duty_resolution = BACKLIGHT_RESOLUTION,
+      .timer_num = BACKLIGHT_TIMER,
+      .freq_hz = BACKLIGHT_FREQ,
+      .clk_cfg = LEDC_AUTO_CLK,
+      .deconfigure = false};
+  ESP_ERROR_CHECK(ledc_timer_config(&ledc_timer));
+
+  ledc_channel_config_t ledc_channel = {
+      .gpio_num = TFT_LED_PIN,
+      .speed_mode = BACKLIGHT_MODE,
+      .channel = BACKLIGHT_CHANNEL,
+      .intr_type = LEDC_INTR_DISABLE,
+      .timer_sel = BACKLIGHT_TIMER,
+      .duty = 0,
+      .hpoint = 0,
+      .flags = 0};
+  ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel));
+  ESP_ERROR_CHECK(ledc_fade_func_install(0));
+
+  backlight_build_table(OperatingParameters.backlightMin, OperatingParameters.backlightMax);
+}
+
+//
+// Start a hardware fade to 'level' over 'ms'; returns immediately.
+// backlightLevel only ever holds a level that indexes the table, so a
+// failed fade leaves it where the last good one was headed.
+//
+static void backlight_start(int level, int ms)
+{
+  if (level < OFF_BRIGHTNESS)
+    level = OFF_BRIGHTNESS;
+  else if (level > FULL_BRIGHTNESS)
+    level = FULL_BRIGHTNESS;
+#if SOC_LEDC_SUPPORT_FADE_STOP
+  // Retarget a fade that is still running instead of waiting for it
+  ledc_fade_stop(BACKLIGHT_MODE, BACKLIGHT_CHANNEL);
+#endif
+  if (ledc_set_fade_time_and_start(BACKLIGHT_MODE, BACKLIGHT_CHANNEL, backlightTable[level],
+                                   ms > 0 ? ms : 1, LEDC_FADE_NO_WAIT) != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Backlight fade to %d failed", level);
+    OperatingParameters.Errors.hardwareErrors++;
+    return;
+  }
+  backlightLevel = level;
+}
+
+static void backlight_fade(int level, int ms)
+{
+  if (level != backlightLevel)
+    backlight_start(level, ms);
+}
+
+//
+// Set the duty range. The table is rebuilt and the current level redone
+// by backlight_range_update() on the UI task, which owns the backlight;
+// tftApplyBacklightRange() may be called from any task and doesn't save
+// the range; the caller does.
+//
+bool tftApplyBacklightRange(int minPercent, int maxPercent)
+{
+  if (minPercent < 0 || maxPercent > 100 || minPercent >= maxPercent)
+    return false;
+
+  portENTER_CRITICAL(&backlightLock);
+  OperatingParameters.backlightMin = minPercent;
+  OperatingParameters.backlightMax = maxPercent;
+  backlightRangeChanged = true;
+  portEXIT_CRITICAL(&backlightLock);
+  return true;
+}
+
+// Called from tftPump()
+static void backlight_range_update()
+{
+  int minPercent, maxPercent;
+
+  if (!backlightRangeChanged)
+    return;
+  portENTER_CRITICAL(&backlightLock);
+  minPercent = OperatingParameters.backlightMin;
+  maxPercent = OperatingParameters.backlightMax;
+  backlightRangeChanged = false;
+  portEXIT_CRITICAL(&backlightLock);
+
+  backlight_build_table(minPercent, maxPercent);
+  backlight_start(backlightLevel, WAKE_FADE_MS);
+}
+
+//
+// The set point arc's range and the tenths label follow the display units.
+// updateTempUnits() converts the values on whatever task changed the units
+// and calls tftApplyTempUnits(); temp_units_update() redoes the widgets on
+// the UI task, which owns LVGL, for the units in effect by then.
+//
+void tftApplyTempUnits()
+{
+  portENTER_CRITICAL(&tempUnitsLock);
+  tempUnitsChanged = true;
+  portEXIT_CRITICAL(&tempUnitsLock);
+}
+
+// Called from tftPump()
+static void temp_units_update()
+{
+  if (!tempUnitsChanged)
     return;
-  adjustment = curBrightness > convertedLightLevel ? adjustment * -1 : adjustment;
-  tft.setBrightness(CLAMP(curBrightness + adjustment, MIN_BRIGHTNESS, FULL_BRIGHTNESS));
+  portENTER_CRITICAL(&tempUnitsLock);
+  tempUnitsChanged = false;
+  portEXIT_CRITICAL(&tempUnitsLock);
+
+  if (OperatingParameters.tempUnits == 'C')
+  {
+    lv_arc_set_range(ui_TempArc, (int16_t)(SET_TEMP_MIN_C*10), (int16_t)(SET_TEMP_MAX_C*10));
+    lv_obj_clear_flag(ui_SetTempFrac, LV_OBJ_FLAG_HIDDEN);
+  }
+  else
+  {
+    lv_arc_set_range(ui_TempArc, (int16_t)(SET_TEMP_MIN_F*10), (int16_t)(SET_TEMP_MAX_F*10));
+    lv_obj_add_flag(ui_SetTempFrac, LV_OBJ_FLAG_HIDDEN);
+  }
+}
+
+bool tftSetBacklightRange(int minPercent, int maxPercent)
+{
+  if (!tftApplyBacklightRange(minPercent, maxPercent))
+    return false;
+  eepromUpdateBacklight();
+  return true;
+}
+
+//
+// Ambient light (lux) maps onto the backlight range on a log scale, which
+// is closer to how bright a room looks than the raw sensor reading.
+//
+#define LUX_DARK        1.0     // At or below this, MIN_BRIGHTNESS
+#define LUX_BRIGHT      1000.0  // At or above this, FULL_BRIGHTNESS
+#define LUX_HYSTERESIS  0.25    // Change in ln(lux) (~28%) needed to pick a new target
+
+int luxToScreenBrightness(float lux)
+{
+  float level = logf(fmaxf(lux, LUX_DARK) / LUX_DARK) / logf(LUX_BRIGHT / LUX_DARK);
+
+  if (level > 1.0)
+    level = 1.0;
+  return MIN_BRIGHTNESS + (int)(level * (FULL_BRIGHTNESS - MIN_BRIGHTNESS) + 0.5);
+}
+
+//
+// Brightness the ambient light calls for. A new target is only chosen once
+// the light has moved well away from the level the current one was chosen
+// at, so small fluctuations around a boundary don't make the backlight hunt.
+//
+static int auto_brightness_target()
+{
+  static int targetBrightness = -1;
+  static float targetLux = 0.0;
+  float lux = OperatingParameters.lightLux;
+
+  if (targetBrightness < 0 ||
+      fabsf(logf((lux + LUX_DARK) / (targetLux + LUX_DARK))) > LUX_HYSTERESIS)
+  {
+    targetBrightness = luxToScreenBrightness(lux);
+    targetLux = lux;
+  }
+  return targetBrightness;
+}
+
+void tftAutoBrightness()
+{
+  int target = auto_brightness_target();
+
+  if (target != backlightLevel)
+    backlight_fade(target, abs(target - backlightLevel) * FADE_MS_PER_LEVEL);
 }
-#undef CLAMP
 
 void tftWakeDisplay(bool beep)
 {
@@ -129,6 +322,7 @@ void tftWakeDisplay(bool beep)
   tftShowDisplayItems();
   tftEnableTouchTimer();
   tftUpdateTouchTimestamp();
+  backlight_fade(auto_brightness_target(), WAKE_FADE_MS);
   tftAwake = true;
 }
 
@@ -140,6 +334,7 @@ void tftWakeDisplayMotion()
     tftShowDisplayItems();
     tftEnableTouchTimer();
     tftUpdateTouchTimestamp();
+    backlight_fade(auto_brightness_target(), WAKE_FADE_MS);
     tftAwake = true;
   }
 }
@@ -149,7 +344,7 @@ void tftDimDisplay()
   if (tftTouchTimerEnabled)
   {
     ESP_LOGD(TAG, "Dimming display");
-    tft.setBrightness(OFF_BRIGHTNESS);
+    backlight_fade(OFF_BRIGHTNESS, DIM_FADE_MS);
     tftHideDisplayItems();
     tftDisableTouchTimer();
     tftAwake = false;
@@ -374,6 +569,228 @@ Cal data:
   for (int n=0; n < 8; n++) ESP_LOGI (TAG, "%d : %d", n, calData[n]);
 }
 
+//
+// Task profiler panel. A "Tasks" button on the Info screen lays a table
+// of per-task CPU use and free stack (see profiler.cpp) over the network
+// details; pressing it again or leaving the screen takes it away. While
+// it is up the table follows the profiler's samples. A button in the
+// panel switches the table to the boot timeline (see boot.cpp) and back.
+//
+#define TASKS_PANEL_HEIGHT  196     // Down to the buttons at the bottom
+
+static lv_obj_t *tasksPanel;
+static lv_obj_t *tasksLoadLabel;
+static lv_obj_t *tasksTable;
+static lv_obj_t *tasksModeLabel;
+static bool tasksShowBoot;
+static int64_t tasksRefreshed;
+
+static void tasks_set_columns(const char *const *headings, const lv_coord_t *widths)
+{
+  for (int c = 0; c < 4; c++)
+  {
+    lv_table_set_col_width(tasksTable, c, widths[c]);
+    lv_table_set_cell_value(tasksTable, 0, c, headings[c]);
+  }
+}
+
+// Times are in ms since the system timer started
+static void boot_refresh()
+{
+  static const char *const headings[] = {"Phase", "Start", "End", "ms"};
+  static const lv_coord_t widths[] = {124, 64, 64, 56};
+  BOOT_TIMES frame, decision;
+  int row = 1;
+
+  tasksRefreshed = millis();
+  tasks_set_columns(headings, widths);
+  bootGetTimes(BOOT_FIRST_FRAME, &frame);
+  bootGetTimes(BOOT_FIRST_DECISION, &decision);
+  lv_label_set_text_fmt(tasksLoadLabel, "1st frame %d ms, control %d ms",
+                        (int)(frame.endUs / 1000), (int)(decision.endUs / 1000));
+
+  lv_table_set_row_cnt(tasksTable, NR_BOOT_EVENTS + 1);
+  for (int e = 0; e < NR_BOOT_EVENTS; e++)
+  {
+    BOOT_TIMES t;
+
+    bootGetTimes((BOOT_EVENT)e, &t);
+    if (t.startUs == 0)
+      continue;
+    lv_table_set_cell_value(tasksTable, row, 0, bootEventName((BOOT_EVENT)e));
+    lv_table_set_cell_value_fmt(tasksTable, row, 1, "%d", (int)(t.startUs / 1000));
+    if (BOOT_IS_MILESTONE(e) || (t.endUs == 0))
+    {
+      lv_table_set_cell_value(tasksTable, row, 2, "");
+      lv_table_set_cell_value(tasksTable, row, 3, "");
+    }
+    else
+    {
+      lv_table_set_cell_value_fmt(tasksTable, row, 2, "%d", (int)(t.endUs / 1000));
+      lv_table_set_cell_value_fmt(tasksTable, row, 3, t.ok ? "%d" : "%d!", (int)((t.endUs - t.startUs) / 1000));
+    }
+    row++;
+  }
+  lv_table_set_row_cnt(tasksTable, row);
+}
+
+static void tasks_refresh()
+{
+  static const char *const headings[] = {"Task", "CPU%", "1m%", "Stack"};
+  static const lv_coord_t widths[] = {136, 58, 50, 64};
+  PROFILE_LOAD load;
+
+  if (tasksShowBoot)
+  {
+    boot_refresh();
+    return;
+  }
+  tasks_set_columns(headings, widths);
+  PROFILE_TASK *tasks = (PROFILE_TASK *)malloc(METRIC_MAX_TASKS * sizeof(PROFILE_TASK));
+  int n = (tasks == NULL) ? 0 : profilerGetTasks(tasks, METRIC_MAX_TASKS);
+
+  tasksRefreshed = millis();
+  profilerGetLoad(&load);
+  if (load.valid == 0)
+    lv_label_set_text(tasksLoadLabel, "Waiting for the first sample...");
+  else if (portNUM_PROCESSORS > 1)
+    lv_label_set_text_fmt(tasksLoadLabel, "CPU load: core 0 %d%%, core 1 %d%%",
+                          (load.busy[0][0] + 5) / 10, (load.busy[portNUM_PROCESSORS - 1][0] + 5) / 10);
+  else
+    lv_label_set_text_fmt(tasksLoadLabel, "CPU load: %d%%", (load.busy[0][0] + 5) / 10);
+
+  lv_table_set_row_cnt(tasksTable, n + 1);
+  for (int i = 0; i < n; i++)
+  {
+    uint32_t sum = 0;
+
+    for (int h = 0; h < tasks[i].valid; h++)
+      sum += tasks[i].cpu[h];
+    lv_table_set_cell_value(tasksTable, i + 1, 0, tasks[i].name);
+    lv_table_set_cell_value_fmt(tasksTable, i + 1, 1, "%d.%d", tasks[i].cpu[0] / 10, tasks[i].cpu[0] % 10);
+    lv_table_set_cell_value_fmt(tasksTable, i + 1, 2, "%d",
+                                (tasks[i].valid > 0) ? (int)((sum / tasks[i].valid + 5) / 10) : 0);
+    lv_table_set_cell_value_fmt(tasksTable, i + 1, 3, "%lu", (unsigned long)tasks[i].stackFree);
+  }
+  free(tasks);
+}
+
+static void tasks_button_event(lv_event_t *e)
+{
+  if (lv_event_get_code(e) != LV_EVENT_CLICKED)
+    return;
+  tftBeep(e);
+  if (lv_obj_has_flag(tasksPanel, LV_OBJ_FLAG_HIDDEN))
+  {
+    tasks_refresh();
+    lv_obj_clear_flag(tasksPanel, LV_OBJ_FLAG_HIDDEN);
+  }
+  else
+  {
+    lv_obj_add_flag(tasksPanel, LV_OBJ_FLAG_HIDDEN);
+  }
+}
+
+static void tasks_mode_event(lv_event_t *e)
+{
+  if (lv_event_get_code(e) != LV_EVENT_CLICKED)
+    return;
+  tftBeep(e);
+  tasksShowBoot = !tasksShowBoot;
+  lv_label_set_text(tasksModeLabel, tasksShowBoot ? "Tasks" : "Boot");
+  tasks_refresh();
+}
+
+static void tasks_screen_event(lv_event_t *e)
+{
+  if (lv_event_get_code(e) == LV_EVENT_SCREEN_UNLOAD_START)
+    lv_obj_add_flag(tasksPanel, LV_OBJ_FLAG_HIDDEN);
+}
+
+static void tasks_panel_init()
+{
+  lv_obj_t *btn = lv_btn_create(ui_Info);
+  lv_obj_set_size(btn, 100, 36);
+  lv_obj_set_align(btn, LV_ALIGN_BOTTOM_RIGHT);
+  lv_obj_set_pos(btn, -214, -3);
+  lv_obj_clear_flag(btn, LV_OBJ_FLAG_SCROLLABLE);
+  lv_obj_set_style_bg_color(btn, lv_color_hex(0x2095F6), LV_PART_MAIN | LV_STATE_DEFAULT);
+  lv_obj_set_style_bg_grad_color(btn, lv_color_hex(0x2620F6), LV_PART_MAIN | LV_STATE_DEFAULT);
+  lv_obj_set_style_bg_grad_dir(btn, LV_GRAD_DIR_VER, LV_PART_MAIN | LV_STATE_DEFAULT);
+  lv_obj_add_event_cb(btn, tasks_button_event, LV_EVENT_ALL, NULL);
+
+  lv_obj_t *label = lv_label_create(btn);
+  lv_label_set_text(label, "Tasks");
+  lv_obj_set_style_text_color(label, lv_color_hex(0xFFE300), LV_PART_MAIN | LV_STATE_DEFAULT);
+  lv_obj_center(label);
+
+  tasksPanel = lv_obj_create(ui_Info);
+  lv_obj_set_size(tasksPanel, screenWidth, TASKS_PANEL_HEIGHT);
+  lv_obj_set_align(tasksPanel, LV_ALIGN_TOP_LEFT);
+  lv_obj_set_style_radius(tasksPanel, 0, LV_PART_MAIN);
+  lv_obj_set_style_pad_all(tasksPanel, 2, LV_PART_MAIN);
+  lv_obj_set_style_border_width(tasksPanel, 0, LV_PART_MAIN);
+  lv_obj_set_flex_flow(tasksPanel, LV_FLEX_FLOW_COLUMN);
+  lv_obj_add_flag(tasksPanel, LV_OBJ_FLAG_HIDDEN);
+
+  // Load (or boot milestones) on the left, the Boot/Tasks switch on the right
+  lv_obj_t *row = lv_obj_create(tasksPanel);
+  lv_obj_set_size(row, LV_PCT(100), LV_SIZE_CONTENT);
+  lv_obj_set_style_pad_all(row, 0, LV_PART_MAIN);
+  lv_obj_set_style_border_width(row, 0, LV_PART_MAIN);
+  lv_obj_set_flex_flow(row, LV_FLEX_FLOW_ROW);
+  lv_obj_set_flex_align(row, LV_FLEX_ALIGN_SPACE_BETWEEN, LV_FLEX_ALIGN_CENTER, LV_FLEX_ALIGN_CENTER);
+  lv_obj_clear_flag(row, LV_OBJ_FLAG_SCROLLABLE);
+
+  tasksLoadLabel = lv_label_create(row);
+  lv_obj_set_style_text_font(tasksLoadLabel, &lv_font_montserrat_14, LV_PART_MAIN);
+
+  btn = lv_btn_create(row);
+  lv_obj_set_size(btn, 64, 26);
+  lv_obj_add_event_cb(btn, tasks_mode_event, LV_EVENT_ALL, NULL);
+  tasksModeLabel = lv_label_create(btn);
+  lv_label_set_text(tasksModeLabel, "Boot");
+  lv_obj_set_style_text_font(tasksModeLabel, &lv_font_montserrat_14, LV_PART_MAIN);
+  lv_obj_center(tasksModeLabel);
+
+  tasksTable = lv_table_create(tasksPanel);
+  lv_table_set_col_cnt(tasksTable, 4);
+  lv_obj_set_style_text_font(tasksTable, &lv_font_montserrat_14, LV_PART_ITEMS);
+  lv_obj_set_style_pad_ver(tasksTable, 2, LV_PART_ITEMS);
+  lv_obj_set_style_pad_hor(tasksTable, 4, LV_PART_ITEMS);
+
+  lv_obj_add_event_cb(ui_Info, tasks_screen_event, LV_EVENT_ALL, NULL);
+}
+
+// Called from tftPump() to keep an open panel current
+static void tasks_panel_update()
+{
+  if ((tasksPanel != NULL) && !lv_obj_has_flag(tasksPanel, LV_OBJ_FLAG_HIDDEN) &&
+      (millis() - tasksRefreshed > PROFILE_INTERVAL))
+    tasks_refresh();
+}
+
+// LVGL's pool may only be looked at from this task, so the heap monitor
+// reads a copy refreshed about once a second
+static volatile uint32_t lvglMemoryUsed;
+static int64_t lvglMemoryChecked;
+
+static void lvgl_memory_update()
+{
+  lv_mem_monitor_t mon;
+
+  if (millis() - lvglMemoryChecked < 1000)
+    return;
+  lvglMemoryChecked = millis();
+  lv_mem_monitor(&mon);
+  lvglMemoryUsed = mon.total_size - mon.free_size;
+}
+
+uint32_t tftLvglMemoryUsed()
+{
+  return lvglMemoryUsed;
+}
+
 void tftInit()
 {
   // The TFT display IRQ pin must be pulled up
@@ -382,6 +799,7 @@ void tftInit()
   lv_init();
 
   tft.begin();
+  backlight_init();
 
   memcpy (calData, calData_3_2, sizeof(calData));
   tft.setTouchCalibrate(calData);
@@ -406,6 +824,8 @@ void tftInit()
   lv_indev_drv_register(&indev_drv);
   
   ui_init();
+  tasks_panel_init();
+  tftWifiScanInit();
 
   setHvacModesDropdown();
 
@@ -428,9 +848,21 @@ void tftPump(void * parameter)
 {
   for(;;) // infinite loop
   {
+    int64_t start = esp_timer_get_time();
+    uint32_t flushes = flushCount;
+
     lv_timer_handler();
+    // Most passes find nothing to redraw; only time the ones that did
+    if (flushCount != flushes)
+      metricObserveSince(METRIC_LVGL_RENDER, start);
 
+    // Before the arc is set to the converted set point
+    temp_units_update();
     tftUpdateDisplay();
+    tasks_panel_update();
+    lvgl_memory_update();
+    backlight_range_update();
+    tftWifiScanUpdate();
 
     if (millis() - lastTouchDetected > OperatingParameters.thermostatSleepTime * 1000)
     {
@@ -10,7 +10,9 @@
 // #include <nvs_flash.h>    // For nvs_flash_init()
 
 #define screenWidth 320
-TaskHandle_t ntScanTaskHandler = NULL;
+#define SCAN_PAGE 8                   // Networks per page of the SSID dropdown
+#define SCAN_PREV LV_SYMBOL_UP " Previous"
+#define SCAN_MORE LV_SYMBOL_DOWN " More"
 
 void tftUpdateTempSet(lv_event_t * e)
 {
@@ -93,52 +95,169 @@ void tftBeep(lv_event_t * e)
   audioBeep();
 }
 
-void wifiScanner(void *pvParameters)
+//
+// The SSID dropdown shows the scan results a page at a time, with
+// Previous/More entries to turn the page. The list is refreshed from
+// tftPump() as the scan goes through the channels.
+//
+static WIFI_NETWORK scanNetworks[WIFI_SCAN_MAX];
+static int scanCount;
+static int scanPage;
+static uint32_t scanVersion;
+static bool scanRunning;
+static char scanSelected[33];         // SSID picked, kept across refreshes
+
+//
+// The dropdown always shows a network as selected, never a page entry,
+// and scanSelected is that network: the one picked if it is on this
+// page, else the first on the page.
+//
+static void ssid_dropdown_fill()
 {
-  WiFi_ScanSSID();
+  char options[SCAN_PAGE * 34 + 32] = "";
+  int first = scanPage * SCAN_PAGE;
+  int selected = -1;
+  int opt = 0;
 
-  lv_dropdown_set_options(ui_SsidDropdown, Get_WiFiSSID_DD_List());
-  lv_label_set_text(ui_WifiStatusLabel, "Scan Done");
-  ui_WifiStatusLabel_timestamp = millis();
-  lv_obj_clear_state(ui_ScanBtn, LV_STATE_DISABLED);
-  audioBeep();
+  if (scanPage > 0)
+  {
+    strlcat(options, SCAN_PREV "\n", sizeof(options));
+    opt++;
+  }
+  for (int i = first; (i < scanCount) && (i < first + SCAN_PAGE); i++, opt++)
+  {
+    char ssid[34];
+
+    // Options are newline separated
+    strlcpy(ssid, scanNetworks[i].ssid, sizeof(ssid));
+    for (char *c = ssid; *c; c++)
+      if (*c < ' ')
+        *c = '?';
+    if (strcmp(scanNetworks[i].ssid, scanSelected) == 0)
+      selected = opt;
+    strlcat(ssid, "\n", sizeof(ssid));
+    strlcat(options, ssid, sizeof(options));
+  }
+  if (first + SCAN_PAGE < scanCount)
+    strlcat(options, SCAN_MORE "\n", sizeof(options));
+
+  if ((selected < 0) && (first < scanCount))
+  {
+    selected = (scanPage > 0) ? 1 : 0;
+    strlcpy(scanSelected, scanNetworks[first].ssid, sizeof(scanSelected));
+  }
+  else if (selected < 0)
+    scanSelected[0] = '\0';
+
+  if (options[0] == '\0')
+    strlcpy(options, scanRunning ? "" : "-- No SSIDs --", sizeof(options));
+  else
+    options[strlen(options) - 1] = '\0';
+  lv_dropdown_set_options(ui_SsidDropdown, options);
+  lv_dropdown_set_selected(ui_SsidDropdown, (selected < 0) ? 0 : selected);
+}
+
+// The network picked in the dropdown; NULL for nothing or a page entry
+static const char *ssid_dropdown_network()
+{
+  int opt = lv_dropdown_get_selected(ui_SsidDropdown);
+  int i;
+
+  if (scanPage > 0)
+  {
+    if (opt == 0)
+      return NULL;
+    opt--;
+  }
+  i = scanPage * SCAN_PAGE + opt;
+  if ((opt >= SCAN_PAGE) || (i >= scanCount))
+    return NULL;
+  return scanNetworks[i].ssid;
+}
+
+static void ssid_dropdown_event(lv_event_t * e)
+{
+  const char *ssid = ssid_dropdown_network();
+  int opt = lv_dropdown_get_selected(ui_SsidDropdown);
 
-  ntScanTaskHandler = NULL;
-  vTaskDelete(NULL);
+  if (ssid != NULL)
+  {
+    strlcpy(scanSelected, ssid, sizeof(scanSelected));
+    return;
+  }
+  if ((scanPage > 0) && (opt == 0))
+    scanPage--;
+  else if ((scanPage + 1) * SCAN_PAGE < scanCount)
+    scanPage++;
+  else
+    return;
+  ssid_dropdown_fill();
+  lv_dropdown_open(ui_SsidDropdown);
 }
 
-static void networkScanner() {
-  xTaskCreate(wifiScanner,
-              "ScanWifiTask",
-              4096,
-              NULL,
-              tskIDLE_PRIORITY+2,
-              &ntScanTaskHandler);
+void tftWifiScanInit()
+{
+  lv_obj_add_event_cb(ui_SsidDropdown, ssid_dropdown_event, LV_EVENT_VALUE_CHANGED, NULL);
+}
+
+// Called from tftPump(); only does something when the results changed
+void tftWifiScanUpdate()
+{
+  uint32_t version = WifiScanVersion();
+  bool running;
+
+  if (version == scanVersion)
+    return;
+  scanVersion = version;
+  running = WifiScanRunning();
+
+  scanCount = WifiScanResults(scanNetworks, WIFI_SCAN_MAX);
+  // Stay with the network picked as the list is sorted again
+  for (int i = 0; i < scanCount; i++)
+    if (strcmp(scanNetworks[i].ssid, scanSelected) == 0)
+    {
+      scanPage = i / SCAN_PAGE;
+      break;
+    }
+  if (scanPage * SCAN_PAGE >= scanCount)
+    scanPage = 0;
+  if (scanRunning && !running)
+  {
+    scanRunning = false;
+    lv_label_set_text_fmt(ui_WifiStatusLabel, "Scan Done (%d)", scanCount);
+    ui_WifiStatusLabel_timestamp = millis();
+    lv_obj_clear_state(ui_ScanBtn, LV_STATE_DISABLED);
+    audioBeep();
+  }
+  else if (running)
+  {
+    scanRunning = true;
+    lv_label_set_text_fmt(ui_WifiStatusLabel, "Scanning... (%d)", scanCount);
+  }
+  ssid_dropdown_fill();
 }
 
 void StartWifiScan(lv_event_t * e)
 {
   audioBeep();
+  // Results come in through tftWifiScanUpdate()
+  if (!WifiScanStart())
+  {
+    lv_label_set_text(ui_WifiStatusLabel, "Wifi not running");
+    ui_WifiStatusLabel_timestamp = millis();
+    return;
+  }
   lv_obj_add_state(ui_ScanBtn, LV_STATE_DISABLED);
   lv_label_set_text(ui_WifiStatusLabel, "Scanning...");
-
-  // Scan for SSIDs. This is done synchronously, so complete it via a RTOS task.
-  networkScanner();
 }
 
-extern bool wifiScanActive;
-
 void stopWifiScan(lv_event_t * e)
 {
-  if (ntScanTaskHandler != NULL)
-  {
-    vTaskDelete(ntScanTaskHandler);
-    ntScanTaskHandler = NULL;
-  }
+  WifiScanStop();
+  scanRunning = false;
   lv_label_set_text(ui_WifiStatusLabel, "Scan Aborted");
   ui_WifiStatusLabel_timestamp = millis();
   lv_obj_clear_state(ui_ScanBtn, LV_STATE_DISABLED);
-  wifiScanActive = false;
 }
 
 #define LABEL_COLOR "#850808"
@@ -214,20 +333,17 @@ void tftUpdateUiSleepValue(lv_event_t * e)
 
 void tftSetNewWifi(lv_event_t * e)
 {
-  lv_dropdown_get_selected_str(ui_SsidDropdown, WifiCreds.ssid, sizeof(WifiCreds.ssid));
-  if (strlen(WifiCreds.ssid) > 0)
+  // The network shown as selected; the list may have been re-sorted since
+  if (scanSelected[0] != '\0')
   {
+    strlcpy(WifiCreds.ssid, scanSelected, sizeof(WifiCreds.ssid));
     strcpy (WifiCreds.password, lv_textarea_get_text(ui_PSK));
     printf ("*** [tftSetNewWifi] WifiCreds.password = %s\n", WifiCreds.password);
     // Save the new wifi credentials to NVRAM
     setWifiCreds(); //Store locally (in Thermostat NVS)
     WifiSetCredentials(WifiCreds.ssid, WifiCreds.password);
-    // Initiate a disconnect so the new wifi info will be used when auto-reconnect happens
+    // Disconnect; the wifi manager reconnects straight away with the new info
     WifiDisconnect();
-
-    // Immediately start a new wifi connection
-    lastWifiReconnect = 0;
-//    startReconnectTask();
   }
 }
 
@@ -247,6 +363,7 @@ void SaveConfigSettings(lv_event_t * e)
       OperatingParameters.tempCurrent = (OperatingParameters.tempCurrent - 32.0) / (9.0/5.0);
       OperatingParameters.tempCorrection = OperatingParameters.tempCorrection * 5.0 / 9.0;
       OperatingParameters.tempSwing = OperatingParameters.tempSwing * 5.0 / 9.0;
+      OperatingParameters.ecoSetback = OperatingParameters.ecoSetback * 5.0 / 9.0;
       resetTempSmooth();
     }
     OperatingParameters.tempUnits = 'C';
@@ -260,6 +377,7 @@ void SaveConfigSettings(lv_event_t * e)
       OperatingParameters.tempCurrent = (OperatingParameters.tempCurrent * 9.0/5.0) + 32.0;
       OperatingParameters.tempCorrection = OperatingParameters.tempCorrection * 1.8;
       OperatingParameters.tempSwing = OperatingParameters.tempSwing * 1.8;
+      OperatingParameters.ecoSetback = OperatingParameters.ecoSetback * 1.8;
       resetTempSmooth();
     }
     OperatingParameters.tempUnits = 'F';
@@ -612,9 +730,7 @@ void saveDeviceName(lv_event_t * e)
   if (strcmp(oldName, OperatingParameters.DeviceName))
   {
     printf ("Hostname/Devicename changed -- Restarting wifi to update network name\n");
-    // Initiate a disconnect so the new wifi info will be used when auto-reconnect happens
+    // Disconnect; the wifi manager reconnects straight away with the new name
     WifiDisconnect();
-    // Immediately start a new wifi connection
-    lastWifiReconnect = 0;
   }
 }
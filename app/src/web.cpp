@@ -2,9 +2,9 @@
 /*
  * web.cpp
  *
- * This module implements the web UI page. It also provide the
- * initialization of mDNS so the web page can be connected to without
- * knowing the IP address.
+ * This module implements the web UI page. mDNS (mdns.cpp, started
+ * with wifi) lets the web page be connected to without knowing the IP
+ * address.
  *
  * Copyright (c) 2023 Steve Meisner (steve@meisners.net)
  *
@@ -39,161 +39,93 @@
 
 #include <esp_http_server.h>
 #include <esp_ota_ops.h>
+#include <esp_timer.h>
 #include "thermostat.hpp"
-#include "ui/ui.h"
 #include "version.h"
 #include "web_ui.h"
 
 static const char *TAG = "WEB";
 
 static char html[2200];
-static char xml[800];
+static char xml[1600];
 
-float doTempUp(void)
+//
+// Convert the temperatures to 'units' ('C' or 'F'); not saved. May be
+// called from any task: the display follows on the UI task.
+//
+void updateTempUnits(char units)
 {
-  if (OperatingParameters.tempUnits == 'C')
-  {
-    OperatingParameters.tempSet += 0.5;
-    updateHvacSetTemp(roundValue(OperatingParameters.tempSet, 1));
-  } else {
-    OperatingParameters.tempSet += 1.0;
-    updateHvacSetTemp(roundValue(OperatingParameters.tempSet, 0));
+  if (units == OperatingParameters.tempUnits)
+    return;
+  if (units == 'C') {
+    OperatingParameters.tempSet = (OperatingParameters.tempSet - 32.0) / (9.0/5.0);
+    OperatingParameters.tempSetAutoMin = (OperatingParameters.tempSetAutoMin - 32.0) / (9.0/5.0);
+    OperatingParameters.tempSetAutoMax = (OperatingParameters.tempSetAutoMax - 32.0) / (9.0/5.0);
+    OperatingParameters.tempCurrent = (OperatingParameters.tempCurrent - 32.0) / (9.0/5.0);
+    OperatingParameters.tempCorrection = OperatingParameters.tempCorrection * 5.0 / 9.0;
+    OperatingParameters.tempSwing = OperatingParameters.tempSwing * 5.0 / 9.0;
+    OperatingParameters.ecoSetback = OperatingParameters.ecoSetback * 5.0 / 9.0;
+    resetTempSmooth();
+    OperatingParameters.tempUnits = 'C';
+  }
+  else {
+    OperatingParameters.tempSet = (OperatingParameters.tempSet * 9.0/5.0) + 32.0;
+    OperatingParameters.tempSetAutoMin = (OperatingParameters.tempSetAutoMin * 9.0/5.0) + 32.0;
+    OperatingParameters.tempSetAutoMax = (OperatingParameters.tempSetAutoMax * 9.0/5.0) + 32.0;
+    OperatingParameters.tempCurrent = (OperatingParameters.tempCurrent * 9.0/5.0) + 32.0;
+    OperatingParameters.tempCorrection = OperatingParameters.tempCorrection * 1.8;
+    OperatingParameters.tempSwing = OperatingParameters.tempSwing * 1.8;
+    OperatingParameters.ecoSetback = OperatingParameters.ecoSetback * 1.8;
+    resetTempSmooth();
+    OperatingParameters.tempUnits = 'F';
   }
-  return OperatingParameters.tempSet;
+  // The arc range and the tenths label, once the units above are set
+  tftApplyTempUnits();
 }
 
-float doTempDown(void)
+#define min(x, y) ((x < y) ? x : y)
+
+// Read a whole request body of up to 'max' bytes into 'body' (max + 1 bytes)
+static esp_err_t web_read_body(httpd_req_t *req, char *body, size_t max)
 {
-  if (OperatingParameters.tempUnits == 'C')
-  {
-    OperatingParameters.tempSet -= 0.5;
-    updateHvacSetTemp(roundValue(OperatingParameters.tempSet, 1));
-  } else {
-    OperatingParameters.tempSet -= 1.0;
-    updateHvacSetTemp(roundValue(OperatingParameters.tempSet, 0));
-  }
-  return OperatingParameters.tempSet;
-}
-
-float enforceRange(float value, float min, float max) {
-  if (value < min)
-    return min;
-  if (value > max)
-    return max;
-  return value;
-}
-
-#define BUTTON_CONTENT_SIZE 30
-void buttonDispatch(char content[BUTTON_CONTENT_SIZE])
-{
-  if (!strncmp(content, "tempUp", BUTTON_CONTENT_SIZE))
-    doTempUp();
-  else if (!strncmp(content, "tempDown", BUTTON_CONTENT_SIZE))
-    doTempDown();
-  else if (!strncmp(content, "hvacModeOff", BUTTON_CONTENT_SIZE))
-    updateHvacMode(OFF);
-  else if (!strncmp(content, "hvacModeAuto", BUTTON_CONTENT_SIZE))
-    updateHvacMode(AUTO);
-  else if (!strncmp(content, "hvacModeHeat", BUTTON_CONTENT_SIZE))
-    updateHvacMode(HEAT);
-  else if (!strncmp(content, "hvacModeCool", BUTTON_CONTENT_SIZE))
-    updateHvacMode(COOL);
-  else if (!strncmp(content, "hvacModeFan", BUTTON_CONTENT_SIZE))
-    updateHvacMode(FAN_ONLY);
-  else if (!strncmp(content, "clear", BUTTON_CONTENT_SIZE))
-    clearNVS();
-#ifdef TELNET_ENABLED
-  else if (!strncmp(content, "terminateTelnet", BUTTON_CONTENT_SIZE))
-//    if (telnetServiceRunning()) //@@@
-    terminateTelnetSession();
-#endif
-  else if (!strncmp(content, "hvacCoolEnable", BUTTON_CONTENT_SIZE))
-  {
-    OperatingParameters.hvacCoolEnable = !OperatingParameters.hvacCoolEnable; 
-    #ifdef MQTT_ENABLED
-    updateEnabledHvacModes();
-    #endif
-  }
-  else if (!strncmp(content, "hvacFanEnable", BUTTON_CONTENT_SIZE))
-  {
-    OperatingParameters.hvacFanEnable = !OperatingParameters.hvacFanEnable;
-    #ifdef MQTT_ENABLED
-    updateEnabledHvacModes();
-    #endif
-  }
-  else if (!strncmp(content, "swingUp", BUTTON_CONTENT_SIZE))
-  {
-    OperatingParameters.tempSwing = enforceRange(OperatingParameters.tempSwing + 0.1, 0.0, 6.0);
-    eepromUpdateArbFloat("setSwing", OperatingParameters.tempSwing);
-  }
-  else if (!strncmp(content, "swingDown", BUTTON_CONTENT_SIZE))
-  {
-    OperatingParameters.tempSwing = enforceRange(OperatingParameters.tempSwing - 0.1, 0.0, 6.0);
-    eepromUpdateArbFloat("setSwing", OperatingParameters.tempSwing);
-  }
-  else if (!strncmp(content, "correctionUp", BUTTON_CONTENT_SIZE))
-  {
-    OperatingParameters.tempCorrection = enforceRange(OperatingParameters.tempCorrection + 0.1, -10.0, 10.0);
-    eepromUpdateArbFloat("setTempCorr", OperatingParameters.tempCorrection);
-  }
-  else if (!strncmp(content, "correctionDown", BUTTON_CONTENT_SIZE))
-  {
-    OperatingParameters.tempCorrection = enforceRange(OperatingParameters.tempCorrection - 0.1, -10.0, 10.0);
-    eepromUpdateArbFloat("setTempCorr", OperatingParameters.tempCorrection);
-  }
-  else if (!strncmp(content, "twoStageEnable", BUTTON_CONTENT_SIZE))
+  size_t received = 0;
+
+  if (req->content_len > max)
   {
-    OperatingParameters.hvac2StageHeatEnable = !OperatingParameters.hvac2StageHeatEnable;
-    #ifdef MQTT_ENABLED
-    updateEnabledHvacModes();
-    #endif
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Body too large");
+    return ESP_FAIL;
   }
-  else if (!strncmp(content, "reverseEnable", BUTTON_CONTENT_SIZE))
+
+  while (received < req->content_len)
   {
-    OperatingParameters.hvacReverseValveEnable = !OperatingParameters.hvacReverseValveEnable;
-    #ifdef MQTT_ENABLED
-    updateEnabledHvacModes();
-    #endif
-  }
-  else if (!strncmp(content, "unitToggle", BUTTON_CONTENT_SIZE)) {
-    if (OperatingParameters.tempUnits == 'F') {
-      OperatingParameters.tempSet = (OperatingParameters.tempSet - 32.0) / (9.0/5.0);
-      OperatingParameters.tempCurrent = (OperatingParameters.tempCurrent - 32.0) / (9.0/5.0);
-      OperatingParameters.tempCorrection = OperatingParameters.tempCorrection * 5.0 / 9.0;
-      OperatingParameters.tempSwing = OperatingParameters.tempSwing * 5.0 / 9.0;
-      resetTempSmooth();
-      lv_arc_set_range(ui_TempArc, 7*10, 33*10);
-      lv_obj_clear_flag(ui_SetTempFrac, LV_OBJ_FLAG_HIDDEN);
-      OperatingParameters.tempUnits = 'C';
-    }
-    else {
-      OperatingParameters.tempSet = (OperatingParameters.tempSet * 9.0/5.0) + 32.0;
-      OperatingParameters.tempCurrent = (OperatingParameters.tempCurrent * 9.0/5.0) + 32.0;
-      OperatingParameters.tempCorrection = OperatingParameters.tempCorrection * 1.8;
-      OperatingParameters.tempSwing = OperatingParameters.tempSwing * 1.8;
-      resetTempSmooth();
-      lv_arc_set_range(ui_TempArc, 45*10, 92*10);
-      lv_obj_add_flag(ui_SetTempFrac, LV_OBJ_FLAG_HIDDEN);
-      OperatingParameters.tempUnits = 'F';
+    int n = httpd_req_recv(req, &body[received], req->content_len - received);
+
+    if (n == HTTPD_SOCK_ERR_TIMEOUT)
+      continue;
+    if (n <= 0)
+    {
+      ESP_LOGW(TAG, "%s: receive failed (%d)", req->uri, n);
+      OperatingParameters.Errors.systemErrors++;
+      return ESP_FAIL;
     }
+    received += n;
   }
-  else
-  {
-    ESP_LOGE(TAG, "Could not dispatch request \"%s\"", content);
-    OperatingParameters.Errors.systemErrors++;
-  }
+  body[received] = '\0';
+  return ESP_OK;
 }
 
-#define min(x, y) ((x < y) ? x : y)
-
+//
+// The web UI buttons post the name of an action (actions.cpp)
+//
 esp_err_t handleButton(httpd_req_t *req)
 {
-  char content[BUTTON_CONTENT_SIZE];
-  size_t recv_size = min(req->content_len, sizeof(content));
+  char content[ACTION_NAME_MAX + 1];
+
+  if (web_read_body(req, content, ACTION_NAME_MAX) != ESP_OK)
+    return ESP_FAIL;
+  if (!actionDispatch(content, req->content_len, ACTION_SRC_WEB))
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown action");
   httpd_resp_set_type(req, "text/xml");
-  int ret = httpd_req_recv(req, content, recv_size);
-  content[recv_size] = '\0';
-  buttonDispatch(content);
   return httpd_resp_send(req, 0, 0);
 }
 
@@ -205,7 +137,22 @@ esp_err_t handleButton(httpd_req_t *req)
   }                                                             \
   strcat(xmlBuffer, other);
 
+static esp_err_t send_xml(httpd_req_t *req);
+
 esp_err_t handleXML(httpd_req_t *req)
+{
+  int64_t start = esp_timer_get_time();
+  esp_err_t ret;
+
+  // The status page polls this; keep wifi responsive while it is open
+  WifiPowerBoost();
+  ret = send_xml(req);
+
+  metricObserveSince(METRIC_WEB_XML, start);
+  return ret;
+}
+
+static esp_err_t send_xml(httpd_req_t *req)
 {
   char buf[128];
   ssize_t xmlSpace = sizeof(xml) - 1;
@@ -228,14 +175,26 @@ esp_err_t handleXML(httpd_req_t *req)
   CAT_IF_SPACE(xml, buf, xmlSpace, req);
   xmlSpace -= snprintf(buf, sizeof(buf), "<light>%d</light>\n", OperatingParameters.lightDetected);
   CAT_IF_SPACE(xml, buf, xmlSpace, req);
+  xmlSpace -= snprintf(buf, sizeof(buf), "<lux>%.0f</lux>\n", OperatingParameters.lightLux);
+  CAT_IF_SPACE(xml, buf, xmlSpace, req);
   xmlSpace -= snprintf(buf, sizeof(buf), "<motion>%s</motion>\n", OperatingParameters.motionDetected ? "True" : "False");
   CAT_IF_SPACE(xml, buf, xmlSpace, req);
+  xmlSpace -= snprintf(buf, sizeof(buf), "<occupancy>%s</occupancy>\n", OperatingParameters.occupied ? "Occupied" : "Vacant");
+  CAT_IF_SPACE(xml, buf, xmlSpace, req);
+  xmlSpace -= snprintf(buf, sizeof(buf), "<distance>%d</distance>\n", OperatingParameters.targetDistance);
+  CAT_IF_SPACE(xml, buf, xmlSpace, req);
+  xmlSpace -= snprintf(buf, sizeof(buf), "<ecoSetback>%.1f</ecoSetback>\n", OperatingParameters.ecoSetback);
+  CAT_IF_SPACE(xml, buf, xmlSpace, req);
+  xmlSpace -= snprintf(buf, sizeof(buf), "<vacancyTimeout>%d</vacancyTimeout>\n", OperatingParameters.vacancyTimeout);
+  CAT_IF_SPACE(xml, buf, xmlSpace, req);
   xmlSpace -= snprintf(buf, sizeof(buf), "<units>%c</units>\n", OperatingParameters.tempUnits);
   CAT_IF_SPACE(xml, buf, xmlSpace, req);
   xmlSpace -= snprintf(buf, sizeof(buf), "<swing>%.1f</swing>\n", OperatingParameters.tempSwing);
   CAT_IF_SPACE(xml, buf, xmlSpace, req);
   xmlSpace -= snprintf(buf, sizeof(buf), "<correction>%.1f</correction>\n", OperatingParameters.tempCorrection);
   CAT_IF_SPACE(xml, buf, xmlSpace, req);
+  xmlSpace -= snprintf(buf, sizeof(buf), "<controlMode>%s</controlMode>\n", hvacControlModeToString(OperatingParameters.hvacControlMode));
+  CAT_IF_SPACE(xml, buf, xmlSpace, req);
   xmlSpace -= snprintf(buf, sizeof(buf), "<wifiStrength>%d</wifiStrength>\n", WifiSignal());
   CAT_IF_SPACE(xml, buf, xmlSpace, req);
   xmlSpace -= snprintf(buf, sizeof(buf), "<address>%s</address>\n", WifiAddress());
@@ -254,13 +213,461 @@ esp_err_t handleXML(httpd_req_t *req)
   CAT_IF_SPACE(xml, buf, xmlSpace, req);
   xmlSpace -= snprintf(buf, sizeof(buf), "<reverseEnable>%d</reverseEnable>\n", OperatingParameters.hvacReverseValveEnable);
   CAT_IF_SPACE(xml, buf, xmlSpace, req);
+  for (int s = 0; s < NR_HVAC_STAGES; s++)
+  {
+    static const char *stageTag[NR_HVAC_STAGES] = { "heat", "cool", "fan" };
+    HVAC_RUNTIME_STATS stats;
+    hvacGetRuntimeStats((HVAC_STAGE)s, &stats);
+    xmlSpace -= snprintf(buf, sizeof(buf), "<%sToday>%lu</%sToday>\n", stageTag[s], stats.todaySeconds / 60, stageTag[s]);
+    CAT_IF_SPACE(xml, buf, xmlSpace, req);
+    xmlSpace -= snprintf(buf, sizeof(buf), "<%sCycles>%lu</%sCycles>\n", stageTag[s], stats.todayCycles, stageTag[s]);
+    CAT_IF_SPACE(xml, buf, xmlSpace, req);
+    xmlSpace -= snprintf(buf, sizeof(buf), "<%sDuty>%.1f</%sDuty>\n", stageTag[s], stats.dutyDay, stageTag[s]);
+    CAT_IF_SPACE(xml, buf, xmlSpace, req);
+  }
   CAT_IF_SPACE(xml, "</Data>", xmlSpace, req);
   ESP_LOGD(TAG, "Remaining XML space: %ld", xmlSpace);
   return httpd_resp_send(req, xml, strlen(xml));
 }
 
+/*
+ * Schedule commands are sent as the body of a PUT; an empty body just
+ * lists the schedule. See schedule.cpp for the command syntax. A rejected
+ * command gets a 400 with the reason.
+ */
+esp_err_t handleSchedule(httpd_req_t *req)
+{
+  char content[64];
+  static char reply[1200];
+
+  if (web_read_body(req, content, sizeof(content) - 1) != ESP_OK)
+    return ESP_FAIL;
+  httpd_resp_set_type(req, "text/plain");
+  if (!scheduleCommand(content, reply, sizeof(reply)))
+    httpd_resp_set_status(req, HTTPD_400);
+  return httpd_resp_sendstr(req, reply);
+}
+
+/*
+ * Radar commands (see radar.cpp) are sent as the body of a PUT; an empty
+ * body returns the gate energy histogram. A rejected or failed command
+ * gets a 400 with the reason.
+ */
+esp_err_t handleRadar(httpd_req_t *req)
+{
+  char content[64];
+  static char reply[1200];
+
+  if (web_read_body(req, content, sizeof(content) - 1) != ESP_OK)
+    return ESP_FAIL;
+  httpd_resp_set_type(req, "text/plain");
+  if (!radarCommand(content, reply, sizeof(reply)))
+    httpd_resp_set_status(req, HTTPD_400);
+  return httpd_resp_sendstr(req, reply);
+}
+
+/*
+ * Server-sent event stream of the radar gate energies. Each client gets
+ * its own task so the web server isn't tied up; the radar is kept in
+ * engineering mode while anyone is watching.
+ */
+#define RADAR_STREAM_CLIENTS  2
+#define RADAR_STREAM_INTERVAL 250     // ms between events
+
+static int radarStreamClients = 0;
+
+static void radarStreamTask(void *arg)
+{
+  httpd_req_t *req = (httpd_req_t *)arg;
+  char event[512];
+  int n;
+
+  // The handler has counted this stream; turning it on again is harmless
+  radarSetEngineeringMode(true);
+
+  httpd_resp_set_type(req, "text/event-stream");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  for (;;)
+  {
+    n = snprintf(event, sizeof(event), "data: ");
+    n += radarFormatGatesJson(event + n, sizeof(event) - n - 2);
+    n += snprintf(event + n, sizeof(event) - n, "\n\n");
+    if (httpd_resp_send_chunk(req, event, n) != ESP_OK)
+      break;
+    vTaskDelay(pdMS_TO_TICKS(RADAR_STREAM_INTERVAL));
+  }
+  ESP_LOGI(TAG, "Radar event stream closed");
+  httpd_req_async_handler_complete(req);
+
+  if (__atomic_sub_fetch(&radarStreamClients, 1, __ATOMIC_RELAXED) == 0)
+    radarSetEngineeringMode(false);
+  vTaskDelete(NULL);
+}
+
+esp_err_t handleRadarEvents(httpd_req_t *req)
+{
+  httpd_req_t *async;
+
+  if (__atomic_add_fetch(&radarStreamClients, 1, __ATOMIC_RELAXED) > RADAR_STREAM_CLIENTS)
+  {
+    __atomic_sub_fetch(&radarStreamClients, 1, __ATOMIC_RELAXED);
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    return httpd_resp_sendstr(req, "Too many radar streams\n");
+  }
+  if (httpd_req_async_handler_begin(req, &async) != ESP_OK)
+  {
+    __atomic_sub_fetch(&radarStreamClients, 1, __ATOMIC_RELAXED);
+    return httpd_resp_send_500(req);
+  }
+
+  if (xTaskCreate(radarStreamTask, "Radar Stream", 4096, async, tskIDLE_PRIORITY + 1, NULL) != pdPASS)
+  {
+    ESP_LOGE(TAG, "Unable to start radar event stream");
+    OperatingParameters.Errors.systemErrors++;
+    __atomic_sub_fetch(&radarStreamClients, 1, __ATOMIC_RELAXED);
+    httpd_req_async_handler_complete(async);
+    return ESP_FAIL;
+  }
+  ESP_LOGI(TAG, "Radar event stream opened");
+  return ESP_OK;
+}
+
+/*
+ * Plain text stream of the log, like "tail -f": the last LOG_STREAM_BACKLOG
+ * lines and then new ones as they arrive. Each client reads the log ring
+ * through its own cursor in its own task, so a slow client only ever
+ * loses its own lines.
+ */
+#define LOG_STREAM_CLIENTS    2
+#define LOG_STREAM_BACKLOG    50
+#define LOG_STREAM_INTERVAL   200     // ms between looks at the log ring
+
+static int logStreamClients = 0;
+
+static void logStreamTask(void *arg)
+{
+  httpd_req_t *req = (httpd_req_t *)arg;
+  char chunk[1024];
+  char line[LOG_LINE_MAX];
+  LOG_CURSOR cursor;
+  size_t used;
+  int n = 0;
+
+  logCursorInit(&cursor, LOG_STREAM_BACKLOG);
+  httpd_resp_set_type(req, "text/plain");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  for (;;)
+  {
+    used = 0;
+    if (cursor.dropped)
+    {
+      used = snprintf(chunk, sizeof(chunk), "[%lu log lines dropped]\n", cursor.dropped);
+      cursor.dropped = 0;
+    }
+    while ((sizeof(chunk) - used > sizeof(line)) &&
+           ((n = logRead(&cursor, line, sizeof(line), NULL)) > 0))
+    {
+      memcpy(chunk + used, line, n);
+      used += n;
+    }
+    if ((used > 0) && (httpd_resp_send_chunk(req, chunk, used) != ESP_OK))
+      break;
+    if (n == 0)
+      vTaskDelay(pdMS_TO_TICKS(LOG_STREAM_INTERVAL));
+  }
+  httpd_req_async_handler_complete(req);
+  __atomic_sub_fetch(&logStreamClients, 1, __ATOMIC_RELAXED);
+  ESP_LOGI(TAG, "Log stream closed");
+  vTaskDelete(NULL);
+}
+
+esp_err_t handleLog(httpd_req_t *req)
+{
+  httpd_req_t *async;
+
+  if (__atomic_add_fetch(&logStreamClients, 1, __ATOMIC_RELAXED) > LOG_STREAM_CLIENTS)
+  {
+    __atomic_sub_fetch(&logStreamClients, 1, __ATOMIC_RELAXED);
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    return httpd_resp_sendstr(req, "Too many log streams\n");
+  }
+  if (httpd_req_async_handler_begin(req, &async) != ESP_OK)
+  {
+    __atomic_sub_fetch(&logStreamClients, 1, __ATOMIC_RELAXED);
+    return httpd_resp_send_500(req);
+  }
+
+  if (xTaskCreate(logStreamTask, "Log Stream", 4096, async, tskIDLE_PRIORITY, NULL) != pdPASS)
+  {
+    ESP_LOGE(TAG, "Unable to start log stream");
+    OperatingParameters.Errors.systemErrors++;
+    __atomic_sub_fetch(&logStreamClients, 1, __ATOMIC_RELAXED);
+    httpd_req_async_handler_complete(async);
+    return ESP_FAIL;
+  }
+  ESP_LOGI(TAG, "Log stream opened");
+  return ESP_OK;
+}
+
+typedef struct
+{
+  httpd_req_t *req;
+  size_t len;
+  char buf[1024];
+} CHUNKED_RESPONSE;
+
+// Collect lines and send them as a chunk once the buffer fills
+static void chunked_output(void *ctx, const char *text)
+{
+  CHUNKED_RESPONSE *resp = (CHUNKED_RESPONSE *)ctx;
+  size_t n = strlen(text);
+
+  if (resp->len + n > sizeof(resp->buf))
+  {
+    httpd_resp_send_chunk(resp->req, resp->buf, resp->len);
+    resp->len = 0;
+  }
+  if (n > sizeof(resp->buf))
+  {
+    httpd_resp_send_chunk(resp->req, text, n);
+    return;
+  }
+  memcpy(&resp->buf[resp->len], text, n);
+  resp->len += n;
+}
+
+/*
+ * Prometheus text exposition of the metrics in metrics.cpp.
+ */
+esp_err_t handleMetrics(httpd_req_t *req)
+{
+  CHUNKED_RESPONSE *resp = (CHUNKED_RESPONSE *)malloc(sizeof(CHUNKED_RESPONSE));
+
+  if (resp == NULL)
+  {
+    ESP_LOGE(TAG, "No memory for /metrics");
+    OperatingParameters.Errors.systemErrors++;
+    return httpd_resp_send_500(req);
+  }
+  resp->req = req;
+  resp->len = 0;
+
+  httpd_resp_set_type(req, "text/plain; version=0.0.4");
+  metricsWrite(true, chunked_output, resp);
+  if (resp->len > 0)
+    httpd_resp_send_chunk(req, resp->buf, resp->len);
+  free(resp);
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/*
+ * Every sample the heap monitor holds, as CSV (see measure-heap.sh).
+ */
+esp_err_t handleHeap(httpd_req_t *req)
+{
+  CHUNKED_RESPONSE *resp = (CHUNKED_RESPONSE *)malloc(sizeof(CHUNKED_RESPONSE));
+
+  if (resp == NULL)
+  {
+    ESP_LOGE(TAG, "No memory for /heap");
+    OperatingParameters.Errors.systemErrors++;
+    return httpd_resp_send_500(req);
+  }
+  resp->req = req;
+  resp->len = 0;
+
+  httpd_resp_set_type(req, "text/csv");
+  heapMonitorWriteCsv(0, chunked_output, resp);
+  if (resp->len > 0)
+    httpd_resp_send_chunk(req, resp->buf, resp->len);
+  free(resp);
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+//
+// While provisioning, anything but our station address (a captive
+// portal check, the access point's address, whatever the user typed)
+// is sent to the setup page
+//
+static bool web_captive_redirect(httpd_req_t *req)
+{
+  char host[64];
+  char location[40];
+  uint32_t ip = WifiProvisionAddress();
+
+  if (!WifiProvisioning() || (ip == 0))
+    return false;
+  if (WifiConnected() && (httpd_req_get_hdr_value_str(req, "Host", host, sizeof(host)) == ESP_OK) &&
+      !strcmp(host, WifiAddress()))
+    return false;
+
+  snprintf(location, sizeof(location), "http://%d.%d.%d.%d/setup",
+           (int)(ip & 0xff), (int)((ip >> 8) & 0xff), (int)((ip >> 16) & 0xff), (int)(ip >> 24));
+  httpd_resp_set_status(req, "302 Found");
+  httpd_resp_set_hdr(req, "Location", location);
+  httpd_resp_send(req, NULL, 0);
+  return true;
+}
+
+static esp_err_t web_not_found(httpd_req_t *req, httpd_err_code_t err)
+{
+  if (web_captive_redirect(req))
+    return ESP_OK;
+  return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, NULL);
+}
+
+static esp_err_t setup_page(httpd_req_t *req, const char *message, void (*writer)(const char *, METRICS_OUTPUT, void *))
+{
+  CHUNKED_RESPONSE *resp = (CHUNKED_RESPONSE *)malloc(sizeof(CHUNKED_RESPONSE));
+
+  if (resp == NULL)
+  {
+    ESP_LOGE(TAG, "No memory for %s", req->uri);
+    OperatingParameters.Errors.systemErrors++;
+    return httpd_resp_send_500(req);
+  }
+  resp->req = req;
+  resp->len = 0;
+
+  httpd_resp_set_type(req, "text/html");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+  writer(message, chunked_output, resp);
+  if (resp->len > 0)
+    httpd_resp_send_chunk(req, resp->buf, resp->len);
+  free(resp);
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/*
+ * Headless setup and the saved networks (provision.cpp). Only there
+ * while provisioning, so the wifi settings can't be changed from the
+ * house network.
+ */
+esp_err_t handleSetup(httpd_req_t *req)
+{
+  char query[16];
+
+  if (!WifiProvisioning())
+    return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, NULL);
+  if ((httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) && strstr(query, "scan=1"))
+    WifiScanStart();
+  return setup_page(req, NULL, provisionWritePage);
+}
+
+esp_err_t handleSetupSave(httpd_req_t *req)
+{
+  char body[PROVISION_FORM_MAX + 1];
+  char message[80];
+
+  if (!WifiProvisioning())
+    return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, NULL);
+  if (web_read_body(req, body, PROVISION_FORM_MAX) != ESP_OK)
+    return ESP_FAIL;
+
+  provisionSubmit(body, message, sizeof(message));
+  return setup_page(req, message, provisionWritePage);
+}
+
+esp_err_t handleNetworks(httpd_req_t *req)
+{
+  if (!WifiProvisioning())
+    return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, NULL);
+  return setup_page(req, NULL, provisionNetworksWritePage);
+}
+
+esp_err_t handleNetworksSave(httpd_req_t *req)
+{
+  char body[PROVISION_FORM_MAX + 1];
+  char message[80];
+
+  if (!WifiProvisioning())
+    return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, NULL);
+  if (web_read_body(req, body, PROVISION_FORM_MAX) != ESP_OK)
+    return ESP_FAIL;
+
+  provisionNetworksSubmit(body, message, sizeof(message));
+  return setup_page(req, message, provisionNetworksWritePage);
+}
+
+/*
+ * JSON API (api.cpp). GET sends the resource; PATCH (state) and PUT
+ * (config) apply a JSON object of changes and send the resource as it
+ * is afterwards, or a 400 with {"error": ...} if nothing was changed.
+ */
+static esp_err_t api_send(httpd_req_t *req, API_RESOURCE resource, const char *error)
+{
+  CHUNKED_RESPONSE *resp = (CHUNKED_RESPONSE *)malloc(sizeof(CHUNKED_RESPONSE));
+
+  if (resp == NULL)
+  {
+    ESP_LOGE(TAG, "No memory for %s", req->uri);
+    OperatingParameters.Errors.systemErrors++;
+    return httpd_resp_send_500(req);
+  }
+  resp->req = req;
+  resp->len = 0;
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+  if (error != NULL)
+  {
+    httpd_resp_set_status(req, HTTPD_400);
+    apiWriteError(error, chunked_output, resp);
+  }
+  else
+    apiWrite(resource, chunked_output, resp);
+  if (resp->len > 0)
+    httpd_resp_send_chunk(req, resp->buf, resp->len);
+  free(resp);
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static esp_err_t api_update(httpd_req_t *req, API_RESOURCE resource)
+{
+  char *body = (char *)malloc(API_BODY_MAX + 1);
+  char error[80];
+  bool ok;
+
+  if (body == NULL)
+  {
+    ESP_LOGE(TAG, "No memory for %s", req->uri);
+    OperatingParameters.Errors.systemErrors++;
+    return httpd_resp_send_500(req);
+  }
+  if (web_read_body(req, body, API_BODY_MAX) != ESP_OK)
+  {
+    free(body);
+    return ESP_FAIL;
+  }
+  ok = apiUpdate(resource, body, strlen(body), error, sizeof(error));
+  free(body);
+  return api_send(req, resource, ok ? NULL : error);
+}
+
+esp_err_t handleApiState(httpd_req_t *req)
+{
+  return api_send(req, API_STATE, NULL);
+}
+
+esp_err_t handleApiStatePatch(httpd_req_t *req)
+{
+  return api_update(req, API_STATE);
+}
+
+esp_err_t handleApiConfig(httpd_req_t *req)
+{
+  return api_send(req, API_CONFIG, NULL);
+}
+
+esp_err_t handleApiConfigPut(httpd_req_t *req)
+{
+  return api_update(req, API_CONFIG);
+}
+
 esp_err_t handleRoot(httpd_req_t *req)
 {
+  if (web_captive_redirect(req))
+    return ESP_OK;
   return httpd_resp_send(req, webUI, sizeof(webUI));
 }
 
@@ -339,17 +746,93 @@ httpd_uri_t uri_button = {
     .method = HTTP_PUT,
     .handler = handleButton,
     .user_ctx = NULL};
+httpd_uri_t uri_schedule = {
+    .uri = "/schedule",
+    .method = HTTP_PUT,
+    .handler = handleSchedule,
+    .user_ctx = NULL};
+httpd_uri_t uri_radar = {
+    .uri = "/radar",
+    .method = HTTP_PUT,
+    .handler = handleRadar,
+    .user_ctx = NULL};
+httpd_uri_t uri_radar_events = {
+    .uri = "/radar/events",
+    .method = HTTP_GET,
+    .handler = handleRadarEvents,
+    .user_ctx = NULL};
+httpd_uri_t uri_log = {
+    .uri = "/log",
+    .method = HTTP_GET,
+    .handler = handleLog,
+    .user_ctx = NULL};
+httpd_uri_t uri_metrics = {
+    .uri = "/metrics",
+    .method = HTTP_GET,
+    .handler = handleMetrics,
+    .user_ctx = NULL};
+httpd_uri_t uri_heap = {
+    .uri = "/heap",
+    .method = HTTP_GET,
+    .handler = handleHeap,
+    .user_ctx = NULL};
 httpd_uri_t uri_upload = {
     .uri = "/upload",
     .method = HTTP_GET,
     .handler = fwUpload,
     .user_ctx = NULL};
+httpd_uri_t uri_setup = {
+    .uri = "/setup",
+    .method = HTTP_GET,
+    .handler = handleSetup,
+    .user_ctx = NULL};
+httpd_uri_t uri_setup_save = {
+    .uri = "/setup",
+    .method = HTTP_POST,
+    .handler = handleSetupSave,
+    .user_ctx = NULL};
+httpd_uri_t uri_networks = {
+    .uri = "/networks",
+    .method = HTTP_GET,
+    .handler = handleNetworks,
+    .user_ctx = NULL};
+httpd_uri_t uri_networks_save = {
+    .uri = "/networks",
+    .method = HTTP_POST,
+    .handler = handleNetworksSave,
+    .user_ctx = NULL};
+httpd_uri_t uri_api_state = {
+    .uri = "/api/v1/state",
+    .method = HTTP_GET,
+    .handler = handleApiState,
+    .user_ctx = NULL};
+httpd_uri_t uri_api_state_patch = {
+    .uri = "/api/v1/state",
+    .method = HTTP_PATCH,
+    .handler = handleApiStatePatch,
+    .user_ctx = NULL};
+httpd_uri_t uri_api_config = {
+    .uri = "/api/v1/config",
+    .method = HTTP_GET,
+    .handler = handleApiConfig,
+    .user_ctx = NULL};
+httpd_uri_t uri_api_config_put = {
+    .uri = "/api/v1/config",
+    .method = HTTP_PUT,
+    .handler = handleApiConfigPut,
+    .user_ctx = NULL};
 httpd_uri_t uri_update = {
     .uri = "/update",
     .method = HTTP_POST,
     .handler = fwUpdate,
     .user_ctx = NULL};
 
+static esp_err_t web_session_open(httpd_handle_t hd, int sockfd)
+{
+  WifiPowerBoost();
+  return ESP_OK;
+}
+
 void webStart()
 {
   if (!WifiConnected())
@@ -360,13 +843,32 @@ void webStart()
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
   httpd_handle_t server = NULL;
 
+  config.server_port = WEB_PORT;
+  config.max_uri_handlers = 20;
+  config.open_fn = web_session_open;
+
   if (httpd_start(&server, &config) == ESP_OK)
   {
     httpd_register_uri_handler(server, &uri_get);
     httpd_register_uri_handler(server, &uri_xml);
     httpd_register_uri_handler(server, &uri_button);
+    httpd_register_uri_handler(server, &uri_schedule);
+    httpd_register_uri_handler(server, &uri_radar);
+    httpd_register_uri_handler(server, &uri_radar_events);
+    httpd_register_uri_handler(server, &uri_log);
+    httpd_register_uri_handler(server, &uri_metrics);
+    httpd_register_uri_handler(server, &uri_heap);
     httpd_register_uri_handler(server, &uri_upload);
     httpd_register_uri_handler(server, &uri_update);
+    httpd_register_uri_handler(server, &uri_setup);
+    httpd_register_uri_handler(server, &uri_setup_save);
+    httpd_register_uri_handler(server, &uri_networks);
+    httpd_register_uri_handler(server, &uri_networks_save);
+    httpd_register_uri_handler(server, &uri_api_state);
+    httpd_register_uri_handler(server, &uri_api_state_patch);
+    httpd_register_uri_handler(server, &uri_api_config);
+    httpd_register_uri_handler(server, &uri_api_config_put);
+    httpd_register_err_handler(server, HTTPD_404_NOT_FOUND, web_not_found);
   }
 
   if (server == NULL)
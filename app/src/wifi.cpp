@@ -23,19 +23,79 @@
  *   1-Dec-2023: Steve Meisner (steve@meisners.net) - Added support for telnet
  *  29-Apr-2024: Steve Meisner (steve@meisners.net) - Reworked the way wifi reconnects work
  * 
+ * Reconnects:
+ *
+ * One long lived task, the wifi manager, owns reconnecting. When the
+ * connection drops it retries straight away, then backs off
+ * exponentially (WIFI_BACKOFF_MIN doubling up to WIFI_BACKOFF_MAX) with
+ * a random half of each delay as jitter, so a houseful of thermostats
+ * doesn't hit a router that has just rebooted all at the same moment.
+ *
+ * The BSSID and channel of the access point last connected to are kept
+ * in NVS. Every attempt first goes straight for that access point on
+ * that channel (no scan of all channels); only if that fails is the
+ * same attempt repeated with a full scan. DHCP asks for the previous
+ * address again (CONFIG_LWIP_DHCP_RESTORE_LAST_IP).
+ *
+ * How long attempts and outages take goes into the wifi_connect and
+ * wifi_outage histograms (metrics.cpp).
+ *
+ * Power save:
+ *
+ * The station uses modem sleep: NONE keeps the radio on, MIN wakes for
+ * every DTIM beacon, MAX only every WIFI_LISTEN_INTERVAL beacons (the
+ * access point holds our frames until then, so incoming traffic waits up
+ * to ~300 ms). Going out is never delayed. So that the web pages and
+ * telnet stay snappy, using them drops MAX to MIN for
+ * WIFI_POWER_BOOST_TIME; MQTT uses a longer keepalive under MAX.
+ *
+ * There's no way to read the radio's on time from the driver, so it is
+ * estimated from the time spent in each mode: fully on while not
+ * connected or in NONE, otherwise WIFI_BEACON_AWAKE_US per wake.
+ *
+ * Several networks:
+ *
+ * Up to WIFI_NETWORKS_MAX networks are saved, in the order they are
+ * preferred. Each attempt goes to the best one by wifi_network_score():
+ * its signal in a recent scan (one not seen is most likely out of
+ * range), how often connecting to it has worked, failures since it last
+ * did and its place in the list. A network that has just been entered
+ * goes first, whatever its score.
+ *
+ * Roaming: the driver says when the signal drops below WIFI_ROAM_RSSI.
+ * If the access point does 802.11v we ask it where to go (a BSS
+ * transition query) and the supplicant follows its advice. Otherwise we
+ * scan, and if a saved network is WIFI_ROAM_HYSTERESIS stronger than
+ * what we have (which may be another access point with our SSID),
+ * reconnect to it with a full scan, so the strongest access point wins.
+ * 802.11k is turned on as well so the access point can ask for beacon
+ * reports.
+ *
+ * Provisioning:
+ *
+ * For headless setup (provision.cpp) the driver runs as access point
+ * and station at once. The access point can't sleep, so power save is
+ * off meanwhile. Once the station has connected and stayed up for
+ * PROVISION_LINGER, the wifi manager takes the access point down again.
  */
 
 #include <string> // for string class
 #include "thermostat.hpp"
 #include <esp_mac.h>  // for esp_read_mac()
 #include "esp_wifi.h"
+#include "esp_timer.h"
+#include "esp_random.h"
 #include "esp_log.h"
 #include "esp_wps.h"
 #include "esp_event.h"
 #include "nvs_flash.h"
+#ifdef CONFIG_ESP_WIFI_11KV_SUPPORT
+#include "esp_wnm.h"
+#endif
 
 //@@@ forward declaration for event_handler()
 void WifiRegisterEventCallbacks();
+static void wifi_roam_check();
 
 static const char *TAG = "WIFI";
 
@@ -52,18 +112,23 @@ static const char *TAG = "WIFI";
 
 /////////////////////////////////////////////////////////////////////
 
-#define WIFI_MAX_SSID (6u)
-#define WIFI_SSID_LEN (32u)
-#define DEFAULT_SCAN_LIST_SIZE WIFI_MAX_SSID
-
 /* The event group allows multiple bits for each event, but we only care about two events:
  * - we are connected to the AP with an IP
  * - we failed to connect after the maximum amount of retries */
 #define WIFI_CONNECTED_BIT BIT0
 #define WIFI_FAIL_BIT BIT1
-#define WIFI_FAIL_ABORTED BIT2
 
-bool wifiScanActive = false;
+// Task notification bits for the wifi manager
+#define WIFI_NOTIFY_LOST      BIT0    // Disconnected; schedule a retry
+#define WIFI_NOTIFY_CONNECTED BIT1    // Got an IP address
+#define WIFI_NOTIFY_NOW       BIT2    // Retry without waiting (new settings)
+#define WIFI_NOTIFY_POWER     BIT3    // Power save mode or boost changed
+#define WIFI_NOTIFY_SCAN      BIT4    // Scan started, or a channel is done
+#define WIFI_NOTIFY_ROAM      BIT5    // Signal dropped below WIFI_ROAM_RSSI
+
+#define WIFI_BEACON_US        102400  // Usual beacon interval (100 TU)
+#define WIFI_BEACON_AWAKE_US  4000    // Radio on around each beacon we wake for (estimate)
+
 static bool wifiConnecting = false;
 
 /* FreeRTOS event group to signal when we are connected*/
@@ -73,306 +138,752 @@ esp_event_handler_instance_t instance_any_id;
 esp_event_handler_instance_t instance_got_ip;
 
 static esp_netif_t *esp_netif_interface_sta;
+static esp_netif_t *esp_netif_interface_ap;
 
 WIFI_CREDS WifiCreds;
 WIFI_STATUS WifiStatus = {};
 
-static int64_t lastWifiMillis = 0;
-TaskHandle_t ntReconnectTaskHandler = NULL;
+static TaskHandle_t wifiManagerTask = NULL;
+static WIFI_CACHE wifiCache;              // Access point to try first
+static bool wifiCacheDirty;               // Changed since it was saved
+static uint8_t wifiConnectedBssid[6];     // From the last STA_CONNECTED event
+static uint8_t wifiConnectedChannel;
+static portMUX_TYPE wifiCacheLock = portMUX_INITIALIZER_UNLOCKED;
+static bool wifiFastAttempt;              // Current attempt is for the cached access point
+static int64_t wifiAttemptStart;          // esp_timer time; 0 when no attempt is under way
+static int64_t wifiOutageStart;           // esp_timer time the connection dropped; 0 if up
+
+static WIFI_POWER_MODE wifiPowerActive = WIFI_POWER_MIN;  // Driver default
+static int64_t wifiBoostUntil;            // millis(); 0 when not boosted
+static uint32_t wifiBoosts;
+static int64_t wifiPowerSince;            // esp_timer time of the last accounting
+static uint64_t wifiConnectedUs[NR_WIFI_POWER_MODES];
+static uint64_t wifiDownUs;
+static uint64_t wifiRadioOnUs;
+static portMUX_TYPE wifiPowerLock = portMUX_INITIALIZER_UNLOCKED;
+
+static bool wifiProvisioning;            // The provisioning access point is up
+static char wifiProvisionSsid[33];
+static int64_t wifiProvisionDoneAt;       // millis() it goes down; 0 while the station isn't connected
+
+static portMUX_TYPE wifiNetworksLock = portMUX_INITIALIZER_UNLOCKED;   // WifiCreds.networks
+static bool wifiNetworksDirty;            // Their stats changed since they were saved
+static int wifiTryNext = -1;              // Network to try next whatever its score; -1 if none
+static bool wifiTryFullScan;              // ...and not at the cached access point (roaming away)
+static char wifiTrySsid[33];              // Network of the current (or last) attempt
+static char wifiTryPass[64];
+static bool wifiRoamCheck;                // The scan under way is looking for somewhere better
+static int64_t wifiRoamArmAt;             // millis() to watch the signal again; 0 if not due
+static uint32_t wifiRoams;
+static int64_t wifiScanDoneAt;            // millis() the last scan finished; 0 if none has
+
+static const char *wifi_power_str[NR_WIFI_POWER_MODES] = {"none", "min", "max"};
 
 ///////////////////////////////////////////////////////////////////////////////////////
 //
-// Support for wifi scanning with an existing wifi connection, and with TFT UI:
-// From: https://github.com/xpress-embedo/ESP32/blob/master/ConnectToWiFi/src/main.cpp
+// Scanning for networks (TFT UI and console)
 //
-// The code to do the scan for new networks was taken from the Espressif examples:
-// https://raw.githubusercontent.com/espressif/esp-idf/refs/tags/v5.4/examples/wifi/scan/main/scan.c
+// The wifi manager scans one channel at a time, so a connected station
+// gets back to its access point between channels and results show up
+// while the scan is still going. A connect attempt always comes first:
+// it stops a channel scan that is under way, and the scan carries on
+// once the attempt is over. What is found is merged into one list, a
+// single entry per SSID with its strongest signal, strongest first.
 //
 ///////////////////////////////////////////////////////////////////////////////////////
 
-static char wifi_dd_list[WIFI_MAX_SSID*WIFI_SSID_LEN] = { 0 };
+#define WIFI_SCAN_PER_CHANNEL 16      // AP records read per channel
 
-/**
- * @brief This function returns the WiFi SSID Names appended together which is 
- *        suitable for LVGL drop down widget
- * @param  none
- * @return pointer to wifi ssid drop down list
- */
-char *Get_WiFiSSID_DD_List( void )
-{
-  return wifi_dd_list;
-}
-
-
-void WiFi_SsidScanExisting(void)
-{
-  std::string ssid_name;
-  uint16_t number = DEFAULT_SCAN_LIST_SIZE;
-  wifi_ap_record_t ap_info[DEFAULT_SCAN_LIST_SIZE];
-  uint16_t ap_count = 0;
-  wifi_active_scan_time_t active {
-    .min = 0,
-    .max = 120
-  };
-  wifi_scan_time_t scan_time = {
-    .active = active,
-    .passive = 360
-  };
-  wifi_scan_config_t scan_config = {
-    .ssid = 0,
-    .bssid = 0,
-    .channel = 0,
-    .show_hidden = false,
-    .scan_type = WIFI_SCAN_TYPE_ACTIVE,
-    .scan_time = scan_time,
-    .home_chan_dwell_time = 0
-  };
+static WIFI_NETWORK wifiScanList[WIFI_SCAN_MAX];
+static int wifiScanCount;
+static uint32_t wifiScanVersion;      // Bumped when the list or the running state changes
+static uint8_t wifiScanChannel;       // Next channel to scan; 0 when no scan is running
+static uint8_t wifiScanLastChannel;
+static bool wifiScanBusy;             // The driver is scanning a channel for us
+static portMUX_TYPE wifiScanLock = portMUX_INITIALIZER_UNLOCKED;
 
-  if (wifiConnecting)
+//
+// Merge the 'n' networks in 'found' into 'list' ('count' entries, room
+// for 'max'), keeping it sorted by signal then name. Hidden networks are
+// skipped and when the list is full the weakest drop off. Returns the
+// new count.
+//
+static int wifi_scan_merge(WIFI_NETWORK *list, int count, int max, const WIFI_NETWORK *found, int n)
+{
+  for (int f = 0; f < n; f++)
+  {
+    const WIFI_NETWORK *net = &found[f];
+    int i;
+
+    if (net->ssid[0] == '\0')
+      continue;
+
+    for (i = 0; i < count; i++)
+      if (strcmp(list[i].ssid, net->ssid) == 0)
+        break;
+    if (i < count)
+    {
+      if (net->rssi <= list[i].rssi)
+        continue;
+      // Stronger than before: take it out and insert it again
+      memmove(&list[i], &list[i + 1], (count - i - 1) * sizeof(WIFI_NETWORK));
+      count--;
+    }
+
+    for (i = 0; i < count; i++)
+      if ((net->rssi > list[i].rssi) ||
+          ((net->rssi == list[i].rssi) && (strcmp(net->ssid, list[i].ssid) < 0)))
+        break;
+    if (i >= max)
+      continue;
+    if (count == max)
+      count--;
+    memmove(&list[i + 1], &list[i], (count - i) * sizeof(WIFI_NETWORK));
+    list[i] = *net;
+    count++;
+  }
+  return count;
+}
+
+// Pick up what the last channel scan found
+static void wifi_scan_collect()
+{
+  wifi_ap_record_t *records = (wifi_ap_record_t *)malloc(WIFI_SCAN_PER_CHANNEL * sizeof(wifi_ap_record_t));
+  WIFI_NETWORK found[WIFI_SCAN_PER_CHANNEL];
+  uint16_t number = WIFI_SCAN_PER_CHANNEL;
+
+  if (records == NULL)
   {
-    ESP_LOGW(TAG, "** DELAYING SCAN UNTIL WIFI CONNECT COMPLETE **");
-    while (wifiConnecting)
-      vTaskDelay(pdMS_TO_TICKS(200));
-    ESP_LOGW(TAG, "** Resuming wifi scan **");
+    ESP_LOGE(TAG, "Out of memory for scan results");
+    OperatingParameters.Errors.systemErrors++;
+    esp_wifi_clear_ap_list();
+    return;
   }
+  if (esp_wifi_scan_get_ap_records(&number, records) != ESP_OK)
+    number = 0;
+  for (int i = 0; i < number; i++)
+  {
+    strlcpy(found[i].ssid, (const char *)records[i].ssid, sizeof(found[i].ssid));
+    found[i].rssi = records[i].rssi;
+    found[i].channel = records[i].primary;
+    found[i].secure = (records[i].authmode != WIFI_AUTH_OPEN);
+  }
+  free(records);
 
-  memset(ap_info, 0, sizeof(ap_info));
+  portENTER_CRITICAL(&wifiScanLock);
+  wifiScanCount = wifi_scan_merge(wifiScanList, wifiScanCount, WIFI_SCAN_MAX, found, number);
+  wifiScanVersion++;
+  portEXIT_CRITICAL(&wifiScanLock);
+}
 
-  esp_wifi_stop();
-  WifiStatus.wifi_started = false;
+static void wifi_scan_end()
+{
+  portENTER_CRITICAL(&wifiScanLock);
+  wifiScanChannel = 0;
+  wifiScanVersion++;
+  portEXIT_CRITICAL(&wifiScanLock);
+}
 
-  if (!WifiStart("", "", ""))
+// Scan the next channel, unless a connect attempt is under way
+static void wifi_scan_next()
+{
+  wifi_scan_config_t config;
+
+  if ((wifiScanChannel == 0) || wifiScanBusy || wifiConnecting || (wifiAttemptStart != 0))
+    return;
+  if (wifiScanChannel > wifiScanLastChannel)
+  {
+    ESP_LOGI(TAG, "Scan done, %d networks", wifiScanCount);
+    wifiScanDoneAt = millis();
+    wifi_scan_end();
+    if (wifiRoamCheck)
+      wifi_roam_check();
+    return;
+  }
+
+  memset(&config, 0, sizeof(config));
+  config.channel = wifiScanChannel;
+  config.show_hidden = false;
+  config.scan_type = WIFI_SCAN_TYPE_ACTIVE;
+  config.scan_time.active.min = 0;
+  config.scan_time.active.max = 120;
+  if (esp_wifi_scan_start(&config, false) != ESP_OK)
   {
-    ESP_LOGE (TAG, "Failed to start wifi to perform scan.");
-    ap_count = 0;
+    ESP_LOGE(TAG, "Could not scan channel %u", wifiScanChannel);
+    OperatingParameters.Errors.wifiErrors++;
+    wifi_scan_end();
+    return;
   }
+  wifiScanBusy = true;
+}
 
-  esp_wifi_scan_start(&scan_config, true);
-  // ESP_ERROR_CHECK(esp_wifi_scan_get_ap_num(&ap_count));
-  esp_wifi_scan_get_ap_num(&ap_count);
-  // ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&number, ap_info));
-  esp_wifi_scan_get_ap_records(&number, ap_info);
+// A connect attempt is about to start; the channel is scanned again later
+static void wifi_scan_pause()
+{
+  if (!wifiScanBusy)
+    return;
+  esp_wifi_scan_stop();
+  wifiScanBusy = false;
+}
 
-  ESP_LOGI(TAG, "Total APs scanned = %u", ap_count);
-  if (ap_count == 0)
+//
+// Start scanning in the background; the results come in through
+// WifiScanResults() as each channel is done.
+//
+bool WifiScanStart()
+{
+  wifi_country_t country;
+
+  if (!WifiStatus.wifi_started || (wifiManagerTask == NULL))
   {
-    ESP_LOGW(TAG, "- No Networks Found");
-    memset (wifi_dd_list, 0x00, sizeof(wifi_dd_list));
-    strcpy (wifi_dd_list, "-- No SSIDs --");
+    ESP_LOGW(TAG, "Can't scan, wifi isn't running");
+    return false;
+  }
+  if (wifiScanChannel != 0)
+    return true;
+
+  portENTER_CRITICAL(&wifiScanLock);
+  wifiScanCount = 0;
+  wifiScanChannel = 1;
+  wifiScanLastChannel = 13;
+  if ((esp_wifi_get_country(&country) == ESP_OK) && (country.nchan != 0))
+  {
+    wifiScanChannel = country.schan;
+    wifiScanLastChannel = country.schan + country.nchan - 1;
+  }
+  wifiScanVersion++;
+  portEXIT_CRITICAL(&wifiScanLock);
+
+  ESP_LOGI(TAG, "Scanning channels %u-%u", wifiScanChannel, wifiScanLastChannel);
+  xTaskNotify(wifiManagerTask, WIFI_NOTIFY_SCAN, eSetBits);
+  return true;
+}
+
+void WifiScanStop()
+{
+  if (wifiScanChannel != 0)
+    wifi_scan_end();
+}
+
+bool WifiScanRunning()
+{
+  return (wifiScanChannel != 0);
+}
+
+uint32_t WifiScanVersion()
+{
+  return wifiScanVersion;
+}
+
+// Copy out up to 'max' networks found so far, strongest first
+int WifiScanResults(WIFI_NETWORK *networks, int max)
+{
+  int n;
+
+  portENTER_CRITICAL(&wifiScanLock);
+  n = std::min(wifiScanCount, max);
+  memcpy(networks, wifiScanList, n * sizeof(WIFI_NETWORK));
+  portEXIT_CRITICAL(&wifiScanLock);
+  return n;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+//
+// Saved networks and roaming (see the top of the module)
+//
+///////////////////////////////////////////////////////////////////////////////////////
+
+static int wifi_networks_find(const WIFI_SAVED_NETWORK *list, int count, const char *ssid)
+{
+  for (int i = 0; i < count; i++)
+    if (strcmp(list[i].ssid, ssid) == 0)
+      return i;
+  return -1;
+}
+
+//
+// Put 'ssid' at 'pos' in 'list' (-1 or past the end: last), adding it
+// or moving it there. A new password starts its history afresh. When
+// the list is full the last network drops off. Returns the new count.
+//
+static int wifi_networks_add(WIFI_SAVED_NETWORK *list, int count, const char *ssid, const char *pass, int pos)
+{
+  WIFI_SAVED_NETWORK net;
+  int i = wifi_networks_find(list, count, ssid);
+
+  if (i >= 0)
+  {
+    net = list[i];
+    memmove(&list[i], &list[i + 1], (count - i - 1) * sizeof(WIFI_SAVED_NETWORK));
+    count--;
   }
   else
   {
-    std::string ssid;
-    for (int i = 0; (i < DEFAULT_SCAN_LIST_SIZE) && (i < ap_count); i++)
+    memset(&net, 0, sizeof(net));
+    strlcpy(net.ssid, ssid, sizeof(net.ssid));
+  }
+  if (strcmp(net.password, pass) != 0)
+  {
+    memset(&net, 0, sizeof(net));
+    strlcpy(net.ssid, ssid, sizeof(net.ssid));
+    strlcpy(net.password, pass, sizeof(net.password));
+  }
+
+  if ((pos < 0) || (pos > count))
+    pos = count;
+  if (pos >= WIFI_NETWORKS_MAX)
+    pos = WIFI_NETWORKS_MAX - 1;
+  if (count == WIFI_NETWORKS_MAX)
+    count--;
+  memmove(&list[pos + 1], &list[pos], (count - pos) * sizeof(WIFI_SAVED_NETWORK));
+  list[pos] = net;
+  return count + 1;
+}
+
+static int wifi_networks_remove(WIFI_SAVED_NETWORK *list, int count, const char *ssid)
+{
+  int i = wifi_networks_find(list, count, ssid);
+
+  if (i < 0)
+    return count;
+  memmove(&list[i], &list[i + 1], (count - i - 1) * sizeof(WIFI_SAVED_NETWORK));
+  return count - 1;
+}
+
+//
+// How good a candidate the network at 'index' is, higher is better.
+// 'rssi' is its signal in a recent scan, INT8_MIN if the scan didn't see
+// it. Without a recent scan ('scanned' false) signal doesn't count.
+//
+static int wifi_network_score(const WIFI_SAVED_NETWORK *net, int index, bool scanned, int rssi)
+{
+  int score = -5 * index;
+
+  if (scanned)
+    score += (rssi == INT8_MIN) ? -60 : rssi + 100;
+  score += 20 * net->successes / (net->successes + net->failures + 1);
+  score -= 15 * std::min((int)net->recentFailures, 4);
+  return score;
+}
+
+// The best of 'count' saved networks given what a scan saw; -1 if none
+static int wifi_networks_pick(const WIFI_SAVED_NETWORK *list, int count,
+                              const WIFI_NETWORK *visible, int nvisible, bool scanned)
+{
+  int best = -1;
+  int bestScore = 0;
+
+  for (int i = 0; i < count; i++)
+  {
+    int rssi = INT8_MIN;
+    int score;
+
+    for (int v = 0; v < nvisible; v++)
+      if (strcmp(visible[v].ssid, list[i].ssid) == 0)
+        rssi = visible[v].rssi;
+    score = wifi_network_score(&list[i], i, scanned, rssi);
+    if ((best < 0) || (score > bestScore))
     {
-      ESP_LOGI(TAG, "SSID \t\t%s", ap_info[i].ssid);
-      ESP_LOGD(TAG, "RSSI \t\t%d", ap_info[i].rssi);
-      if (ap_info[i].authmode != WIFI_AUTH_WEP)
-      {
-          // print_cipher_type(ap_info[i].pairwise_cipher, ap_info[i].group_cipher);
-      }
-      ESP_LOGD(TAG, "Channel \t\t%d", ap_info[i].primary);
-
-      ssid = (const char *)(ap_info[i].ssid);
-      if (ssid_name.find(ssid) == -1) //std::string::npos)
-      {
-        if( i == 0 )
-        {
-          ssid_name = ssid;
-        }
-        else
-        {
-          ssid_name = ssid_name + '\n';
-          ssid_name = ssid_name + ssid;
-        }
-      }
+      best = i;
+      bestScore = score;
     }
-
-    // clear the array, it might be possible that we coming after rescanning
-    memset (wifi_dd_list, 0x00, sizeof(wifi_dd_list));
-    strncpy (wifi_dd_list, ssid_name.c_str(), sizeof(wifi_dd_list));
   }
+  return best;
 }
 
-void WiFi_SsidScanNew(void)
+// A saved network seen WIFI_ROAM_HYSTERESIS stronger than 'rssi'; -1 if none
+static int wifi_roam_target(const WIFI_SAVED_NETWORK *list, int count,
+                            const WIFI_NETWORK *visible, int nvisible, int rssi)
 {
-  std::string ssid_list;
-  std::string ssid;
+  int best = -1;
+  int bestRssi = rssi + WIFI_ROAM_HYSTERESIS - 1;
 
-  //
-  // Reset the state of the wifi subsystem.
-  //
-  esp_wifi_stop();
-  esp_netif_destroy_default_wifi(esp_netif_interface_sta);
-  esp_event_loop_delete_default();
-  esp_wifi_deinit();
-  WifiStatus.wifi_started = false;
-  WifiStatus.driver_started = false;
-  WifiStatus.if_init = false;
+  for (int v = 0; v < nvisible; v++)
+  {
+    int i = wifi_networks_find(list, count, visible[v].ssid);
 
-  //
-  // Initialize the wifi subsystem.
-  //
-  ESP_ERROR_CHECK(esp_netif_init());
-  ESP_ERROR_CHECK(esp_event_loop_create_default());
-  esp_netif_t *sta_netif = esp_netif_create_default_wifi_sta();
-  assert(sta_netif);
+    if ((i >= 0) && (visible[v].rssi > bestRssi))
+    {
+      best = i;
+      bestRssi = visible[v].rssi;
+    }
+  }
+  return best;
+}
 
-  wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-  ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+// The first choice is what the UIs show and edit
+static void wifi_networks_sync()
+{
+  if (WifiCreds.count > 0)
+  {
+    strlcpy(WifiCreds.ssid, WifiCreds.networks[0].ssid, sizeof(WifiCreds.ssid));
+    strlcpy(WifiCreds.password, WifiCreds.networks[0].password, sizeof(WifiCreds.password));
+  }
+  else
+  {
+    WifiCreds.ssid[0] = '\0';
+    WifiCreds.password[0] = '\0';
+  }
+}
 
-  uint16_t number = DEFAULT_SCAN_LIST_SIZE;
-  wifi_ap_record_t ap_info[DEFAULT_SCAN_LIST_SIZE];
-  uint16_t ap_count = 0;
-  memset(ap_info, 0, sizeof(ap_info));
+//
+// Pick the network for the next attempt into wifiTrySsid/wifiTryPass,
+// or 'ssid'/'pass' if none are saved. 'fast' says whether it may go
+// straight for the cached access point. False if there's nothing to try.
+//
+static bool wifi_choose(const char *ssid, const char *pass, bool *fast)
+{
+  WIFI_NETWORK *visible = NULL;
+  bool scanned = (wifiScanDoneAt != 0) && (millis() - wifiScanDoneAt < WIFI_SCAN_FRESH);
+  int n = 0;
+  int pick;
 
-  ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-  ESP_ERROR_CHECK(esp_wifi_start());
+  if (scanned)
+  {
+    visible = (WIFI_NETWORK *)malloc(WIFI_SCAN_MAX * sizeof(WIFI_NETWORK));
+    if (visible != NULL)
+      n = WifiScanResults(visible, WIFI_SCAN_MAX);
+    else
+      scanned = false;
+  }
 
-  //
-  // Start the scan...
-  //
-  esp_wifi_scan_start(NULL, true);
+  portENTER_CRITICAL(&wifiNetworksLock);
+  *fast = !wifiTryFullScan;
+  wifiTryFullScan = false;
+  pick = wifiTryNext;
+  wifiTryNext = -1;
+  if ((pick < 0) || (pick >= WifiCreds.count))
+    pick = wifi_networks_pick(WifiCreds.networks, WifiCreds.count, visible, n, scanned);
+  if (pick >= 0)
+  {
+    ssid = WifiCreds.networks[pick].ssid;
+    pass = WifiCreds.networks[pick].password;
+  }
+  if (ssid != wifiTrySsid)
+    strlcpy(wifiTrySsid, ssid, sizeof(wifiTrySsid));
+  if (pass != wifiTryPass)
+    strlcpy(wifiTryPass, pass, sizeof(wifiTryPass));
+  portEXIT_CRITICAL(&wifiNetworksLock);
+
+  free(visible);
+  return (wifiTrySsid[0] != '\0');
+}
 
-  //
-  // Complete ... Generate the list of SSIDs found.
-  //
-  ESP_LOGI(TAG, "Max AP number ap_info can hold = %u", number);
-  ESP_ERROR_CHECK(esp_wifi_scan_get_ap_num(&ap_count));
-  ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&number, ap_info));
-  ESP_LOGI(TAG, "Total APs scanned = %u, actual AP number ap_info holds = %u", ap_count, number);
-  for (int i = 0; i < number; i++)
+// Record how the attempt at wifiTrySsid went
+static void wifi_network_result(bool ok, int8_t rssi)
+{
+  portENTER_CRITICAL(&wifiNetworksLock);
+  int i = wifi_networks_find(WifiCreds.networks, WifiCreds.count, wifiTrySsid);
+  if (i >= 0)
   {
-    ESP_LOGI(TAG, "SSID \t\t%s", ap_info[i].ssid);
-    ESP_LOGI(TAG, "RSSI \t\t%d", ap_info[i].rssi);
-    ESP_LOGI(TAG, "Channel \t\t%d", ap_info[i].primary);
+    WIFI_SAVED_NETWORK *net = &WifiCreds.networks[i];
 
-    ssid = (const char *)(ap_info[i].ssid);
-    if (ssid_list.find(ssid) == -1)
+    if (ok)
     {
-      if ( i == 0 )
-      {
-        ssid_list = ssid;
-      }
-      else
-      {
-        ssid_list = ssid_list + '\n';
-        ssid_list = ssid_list + ssid;
-      }
+      if (net->successes < UINT16_MAX)
+        net->successes++;
+      net->recentFailures = 0;
+      net->lastRssi = rssi;
     }
+    else
+    {
+      if (net->failures < UINT16_MAX)
+        net->failures++;
+      if (net->recentFailures < UINT8_MAX)
+        net->recentFailures++;
+    }
+    wifiNetworksDirty = true;
   }
+  portEXIT_CRITICAL(&wifiNetworksLock);
+}
 
-  //
-  // Clear the array, it might be possible that we are running
-  // the scan again.
-  //
-  memset (wifi_dd_list, 0x00, sizeof(wifi_dd_list));
-  strncpy (wifi_dd_list, ssid_list.c_str(), sizeof(wifi_dd_list));
+// The signal is weak: look for something better
+static void wifi_roam()
+{
+  wifi_ap_record_t ap;
 
-  // // Now that we have torn down the Wifi connection, we need 
-  // // to request it to be rebuilt.
-  // WifiStatus.reconnect_requested = true;
+  if (!WifiStatus.Connected || (esp_wifi_sta_get_ap_info(&ap) != ESP_OK))
+    return;
+  ESP_LOGI(TAG, "Signal down to %d dBm, looking for a better access point", ap.rssi);
+#ifdef CONFIG_ESP_WIFI_11KV_SUPPORT
+  // The access point knows its neighbours; the supplicant moves if told to
+  if (esp_wnm_is_btm_supported_connection() &&
+      (esp_wnm_send_bss_transition_mgmt_query(REASON_RSSI, NULL, 0) == 0))
+  {
+    wifiRoams++;
+    return;
+  }
+#endif
+  wifiRoamCheck = WifiScanStart();
 }
 
-/**
- * @brief Scans for the SSID and store the results in a WiFi drop down list
- * "wifi_dd_list", this list is suitable to be used with the LVGL Drop Down.
- * Initialize Wi-Fi as sta and set scan method.
- * @param  none
- */
-void WiFi_ScanSSID(void)
+// The scan started by wifi_roam() is done
+static void wifi_roam_check()
 {
-  wifiScanActive = true;
+  WIFI_NETWORK *visible;
+  wifi_ap_record_t ap;
+  char ssid[33];
+  int n, target;
 
-  // if (OperatingParameters.wifiConnected)
-    WiFi_SsidScanExisting();
-  // else
-  //   WiFi_SsidScanNew();
+  wifiRoamCheck = false;
+  if (!WifiStatus.Connected || (esp_wifi_sta_get_ap_info(&ap) != ESP_OK))
+    return;
+  visible = (WIFI_NETWORK *)malloc(WIFI_SCAN_MAX * sizeof(WIFI_NETWORK));
+  if (visible == NULL)
+  {
+    ESP_LOGE(TAG, "Out of memory for roaming");
+    OperatingParameters.Errors.systemErrors++;
+    return;
+  }
+  n = WifiScanResults(visible, WIFI_SCAN_MAX);
 
-  // Wifi scan is complete...clear the flag.
-  wifiScanActive = false;
+  portENTER_CRITICAL(&wifiNetworksLock);
+  target = wifi_roam_target(WifiCreds.networks, WifiCreds.count, visible, n, ap.rssi);
+  if (target >= 0)
+  {
+    strlcpy(ssid, WifiCreds.networks[target].ssid, sizeof(ssid));
+    wifiTryNext = target;
+    wifiTryFullScan = true;
+  }
+  portEXIT_CRITICAL(&wifiNetworksLock);
+  free(visible);
+  if (target < 0)
+    return;
+
+  // The disconnect event has the wifi manager connect straight away
+  ESP_LOGI(TAG, "Roaming to \"%s\"", ssid);
+  wifiRoams++;
+  esp_wifi_disconnect();
 }
 
+//
+// Station settings for one connect attempt. A fast one goes straight for
+// the cached access point on its channel; otherwise all channels are
+// scanned and the strongest access point with the SSID is used.
+//
+static esp_err_t wifi_set_sta_config(const char *ssid, const char *pass, bool fast)
+{
+  wifi_config_t wifi_config;
 
+  bzero(&wifi_config, sizeof(wifi_config_t));
+  strncpy((char *)wifi_config.sta.ssid, ssid, sizeof(wifi_config.sta.ssid));
+  strncpy((char *)wifi_config.sta.password, pass, sizeof(wifi_config.sta.password));
+  wifi_config.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
+  wifi_config.sta.pmf_cfg.capable = true;
+  wifi_config.sta.pmf_cfg.required = false;
+  // Sent when associating; only MAX uses it (0 is the driver default)
+  if (OperatingParameters.wifiPowerSave == WIFI_POWER_MAX)
+    wifi_config.sta.listen_interval = WIFI_LISTEN_INTERVAL;
+  // Radio measurement (802.11k) and BSS transition management (802.11v)
+  wifi_config.sta.rm_enabled = 1;
+  wifi_config.sta.btm_enabled = 1;
+
+  portENTER_CRITICAL(&wifiCacheLock);
+  fast = fast && (wifiCache.channel != 0) && (strcmp(wifiCache.ssid, ssid) == 0);
+  if (fast)
+  {
+    memcpy(wifi_config.sta.bssid, wifiCache.bssid, sizeof(wifi_config.sta.bssid));
+    wifi_config.sta.bssid_set = true;
+    wifi_config.sta.channel = wifiCache.channel;
+    wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+  }
+  portEXIT_CRITICAL(&wifiCacheLock);
+  if (!fast)
+  {
+    wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    wifi_config.sta.sort_method = WIFI_CONNECT_AP_BY_SIGNAL;
+  }
+  wifiFastAttempt = fast;
 
-/////////////////////////////////////////////////////////////////
-// End of Support for TFT UI
-/////////////////////////////////////////////////////////////////
+  ESP_LOGD(TAG, "  Calling esp_wifi_set_config() (%s)", fast ? "cached AP" : "full scan");
+  return esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+}
 
-static void event_handler(void* arg, esp_event_base_t event_base,
-								int32_t event_id, void* event_data)
+const char *wifiPowerModeToString(WIFI_POWER_MODE mode)
 {
-  // Only execute the next call if telnet is not enabled. This is
-  // necessary since remote log monitoring could be enabled. If it
-  // is, and we are called back here due to wifi disconnect event,
-  // the next ESP_LOGx call will cause a panic.
-#ifndef TELNET_ENABLED
-  ESP_LOGI(TAG, "event_handler()");
-#endif
+  if (mode >= NR_WIFI_POWER_MODES)
+    return "Unknown";
+  return wifi_power_str[mode];
+}
 
-  if (wifiScanActive)
+WIFI_POWER_MODE strToWifiPowerMode(const char *str)
+{
+  for (int m = 0; m < NR_WIFI_POWER_MODES; m++)
+    if (!strcasecmp(str, wifi_power_str[m]))
+      return (WIFI_POWER_MODE)m;
+  if (!strcasecmp(str, "off"))
+    return WIFI_POWER_NONE;
+  return NR_WIFI_POWER_MODES;
+}
+
+//
+// Charge the time since the last call to whatever the radio was doing.
+// Called before anything that changes it (connection state, mode).
+//
+static void wifi_power_account()
+{
+  int64_t now = esp_timer_get_time();
+
+  portENTER_CRITICAL(&wifiPowerLock);
+  uint64_t us = (wifiPowerSince == 0) ? 0 : now - wifiPowerSince;
+  wifiPowerSince = now;
+  if (!WifiStatus.wifi_started)
+    us = 0;
+  else if (!WifiStatus.Connected)
   {
-    ESP_LOGE(TAG, "  SSID scan active - aborting wifi connect (event_id = %d)", event_id);
-    xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_ABORTED);
-    // WifiStatus.Connected = false;
-    // OperatingParameters.wifiConnected = false;
-    wifiConnecting = false;
+    wifiDownUs += us;
+    wifiRadioOnUs += us;
+  }
+  else
+  {
+    wifiConnectedUs[wifiPowerActive] += us;
+    if (wifiPowerActive == WIFI_POWER_NONE)
+      wifiRadioOnUs += us;
+    else if (wifiPowerActive == WIFI_POWER_MIN)
+      wifiRadioOnUs += us * WIFI_BEACON_AWAKE_US / WIFI_BEACON_US;    // DTIM 1 assumed
+    else
+      wifiRadioOnUs += us * WIFI_BEACON_AWAKE_US / (WIFI_BEACON_US * WIFI_LISTEN_INTERVAL);
+  }
+  portEXIT_CRITICAL(&wifiPowerLock);
+}
+
+// Put the configured mode (less any boost) into effect
+static void wifi_power_apply(bool force)
+{
+  static const wifi_ps_type_t ps[NR_WIFI_POWER_MODES] = {WIFI_PS_NONE, WIFI_PS_MIN_MODEM, WIFI_PS_MAX_MODEM};
+  WIFI_POWER_MODE mode = OperatingParameters.wifiPowerSave;
+
+  if (mode >= NR_WIFI_POWER_MODES)
+    mode = WIFI_POWER_MIN;
+  if ((mode == WIFI_POWER_MAX) && (wifiBoostUntil != 0))
+    mode = WIFI_POWER_MIN;
+  if (wifiProvisioning)
+    mode = WIFI_POWER_NONE;
+  if ((mode == wifiPowerActive) && !force)
+    return;
+  if (!WifiStatus.if_init)
+    return;
+
+  if (esp_wifi_set_ps(ps[mode]) != ESP_OK)
+  {
+    ESP_LOGE(TAG, "esp_wifi_set_ps(%s) failed", wifi_power_str[mode]);
+    OperatingParameters.Errors.wifiErrors++;
     return;
   }
+  wifi_power_account();
+  portENTER_CRITICAL(&wifiPowerLock);
+  wifiPowerActive = mode;
+  portEXIT_CRITICAL(&wifiPowerLock);
+  ESP_LOGI(TAG, "Power save: %s", wifi_power_str[mode]);
+}
 
-  if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
+static void event_handler(void* arg, esp_event_base_t event_base,
+								int32_t event_id, void* event_data)
+{
+  // Logging is safe here: log output goes to the log ring, and telnet
+  // monitors read it from the telnet task, never from this one
+  ESP_LOGD(TAG, "event_handler()");
+
+  if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_SCAN_DONE)
+  {
+    if (wifiManagerTask != NULL)
+      xTaskNotify(wifiManagerTask, WIFI_NOTIFY_SCAN, eSetBits);
+  }
+  else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
   {
     ESP_LOGD(TAG, "  event = STA_START");
+    if (strlen(wifiTrySsid)
 #ifdef MATTER_ENABLED
-    if (!OperatingParameters.MatterStarted)
+        && !OperatingParameters.MatterStarted
 #endif
+       )
       esp_wifi_connect();
-      // WifiStatus.reconnect_requested = true;
-      wifiConnecting = false;
-      // esp_wifi_connect();
+    wifiConnecting = false;
+  }
+  else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED)
+  {
+    wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
+    memcpy(wifiConnectedBssid, event->bssid, sizeof(wifiConnectedBssid));
+    wifiConnectedChannel = event->channel;
   }
   else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
   {
-    if (esp_wifi_connect() == ESP_OK)
+    //
+    // The cached access point wasn't there (the router came back on
+    // another channel, or this is a different one): try again, still as
+    // part of this attempt, scanning all channels.
+    //
+    if (wifiFastAttempt && !WifiStatus.Connected)
     {
-      ESP_LOGI(TAG, "Wifi reconnect worked!");
-      return;
+      metricInc(METRIC_WIFI_FAST_MISSES);
+      if ((wifi_set_sta_config(wifiTrySsid, wifiTryPass, false) == ESP_OK) &&
+          (esp_wifi_connect() == ESP_OK))
+        return;
     }
-    // The next call has a side effect of disabling logging via telnet...
-#ifdef TELNET_ENABLED
+    // Don't wait for telnet to stop; this is the event loop task
     if (telnetServiceRunning())
-      terminateTelnetSession();
-#endif
-    /// ...making the next line safe.
-    ESP_LOGI(TAG, "  event = STA_DISCONECTED");
+      telnetRequestStop();
+    ESP_LOGI(TAG, "  event = STA_DISCONECTED (reason %d)", ((wifi_event_sta_disconnected_t *)event_data)->reason);
+    if (WifiStatus.Connected)
+      wifiOutageStart = esp_timer_get_time();
+    else if (wifiAttemptStart != 0)
+      wifi_network_result(false, 0);
+    wifi_power_account();
     WifiStatus.Connected = false;
     wifiConnecting = false;
+    wifiAttemptStart = 0;
     OperatingParameters.wifiConnected = false;
-    esp_wifi_disconnect();
-    esp_wifi_stop();
 
 #ifdef MATTER_ENABLED
     if (!OperatingParameters.MatterStarted)
     {
 #endif
-      ESP_LOGW(TAG, "  connect to the AP failed - requesting delayed retry");
       WifiStatus.reconnect_requested = true;
-      wifiConnecting = false;
+      if (wifiManagerTask != NULL)
+        xTaskNotify(wifiManagerTask, WIFI_NOTIFY_LOST, eSetBits);
 #ifdef MATTER_ENABLED
     }
 #endif
 
     xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
   }
+  else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_BSS_RSSI_LOW)
+  {
+    if (wifiManagerTask != NULL)
+      xTaskNotify(wifiManagerTask, WIFI_NOTIFY_ROAM, eSetBits);
+  }
   else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
   {
     ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
+    wifi_ap_record_t ap;
     ESP_LOGI(TAG, "  event = IP_EVENT_STA_GOT_IP - ip: " IPSTR, IP2STR(&event->ip_info.ip));
+    wifi_power_account();
     WifiStatus.Connected = true;
     OperatingParameters.wifiConnected = true;
     WifiStatus.ip = event->ip_info.ip;
     wifiConnecting = false;
 
+    if (wifiAttemptStart != 0)
+      metricObserveSince(METRIC_WIFI_CONNECT, wifiAttemptStart);
+    if (wifiOutageStart != 0)
+      metricObserveSince(METRIC_WIFI_OUTAGE, wifiOutageStart);
+    wifiAttemptStart = 0;
+    wifiOutageStart = 0;
+    wifi_network_result(true, (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) ? ap.rssi : 0);
+
+    // Remember where we got in, for next time
+    portENTER_CRITICAL(&wifiCacheLock);
+    if ((strcmp(wifiCache.ssid, wifiTrySsid) != 0) ||
+        (memcmp(wifiCache.bssid, wifiConnectedBssid, sizeof(wifiCache.bssid)) != 0) ||
+        (wifiCache.channel != wifiConnectedChannel))
+    {
+      strlcpy(wifiCache.ssid, wifiTrySsid, sizeof(wifiCache.ssid));
+      memcpy(wifiCache.bssid, wifiConnectedBssid, sizeof(wifiCache.bssid));
+      wifiCache.channel = wifiConnectedChannel;
+      wifiCacheDirty = true;
+    }
+    portEXIT_CRITICAL(&wifiCacheLock);
+
     if (WifiStatus.reconnect_requested)
     {
       WifiStatus.reconnect_requested = false;
@@ -384,6 +895,8 @@ static void event_handler(void* arg, esp_event_base_t event_base,
       // #endif
     }
 
+    if (wifiManagerTask != NULL)
+      xTaskNotify(wifiManagerTask, WIFI_NOTIFY_CONNECTED, eSetBits);
     xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
   }
 }
@@ -495,7 +1008,7 @@ void WifiSwitchMatterMode()
 {
   if (OperatingParameters.MatterEnabled)
   {
-    // Setting MatterStarted keeps networkReconnect task from running
+    // Setting MatterStarted keeps the wifi manager from reconnecting
     OperatingParameters.MatterStarted = true;
     ESP_LOGI(TAG, "Enabling Matter");
     // Since we are shutting down wifi to enable Matter,
@@ -504,6 +1017,7 @@ void WifiSwitchMatterMode()
     ESP_LOGI(TAG, "Shutting down wifi connection");
     WifiDisconnect();
     ESP_LOGI(TAG, "Unloading wifi driver");
+    mdnsStop();
     WifiDeinit();
     ESP_LOGI(TAG, "Starting Matter API");
     OperatingParameters.MatterStarted = MatterInit();
@@ -533,8 +1047,37 @@ void WifiMatterStarted()
 }
 #endif
 
+// The provisioning access point, named after our MAC address
+static esp_err_t wifi_set_ap_config()
+{
+  wifi_config_t wifi_config;
+  uint8_t mac[6];
+
+  if (esp_netif_interface_ap == NULL)
+    esp_netif_interface_ap = esp_netif_create_default_wifi_ap();
+  esp_read_mac(mac, ESP_MAC_WIFI_SOFTAP);
+  snprintf(wifiProvisionSsid, sizeof(wifiProvisionSsid), PROVISION_AP_PREFIX "%02X%02X%02X",
+           mac[3], mac[4], mac[5]);
+
+  bzero(&wifi_config, sizeof(wifi_config_t));
+  strncpy((char *)wifi_config.ap.ssid, wifiProvisionSsid, sizeof(wifi_config.ap.ssid));
+  wifi_config.ap.ssid_len = strlen(wifiProvisionSsid);
+  strncpy((char *)wifi_config.ap.password, PROVISION_AP_PASSWORD, sizeof(wifi_config.ap.password));
+  wifi_config.ap.authmode = (strlen(PROVISION_AP_PASSWORD) >= 8) ? WIFI_AUTH_WPA2_PSK : WIFI_AUTH_OPEN;
+  wifi_config.ap.channel = PROVISION_AP_CHANNEL;
+  wifi_config.ap.max_connection = 2;
+  wifi_config.ap.beacon_interval = 100;
+  return esp_wifi_set_config(WIFI_IF_AP, &wifi_config);
+}
+
+//
+// 'ssid' and 'pass' are the first choice; with networks saved, the best
+// of them (usually the first) is connected to.
+//
 bool WifiStart(const char *hostname, const char *ssid, const char *pass)
 {
+  bool fast;
+
   // This code needs to be revisited later after Arduino framework removed.
   // See comments at top of module.
   //
@@ -572,11 +1115,9 @@ bool WifiStart(const char *hostname, const char *ssid, const char *pass)
     esp_netif_interface_sta = esp_netif_create_default_wifi_sta();
   }
 
-  if (strlen(ssid))
-  {
-    ESP_LOGD(TAG, "  Calling WifiRegisterEventCallbacks()");
-    WifiRegisterEventCallbacks();
-  }
+  // Also wanted without an SSID, for scans
+  ESP_LOGD(TAG, "  Calling WifiRegisterEventCallbacks()");
+  WifiRegisterEventCallbacks();
 
   ESP_LOGI(TAG, "  Initializing wifi");
 
@@ -591,23 +1132,30 @@ bool WifiStart(const char *hostname, const char *ssid, const char *pass)
   WifiStatus.if_init = true;
 
   ESP_LOGD(TAG, "  Calling esp_wifi_set_mode()");
-  ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+  ESP_ERROR_CHECK(esp_wifi_set_mode(wifiProvisioning ? WIFI_MODE_APSTA : WIFI_MODE_STA));
+  if (wifiProvisioning && (wifi_set_ap_config() != ESP_OK))
+  {
+    ESP_LOGE(TAG, "Could not configure the provisioning access point");
+    OperatingParameters.Errors.wifiErrors++;
+  }
 
   if (strlen(ssid))
   {
-    // Set the wifi parameters
-    wifi_config_t wifi_config;
-    bzero(&wifi_config, sizeof(wifi_config_t));
-    strcpy((char *)wifi_config.sta.ssid, ssid);
-    strcpy((char *)wifi_config.sta.password, pass);
-    wifi_config.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
-    wifi_config.sta.pmf_cfg.capable = true;
-    wifi_config.sta.pmf_cfg.required = false;
+    static bool cacheLoaded;
 
-    /* Initialize STA */
-    ESP_LOGD(TAG, "  Calling esp_wifi_set_config()");
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+    if (!cacheLoaded)
+    {
+      cacheLoaded = true;
+      if (!eepromGetWifiCache(&wifiCache))
+        memset(&wifiCache, 0, sizeof(wifiCache));
+    }
+
+    /* Initialize STA with the best of the saved networks */
+    wifi_choose(ssid, pass, &fast);
+    ESP_ERROR_CHECK(wifi_set_sta_config(wifiTrySsid, wifiTryPass, fast));
   }
+  else
+    wifiTrySsid[0] = '\0';
 
   // Retrieve the MAC address of the interface
   esp_read_mac(OperatingParameters.mac, ESP_MAC_WIFI_STA);
@@ -620,8 +1168,12 @@ bool WifiStart(const char *hostname, const char *ssid, const char *pass)
     OperatingParameters.mac[5]);
 
   ESP_LOGI(TAG, "  Calling esp_wifi_start()");
+  if (strlen(ssid))
+    wifiAttemptStart = esp_timer_get_time();    // STA_START connects
 	ESP_ERROR_CHECK(esp_wifi_start());
+  wifi_power_account();
   WifiStatus.wifi_started = true;
+  wifi_power_apply(true);
 
   if (strlen(ssid) == 0)
   {
@@ -634,7 +1186,7 @@ bool WifiStart(const char *hostname, const char *ssid, const char *pass)
   esp_err_t ret_value = ESP_OK;
   ESP_LOGI(TAG, "  Waiting for event callback...");
   EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
-        WIFI_CONNECTED_BIT | WIFI_FAIL_BIT | WIFI_FAIL_ABORTED,
+        WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
         pdFALSE,
         pdFALSE,
         xTicksToWait);
@@ -644,7 +1196,7 @@ bool WifiStart(const char *hostname, const char *ssid, const char *pass)
   if (bits & WIFI_CONNECTED_BIT)
   {
     ESP_LOGI(TAG, "Connected to AP SSID: %s Pre-shared key: %c%c****", 
-      WifiCreds.ssid, WifiCreds.password[0], WifiCreds.password[1]);
+      wifiTrySsid, wifiTryPass[0], wifiTryPass[1]);
     WifiStatus.Connected = true;
     ret_value = ESP_OK;
     // Start SNTP service
@@ -653,19 +1205,16 @@ bool WifiStart(const char *hostname, const char *ssid, const char *pass)
   else if (bits & WIFI_FAIL_BIT)
   {
     ESP_LOGE(TAG, "Failed to connect to SSID:%s, Pre-shared key: %c%c****", 
-      WifiCreds.ssid, WifiCreds.password[0], WifiCreds.password[1]);
-    ret_value = ESP_FAIL;
-  }
-  else if (bits & WIFI_FAIL_ABORTED)
-  {
-    ESP_LOGE(TAG, "Aborted connect to SSID:%s, Pre-shared key: %c%c****", 
-      WifiCreds.ssid, WifiCreds.password[0], WifiCreds.password[1]);
+      wifiTrySsid, wifiTryPass[0], wifiTryPass[1]);
     ret_value = ESP_FAIL;
   }
   else
   {
     ESP_LOGW(TAG, "UNEXPECTED EVENT (0x%08x)", bits);
+    wifiAttemptStart = 0;
     esp_wifi_stop();
+    wifiScanBusy = false;
+    wifi_power_account();
     WifiStatus.wifi_started = false;
     WifiStatus.reconnect_requested = true;
     ret_value = ESP_FAIL;
@@ -710,6 +1259,8 @@ void WifiDeinit()
   {
     ESP_LOGD(TAG, "- Calling esp_wifi_stop()");
     esp_wifi_stop();
+    wifiScanBusy = false;
+    wifi_power_account();
     WifiStatus.wifi_started = false;
   }
 
@@ -717,6 +1268,11 @@ void WifiDeinit()
   {
     ESP_LOGD(TAG, "- Taking down network stack");
     esp_netif_destroy_default_wifi(esp_netif_interface_sta);
+    if (esp_netif_interface_ap != NULL)
+    {
+      esp_netif_destroy_default_wifi(esp_netif_interface_ap);
+      esp_netif_interface_ap = NULL;
+    }
     esp_event_loop_delete_default();
     esp_wifi_deinit();
     WifiStatus.driver_started = false;
@@ -733,21 +1289,23 @@ void WifiDisconnect()
 {
   ESP_LOGI(TAG, "WifiDisconnect()");
 
-  ESP_LOGD(TAG, "- Calling WifiDeregisterEventCallbacks()");
-  WifiDeregisterEventCallbacks();
+  // The wifi manager reconnects, with the new settings, as soon as the
+  // disconnect event arrives
+  WifiStatus.reconnect_requested = true;
+  if (wifiManagerTask != NULL)
+    xTaskNotify(wifiManagerTask, WIFI_NOTIFY_NOW, eSetBits);
 
   ESP_LOGD(TAG, "- Calling esp_wifi_disconnect()");
   esp_wifi_disconnect();
   OperatingParameters.wifiConnected = false;
-  // Reset lastWifiMillis to 0 so a reconnect is enabled right away
-  // [see networkReconnectTask()]
-  lastWifiMillis = 0;
-  WifiStatus.reconnect_requested = true;
 
 }
 
 bool WifiReconnect(const char *hostname, const char *ssid, const char *pass)
 {
+  bool mdns = false;
+  bool started;
+
   ESP_LOGI(TAG, "WifiReconnect()");
 
   if (!WifiStatus.driver_started)
@@ -758,73 +1316,459 @@ bool WifiReconnect(const char *hostname, const char *ssid, const char *pass)
 
   if (WifiStatus.if_init)
   {
+    // mDNS uses the event loop and interfaces WifiDeinit() deletes
+    mdns = mdnsStop();
     ESP_LOGD(TAG, "- Calling WifiDeinit()");
     WifiDeinit();
   }
 
   ESP_LOGI(TAG, "- Restarting wifi");
-  return (WifiStart(hostname, ssid, pass));
+  started = WifiStart(hostname, ssid, pass);
+  if (mdns)
+    mdnsStart();
+  return started;
 }
 
-void networkReconnectTask(void *pvParameters)
+// Delay before the next retry (ms); the first one after a drop is immediate
+static uint32_t wifi_next_backoff(uint32_t *backoff)
 {
-  // Level set to 'W' (warn) since this is kind of significant
-  ESP_LOGW(TAG, "Starting network reconnect task");
+  uint32_t delay;
 
-  if (wifiScanActive)
+  if (*backoff == 0)
   {
-    ESP_LOGE(TAG, "** ABORTING -- WIFI SSID SCAN ACTIVE **");
-    ntReconnectTaskHandler = NULL;
-    vTaskDelete(NULL);
-    return;
+    *backoff = WIFI_BACKOFF_MIN;
+    return 0;
   }
+  delay = *backoff / 2 + esp_random() % (*backoff / 2 + 1);
+  *backoff = std::min(*backoff * 2, (uint32_t)WIFI_BACKOFF_MAX);
+  return delay;
+}
 
-  if (millis() - lastWifiMillis < WIFI_CONNECT_INTERVAL)
+// Start one connect attempt; false if it has to wait
+static bool wifi_attempt()
+{
+  bool fast;
+
+  if (WifiStatus.Connected || (strlen(WifiCreds.ssid) == 0))
+    return true;
+#ifdef MATTER_ENABLED
+  if (OperatingParameters.MatterStarted)
+    return true;
+#endif
+  if (wifiConnecting)
+    return false;
+  wifi_scan_pause();
+
+  metricInc(METRIC_WIFI_RETRIES);
+  if (!WifiStatus.wifi_started)
   {
-    ESP_LOGW(TAG, "- Wifi reconnect retry too soon ... delaying");
-    ntReconnectTaskHandler = NULL;
-    vTaskDelete(NULL);
-    return; // Will never get here, but wanted to give the compiler an exit path
+    // The driver was stopped (connect timed out in WifiStart()); start over
+    WifiReconnect(OperatingParameters.DeviceName, WifiCreds.ssid, WifiCreds.password);
+    return true;
   }
 
-  // Update timestamp for last wifi connect attempt
-  lastWifiMillis = millis();
+  if (!wifi_choose(WifiCreds.ssid, WifiCreds.password, &fast))
+    return true;
+  if (WifiCreds.count > 1)
+  {
+    ESP_LOGI(TAG, "Trying \"%s\"", wifiTrySsid);
+    // Find out which of them are in range, for the next attempt
+    if ((millis() - wifiScanDoneAt > WIFI_SCAN_FRESH) && !WifiScanRunning())
+      WifiScanStart();
+  }
 
-  if (WifiReconnect(OperatingParameters.DeviceName, WifiCreds.ssid, WifiCreds.password) == true)
+  esp_netif_set_hostname(esp_netif_interface_sta, OperatingParameters.DeviceName);
+  if (wifi_set_sta_config(wifiTrySsid, wifiTryPass, fast) != ESP_OK)
   {
-    OperatingParameters.wifiConnected = true;
+    OperatingParameters.Errors.wifiErrors++;
+    return true;
   }
-  else
+  wifiAttemptStart = esp_timer_get_time();
+  if (esp_wifi_connect() != ESP_OK)
   {
-    OperatingParameters.wifiConnected = false;
+    ESP_LOGE(TAG, "esp_wifi_connect() failed");
+    OperatingParameters.Errors.wifiErrors++;
+    wifiAttemptStart = 0;
+    return false;
   }
+  return true;
+}
+
+//
+// Owns reconnecting: sleeps until the event handler reports a lost
+// connection (or a retry falls due), then tries again, backing off
+// between failed attempts.
+//
+static void wifi_manager(void *parameter)
+{
+  int64_t retryAt = 0;              // millis(); 0 when none is due
+  uint32_t backoff = 0;
+
+  // The first connect (WifiStart() at boot) may already have failed
+  if (!WifiStatus.Connected)
+    retryAt = millis() + wifi_next_backoff(&backoff);
+
+  for (;;)
+  {
+    uint32_t events = 0;
+    int64_t due = retryAt;
+    int64_t attempt = wifiAttemptStart;
+    TickType_t wait = portMAX_DELAY;
+
+    if (attempt != 0)
+    {
+      int64_t timeout = attempt / 1000 + WIFI_ATTEMPT_TIMEOUT;
+      due = (due == 0) ? timeout : std::min(due, timeout);
+    }
+    if (wifiBoostUntil != 0)
+      due = (due == 0) ? wifiBoostUntil : std::min(due, wifiBoostUntil);
+    if (wifiProvisionDoneAt != 0)
+      due = (due == 0) ? wifiProvisionDoneAt : std::min(due, wifiProvisionDoneAt);
+    if (wifiRoamArmAt != 0)
+      due = (due == 0) ? wifiRoamArmAt : std::min(due, wifiRoamArmAt);
+    if (due != 0)
+      wait = pdMS_TO_TICKS(std::max(due - millis(), (int64_t)0));
+    xTaskNotifyWait(0, UINT32_MAX, &events, wait);
+
+    if (events & WIFI_NOTIFY_NOW)
+    {
+      // Already down: no disconnect event is coming, so retry now
+      backoff = 0;
+      if (!WifiStatus.Connected)
+        retryAt = millis();
+    }
+    if (events & WIFI_NOTIFY_CONNECTED)
+    {
+      backoff = 0;
+      retryAt = 0;
+      ESP_LOGI(TAG, "Wifi connected");
+      wifiRoamArmAt = millis();
+      if (wifiProvisioning)
+        wifiProvisionDoneAt = millis() + PROVISION_LINGER;
+    }
+    if (events & WIFI_NOTIFY_LOST)
+    {
+      uint32_t delay = wifi_next_backoff(&backoff);
+
+      ESP_LOGW(TAG, "Wifi retry in %lu ms", (unsigned long)delay);
+      retryAt = millis() + delay;
+      wifiProvisionDoneAt = 0;
+    }
+
+    // Associated but never got an address (or no event at all): drop
+    // it; the disconnect event schedules the retry
+    attempt = wifiAttemptStart;
+    if ((attempt != 0) && (esp_timer_get_time() - attempt > WIFI_ATTEMPT_TIMEOUT * 1000LL))
+    {
+      ESP_LOGW(TAG, "Wifi connect attempt timed out");
+      OperatingParameters.Errors.wifiErrors++;
+      wifi_network_result(false, 0);
+      wifiAttemptStart = 0;
+      esp_wifi_disconnect();
+    }
+
+    if ((retryAt != 0) && (millis() >= retryAt))
+      retryAt = wifi_attempt() ? 0 : millis() + WIFI_BACKOFF_MIN;
+
+    portENTER_CRITICAL(&wifiPowerLock);
+    if ((wifiBoostUntil != 0) && (millis() >= wifiBoostUntil))
+    {
+      wifiBoostUntil = 0;
+      events |= WIFI_NOTIFY_POWER;
+    }
+    portEXIT_CRITICAL(&wifiPowerLock);
+    if (events & WIFI_NOTIFY_POWER)
+      wifi_power_apply(false);
+
+    if ((wifiProvisionDoneAt != 0) && (millis() >= wifiProvisionDoneAt))
+      WifiProvisionStop();
 
-  ntReconnectTaskHandler = NULL;
-  vTaskDelete(NULL);
+    // The low signal event fires once each time the threshold is set
+    if (events & WIFI_NOTIFY_ROAM)
+    {
+      wifi_roam();
+      wifiRoamArmAt = millis() + WIFI_ROAM_INTERVAL;
+    }
+    if ((wifiRoamArmAt != 0) && (millis() >= wifiRoamArmAt))
+    {
+      wifiRoamArmAt = 0;
+      if (WifiStatus.Connected && (esp_wifi_set_rssi_threshold(WIFI_ROAM_RSSI) != ESP_OK))
+        ESP_LOGW(TAG, "Could not set the roaming threshold");
+    }
+
+    // A channel is done (not one stopped by wifi_scan_pause())
+    if ((events & WIFI_NOTIFY_SCAN) && wifiScanBusy)
+    {
+      wifiScanBusy = false;
+      wifi_scan_collect();
+      portENTER_CRITICAL(&wifiScanLock);
+      if (wifiScanChannel != 0)
+        wifiScanChannel++;
+      portEXIT_CRITICAL(&wifiScanLock);
+    }
+    wifi_scan_next();
+
+    // NVS writes stay out of the event handler
+    if (wifiCacheDirty)
+    {
+      WIFI_CACHE cache;
+
+      portENTER_CRITICAL(&wifiCacheLock);
+      cache = wifiCache;
+      wifiCacheDirty = false;
+      portEXIT_CRITICAL(&wifiCacheLock);
+      if (!eepromUpdateWifiCache(&cache))
+        ESP_LOGW(TAG, "Could not save the access point for fast reconnects");
+    }
+    if (wifiNetworksDirty)
+    {
+      wifiNetworksDirty = false;
+      if (!eepromUpdateWifiNetworks())
+        ESP_LOGW(TAG, "Could not save the wifi network history");
+    }
+  }
 }
 
-void startReconnectTask()
+//
+// Called once the first connect attempt (app_main()) is over
+//
+void WifiManagerStart()
 {
 #ifdef MATTER_ENABLED
   if (OperatingParameters.MatterStarted)
   {
-    ESP_LOGW(TAG, "Network reconnect task -- Matter running ... Exiting");
+    ESP_LOGW(TAG, "Wifi manager -- Matter running ... Exiting");
+    return;
+  }
+#endif
+  if (wifiManagerTask != NULL)
     return;
+
+  if (xTaskCreate(
+      wifi_manager,
+      "Wifi Manager",
+      4096,
+      NULL,
+      1,
+      &wifiManagerTask) != pdPASS)
+  {
+    ESP_LOGE(TAG, "Could not start the wifi manager");
+    OperatingParameters.Errors.systemErrors++;
+    wifiManagerTask = NULL;
+  }
+}
+
+//
+// Change the power save profile and save it. MAX's listen interval is
+// only sent to the access point when associating, so until the next
+// reconnect the access point may hold frames for less long than that.
+//
+void WifiSetPowerSave(WIFI_POWER_MODE mode)
+{
+  if (mode >= NR_WIFI_POWER_MODES)
+    return;
+  OperatingParameters.wifiPowerSave = mode;
+  if (!eepromUpdateWifiPower())
+    ESP_LOGW(TAG, "Could not save the power save mode");
+
+  if (wifiManagerTask != NULL)
+    xTaskNotify(wifiManagerTask, WIFI_NOTIFY_POWER, eSetBits);
+  else
+    wifi_power_apply(false);
+}
+
+//
+// Someone is using the web pages or telnet: keep replies prompt by
+// waking for every DTIM beacon for a while. Cheap enough to call on
+// every request.
+//
+void WifiPowerBoost()
+{
+  bool start;
+
+  if (OperatingParameters.wifiPowerSave != WIFI_POWER_MAX)
+    return;
+
+  portENTER_CRITICAL(&wifiPowerLock);
+  start = (wifiBoostUntil == 0);
+  wifiBoostUntil = millis() + WIFI_POWER_BOOST_TIME;
+  if (start)
+    wifiBoosts++;
+  portEXIT_CRITICAL(&wifiPowerLock);
+
+  if (start && (wifiManagerTask != NULL))
+    xTaskNotify(wifiManagerTask, WIFI_NOTIFY_POWER, eSetBits);
+}
+
+void WifiGetPowerStats(WIFI_POWER_STATS *stats)
+{
+  wifi_power_account();
+
+  portENTER_CRITICAL(&wifiPowerLock);
+  stats->mode = OperatingParameters.wifiPowerSave;
+  stats->active = wifiPowerActive;
+  stats->boosts = wifiBoosts;
+  for (int m = 0; m < NR_WIFI_POWER_MODES; m++)
+    stats->connectedMs[m] = wifiConnectedUs[m] / 1000;
+  stats->downMs = wifiDownUs / 1000;
+  stats->radioOnMs = wifiRadioOnUs / 1000;
+  portEXIT_CRITICAL(&wifiPowerLock);
+}
+
+//
+// Bring up the provisioning access point and captive DNS next to the
+// station (which carries on as before), and start a scan for the setup
+// page to offer.
+//
+bool WifiProvisionStart()
+{
+  esp_err_t err;
+
+#ifdef MATTER_ENABLED
+  if (OperatingParameters.MatterStarted)
+  {
+    ESP_LOGW(TAG, "Can't provision, Matter owns wifi");
+    return false;
   }
 #endif
-  if (ntReconnectTaskHandler)
+  if (!WifiStatus.wifi_started)
+  {
+    ESP_LOGW(TAG, "Can't provision, wifi isn't running");
+    return false;
+  }
+  if (wifiProvisioning)
+    return true;
+
+  err = esp_wifi_set_mode(WIFI_MODE_APSTA);
+  if (err == ESP_OK)
+    err = wifi_set_ap_config();
+  if (err != ESP_OK)
   {
-    ESP_LOGE(TAG, "Network reconnect task already running ... Exiting");
+    ESP_LOGE(TAG, "Could not start the provisioning access point (%d)", err);
+    OperatingParameters.Errors.wifiErrors++;
+    esp_wifi_set_mode(WIFI_MODE_STA);
+    return false;
+  }
+  wifiProvisionDoneAt = 0;
+  wifiProvisioning = true;
+  wifi_power_apply(false);
+
+  provisionDnsStart(WifiProvisionAddress());
+  WifiScanStart();
+  ESP_LOGI(TAG, "Provisioning: join \"%s\" and browse to any address", wifiProvisionSsid);
+  return true;
+}
+
+void WifiProvisionStop()
+{
+  if (!wifiProvisioning)
     return;
+
+  wifiProvisioning = false;
+  wifiProvisionDoneAt = 0;
+  provisionDnsStop();
+  if (WifiStatus.wifi_started && (esp_wifi_set_mode(WIFI_MODE_STA) != ESP_OK))
+  {
+    ESP_LOGE(TAG, "Could not stop the provisioning access point");
+    OperatingParameters.Errors.wifiErrors++;
   }
+  wifi_power_apply(false);
+  ESP_LOGI(TAG, "Provisioning done");
+}
+
+bool WifiProvisioning()
+{
+  return wifiProvisioning;
+}
+
+// The access point's address (network order); 0 if there's none
+uint32_t WifiProvisionAddress()
+{
+  esp_netif_ip_info_t ipInfo;
+
+  if ((esp_netif_interface_ap == NULL) || (esp_netif_get_ip_info(esp_netif_interface_ap, &ipInfo) != ESP_OK))
+    return 0;
+  return ipInfo.ip.addr;
+}
 
-  xTaskCreate(
-    networkReconnectTask,
-    "NetworkReconnectTask",
-    4096,
-    NULL,
-    1,
-    &ntReconnectTaskHandler);
+const char *WifiProvisionSsid()
+{
+  return wifiProvisionSsid;
+}
+
+//
+// Add a network at 'pos' (-1: last), or change its password or place.
+// Saved by setWifiCreds(). One that becomes the first choice is tried
+// next.
+//
+bool WifiNetworkAdd(const char *ssid, const char *pass, int pos)
+{
+  int before, after;
+  bool changed;
+
+  if ((ssid[0] == '\0') || (strlen(ssid) >= sizeof(WifiCreds.ssid)) ||
+      (strlen(pass) >= sizeof(WifiCreds.password)))
+    return false;
+
+  portENTER_CRITICAL(&wifiNetworksLock);
+  before = wifi_networks_find(WifiCreds.networks, WifiCreds.count, ssid);
+  changed = (before < 0) || (strcmp(WifiCreds.networks[before].password, pass) != 0);
+  WifiCreds.count = wifi_networks_add(WifiCreds.networks, WifiCreds.count, ssid, pass, pos);
+  after = wifi_networks_find(WifiCreds.networks, WifiCreds.count, ssid);
+  if ((after == 0) && (changed || (before != 0)))
+    wifiTryNext = 0;
+  wifi_networks_sync();
+  portEXIT_CRITICAL(&wifiNetworksLock);
+  return true;
+}
+
+bool WifiNetworkRemove(const char *ssid)
+{
+  int count;
+
+  portENTER_CRITICAL(&wifiNetworksLock);
+  count = WifiCreds.count;
+  WifiCreds.count = wifi_networks_remove(WifiCreds.networks, WifiCreds.count, ssid);
+  wifi_networks_sync();
+  portEXIT_CRITICAL(&wifiNetworksLock);
+  return (WifiCreds.count != count);
+}
+
+bool WifiNetworkMove(const char *ssid, int pos)
+{
+  char pass[sizeof(WifiCreds.password)];
+  int i;
+
+  portENTER_CRITICAL(&wifiNetworksLock);
+  i = wifi_networks_find(WifiCreds.networks, WifiCreds.count, ssid);
+  if (i >= 0)
+    strlcpy(pass, WifiCreds.networks[i].password, sizeof(pass));
+  portEXIT_CRITICAL(&wifiNetworksLock);
+  if (i < 0)
+    return false;
+  return WifiNetworkAdd(ssid, pass, pos);
+}
+
+int WifiNetworksGet(WIFI_SAVED_NETWORK *networks, int max)
+{
+  int n;
+
+  portENTER_CRITICAL(&wifiNetworksLock);
+  n = std::min((int)WifiCreds.count, max);
+  memcpy(networks, WifiCreds.networks, n * sizeof(WIFI_SAVED_NETWORK));
+  portEXIT_CRITICAL(&wifiNetworksLock);
+  return n;
+}
+
+// Which of the saved networks we're on; "" if none
+const char *WifiConnectedSsid()
+{
+  return WifiConnected() ? wifiTrySsid : "";
+}
+
+uint32_t WifiRoamCount()
+{
+  return wifiRoams;
 }
 
 uint16_t rssiToPercent(int rssi_i)
@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * actions_bench.cpp
+ *
+ * Times the action lookup (actions.cpp) against the strncmp() chain the
+ * web /button handler used before it: every name the web UI sends, and
+ * one that isn't there, as the handler gets them (a terminated copy in a
+ * fixed buffer). Built with -O2 and no sanitizers; see "make bench".
+ * Only prints the timings, there is nothing to pass or fail.
+ *
+ */
+
+#include <chrono>
+#include "actions.cpp"
+
+#define ROUNDS              2000000
+#define BUTTON_CONTENT_SIZE 30
+
+using namespace std::chrono;
+
+// The if/else chain of strncmp()s, one per button
+static int chain_lookup(const char *content)
+{
+  for (int a = 0; a < NR_ACTIONS; a++)
+    if (!strncmp(content, actionNames[a], BUTTON_CONTENT_SIZE))
+      return a;
+  return NR_ACTIONS;
+}
+
+int main()
+{
+  const char *workload[NR_ACTIONS + 1];
+  volatile int sink = 0;
+
+  for (int a = 0; a < NR_ACTIONS; a++)
+    workload[a] = actionNames[a];
+  workload[NR_ACTIONS] = "noSuchButton";
+
+  printf("%d names, hash seed %u\n", NR_ACTIONS, actionSeed);
+  for (int hashed = 0; hashed < 2; hashed++)
+  {
+    auto start = steady_clock::now();
+
+    for (int r = 0; r < ROUNDS; r++)
+      for (int w = 0; w <= NR_ACTIONS; w++)
+      {
+        char content[BUTTON_CONTENT_SIZE];
+
+        strncpy(content, workload[w], sizeof(content) - 1);
+        content[sizeof(content) - 1] = '\0';
+        sink = sink + (hashed ? actionLookup(content, strlen(content)) : chain_lookup(content));
+      }
+
+    double ns = duration<double, std::nano>(steady_clock::now() - start).count() / (ROUNDS * ((int)NR_ACTIONS + 1.0));
+    printf("%-14s %6.1f ns a lookup\n", hashed ? "perfect hash" : "strncmp chain", ns);
+  }
+  return 0;
+}
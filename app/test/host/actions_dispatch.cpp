@@ -0,0 +1,159 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * actions_dispatch.cpp
+ *
+ * Checks the action dispatcher (actions.cpp):
+ *   - every name is found through the perfect hash, and near misses
+ *     (case, a byte short or long, a terminator counted in) are not
+ *   - a name need not be terminated; a huge one is turned away
+ *   - clearing the NVS and closing telnet only run for the web UI
+ *   - runs and unknown names are counted per source, for the console
+ *     table and /metrics
+ *   - a fuzz run of random strings and mutated names against a plain
+ *     compare of every name, in exact size buffers under ASan
+ *
+ * The speed of the lookup is measured by actions_bench (make bench).
+ *
+ */
+
+#include <random>
+#include <string>
+#include <vector>
+#include "actions.cpp"
+#include "host_test.h"
+
+#define FUZZ_LOOKUPS    500000
+
+static int nvsClears, telnetStops;
+
+void clearNVS() { nvsClears++; }
+void terminateTelnetSession() { telnetStops++; }
+
+static void metrics_output(void *ctx, const char *text)
+{
+  ((std::string *)ctx)->append(text);
+}
+
+static void check_lookup()
+{
+  std::string big(5000, 'x');
+
+  for (int a = 0; a < NR_ACTIONS; a++)
+    CHECK(actionLookup(actionNames[a], strlen(actionNames[a])) == a);
+  CHECK(actionLookup("", 0) == ACTION_NONE);
+  CHECK(actionLookup("tempup", 6) == ACTION_NONE);
+  CHECK(actionLookup("tempUpx", 7) == ACTION_NONE);
+  CHECK(actionLookup("tempU", 5) == ACTION_NONE);
+  CHECK(actionLookup("tempUp\0", 7) == ACTION_NONE);
+  CHECK(actionLookup("tempUp..", 6) == ACTION_TEMP_UP);
+  CHECK(actionForMode(COOL) == ACTION_MODE_COOL && actionForMode(DRY) == ACTION_NONE);
+  CHECK(!actionRun(ACTION_NONE, ACTION_SRC_WEB) && !actionRun(ACTION_TEMP_UP, NR_ACTION_SOURCES));
+  CHECK(!actionDispatch(big.c_str(), big.size(), ACTION_SRC_WEB));
+  CHECK(OperatingParameters.Errors.systemErrors == 1);
+}
+
+// What a broker or a console user can run
+static void check_sources()
+{
+  CHECK(!actionDispatch("clear", 5, ACTION_SRC_MQTT));
+  CHECK(!actionDispatch("terminateTelnet", 15, ACTION_SRC_MQTT));
+  CHECK(!actionRun(ACTION_CLEAR_NVS, ACTION_SRC_CONSOLE));
+  CHECK(!actionRun(ACTION_TERMINATE_TELNET, ACTION_SRC_CONSOLE));
+  CHECK(nvsClears == 0 && telnetStops == 0);
+  CHECK(actionDispatch("terminateTelnet", 15, ACTION_SRC_WEB) && telnetStops == 1);
+  CHECK(actionDispatch("clear", 5, ACTION_SRC_WEB) && nvsClears == 1);
+
+  for (int a = 0; a < NR_ACTIONS; a++)
+  {
+    bool system = (a == ACTION_CLEAR_NVS) || (a == ACTION_TERMINATE_TELNET);
+
+    CHECK(actionAllowed((ACTION)a, ACTION_SRC_WEB));
+    CHECK(actionAllowed((ACTION)a, ACTION_SRC_CONSOLE) == !system);
+    CHECK(actionAllowed((ACTION)a, ACTION_SRC_MQTT) == !system);
+  }
+}
+
+static void check_counts()
+{
+  std::string table, prometheus;
+
+  OperatingParameters.tempUnits = 'F';
+  CHECK(actionDispatch("unitToggle", 10, ACTION_SRC_WEB) && OperatingParameters.tempUnits == 'C');
+  CHECK(actionDispatch("swingUp", 7, ACTION_SRC_MQTT) && OperatingParameters.tempSwing > 0.09f);
+  CHECK(actionRun(ACTION_MODE_FAN, ACTION_SRC_CONSOLE));
+  CHECK(actionDispatch("vacancyDown", 11, ACTION_SRC_CONSOLE) && OperatingParameters.vacancyTimeout == 5);
+
+  actionsWrite(false, metrics_output, &table);
+  actionsWrite(true, metrics_output, &prometheus);
+  CHECK(table.find("unitToggle              1        0        0") != std::string::npos);
+  CHECK(table.find("(unknown)               1        0        0") != std::string::npos);
+  // Refused ones aren't counted as run
+  CHECK(table.find("clear                   1        0        0") != std::string::npos);
+  CHECK(prometheus.find("thermostat_actions_total{action=\"swingUp\",source=\"mqtt\"} 1\n") != std::string::npos);
+  CHECK(prometheus.find("thermostat_actions_total{action=\"clear\",source=\"mqtt\"} 0\n") != std::string::npos);
+  CHECK(prometheus.find("thermostat_actions_unknown_total{source=\"web\"} 1\n") != std::string::npos);
+}
+
+// Random strings, and names with a byte changed, dropped or added
+static void check_fuzz()
+{
+  std::mt19937 rng(1);
+  int wrong = 0;
+
+  for (int i = 0; i < FUZZ_LOOKUPS; i++)
+  {
+    std::string name;
+    int expect = ACTION_NONE;
+
+    if (i & 1)
+    {
+      int n = rng() % 40;
+
+      for (int j = 0; j < n; j++)
+        name += (char)((rng() & 3) ? "abcdeghilmnoprstuvwxyACDEFHMOSTU"[rng() % 32] : rng());
+    }
+    else
+    {
+      int pos;
+
+      name = actionNames[rng() % NR_ACTIONS];
+      pos = rng() % (name.size() + 1);
+      switch (rng() % 4)
+      {
+      case 0:
+        if (pos < (int)name.size())
+          name[pos] = (char)rng();
+        break;
+      case 1:
+        if (pos < (int)name.size())
+          name.erase(pos, 1);
+        break;
+      case 2:
+        name.insert(pos, 1, (char)rng());
+        break;
+      }
+    }
+
+    for (int a = 0; a < NR_ACTIONS; a++)
+      if (name == actionNames[a])
+        expect = a;
+    // Exactly the name, no terminator after it
+    std::vector<char> buffer(name.begin(), name.end());
+    if (actionLookup(buffer.data(), buffer.size()) != expect)
+    {
+      if (wrong++ == 0)
+        printf("\"%s\" looked up wrong\n", name.c_str());
+    }
+  }
+  printf("%d fuzzed lookups, %d wrong\n", FUZZ_LOOKUPS, wrong);
+  CHECK(wrong == 0);
+}
+
+int main()
+{
+  check_lookup();
+  check_sources();
+  check_counts();
+  check_fuzz();
+  return host_test_result();
+}
@@ -0,0 +1,246 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * console_parser.cpp
+ *
+ * Drives the shared console (console.cpp) a line at a time, as telnet and
+ * the serial console do, and checks what it prints and changes:
+ * tokenizing, command lookup and argument checks, Get/Set with their
+ * ranges and apply hooks, completion and history.
+ *
+ */
+
+#include <algorithm>
+#include <string>
+#include "console.cpp"
+#include "host_test.h"
+
+static int saves;
+static char unitsConverted;
+static HVAC_MODE lastMode = OFF;
+static float lastTemp;
+
+void updateThermostatParams() { saves++; }
+void updateHvacMode(HVAC_MODE mode) { lastMode = OperatingParameters.hvacSetMode = mode; }
+void updateHvacSetTemp(float temp) { lastTemp = OperatingParameters.tempSet = temp; }
+void updateTempUnits(char units)
+{
+  unitsConverted = units;
+  OperatingParameters.tempUnits = units;
+}
+HVAC_MODE strToHvacMode(char *mode)
+{
+  if (!strcmp(mode, "Cool"))
+    return COOL;
+  if (!strcmp(mode, "Heat"))
+    return HEAT;
+  return ERROR;
+}
+const char *hvacModeToString(HVAC_MODE mode) { return (mode == COOL) ? "Cool" : (mode == HEAT) ? "Heat" : "Off"; }
+HVAC_CONTROL_MODE strToHvacControlMode(const char *str) { return NR_CONTROL_MODES; }
+bool tftSetBacklightRange(int minPercent, int maxPercent)
+{
+  if ((minPercent < 0) || (maxPercent > 100) || (minPercent >= maxPercent))
+    return false;
+  OperatingParameters.backlightMin = minPercent;
+  OperatingParameters.backlightMax = maxPercent;
+  return true;
+}
+
+static std::string output;
+static bool monitorRan;
+
+static int capture(const char *fmt, ...)
+{
+  char buffer[2048];
+  va_list args;
+
+  va_start(args, fmt);
+  vsnprintf(buffer, sizeof(buffer), fmt, args);
+  va_end(args);
+  output += buffer;
+  return 0;
+}
+
+static void cmd_monitor(CONSOLE *con, int argc, char *argv[]) { monitorRan = true; }
+
+// A console's own commands are searched before the shared ones
+static const CONSOLE_CMD ownCommands[] = {
+    {"Monitor", "", "", 0, 0, cmd_monitor, "Monitor"},
+    {NULL}};
+static CONSOLE console = {ownCommands, capture, NULL};
+
+static std::string run(const char *line)
+{
+  char buffer[256];
+
+  strlcpy(buffer, line, sizeof(buffer));
+  output.clear();
+  consoleExecute(&console, buffer);
+  return output;
+}
+
+static bool run_says(const char *line, const char *expect)
+{
+  return run(line).find(expect) != std::string::npos;
+}
+
+static std::string complete(const char *line, int *matches = NULL)
+{
+  char buffer[256];
+  size_t len;
+  int n;
+
+  strlcpy(buffer, line, sizeof(buffer));
+  len = strlen(buffer);
+  output.clear();
+  n = consoleComplete(&console, buffer, &len, sizeof(buffer));
+  if (matches)
+    *matches = n;
+  return std::string(buffer, len);
+}
+
+static void check_tokenize()
+{
+  char line[] = "  set  FriendlyName \"Living room\"\t x";
+  char unterminated[] = "a \"b";
+  char many[] = "a b c d";
+  char *argv[10];
+
+  CHECK(consoleTokenize(line, argv, 10) == 4);
+  CHECK(!strcmp(argv[2], "Living room") && !strcmp(argv[3], "x"));
+  CHECK(consoleTokenize(unterminated, argv, 10) == -1);
+  CHECK(consoleTokenize(many, argv, 3) == 4);
+}
+
+static void check_lookup()
+{
+  int matches;
+  const CONSOLE_CMD *cmd;
+
+  CHECK(consoleLookup(&console, "STATUS", &matches) != NULL && matches == 1);
+  cmd = consoleLookup(&console, "statu", &matches);
+  CHECK(cmd != NULL && !strcmp(cmd->name, "Status"));
+  CHECK(consoleLookup(&console, "stat", &matches) == NULL && matches == 2);
+  CHECK(consoleLookup(&console, "mo", &matches) == NULL && matches == 2);
+  CHECK(run_says("mo", "Ambiguous command: mo could be Monitor Mode"));
+  CHECK(run("mon") == "" && monitorRan);
+  CHECK(run_says("?", "Valid commands"));
+  CHECK(run_says("Schedx", "Unknown command"));
+  CHECK(run_says("say \"unfinished", "Missing closing quote"));
+}
+
+static void check_arguments()
+{
+  CHECK(run_says("temp", "Usage: Temp <temp>"));
+  CHECK(run_says("temp 7x", "Not a number: 7x"));
+  run("temp 21.5");
+  CHECK(lastTemp == 21.5f);
+  CHECK(run_says("backlight 10", "Usage"));
+  CHECK(run_says("backlight 10 x", "Not a whole number"));
+  run("backlight 10 90");
+  CHECK(OperatingParameters.backlightMin == 10 && OperatingParameters.backlightMax == 90);
+  CHECK(run_says("mode", "Usage: Mode"));
+  CHECK(run("mode cool") == "Mode now set to: Cool\n");
+  CHECK(run_says("mode warm", "Invalid mode: Warm"));
+}
+
+static void check_set()
+{
+  int before;
+
+  OperatingParameters.tempUnits = 'F';
+  OperatingParameters.tempSwing = 1.0;
+  before = saves;
+  CHECK(run("set tempswing 2.5") == "tempSwing = 2.50\n");
+  CHECK(OperatingParameters.tempSwing == 2.5f && saves == before + 1);
+  CHECK(run_says("set tempSwing 9", "out of range") && OperatingParameters.tempSwing == 2.5f);
+  CHECK(run_says("set mac 1", "read only"));
+  CHECK(run("set FriendlyName \"Living room\"") == "FriendlyName = Living room\n");
+  CHECK(run_says("set FriendlyName 0123456789012345678901234567890123456789012345678901234567890123456789", "too long"));
+  CHECK(run("set thermostatBeepEnable on") == "thermostatBeepEnable = yes\n");
+  CHECK(run("set hvacSetMode heat") == "hvacSetMode = Heat\n" && lastMode == HEAT);
+  CHECK(run_says("set nosuch 1", "Unknown parameter: nosuch"));
+  CHECK(run_says("set backlightMax 5", "rejected"));
+
+  std::string all = run("get");
+  CHECK(std::count(all.begin(), all.end(), '\n') >= 45);
+}
+
+// tempUnits goes through updateTempUnits() so every temperature is converted
+static void check_units()
+{
+  int before = saves;
+
+  OperatingParameters.tempUnits = 'F';
+  unitsConverted = 0;
+  CHECK(run_says("set tempUnits X", "expected C or F") && unitsConverted == 0);
+  CHECK(run("set tempUnits c") == "tempUnits = C\n");
+  CHECK(unitsConverted == 'C' && saves == before + 1);
+}
+
+// Auto set points keep to the display's range in the current units, low <= high
+static void check_auto_set_points()
+{
+  OperatingParameters.tempUnits = 'F';
+  OperatingParameters.tempSetAutoMin = 68;
+  OperatingParameters.tempSetAutoMax = 75;
+  CHECK(run_says("set tempSetAutoMin 40", "out of range"));
+  CHECK(run_says("set tempSetAutoMax 95", "out of range"));
+  CHECK(run_says("set tempSetAutoMin 80", "rejected") && OperatingParameters.tempSetAutoMin == 68);
+  CHECK(run_says("set tempSetAutoMax 60", "rejected") && OperatingParameters.tempSetAutoMax == 75);
+  CHECK(run("set tempSetAutoMin 65") == "tempSetAutoMin = 65.00\n");
+  CHECK(run("set tempSetAutoMax 75") == "tempSetAutoMax = 75.00\n");
+  CHECK(run_says("set tempSet 30", "out of range"));
+
+  OperatingParameters.tempUnits = 'C';
+  OperatingParameters.tempSetAutoMin = 20;
+  OperatingParameters.tempSetAutoMax = 24;
+  CHECK(run_says("set tempSetAutoMax 50", "out of range"));
+  CHECK(run_says("set tempSetAutoMin 5", "out of range"));
+  CHECK(run("set tempSetAutoMin 18.5") == "tempSetAutoMin = 18.50\n");
+  CHECK(run("set tempSet 21") == "tempSet = 21.00\n" && lastTemp == 21);
+}
+
+static void check_completion()
+{
+  int matches;
+
+  CHECK(complete("stat", &matches) == "stat" && matches == 2);
+  CHECK(complete("statu") == "status ");
+  CHECK(complete("R", &matches) == "R" && matches == 3);
+  CHECK(output.find("Runtime  Radar  Reboot") != std::string::npos);
+  CHECK(complete("Reb") == "Reboot ");
+  CHECK(complete("get tempSw") == "get tempSwing ");
+  CHECK(complete("get temps", &matches) == "get temps" && matches == 4);
+  CHECK(complete("set hvacC") == "set hvacC");
+  CHECK(complete("temp 2") == "temp 2");
+}
+
+static void check_history()
+{
+  CONSOLE_HISTORY history = {};
+  char line[8];
+
+  for (int i = 0; i < 10; i++)
+  {
+    snprintf(line, sizeof(line), "c%d", i);
+    consoleHistoryAdd(&history, line);
+    consoleHistoryAdd(&history, line);      // Repeats are kept once
+  }
+  CHECK(history.count == CONSOLE_HISTORY_LINES);
+  CHECK(!strcmp(consoleHistoryGet(&history, 1), "c9"));
+  CHECK(consoleHistoryGet(&history, CONSOLE_HISTORY_LINES + 1) == NULL);
+}
+
+int main()
+{
+  check_tokenize();
+  check_lookup();
+  check_arguments();
+  check_set();
+  check_units();
+  check_auto_set_points();
+  check_completion();
+  check_history();
+  return host_test_result();
+}
@@ -0,0 +1,209 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * fakes.cpp
+ *
+ * Weak stand-ins, linked into every host test, for the FreeRTOS and
+ * ESP-IDF calls and the firmware functions that the modules under test
+ * reach but that aren't what is being tested. A test that cares about one
+ * of them (what WifiNetworkAdd() was given, say) defines its own, which
+ * takes the place of the one here.
+ *
+ * Tasks are threads, semaphores are a mutex and a condition variable,
+ * and critical sections share one recursive mutex.
+ *
+ */
+
+#include "thermostat.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <pthread.h>
+
+#define WEAK __attribute__((weak))
+
+//
+// FreeRTOS and ESP-IDF
+//
+static auto hostStart = std::chrono::steady_clock::now();
+static std::recursive_mutex hostCritical;
+
+typedef struct
+{
+  std::mutex m;
+  std::condition_variable cv;
+  int count;
+} HOST_SEMAPHORE;
+
+WEAK int64_t millis()
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - hostStart).count();
+}
+WEAK int64_t esp_timer_get_time() { return millis() * 1000; }
+WEAK void portENTER_CRITICAL(portMUX_TYPE *mux) { hostCritical.lock(); }
+WEAK void portEXIT_CRITICAL(portMUX_TYPE *mux) { hostCritical.unlock(); }
+
+WEAK BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stack, void *arg,
+                            UBaseType_t priority, TaskHandle_t *handle)
+{
+  std::thread thread(task, arg);
+
+  if (handle)
+    *handle = (TaskHandle_t)(uintptr_t)std::hash<std::thread::id>()(thread.get_id());
+  thread.detach();
+  return pdPASS;
+}
+WEAK void vTaskDelete(TaskHandle_t task) { pthread_exit(NULL); }
+WEAK void vTaskDelay(TickType_t ticks) { std::this_thread::sleep_for(std::chrono::milliseconds(ticks)); }
+WEAK TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+  return (TaskHandle_t)(uintptr_t)std::hash<std::thread::id>()(std::this_thread::get_id());
+}
+WEAK BaseType_t xTaskNotifyGive(TaskHandle_t task) { return pdPASS; }
+WEAK uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ticks < 5 ? ticks : 5));
+  return 1;
+}
+
+static SemaphoreHandle_t semaphore_create(int count)
+{
+  HOST_SEMAPHORE *s = new HOST_SEMAPHORE;
+
+  s->count = count;
+  return s;
+}
+WEAK SemaphoreHandle_t xSemaphoreCreateBinary() { return semaphore_create(0); }
+WEAK SemaphoreHandle_t xSemaphoreCreateMutex() { return semaphore_create(1); }
+WEAK BaseType_t xSemaphoreGive(SemaphoreHandle_t handle)
+{
+  HOST_SEMAPHORE *s = (HOST_SEMAPHORE *)handle;
+  std::lock_guard<std::mutex> lock(s->m);
+
+  s->count = 1;
+  s->cv.notify_all();
+  return pdTRUE;
+}
+WEAK BaseType_t xSemaphoreTake(SemaphoreHandle_t handle, TickType_t ticks)
+{
+  HOST_SEMAPHORE *s = (HOST_SEMAPHORE *)handle;
+  std::unique_lock<std::mutex> lock(s->m);
+
+  if (!s->cv.wait_for(lock, std::chrono::milliseconds(ticks), [s] { return s->count > 0; }))
+    return pdFALSE;
+  s->count = 0;
+  return pdTRUE;
+}
+
+static int log_discard(const char *fmt, va_list args) { return 0; }
+static vprintf_like_t hostLogOutput = log_discard;
+
+WEAK vprintf_like_t esp_log_set_vprintf(vprintf_like_t output)
+{
+  vprintf_like_t old = hostLogOutput;
+
+  hostLogOutput = output;
+  return old;
+}
+WEAK void esp_log_level_set(const char *tag, esp_log_level_t level) {}
+WEAK const char *esp_err_to_name(esp_err_t err) { return (err == ESP_OK) ? "ESP_OK" : "ESP_FAIL"; }
+WEAK void *heap_caps_calloc(size_t n, size_t size, uint32_t caps) { return calloc(n, size); }
+WEAK size_t heap_caps_get_free_size(uint32_t caps) { return 0; }
+WEAK size_t heap_caps_get_total_size(uint32_t caps) { return 0; }
+WEAK uint32_t esp_get_free_heap_size() { return 0; }
+WEAK void esp_restart() { exit(0); }
+WEAK esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler) { return ESP_OK; }
+WEAK int mbedtls_base64_encode(unsigned char *dst, size_t dlen, size_t *olen, const unsigned char *src, size_t slen)
+{
+  return -1;
+}
+extern "C" WEAK size_t strlcpy(char *dst, const char *src, size_t size) noexcept
+{
+  size_t len = strlen(src);
+
+  if (size)
+  {
+    size_t n = (len < size - 1) ? len : size - 1;
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+  }
+  return len;
+}
+
+//
+// Firmware
+//
+WEAK OPERATING_PARAMETERS OperatingParameters;
+WEAK WIFI_CREDS WifiCreds;
+WEAK const char *VersionString = "host";
+WEAK const char *VersionBuildDateTime = "host";
+WEAK const char *gmt_timezones[] = { "GMT" };
+
+WEAK bool getLocalTime(struct tm *info, uint64_t ms) { return false; }
+WEAK void updateTimezoneFromConfig() {}
+WEAK void clearNVS() {}
+WEAK void setWifiCreds() {}
+WEAK void updateThermostatParams() {}
+WEAK bool eepromUpdateArbFloat(const char *key, float value) { return true; }
+WEAK float roundValue(float value, int places) { return value; }
+WEAK bool eepromGetHvacRuntime(HVAC_STAGE_TOTALS *totals) { memset(totals, 0, NR_HVAC_STAGES * sizeof(*totals)); return false; }
+WEAK bool eepromUpdateHvacRuntime(HVAC_STAGE_TOTALS *totals) { return true; }
+WEAK void MqttRuntimeUpdate() {}
+WEAK void updateTempUnits(char units) { OperatingParameters.tempUnits = units; }
+
+WEAK bool WifiConnected() { return true; }
+WEAK void WifiDisconnect() {}
+WEAK char *WifiAddress() { return (char *)"127.0.0.1"; }
+WEAK const char *WifiConnectedSsid() { return ""; }
+WEAK uint16_t WifiSignal() { return 0; }
+WEAK uint32_t WifiRoamCount() { return 0; }
+WEAK void WifiPowerBoost() {}
+WEAK void WifiSetPowerSave(WIFI_POWER_MODE mode) {}
+WEAK void WifiGetPowerStats(WIFI_POWER_STATS *stats) { memset(stats, 0, sizeof(*stats)); }
+WEAK const char *wifiPowerModeToString(WIFI_POWER_MODE mode) { return "?"; }
+WEAK WIFI_POWER_MODE strToWifiPowerMode(const char *str) { return (WIFI_POWER_MODE)0; }
+WEAK bool WifiScanStart() { return false; }
+WEAK bool WifiScanRunning() { return false; }
+WEAK int WifiScanResults(WIFI_NETWORK *networks, int max) { return 0; }
+WEAK bool WifiProvisionStart() { return false; }
+WEAK void WifiProvisionStop() {}
+WEAK bool WifiProvisioning() { return false; }
+WEAK uint32_t WifiProvisionAddress() { return 0; }
+WEAK const char *WifiProvisionSsid() { return ""; }
+WEAK bool WifiNetworkAdd(const char *ssid, const char *pass, int pos) { return true; }
+WEAK bool WifiNetworkRemove(const char *ssid) { return true; }
+WEAK bool WifiNetworkMove(const char *ssid, int pos) { return true; }
+WEAK int WifiNetworksGet(WIFI_SAVED_NETWORK *networks, int max) { return 0; }
+WEAK bool mdnsGetHostname(char *host, size_t len) { return false; }
+WEAK int telnetSessionCount() { return 0; }
+WEAK void logGetStats(uint32_t *lines, uint32_t *uartDropped) { *lines = *uartDropped = 0; }
+
+WEAK ACTION actionLookup(const char *name, size_t len) { return ACTION_NONE; }
+WEAK const char *actionName(ACTION action) { return "?"; }
+WEAK ACTION actionForMode(HVAC_MODE mode) { return ACTION_NONE; }
+WEAK bool actionAllowed(ACTION action, ACTION_SOURCE source) { return true; }
+WEAK bool actionRun(ACTION action, ACTION_SOURCE source) { return true; }
+WEAK bool actionDispatch(const char *name, size_t len, ACTION_SOURCE source) { return false; }
+
+WEAK const char *hvacModeToString(HVAC_MODE mode) { return "?"; }
+WEAK HVAC_MODE strToHvacMode(char *mode) { return OFF; }
+WEAK const char *hvacStageToString(HVAC_STAGE stage) { return "?"; }
+WEAK void updateHvacMode(HVAC_MODE mode) { OperatingParameters.hvacSetMode = mode; }
+WEAK void updateHvacSetTemp(float setTemp) { OperatingParameters.tempSet = setTemp; }
+WEAK void updateEnabledHvacModes() {}
+WEAK void hvacGetRuntimeStats(HVAC_STAGE stage, HVAC_RUNTIME_STATS *stats) { memset(stats, 0, sizeof(*stats)); }
+WEAK void hvacControlSetMode(HVAC_CONTROL_MODE mode, uint16_t cyclesPerHour) {}
+WEAK void hvacControlGetModel(HVAC_STAGE stage, HVAC_THERMAL_MODEL *model) { memset(model, 0, sizeof(*model)); }
+WEAK const char *hvacControlModeToString(HVAC_CONTROL_MODE mode) { return "?"; }
+WEAK HVAC_CONTROL_MODE strToHvacControlMode(const char *str) { return (HVAC_CONTROL_MODE)0; }
+WEAK bool scheduleCommand(const char *cmd, char *reply, size_t len) { return false; }
+WEAK bool radarCommand(const char *cmd, char *reply, size_t len) { return false; }
+WEAK void ld2410GetStats(RADAR_STATS *stats) { memset(stats, 0, sizeof(*stats)); }
+WEAK bool tftSetBacklightRange(int minPercent, int maxPercent) { return false; }
+
+WEAK void metricsWrite(bool prometheus, METRICS_OUTPUT output, void *ctx) {}
+WEAK void bootWriteReport(METRICS_OUTPUT output, void *ctx) {}
+WEAK void heapMonitorWriteCsv(int lines, METRICS_OUTPUT output, void *ctx) {}
+WEAK void heapMonitorWriteStatus(METRICS_OUTPUT output, void *ctx) {}
+WEAK int profilerGetTasks(PROFILE_TASK *tasks, int max) { return 0; }
+WEAK void profilerGetLoad(PROFILE_LOAD *load) { memset(load, 0, sizeof(*load)); }
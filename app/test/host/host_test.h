@@ -0,0 +1,27 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * host_test.h
+ *
+ * What the host tests share: CHECK() reports a failed condition and
+ * carries on, host_test_result() prints the verdict for main() to return.
+ *
+ */
+
+#pragma once
+#include <stdio.h>
+
+static int hostFailures;
+
+#define CHECK(cond)                                             \
+  do {                                                          \
+    if (!(cond)) {                                              \
+      printf("FAIL %s:%d %s\n", __FILE__, __LINE__, #cond);     \
+      hostFailures++;                                           \
+    }                                                           \
+  } while (0)
+
+static inline int host_test_result()
+{
+  printf("%s\n", hostFailures ? "FAILED" : "OK");
+  return hostFailures ? 1 : 0;
+}
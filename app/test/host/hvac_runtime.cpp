@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * hvac_runtime.cpp
+ *
+ * Runs the state machine's runtime accounting (state_machine.cpp) the way
+ * the loop does, a pass every 40 ms, through furnace runs that start and
+ * stop and cross minute and hour boundaries, and checks:
+ *   - the hour duty counts every minute of a long run, not one capped
+ *     minute bucket
+ *   - a run over the top of the hour is split between the two hour buckets
+ *   - the windows roll on while nothing changes, so an idle hour reads 0%
+ *
+ */
+
+#include <math.h>
+#include "state_machine.cpp"
+#include "host_test.h"
+
+#define PASS_MS   40
+
+static int64_t now;
+
+int64_t millis() { return now; }
+
+// Pass after pass until 'until', with the stage left as it is, as while the
+// temperature is inside the swing band
+static void run_until(int64_t until)
+{
+  while (now < until)
+  {
+    now += PASS_MS;
+    runtime_accumulate(now);
+  }
+}
+
+static bool near(float value, float expect)
+{
+  return fabsf(value - expect) < 0.1;
+}
+
+int main()
+{
+  HVAC_RUNTIME_STATS stats;
+  const HVAC_STAGE_RUNTIME *heat = &hvacRuntime[STAGE_HEAT];
+
+  // Start 10 minutes before the top of an hour
+  now = 5 * 3600000LL - 10 * 60000;
+  runtime_init();
+
+  // A 30 minute run, over the top of the hour
+  runtime_track_mode(HEAT);
+  run_until(now + 30 * 60000);
+  runtime_track_mode(IDLE);
+  hvacGetRuntimeStats(STAGE_HEAT, &stats);
+  printf("30 min run: hour duty %.1f%%, day duty %.2f%%, today %us, %u cycle\n",
+         stats.dutyHour, stats.dutyDay, stats.todaySeconds, stats.todayCycles);
+  CHECK(near(stats.dutyHour, 50.0));
+  CHECK(near(stats.dutyDay, 50.0 / 24));
+  CHECK(stats.todaySeconds == 30 * 60 && stats.todayCycles == 1);
+  CHECK(heat->hourMs[4] == 10 * 60000 && heat->hourMs[5] == 20 * 60000);
+  for (int m = 0; m < RUNTIME_MINUTE_BUCKETS; m++)
+    CHECK(heat->minuteMs[m] <= 60000);
+
+  // Idle for an hour: the minute window empties, the day window doesn't
+  run_until(now + 60 * 60000);
+  hvacGetRuntimeStats(STAGE_HEAT, &stats);
+  CHECK(near(stats.dutyHour, 0.0));
+  CHECK(near(stats.dutyDay, 50.0 / 24));
+
+  // Short runs: 10 minutes off, 5 on, for an hour
+  for (int i = 0; i < 4; i++)
+  {
+    run_until(now + 10 * 60000);
+    runtime_track_mode(HEAT);
+    run_until(now + 5 * 60000);
+    runtime_track_mode(IDLE);
+  }
+  hvacGetRuntimeStats(STAGE_HEAT, &stats);
+  printf("10 off 5 on: hour duty %.1f%%, %u cycles today\n", stats.dutyHour, stats.todayCycles);
+  CHECK(near(stats.dutyHour, 100.0 / 3));
+  CHECK(stats.todayCycles == 5);
+
+  // A day later, nothing is left in the windows
+  run_until(now + 25 * 3600000LL);
+  hvacGetRuntimeStats(STAGE_HEAT, &stats);
+  CHECK(near(stats.dutyHour, 0.0) && near(stats.dutyDay, 0.0));
+  CHECK(stats.lifetime.onSeconds == 50 * 60);
+
+  return host_test_result();
+}
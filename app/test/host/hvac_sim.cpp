@@ -0,0 +1,186 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * hvac_sim.cpp
+ *
+ * House and furnace simulator for the control algorithms in
+ * hvac_control.cpp. A first order house (5 hour time constant) loses heat
+ * to a winter day that swings between 25F and 45F; the furnace heats it
+ * through a heat exchanger that takes ~20 minutes to come up to
+ * temperature and keeps giving off heat after it stops, so the house
+ * keeps warming after the burner is off (coast) and keeps cooling for a
+ * while after it is started (lag).
+ *
+ * Each control mode runs 48 hours with a 70F set point and a 2F swing;
+ * the second day, once the predictive model has learned, is measured:
+ *   cycles       burner starts
+ *   below/above  how far, on average per cycle, the temperature went past
+ *                the bottom/top of the band
+ *   error        mean distance from the set point
+ *
+ * The checks hold the algorithms to what they are for. Predictive must
+ * stay within a few tenths of the band where hysteresis undershoots it,
+ * and time proportional must hold the set point closely at no more than
+ * its cycles per hour. Neither cycles less than hysteresis: hysteresis
+ * lets the temperature fall about half a degree below the band before
+ * the heat arrives, so its swing is wider than the band and its cycles
+ * longer. Keeping to the band means a narrower swing and so more,
+ * shorter cycles. The check only keeps predictive from cycling much more
+ * than hysteresis.
+ *
+ */
+
+#include "hvac_control.cpp"
+#include "host_test.h"
+#include <math.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+OPERATING_PARAMETERS OperatingParameters;
+static int64_t now;
+
+int64_t millis() { return now; }
+bool eepromUpdateThermalModel(HVAC_THERMAL_MODEL *model) { return true; }
+bool eepromGetThermalModel(HVAC_THERMAL_MODEL *model)
+{
+  memset(model, 0, NR_CONTROL_STAGES * sizeof(HVAC_THERMAL_MODEL));
+  return false;
+}
+bool eepromUpdateHvacControl() { return true; }
+const char *hvacStageToString(HVAC_STAGE stage) { return (stage == STAGE_HEAT) ? "Heat" : "Cool"; }
+
+#define SIM_HOURS       48
+#define SIM_MEASURE_H   24      // Measure from here on
+#define SIM_SET         70.0
+#define SIM_SWING       2.0
+
+typedef struct
+{
+  int cycles;
+  double below;
+  double above;
+  double error;
+} SIM_RESULT;
+
+// hvacStateUpdate()'s own heat logic: on below the band, off 0.5F before its top
+static bool hysteresis(bool on, float temp, float minTemp, float maxTemp)
+{
+  if (temp < minTemp)
+    return true;
+  if (temp > maxTemp - 0.5)
+    return false;
+  return on;
+}
+
+static SIM_RESULT simulate(HVAC_CONTROL_MODE mode)
+{
+  float minTemp = SIM_SET - SIM_SWING / 2, maxTemp = SIM_SET + SIM_SWING / 2;
+  double house = SIM_SET, exchanger = 0;
+  double peak = -1e9, trough = 1e9, error = 0;
+  int peaks = 0, troughs = 0;
+  long samples = 0;
+  bool on = false;
+  SIM_RESULT r = {};
+
+  OperatingParameters.tempUnits = 'F';
+  OperatingParameters.tempSet = SIM_SET;
+  OperatingParameters.tempSwing = SIM_SWING;
+  OperatingParameters.hvacCyclesPerHour = 4;
+  OperatingParameters.hvacControlMode = mode;
+  hvacControlInit();
+
+  for (now = 0; now < SIM_HOURS * 3600000LL; now += 1000)
+  {
+    double minutes = 1.0 / 60;
+    double outside = 35 - 10 * cos(2 * M_PI * now / 86400000.0);
+    float temp = roundf(house * 10) / 10;               // The sensor's resolution
+    bool was = on;
+
+    if (mode == CONTROL_HYSTERESIS)
+      on = hysteresis(on, temp, minTemp, maxTemp);
+    else
+      on = hvacControlDemand(STAGE_HEAT, on, temp, minTemp, maxTemp);
+    hvacControlObserve(on ? HEAT : IDLE, temp);
+
+    exchanger += ((on ? 1.0 : 0.0) - exchanger) * minutes / 20.0;
+    house += (exchanger * 0.25 - (house - outside) / 300.0) * minutes;
+
+    if (now < SIM_MEASURE_H * 3600000LL)
+      continue;
+    samples++;
+    error += fabs(house - SIM_SET);
+    peak = fmax(peak, house);
+    trough = fmin(trough, house);
+    if (on && !was)
+    {
+      r.cycles++;
+      // A start closes the previous cycle: its peak, and the trough just before this start
+      if (peak > -1e8)
+      {
+        r.above += fmax(0, peak - maxTemp);
+        peaks++;
+      }
+      r.below += fmax(0, minTemp - trough);
+      troughs++;
+      peak = -1e9;
+      trough = 1e9;
+    }
+  }
+  r.above /= (peaks ? peaks : 1);
+  r.below /= (troughs ? troughs : 1);
+  r.error = error / samples;
+  return r;
+}
+
+// In a child process, so every mode starts with an unlearned model
+static bool run(HVAC_CONTROL_MODE mode, SIM_RESULT *r)
+{
+  int fds[2];
+  int status;
+  pid_t pid;
+
+  if (pipe(fds) != 0)
+    return false;
+  pid = fork();
+  if (pid == 0)
+  {
+    SIM_RESULT result = simulate(mode);
+
+    _exit(write(fds[1], &result, sizeof(result)) == sizeof(result) ? 0 : 1);
+  }
+  close(fds[1]);
+  bool ok = (pid > 0) && (read(fds[0], r, sizeof(*r)) == sizeof(*r));
+  close(fds[0]);
+  if (pid > 0)
+    waitpid(pid, &status, 0);
+  return ok && WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+}
+
+int main()
+{
+  SIM_RESULT r[NR_CONTROL_MODES];
+
+  for (int m = 0; m < NR_CONTROL_MODES; m++)
+  {
+    if (!run((HVAC_CONTROL_MODE)m, &r[m]))
+    {
+      printf("FAIL %s: simulation didn't finish\n", hvacControlModeToString((HVAC_CONTROL_MODE)m));
+      return 1;
+    }
+    printf("%-17s %3d cycles/day  below %.2fF  above %.2fF  error %.2fF\n",
+           hvacControlModeToString((HVAC_CONTROL_MODE)m), r[m].cycles, r[m].below, r[m].above, r[m].error);
+  }
+
+  const SIM_RESULT *hyst = &r[CONTROL_HYSTERESIS];
+  const SIM_RESULT *pred = &r[CONTROL_PREDICTIVE];
+  const SIM_RESULT *tpi = &r[CONTROL_TIME_PROPORTIONAL];
+
+  CHECK(hyst->below > 0.3);                            // The problem being solved
+  CHECK(pred->below + pred->above < 0.2);
+  CHECK(pred->below + pred->above < (hyst->below + hyst->above) / 3);
+  CHECK(pred->cycles <= hyst->cycles * 5 / 4);
+  CHECK(pred->error <= hyst->error);
+  CHECK(tpi->error < 0.25);
+  CHECK(tpi->cycles <= 24 * 4);
+
+  return host_test_result();
+}
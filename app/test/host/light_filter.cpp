@@ -0,0 +1,214 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * light_filter.cpp
+ *
+ * Runs the light sensor's frame averaging and filter (light.cpp) over the
+ * ADC traces in traces/ and holds the lux estimate to the light that was
+ * actually there:
+ *   - within 15% of it once 3 s have passed since a step
+ *   - changing by no more than 3% from one 100 ms frame to the next while
+ *     the light is steady or ramping, with the lamp flicker averaged out
+ *
+ * The traces are 1 kHz samples of the LDR divider, one 100 ms frame per
+ * line: the true lux for the frame, then its 100 samples as 3 hex digits
+ * each. They are synthetic: the light level plus lamp flicker at twice
+ * the mains frequency, a few percent of light noise and 8 counts of ADC
+ * noise, through the same divider model light.cpp inverts.
+ *
+ *   ./light_filter                     check every trace
+ *   ./light_filter --record <trace>    write traces/<trace>.trace again
+ *
+ */
+
+#include "light.cpp"
+#include "host_test.h"
+#include <random>
+
+#define TRACE_DIR         "traces/"
+#define SETTLE_FRAMES     30          // 3 s
+#define STEP_RATIO        1.2         // A change bigger than this between frames is a step
+#define SETTLED_ERROR     0.15
+#define FRAME_JITTER      0.03
+
+OPERATING_PARAMETERS OperatingParameters;
+
+esp_err_t adc_cali_raw_to_voltage(adc_cali_handle_t handle, int raw, int *mv) { return ESP_FAIL; }
+
+typedef struct
+{
+  const char *name;
+  int seconds;
+  float mainsHz;
+  float flicker;              // Peak light modulation, fraction of the level
+  float (*lux)(float t);
+} TRACE;
+
+// Daylight through a window: overcast, a cloud, then dusk; 60 Hz lamps on
+static float dusk_lux(float t)
+{
+  if (t < 5)
+    return 200;
+  if (t < 20)
+    return 30;
+  return 30 * powf(0.1, (t - 20) / 25);
+}
+
+// Fluorescent office lights on 50 Hz mains switched off, leaving a little daylight
+static float office_lux(float t)
+{
+  return (t < 15) ? 500 : 5;
+}
+
+static const TRACE traces[] = {
+  { "dusk", 45, 60, 0.20, dusk_lux },
+  { "office", 30, 50, 0.30, office_lux },
+};
+
+static int lux_to_raw(float lux)
+{
+  float rLdr = LIGHT_R10 * powf(10.0 / lux, LIGHT_GAMMA);
+  float mv = LIGHT_SUPPLY_MV * LIGHT_R_FIXED / (LIGHT_R_FIXED + rLdr);
+
+  return (int)(mv * LIGHT_FULL_SCALE / LIGHT_FULL_SCALE_MV + 0.5);
+}
+
+static int record(const TRACE *trace)
+{
+  char path[64];
+  std::mt19937 rng(1);
+  std::normal_distribution<float> noise(0, 1);
+  FILE *f;
+
+  snprintf(path, sizeof(path), TRACE_DIR "%s.trace", trace->name);
+  if ((f = fopen(path, "w")) == NULL)
+  {
+    perror(path);
+    return 1;
+  }
+  fprintf(f, "# %s: %d s at %d Hz, %.0f%% flicker at %.0f Hz, written by ./light_filter --record %s\n",
+          trace->name, trace->seconds, LIGHT_SAMPLE_HZ, trace->flicker * 100, trace->mainsHz * 2, trace->name);
+  for (int frame = 0; frame < trace->seconds * 10; frame++)
+  {
+    fprintf(f, "%.2f ", trace->lux(frame / 10.0));
+    for (int i = 0; i < LIGHT_FRAME_SAMPLES; i++)
+    {
+      float t = (frame * LIGHT_FRAME_SAMPLES + i) / (float)LIGHT_SAMPLE_HZ;
+      float lux = trace->lux(t) * (1 + trace->flicker * sinf(2 * M_PI * 2 * trace->mainsHz * t) + 0.03 * noise(rng));
+      int raw = lux_to_raw(fmaxf(lux, 0.01)) + (int)lroundf(8 * noise(rng));
+
+      fprintf(f, "%03x", raw < 0 ? 0 : (raw > LIGHT_FULL_SCALE ? LIGHT_FULL_SCALE : raw));
+    }
+    fprintf(f, "\n");
+  }
+  fclose(f);
+  printf("Wrote %s\n", path);
+  return 0;
+}
+
+static void make_frame(uint8_t *frame, const char *hex, int channel)
+{
+  for (int i = 0; i < LIGHT_FRAME_SAMPLES; i++)
+  {
+    adc_digi_output_data_t *p = (adc_digi_output_data_t *)&frame[i * SOC_ADC_DIGI_RESULT_BYTES];
+    char digits[4] = { hex[i * 3], hex[i * 3 + 1], hex[i * 3 + 2], '\0' };
+
+    memset(p, 0, sizeof(*p));
+    p->type2.data = strtoul(digits, NULL, 16);
+    p->type2.channel = channel;
+  }
+}
+
+static void check_trace(const TRACE *trace)
+{
+  char path[64];
+  char line[16 + LIGHT_FRAME_SAMPLES * 3 + 2];
+  uint8_t frame[LIGHT_FRAME_BYTES];
+  float trueLux, lastTrueLux = 0, lastLux = 0;
+  float worstError = 0, worstJitter = 0;
+  int sinceStep = 0, frames = 0;
+  char *hex;
+  FILE *f;
+
+  snprintf(path, sizeof(path), TRACE_DIR "%s.trace", trace->name);
+  if ((f = fopen(path, "r")) == NULL)
+  {
+    printf("FAIL %s: can't open it\n", path);
+    hostFailures++;
+    return;
+  }
+
+  filteredRaw = filteredMv = -1.0;
+  while (fgets(line, sizeof(line), f))
+  {
+    if (line[0] == '#')
+      continue;
+    trueLux = strtof(line, &hex);
+    if (*hex++ != ' ' || strlen(hex) < LIGHT_FRAME_SAMPLES * 3)
+    {
+      printf("FAIL %s: bad line %d\n", path, frames + 1);
+      hostFailures++;
+      break;
+    }
+
+    make_frame(frame, hex, adcChannel);
+    light_process_frame(frame, sizeof(frame));
+    float lux = OperatingParameters.lightLux;
+
+    // The first frame seeds the filter instead of ramping up from nothing
+    if (frames == 0)
+      CHECK(fabsf(lux / trueLux - 1) < SETTLED_ERROR);
+
+    if (frames > 0 && fmaxf(trueLux / lastTrueLux, lastTrueLux / trueLux) > STEP_RATIO)
+      sinceStep = 0;
+    if (frames > 0 && ++sinceStep >= SETTLE_FRAMES)
+    {
+      worstError = fmaxf(worstError, fabsf(lux / trueLux - 1));
+      worstJitter = fmaxf(worstJitter, fabsf(logf(lux / lastLux)));
+    }
+    lastTrueLux = trueLux;
+    lastLux = lux;
+    frames++;
+  }
+  fclose(f);
+
+  printf("%-8s %4d frames  worst settled error %4.1f%%  worst frame to frame %4.1f%%\n",
+         trace->name, frames, worstError * 100, worstJitter * 100);
+  CHECK(frames == trace->seconds * 10);
+  CHECK(worstError < SETTLED_ERROR);
+  CHECK(worstJitter < FRAME_JITTER);
+}
+
+// Samples from another ADC channel in the frame are not the light sensor's
+static void check_other_channel()
+{
+  uint8_t frame[LIGHT_FRAME_BYTES];
+  char hex[LIGHT_FRAME_SAMPLES * 3 + 1];
+
+  filteredRaw = filteredMv = -1.0;
+  OperatingParameters.lightDetected = 1234;
+  for (int i = 0; i < LIGHT_FRAME_SAMPLES; i++)
+    memcpy(&hex[i * 3], "fff", 3);
+  make_frame(frame, hex, adcChannel + 1);
+  light_process_frame(frame, sizeof(frame));
+  CHECK(OperatingParameters.lightDetected == 1234);
+  CHECK(filteredRaw < 0);
+}
+
+int main(int argc, char **argv)
+{
+  adcChannel = (adc_channel_t)7;
+
+  if (argc == 3 && !strcmp(argv[1], "--record"))
+  {
+    for (const TRACE &trace : traces)
+      if (!strcmp(argv[2], trace.name))
+        return record(&trace);
+    printf("No trace %s\n", argv[2]);
+    return 1;
+  }
+
+  for (const TRACE &trace : traces)
+    check_trace(&trace);
+  check_other_channel();
+  return host_test_result();
+}
@@ -0,0 +1,227 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * provision_portal.cpp
+ *
+ * Checks the headless setup (provision.cpp):
+ *   - the captive DNS replies: A answered with the access point address,
+ *     other types with no records, EDNS dropped, and truncated, compressed,
+ *     multi-question and response packets ignored
+ *   - random packets never read or write outside their buffers (run with
+ *     ASan and UBSan, as the Makefile builds it)
+ *   - the DNS task answering a query on a loopback UDP port, and stopping
+ *   - the urlencoded setup form: decoding, empty and oversize fields,
+ *     submitting
+ *   - the setup page: escaped, and reloading only while it could still
+ *     be connecting
+ *
+ */
+
+#include <random>
+#include <string>
+#include <arpa/inet.h>
+#include <poll.h>
+
+#define DNS_PORT 5300
+#include "provision.cpp"
+#include "host_test.h"
+
+#define RANDOM_PACKETS    200000
+
+static int64_t now = 1000;
+static int saves, disconnects;
+static bool connected;
+
+int64_t millis() { return now; }
+void setWifiCreds() { saves++; }
+void WifiDisconnect() { disconnects++; }
+bool WifiConnected() { return connected; }
+char *WifiAddress() { return (char *)"10.0.0.7"; }
+const char *WifiConnectedSsid() { return WifiCreds.ssid; }
+bool WifiScanRunning() { return true; }
+int WifiScanResults(WIFI_NETWORK *networks, int max)
+{
+  memset(networks, 0, 2 * sizeof(WIFI_NETWORK));
+  strcpy(networks[0].ssid, "Home<script>");
+  networks[0].rssi = -40;
+  networks[0].secure = true;
+  strcpy(networks[1].ssid, "Cafe \"Free\"");
+  networks[1].rssi = -70;
+  networks[1].secure = false;
+  return 2;
+}
+
+static void page_output(void *ctx, const char *text)
+{
+  ((std::string *)ctx)->append(text);
+}
+
+static const uint8_t apAddress[4] = {192, 168, 4, 1};
+
+static void check_replies()
+{
+  // www.example.com A IN, recursion desired, and an EDNS OPT record
+  uint8_t query[] = {0x12, 0x34, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 1,
+                     3, 'w', 'w', 'w', 7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0, 0, 1, 0, 1,
+                     0, 0, 0x29, 0x10, 0, 0, 0, 0, 0, 0, 0};
+  uint8_t reply[DNS_PACKET_MAX];
+  uint32_t ip;
+  int n;
+
+  memcpy(&ip, apAddress, 4);
+  n = dns_captive_reply(query, sizeof(query), ip, reply, sizeof(reply));
+  CHECK(n == 33 + DNS_ANSWER_LEN);
+  CHECK(reply[0] == 0x12 && reply[1] == 0x34 && reply[2] == 0x85 && reply[3] == 0x80);
+  CHECK(reply[5] == 1 && reply[7] == 1 && reply[9] == 0 && reply[11] == 0);
+  CHECK(reply[33] == 0xc0 && reply[34] == DNS_HEADER_LEN && reply[36] == 1 && reply[38] == 1);
+  CHECK(reply[42] == DNS_TTL && reply[44] == 4 && !memcmp(&reply[45], apAddress, 4));
+
+  query[30] = 28;                                   // AAAA: no records
+  n = dns_captive_reply(query, sizeof(query), ip, reply, sizeof(reply));
+  CHECK(n == 33 && reply[7] == 0);
+  query[30] = 1;
+
+  CHECK(dns_captive_reply(query, 20, ip, reply, sizeof(reply)) == 0);     // Name cut short
+  CHECK(dns_captive_reply(query, 33, ip, reply, 40) == 0);                // No room for the answer
+  query[2] |= 0x80;
+  CHECK(dns_captive_reply(query, sizeof(query), ip, reply, sizeof(reply)) == 0);
+  query[2] &= 0x7f;
+  query[5] = 2;
+  CHECK(dns_captive_reply(query, sizeof(query), ip, reply, sizeof(reply)) == 0);
+  query[5] = 1;
+  query[12] = 0xc0;
+  CHECK(dns_captive_reply(query, sizeof(query), ip, reply, sizeof(reply)) == 0);
+}
+
+// Exact size buffers, so ASan catches the first byte outside them
+static void check_random_packets()
+{
+  std::mt19937 rng(46);
+  uint32_t ip;
+  int bad = 0;
+
+  memcpy(&ip, apAddress, 4);
+  for (int t = 0; t < RANDOM_PACKETS; t++)
+  {
+    int len = rng() % 80;
+    int max = DNS_HEADER_LEN + rng() % 80;
+    uint8_t *query = (uint8_t *)malloc(len ? len : 1);
+    uint8_t *reply = (uint8_t *)malloc(max);
+    int n;
+
+    for (int i = 0; i < len; i++)
+      query[i] = ((i < DNS_HEADER_LEN) && (rng() % 2)) ? 0 : rng();
+    // Mostly a single question query, so most get past the header checks
+    if (len > 5)
+    {
+      query[2] = 0;
+      query[4] = 0;
+      query[5] = 1;
+    }
+    n = dns_captive_reply(query, len, ip, reply, max);
+    if ((n != 0) && ((n < DNS_HEADER_LEN + 5) || (n > max)))
+      bad++;
+    free(query);
+    free(reply);
+  }
+  CHECK(bad == 0);
+}
+
+static void check_task()
+{
+  const uint8_t query[] = {0xab, 0xcd, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0,
+                           7, 'g', 's', 't', 'a', 't', 'i', 'c', 3, 'c', 'o', 'm', 0, 0, 1, 0, 1};
+  uint8_t reply[DNS_PACKET_MAX];
+  struct sockaddr_in addr = {};
+  struct pollfd p;
+  uint32_t ip;
+  int s, n = 0;
+
+  memcpy(&ip, apAddress, 4);
+  provisionDnsStart(ip);
+  usleep(200000);
+
+  s = socket(AF_INET, SOCK_DGRAM, 0);
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(DNS_PORT);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  sendto(s, query, sizeof(query), 0, (struct sockaddr *)&addr, sizeof(addr));
+  p = { s, POLLIN, 0 };
+  if (poll(&p, 1, 2000) > 0)
+    n = recv(s, reply, sizeof(reply), 0);
+  close(s);
+  CHECK(n == sizeof(query) + DNS_ANSWER_LEN);
+  CHECK((n >= 4) && reply[0] == 0xab && reply[1] == 0xcd);
+  CHECK((n >= 4) && !memcmp(&reply[n - 4], apAddress, 4));
+
+  // It notices within a second
+  provisionDnsStop();
+  for (int waited = 0; (dnsTask != NULL) && (waited < 2000); waited += 10)
+    usleep(10000);
+  CHECK(dnsTask == NULL);
+}
+
+static void check_form()
+{
+  char ssid[33], pass[64];
+  std::string big = "ssid=" + std::string(32, 'a');
+
+  CHECK(provisionParseForm("ssid=My+Net%21&pass=p%26ss%3Dword", ssid, sizeof(ssid), pass, sizeof(pass)));
+  CHECK(!strcmp(ssid, "My Net!") && !strcmp(pass, "p&ss=word"));
+  CHECK(provisionParseForm("pass=x&other=1&ssid=", ssid, sizeof(ssid), pass, sizeof(pass)));
+  CHECK(ssid[0] == '\0' && !strcmp(pass, "x"));
+  // A stray % is kept as it is
+  CHECK(provisionParseForm("ssid=100%&pass=%4", ssid, sizeof(ssid), pass, sizeof(pass)));
+  CHECK(!strcmp(ssid, "100%") && !strcmp(pass, "%4"));
+  CHECK(provisionParseForm("", ssid, sizeof(ssid), pass, sizeof(pass)) && !ssid[0] && !pass[0]);
+  CHECK(provisionParseForm("&&ssid&ssidx=1&ssid=a", ssid, sizeof(ssid), pass, sizeof(pass)) && !strcmp(ssid, "a"));
+  CHECK(provisionParseForm(big.c_str(), ssid, sizeof(ssid), pass, sizeof(pass)) && strlen(ssid) == 32);
+  big += "a";
+  CHECK(!provisionParseForm(big.c_str(), ssid, sizeof(ssid), pass, sizeof(pass)));
+}
+
+static void check_submit_and_page()
+{
+  char message[80];
+  std::string page;
+
+  CHECK(!provisionSubmit("ssid=&pass=12345678", message, sizeof(message)) && saves == 0);
+  CHECK(!provisionSubmit("ssid=Net&pass=short", message, sizeof(message)) && saves == 0);
+  CHECK(provisionSubmit("ssid=Home%3Cscript%3E&pass=secret99", message, sizeof(message)));
+  CHECK(saves == 1 && disconnects == 1);
+  CHECK(!strcmp(WifiCreds.ssid, "Home<script>") && !strcmp(WifiCreds.password, "secret99"));
+
+  // Escaped, open networks left out, reloading while connecting
+  strcpy(OperatingParameters.DeviceName, "Hall & stairs");
+  provisionWritePage(message, page_output, &page);
+  CHECK(page.find("<script>") == std::string::npos);
+  CHECK(page.find("Home&lt;script&gt;") != std::string::npos);
+  CHECK(page.find("Hall &amp; stairs") != std::string::npos);
+  CHECK(page.find("Cafe") == std::string::npos);
+  CHECK(page.find("http-equiv=\"refresh\"") != std::string::npos);
+  CHECK(page.find("2 networks found so far") != std::string::npos);
+  CHECK(page.find("</body></html>") != std::string::npos);
+
+  connected = true;
+  page.clear();
+  provisionWritePage(NULL, page_output, &page);
+  CHECK(page.find("refresh") == std::string::npos);
+  CHECK(page.find("as <a href=\"http://10.0.0.7/\">") != std::string::npos);
+
+  // Given up on
+  connected = false;
+  now += 2 * WIFI_ATTEMPT_TIMEOUT;
+  page.clear();
+  provisionWritePage(NULL, page_output, &page);
+  CHECK(page.find("refresh") == std::string::npos);
+  CHECK(page.find("Not connected to Home&lt;script&gt; yet") != std::string::npos);
+}
+
+int main()
+{
+  check_replies();
+  check_random_packets();
+  check_task();
+  check_form();
+  check_submit_and_page();
+  return host_test_result();
+}
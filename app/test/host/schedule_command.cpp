@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * schedule_command.cpp
+ *
+ * Checks the schedule commands (scheduleCommand() in schedule.cpp), as
+ * telnet, the web UI and MQTT send them:
+ *   - turned away until scheduleInit() has run
+ *   - temperatures outside the display's range rejected with the usage,
+ *     in either units, and nothing changed or saved
+ *   - good ones added, sorted, and saved
+ *
+ */
+
+#include <string>
+#include "schedule.cpp"
+#include "host_test.h"
+
+static int saves;
+
+bool eepromUpdateSchedule(void *config, size_t len) { saves++; return true; }
+bool eepromGetSchedule(void *config, size_t len) { return false; }
+void MqttScheduleUpdate() {}
+
+static bool run(const char *cmd, std::string *reply)
+{
+  char buf[1200];
+  bool ok = scheduleCommand(cmd, buf, sizeof(buf));
+
+  *reply = buf;
+  return ok;
+}
+
+int main()
+{
+  std::string reply;
+
+  OperatingParameters.tempUnits = 'F';
+  OperatingParameters.tempSet = 70;
+  CHECK(!run("list", &reply) && reply.find("not started") != std::string::npos);
+  scheduleInit();
+
+  // Out of range, overflowing the tenths, or not a number
+  CHECK(!run("away 1000", &reply) && reply.find("Usage: away <45-92>") == 0);
+  CHECK(!run("away 44.9", &reply) && !run("away nan", &reply) && !run("away", &reply));
+  CHECK(!run("add mon 06:30 5000", &reply) && reply.find("Usage: add") == 0);
+  CHECK(!run("add mon 06:30 -40", &reply) && !run("add mon 06:30 x heat", &reply));
+  CHECK(!run("add mon 06:30", &reply) && reply.find("Usage: add") == 0);
+  CHECK(!run("vacation 3 93", &reply) && reply.find("Usage: vacation <1-365 days> <45-92>") == 0);
+  CHECK(scheduleGetState() == SCHEDULE_OFF && schedule.nrEntries == 0);
+  CHECK(saves == 0 && OperatingParameters.tempSet == 70);
+
+  // The limits themselves are fine
+  CHECK(run("add weekdays 06:30 68 heat", &reply) && schedule.nrEntries == 5);
+  CHECK(run("add sun 22:00 92", &reply) && schedule.entries[0].setTemp == 920);
+  CHECK(run("away 45", &reply) && scheduleGetState() == SCHEDULE_AWAY && OperatingParameters.tempSet == 45);
+  CHECK(reply.find("Schedule: Away (45.0)") == 0);
+  CHECK(saves == 3);
+
+  // In Celsius the range is the display's Celsius one
+  OperatingParameters.tempUnits = 'C';
+  CHECK(!run("away 45", &reply) && reply.find("Usage: away <7-33>") == 0);
+  CHECK(run("vacation 3 12.5", &reply) && scheduleGetState() == SCHEDULE_VACATION);
+  CHECK(schedule.units == 'C' && schedule.awayTemp == 125);
+
+  return host_test_result();
+}
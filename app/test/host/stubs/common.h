@@ -0,0 +1,137 @@
+#pragma once
+// Host stand-ins for the ESP-IDF and FreeRTOS declarations the firmware uses
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_TIMEOUT 0x107
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_NOT_SUPPORTED 0x106
+#define ESP_ERROR_CHECK(x) (void)(x)
+// Quiet unless built with HOST_VERBOSE; the format is still checked
+#ifdef HOST_VERBOSE
+#define HOST_LOG(tag, fmt, ...) printf("%s: " fmt "\n", tag, ##__VA_ARGS__)
+#else
+#define HOST_LOG(tag, fmt, ...) do { if (0) printf("%s: " fmt, tag, ##__VA_ARGS__); } while (0)
+#endif
+#define ESP_LOGE(tag, fmt, ...) HOST_LOG(tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) HOST_LOG(tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) HOST_LOG(tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) HOST_LOG(tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) HOST_LOG(tag, fmt, ##__VA_ARGS__)
+typedef enum { ESP_LOG_NONE, ESP_LOG_ERROR, ESP_LOG_WARN, ESP_LOG_INFO, ESP_LOG_DEBUG, ESP_LOG_VERBOSE } esp_log_level_t;
+void esp_log_level_set(const char*, esp_log_level_t);
+typedef int (*vprintf_like_t)(const char *, va_list);
+vprintf_like_t esp_log_set_vprintf(vprintf_like_t);
+const char *esp_err_to_name(esp_err_t);
+typedef uint32_t TickType_t; typedef int BaseType_t; typedef unsigned UBaseType_t;
+typedef void* TaskHandle_t; typedef void* EventGroupHandle_t; typedef uint32_t EventBits_t; typedef void* SemaphoreHandle_t; typedef void* QueueHandle_t;
+typedef void (*TaskFunction_t)(void*);
+#define pdMS_TO_TICKS(x) (x)
+#define portTICK_PERIOD_MS 1
+#define portMAX_DELAY 0xffffffff
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define tskIDLE_PRIORITY 0
+#define BIT0 1
+#define BIT1 2
+#define BIT2 4
+#define BIT3 8
+#define BIT4 16
+#define BIT5 32
+#define IRAM_ATTR
+#define EXT_RAM_BSS_ATTR
+void vTaskDelay(TickType_t);
+BaseType_t xTaskCreate(TaskFunction_t, const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t, const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*, BaseType_t);
+void vTaskDelete(TaskHandle_t);
+TickType_t xTaskGetTickCount(void);
+EventGroupHandle_t xEventGroupCreate(void);
+void vEventGroupDelete(EventGroupHandle_t);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t, EventBits_t);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t, EventBits_t);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t, EventBits_t, BaseType_t, BaseType_t, TickType_t);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t);
+uint32_t esp_get_free_heap_size(void);
+const char *esp_get_idf_version(void);
+void esp_restart(void);
+typedef void (*shutdown_handler_t)(void);
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t);
+int64_t esp_timer_get_time(void);
+typedef struct { uint32_t addr; } esp_ip4_addr_t;
+typedef int gpio_num_t;
+int gpio_set_level(gpio_num_t, uint32_t);
+int gpio_get_level(gpio_num_t);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+BaseType_t xQueueReceive(QueueHandle_t, void*, TickType_t);
+BaseType_t xQueueReset(QueueHandle_t);
+#define ESP_ERROR_CHECK_WITHOUT_ABORT(x) (void)(x)
+QueueHandle_t xQueueCreate(UBaseType_t, UBaseType_t);
+BaseType_t xQueueSend(QueueHandle_t, const void*, TickType_t);
+BaseType_t xQueueOverwrite(QueueHandle_t, const void*);
+void vTaskNotifyGiveFromISR(TaskHandle_t, BaseType_t*);
+uint32_t ulTaskNotifyTake(BaseType_t, TickType_t);
+#ifndef portMUX_INITIALIZER_UNLOCKED
+typedef struct { int lock; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+void portENTER_CRITICAL(portMUX_TYPE *);
+void portEXIT_CRITICAL(portMUX_TYPE *);
+#endif
+extern "C" size_t strlcpy(char *, const char *, size_t) noexcept;
+BaseType_t xTaskNotifyGive(TaskHandle_t);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+#ifndef STUB_LOG_EXTRAS
+#define STUB_LOG_EXTRAS
+#ifndef LOG_LOCAL_LEVEL
+#define LOG_LOCAL_LEVEL ESP_LOG_INFO
+#endif
+#define LOG_COLOR_E "\033[0;31m"
+#define LOG_COLOR_W "\033[0;33m"
+#define LOG_COLOR_I "\033[0;32m"
+#define LOG_RESET_COLOR "\033[0m"
+#define CONFIG_LOG_COLORS 1
+uint32_t esp_log_timestamp(void);
+esp_log_level_t esp_log_level_get(const char *tag);
+#endif
+#ifndef STUB_TASK_STATUS
+#define STUB_TASK_STATUS
+#define configUSE_TRACE_FACILITY 1
+typedef enum { eRunning = 0, eReady, eBlocked, eSuspended, eDeleted, eInvalid } eTaskState;
+typedef struct {
+  TaskHandle_t xHandle; const char *pcTaskName; UBaseType_t xTaskNumber; eTaskState eCurrentState;
+  UBaseType_t uxCurrentPriority; UBaseType_t uxBasePriority; uint32_t ulRunTimeCounter;
+  void *pxStackBase; uint32_t usStackHighWaterMark; BaseType_t xCoreID;
+} TaskStatus_t;
+UBaseType_t uxTaskGetNumberOfTasks(void);
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *, UBaseType_t, uint32_t *);
+#endif
+#ifndef portNUM_PROCESSORS
+#define portNUM_PROCESSORS 2
+#define configGENERATE_RUN_TIME_STATS 1
+TaskHandle_t xTaskGetIdleTaskHandleForCore(BaseType_t);
+#endif
+#ifndef STUB_BOOT
+#define STUB_BOOT
+EventBits_t xEventGroupGetBits(EventGroupHandle_t);
+#define configMAX_TASK_NAME_LEN 16
+esp_err_t esp_netif_init(void);
+#endif
+#ifndef STUB_NOTIFY
+#define STUB_NOTIFY
+#include <assert.h>
+typedef enum { eNoAction = 0, eSetBits, eIncrement, eSetValueWithOverwrite, eSetValueWithoutOverwrite } eNotifyAction;
+BaseType_t xTaskNotify(TaskHandle_t, uint32_t, eNotifyAction);
+BaseType_t xTaskNotifyWait(uint32_t, uint32_t, uint32_t *, TickType_t);
+#endif
@@ -0,0 +1,11 @@
+#pragma once
+#include "common.h"
+typedef int gpio_num_t;
+typedef enum { GPIO_INTR_POSEDGE } gpio_int_type_t;
+typedef enum { GPIO_MODE_INPUT } gpio_mode_t;
+typedef enum { GPIO_PULLDOWN_DISABLE } gpio_pulldown_t;
+typedef enum { GPIO_PULLUP_DISABLE } gpio_pullup_t;
+typedef struct { uint64_t pin_bit_mask; gpio_mode_t mode; gpio_pullup_t pull_up_en; gpio_pulldown_t pull_down_en; gpio_int_type_t intr_type; } gpio_config_t;
+esp_err_t gpio_config(const gpio_config_t*);
+esp_err_t gpio_install_isr_service(int);
+esp_err_t gpio_isr_handler_add(gpio_num_t, void (*)(void*), void*);
@@ -0,0 +1,21 @@
+#pragma once
+#include "common.h"
+typedef int uart_port_t;
+#define UART_NUM_2 2
+#define UART_PIN_NO_CHANGE (-1)
+typedef enum { UART_DATA_8_BITS=3 } uart_word_length_t;
+typedef enum { UART_PARITY_DISABLE } uart_parity_t;
+typedef enum { UART_STOP_BITS_1=1 } uart_stop_bits_t;
+typedef enum { UART_HW_FLOWCTRL_DISABLE } uart_hw_flowcontrol_t;
+typedef enum { UART_SCLK_DEFAULT } uart_sclk_t;
+typedef struct { int baud_rate; uart_word_length_t data_bits; uart_parity_t parity; uart_stop_bits_t stop_bits; uart_hw_flowcontrol_t flow_ctrl; uint8_t rx_flow_ctrl_thresh; uart_sclk_t source_clk; } uart_config_t;
+typedef enum { UART_DATA, UART_BREAK, UART_BUFFER_FULL, UART_FIFO_OVF, UART_FRAME_ERR, UART_PARITY_ERR } uart_event_type_t;
+typedef struct { uart_event_type_t type; size_t size; bool timeout_flag; } uart_event_t;
+esp_err_t uart_driver_install(uart_port_t, int, int, int, QueueHandle_t*, int);
+esp_err_t uart_param_config(uart_port_t, const uart_config_t*);
+esp_err_t uart_set_pin(uart_port_t, int, int, int, int);
+int uart_read_bytes(uart_port_t, void*, uint32_t, TickType_t);
+int uart_write_bytes(uart_port_t, const void*, size_t);
+esp_err_t uart_wait_tx_done(uart_port_t, TickType_t);
+esp_err_t uart_flush_input(uart_port_t);
+esp_err_t uart_get_buffered_data_len(uart_port_t, size_t*);
@@ -0,0 +1,6 @@
+#pragma once
+#define NUM_HEAP_TASK_CAPS 4
+typedef struct { TaskHandle_t task; size_t size[NUM_HEAP_TASK_CAPS]; uint32_t count[NUM_HEAP_TASK_CAPS]; } heap_task_totals_t;
+typedef struct { TaskHandle_t task; void *address; size_t size; } heap_task_block_t;
+typedef struct { int32_t caps[NUM_HEAP_TASK_CAPS]; uint32_t mask[NUM_HEAP_TASK_CAPS]; TaskHandle_t *tasks; size_t num_tasks; size_t *num_totals; heap_task_totals_t *totals; size_t max_totals; heap_task_block_t *blocks; size_t max_blocks; } heap_task_info_params_t;
+size_t heap_caps_get_per_task_info(heap_task_info_params_t *params);
@@ -0,0 +1,30 @@
+#pragma once
+#include "common.h"
+typedef void *httpd_handle_t;
+typedef enum { HTTP_GET, HTTP_POST, HTTP_PUT, HTTP_DELETE, HTTP_OPTIONS } httpd_method_t;
+typedef struct httpd_req { httpd_handle_t handle; int method; const char uri[513]; size_t content_len; void *aux; void *user_ctx; void *sess_ctx; } httpd_req_t;
+typedef struct { const char *uri; httpd_method_t method; esp_err_t (*handler)(httpd_req_t *); void *user_ctx; } httpd_uri_t;
+typedef struct { unsigned task_priority; size_t stack_size; int core_id; uint16_t server_port; uint16_t ctrl_port; uint16_t max_open_sockets; uint16_t max_uri_handlers; uint16_t max_resp_headers; uint16_t backlog_conn; bool lru_purge_enable; uint16_t recv_wait_timeout; uint16_t send_wait_timeout; void *uri_match_fn; } httpd_config_t;
+#define HTTPD_DEFAULT_CONFIG() httpd_config_t{}
+typedef enum { HTTPD_500_INTERNAL_SERVER_ERROR = 0, HTTPD_400_BAD_REQUEST, HTTPD_404_NOT_FOUND, HTTPD_405_METHOD_NOT_ALLOWED } httpd_err_code_t;
+#define HTTPD_SOCK_ERR_TIMEOUT -3
+#define HTTPD_RESP_USE_STRLEN -1
+esp_err_t httpd_start(httpd_handle_t *, const httpd_config_t *);
+esp_err_t httpd_register_uri_handler(httpd_handle_t, const httpd_uri_t *);
+esp_err_t httpd_req_async_handler_begin(httpd_req_t *, httpd_req_t **);
+esp_err_t httpd_req_async_handler_complete(httpd_req_t *);
+int httpd_req_recv(httpd_req_t *, char *, size_t);
+esp_err_t httpd_resp_send(httpd_req_t *, const char *, ssize_t);
+esp_err_t httpd_resp_send_500(httpd_req_t *);
+esp_err_t httpd_resp_send_chunk(httpd_req_t *, const char *, ssize_t);
+esp_err_t httpd_resp_send_err(httpd_req_t *, httpd_err_code_t, const char *);
+esp_err_t httpd_resp_sendstr(httpd_req_t *, const char *);
+esp_err_t httpd_resp_sendstr_chunk(httpd_req_t *, const char *);
+esp_err_t httpd_resp_set_hdr(httpd_req_t *, const char *, const char *);
+esp_err_t httpd_resp_set_status(httpd_req_t *, const char *);
+esp_err_t httpd_resp_set_type(httpd_req_t *, const char *);
+size_t httpd_req_get_url_query_len(httpd_req_t *);
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *, char *, size_t);
+esp_err_t httpd_query_key_value(const char *, const char *, char *, size_t);
+size_t httpd_req_get_hdr_value_len(httpd_req_t *, const char *);
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *, const char *, char *, size_t);
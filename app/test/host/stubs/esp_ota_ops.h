@@ -0,0 +1,12 @@
+#pragma once
+#include "common.h"
+typedef uint32_t esp_ota_handle_t;
+typedef struct { int type; int subtype; uint32_t address; uint32_t size; char label[17]; } esp_partition_t;
+#define OTA_SIZE_UNKNOWN 0xffffffff
+#define OTA_WITH_SEQUENTIAL_WRITES 0xfffffffe
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *);
+const esp_partition_t *esp_ota_get_running_partition(void);
+esp_err_t esp_ota_begin(const esp_partition_t *, size_t, esp_ota_handle_t *);
+esp_err_t esp_ota_write(esp_ota_handle_t, const void *, size_t);
+esp_err_t esp_ota_end(esp_ota_handle_t);
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *);
@@ -0,0 +1,3 @@
+#pragma once
+#include "common.h"
+uint32_t esp_random(void);
@@ -0,0 +1,5 @@
+#pragma once
+#include "common.h"
+enum btm_query_reason { REASON_UNSPECIFIED = 0, REASON_RSSI = 5 };
+bool esp_wnm_is_btm_supported_connection(void);
+int esp_wnm_send_bss_transition_mgmt_query(enum btm_query_reason query_reason, const char *btm_candidates, int cand_list);
@@ -0,0 +1,11 @@
+#pragma once
+#include "Arduino.h"
+class ld2410 { public:
+ bool begin(Stream &, bool w=true); bool isConnected(); bool read();
+ bool presenceDetected(); bool stationaryTargetDetected(); uint16_t stationaryTargetDistance();
+ bool movingTargetDetected(); uint16_t movingTargetDistance();
+ bool requestFirmwareVersion(); uint8_t firmware_major_version, firmware_minor_version; uint32_t firmware_bugfix_version;
+ bool requestCurrentConfiguration(); uint8_t max_gate, max_moving_gate, max_stationary_gate; uint16_t sensor_idle_time;
+ uint8_t motion_sensitivity[9], stationary_sensitivity[9];
+ bool requestRestart(); bool requestStartEngineeringMode(); bool requestEndEngineeringMode();
+ bool setMaxValues(uint16_t, uint16_t, uint16_t); bool setGateSensitivityThreshold(uint8_t, uint8_t, uint8_t); };
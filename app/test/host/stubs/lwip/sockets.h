@@ -0,0 +1,12 @@
+#pragma once
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <strings.h>
+#include <ctype.h>
+#define lwip_stricmp strcasecmp
+#define lwip_strnicmp strncasecmp
+#define closesocket close
@@ -0,0 +1,15 @@
+#pragma once
+#include "esp_err.h"
+#include "esp_wifi.h"
+esp_netif_t *esp_netif_get_handle_from_ifkey(const char *if_key);
+typedef struct { const char *key; const char *value; } mdns_txt_item_t;
+typedef enum { MDNS_EVENT_ENABLE_IP4 = 1 << 1, MDNS_EVENT_ENABLE_IP6 = 1 << 2, MDNS_EVENT_ANNOUNCE_IP4 = 1 << 3,
+  MDNS_EVENT_ANNOUNCE_IP6 = 1 << 4, MDNS_EVENT_DISABLE_IP4 = 1 << 5, MDNS_EVENT_DISABLE_IP6 = 1 << 6 } mdns_event_actions_t;
+esp_err_t mdns_init(void);
+void mdns_free(void);
+esp_err_t mdns_hostname_set(const char *hostname);
+esp_err_t mdns_instance_name_set(const char *instance_name);
+esp_err_t mdns_service_add(const char *instance_name, const char *service_type, const char *proto, uint16_t port, mdns_txt_item_t txt[], size_t num_items);
+esp_err_t mdns_service_txt_item_set(const char *service_type, const char *proto, const char *key, const char *value);
+esp_err_t mdns_service_instance_name_set(const char *service_type, const char *proto, const char *instance_name);
+esp_err_t mdns_netif_action(esp_netif_t *esp_netif, mdns_event_actions_t event_action);
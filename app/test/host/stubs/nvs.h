@@ -0,0 +1,14 @@
+#pragma once
+#include "common.h"
+typedef uint32_t nvs_handle_t;
+typedef enum { NVS_TYPE_U8, NVS_TYPE_I8, NVS_TYPE_U16, NVS_TYPE_I16, NVS_TYPE_U32, NVS_TYPE_I32, NVS_TYPE_U64, NVS_TYPE_I64, NVS_TYPE_STR, NVS_TYPE_BLOB, NVS_TYPE_ANY } nvs_type_t;
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode_t;
+esp_err_t nvs_set_i32(nvs_handle_t, const char*, int32_t); esp_err_t nvs_set_u8(nvs_handle_t, const char*, uint8_t);
+esp_err_t nvs_set_u16(nvs_handle_t, const char*, uint16_t); esp_err_t nvs_set_str(nvs_handle_t, const char*, const char*);
+esp_err_t nvs_set_blob(nvs_handle_t, const char*, const void*, size_t);
+esp_err_t nvs_get_i32(nvs_handle_t, const char*, int32_t*); esp_err_t nvs_get_u8(nvs_handle_t, const char*, uint8_t*);
+esp_err_t nvs_get_u16(nvs_handle_t, const char*, uint16_t*); esp_err_t nvs_get_str(nvs_handle_t, const char*, char*, size_t*);
+esp_err_t nvs_get_blob(nvs_handle_t, const char*, void*, size_t*);
+esp_err_t nvs_open(const char*, nvs_open_mode_t, nvs_handle_t*); esp_err_t nvs_commit(nvs_handle_t); void nvs_close(nvs_handle_t);
+esp_err_t nvs_erase_key(nvs_handle_t, const char*);
+typedef uint16_t u_int16_t_;
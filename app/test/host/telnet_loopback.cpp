@@ -0,0 +1,236 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * telnet_loopback.cpp
+ *
+ * Runs the telnet server (telnet.cpp, with the real console and log ring)
+ * on a loopback port and talks to it over sockets:
+ *   - TELNET_MAX_SESSIONS clients are served at once and one more is
+ *     turned away
+ *   - a command split across packets is put back together
+ *   - only one session at a time gets the Config dialog, and the wifi
+ *     networks entered in it are added only when the changes are saved
+ *   - a monitoring client that never reads neither stalls logging nor
+ *     the other sessions, and is told how many lines it lost
+ *   - Quit, telnetRequestStop() and terminateTelnetSession() close what
+ *     they should; telnetRequestStop() without waiting
+ *
+ */
+
+#include <chrono>
+#include <string>
+#include <poll.h>
+
+#define TELNET_PORT 2323
+#include "telnet.cpp"
+#include "host_test.h"
+
+using namespace std::chrono;
+
+static std::string networksAdded;
+
+bool WifiNetworkAdd(const char *ssid, const char *pass, int pos)
+{
+  networksAdded += std::string(ssid) + "/" + pass + "@" + std::to_string(pos) + " ";
+  return true;
+}
+
+static int client_connect()
+{
+  int s = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {};
+
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(TELNET_PORT);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(s, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+  {
+    perror("connect");
+    exit(1);
+  }
+  return s;
+}
+
+// Everything that arrives until the client has been quiet for 50 ms, waiting up to 'ms' for the first of it
+static std::string client_read(int s, int ms)
+{
+  std::string text;
+  char buffer[4096];
+  struct pollfd p = { s, POLLIN, 0 };
+  int n;
+
+  while (poll(&p, 1, ms) > 0)
+  {
+    if ((n = recv(s, buffer, sizeof(buffer), 0)) <= 0)
+      break;
+    text.append(buffer, n);
+    ms = 50;
+  }
+  return text;
+}
+
+static bool client_got(int s, const char *expect, int ms = 500)
+{
+  return client_read(s, ms).find(expect) != std::string::npos;
+}
+
+static void client_send(int s, const char *text)
+{
+  send(s, text, strlen(text), 0);
+}
+
+static bool client_closed(int s)
+{
+  char c;
+
+  client_read(s, 300);
+  return recv(s, &c, 1, MSG_DONTWAIT) == 0;
+}
+
+// Keep the current values until 'prompt' comes up
+static bool config_skip_to(int s, const char *prompt)
+{
+  for (int i = 0; i < 20; i++)
+  {
+    client_send(s, "\r\n");
+    if (client_got(s, prompt))
+      return true;
+  }
+  return false;
+}
+
+static int log_line(vprintf_like_t hook, const char *fmt, ...)
+{
+  va_list args;
+  int n;
+
+  va_start(args, fmt);
+  n = hook(fmt, args);
+  va_end(args);
+  return n;
+}
+
+static bool wait_stopped(int ms)
+{
+  for (int waited = 0; telnetServiceRunning() && waited < ms; waited += 10)
+    usleep(10000);
+  return !telnetServiceRunning();
+}
+
+int main()
+{
+  int c[TELNET_MAX_SESSIONS + 1];
+
+  logInit();
+  telnetStart();
+  usleep(200000);
+
+  for (int i = 0; i < TELNET_MAX_SESSIONS; i++)
+    c[i] = client_connect();
+  usleep(300000);
+  for (int i = 0; i < TELNET_MAX_SESSIONS; i++)
+    client_read(c[i], 100);
+  c[TELNET_MAX_SESSIONS] = client_connect();
+  CHECK(client_got(c[TELNET_MAX_SESSIONS], "Too many"));
+  close(c[TELNET_MAX_SESSIONS]);
+
+  for (int i = 0; i < TELNET_MAX_SESSIONS; i++)
+    client_send(c[i], "help\r\n");
+  for (int i = 0; i < TELNET_MAX_SESSIONS; i++)
+    CHECK(client_got(c[i], "Valid commands"));
+
+  client_send(c[0], "bogu");
+  usleep(150000);
+  client_send(c[0], "s\r\n");
+  CHECK(client_got(c[0], "Unknown command: bogus"));
+
+  client_send(c[0], "config\r\n");
+  CHECK(client_got(c[0], "Device name"));
+  client_send(c[1], "config\r\n");
+  CHECK(client_got(c[1], "already in progress"));
+  client_send(c[0], "thermo1\r\n");
+  CHECK(client_got(c[0], "Friendly name"));
+  CHECK(!strcmp(OperatingParameters.DeviceName, "thermo1"));
+
+  // Networks typed in are only added once the changes are saved...
+  CHECK(config_skip_to(c[0], "WIFI Network name"));
+  client_send(c[0], "home\r\n");
+  CHECK(client_got(c[0], "Password or PSK"));
+  client_send(c[0], "homepass\r\n");
+  CHECK(client_got(c[0], "fallback"));
+  client_send(c[0], "cabin\r\n");
+  CHECK(client_got(c[0], "PSK for cabin"));
+  client_send(c[0], "cabinpass\r\n");
+  CHECK(client_got(c[0], "1 to add"));
+  CHECK(networksAdded.empty() && (WifiCreds.ssid[0] == '\0'));
+  CHECK(config_skip_to(c[0], "Save changes?"));
+  CHECK(networksAdded.empty());
+  client_send(c[0], "yes\r\n");
+  CHECK(client_got(c[0], "Config complete"));
+  CHECK(networksAdded == "home/homepass@0 cabin/cabinpass@-1 ");
+
+  // ...and not at all when they aren't
+  networksAdded.clear();
+  client_send(c[0], "config\r\n");
+  CHECK(config_skip_to(c[0], "fallback"));
+  client_send(c[0], "attic\r\n");
+  CHECK(client_got(c[0], "PSK for attic"));
+  client_send(c[0], "atticpass\r\n");
+  CHECK(config_skip_to(c[0], "Save changes?"));
+  client_send(c[0], "no\r\n");
+  CHECK(client_got(c[0], "Config complete"));
+  CHECK(networksAdded.empty());
+
+  // Session 2 monitors the log but never reads
+  client_send(c[2], "monitor\r\n");
+  usleep(300000);
+
+  vprintf_like_t hook = esp_log_set_vprintf(NULL);
+  char filler[200];
+  int64_t worstUs = 0;
+
+  esp_log_set_vprintf(hook);
+  memset(filler, 'x', sizeof(filler) - 1);
+  filler[sizeof(filler) - 1] = '\0';
+  for (int i = 0; i < 20000; i++)
+  {
+    auto start = steady_clock::now();
+
+    log_line(hook, "I (%d) test: %s\n", i, filler);
+    worstUs = std::max(worstUs, (int64_t)duration_cast<microseconds>(steady_clock::now() - start).count());
+    if (i % 1000 == 0)
+      usleep(1000);
+  }
+  printf("Slowest of 20000 log lines with a stalled monitor: %ld us\n", (long)worstUs);
+  CHECK(worstUs < 20000);
+
+  auto start = steady_clock::now();
+  client_send(c[1], "help\r\n");
+  CHECK(client_got(c[1], "Valid commands", 1000));
+  printf("HELP round trip beside the stalled monitor: %ld ms\n",
+         (long)duration_cast<milliseconds>(steady_clock::now() - start).count());
+  CHECK(client_got(c[2], "dropped"));
+
+  client_send(c[1], "quit\r\n");
+  CHECK(client_got(c[1], "Quiting"));
+  CHECK(client_closed(c[1]));
+
+  // What the wifi event handler does: ask, and carry on at once
+  start = steady_clock::now();
+  telnetRequestStop();
+  CHECK(duration_cast<milliseconds>(steady_clock::now() - start).count() < 10);
+  CHECK(wait_stopped(1000));
+  CHECK(client_closed(c[0]));
+  CHECK(client_closed(c[2]));
+
+  // Started again, then stopped and waited for
+  telnetStart();
+  usleep(200000);
+  c[0] = client_connect();
+  client_send(c[0], "help\r\n");
+  CHECK(client_got(c[0], "Valid commands"));
+  terminateTelnetSession();
+  CHECK(!telnetServiceRunning());
+  CHECK(client_closed(c[0]));
+
+  return host_test_result();
+}
@@ -0,0 +1,131 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * wifi_scan.cpp
+ *
+ * Feeds channel after channel of scan results to the wifi manager's merge
+ * (wifi_scan_merge() in wifi.cpp) and checks the list it keeps:
+ *   - one entry per SSID, with the strongest signal seen
+ *   - sorted by signal, then by name
+ *   - hidden networks left out
+ *   - never more than its size, the weakest dropping off
+ *
+ * A fixed case is followed by random 13 channel scans at small list
+ * sizes, checked against a reference built from everything sent.
+ *
+ */
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include "wifi.cpp"
+#include "host_test.h"
+
+#define RANDOM_SCANS    2000
+
+static WIFI_NETWORK network(const char *ssid, int8_t rssi)
+{
+  WIFI_NETWORK net = {};
+
+  strlcpy(net.ssid, ssid, sizeof(net.ssid));
+  net.rssi = rssi;
+  net.channel = 1;
+  return net;
+}
+
+static bool list_is(const WIFI_NETWORK *list, int count, const std::vector<std::pair<const char *, int>> &expect)
+{
+  if (count != (int)expect.size())
+    return false;
+  for (int i = 0; i < count; i++)
+    if (strcmp(list[i].ssid, expect[i].first) || (list[i].rssi != expect[i].second))
+      return false;
+  return true;
+}
+
+static void check_fixed()
+{
+  WIFI_NETWORK list[8];
+  int count = 0;
+  WIFI_NETWORK first[] = {network("home", -60), network("", -20), network("cafe", -70), network("home", -75)};
+  WIFI_NETWORK second[] = {network("home", -50), network("attic", -70), network("zed", -90)};
+
+  count = wifi_scan_merge(list, count, 8, first, 4);
+  CHECK(list_is(list, count, {{"home", -60}, {"cafe", -70}}));
+  count = wifi_scan_merge(list, count, 8, second, 3);
+  CHECK(list_is(list, count, {{"home", -50}, {"attic", -70}, {"cafe", -70}, {"zed", -90}}));
+
+  // Full: a weaker newcomer is left out, a stronger one pushes the weakest off
+  WIFI_NETWORK weak[] = {network("cellar", -95)};
+  WIFI_NETWORK strong[] = {network("office", -40)};
+
+  count = wifi_scan_merge(list, count, 4, weak, 1);
+  CHECK(list_is(list, count, {{"home", -50}, {"attic", -70}, {"cafe", -70}, {"zed", -90}}));
+  count = wifi_scan_merge(list, count, 4, strong, 1);
+  CHECK(list_is(list, count, {{"office", -40}, {"home", -50}, {"attic", -70}, {"cafe", -70}}));
+}
+
+static void check_random()
+{
+  std::mt19937 rng(1);
+  int unsorted = 0, repeated = 0, overfull = 0, wrongTop = 0;
+
+  for (int scan = 0; scan < RANDOM_SCANS; scan++)
+  {
+    int max = 1 + rng() % 6;
+    WIFI_NETWORK list[8];
+    int count = 0;
+    std::map<std::string, int> strongest;
+
+    for (int channel = 1; channel <= 13; channel++)
+    {
+      WIFI_NETWORK found[5];
+      int n = rng() % 5;
+
+      for (int k = 0; k < n; k++)
+      {
+        char ssid[8];
+
+        snprintf(ssid, sizeof(ssid), "n%d", (int)(rng() % 10));
+        found[k] = network(ssid, -30 - rng() % 60);
+        if (!strongest.count(ssid) || (strongest[ssid] < found[k].rssi))
+          strongest[ssid] = found[k].rssi;
+      }
+      count = wifi_scan_merge(list, count, max, found, n);
+
+      for (int i = 1; i < count; i++)
+        if ((list[i].rssi > list[i - 1].rssi) ||
+            ((list[i].rssi == list[i - 1].rssi) && (strcmp(list[i].ssid, list[i - 1].ssid) <= 0)))
+          unsorted++;
+      for (int i = 0; i < count; i++)
+        for (int j = i + 1; j < count; j++)
+          if (!strcmp(list[i].ssid, list[j].ssid))
+            repeated++;
+      if (count > max)
+        overfull++;
+    }
+
+    // The strongest network is never the one that drops off
+    std::vector<std::pair<int, std::string>> best;
+    for (auto &net : strongest)
+      best.push_back({-net.second, net.first});
+    std::sort(best.begin(), best.end());
+    if (!best.empty() && ((count == 0) || strcmp(list[0].ssid, best[0].second.c_str()) || (list[0].rssi != -best[0].first)))
+      wrongTop++;
+  }
+
+  printf("%d random scans: %d unsorted, %d repeated, %d overfull, %d with the wrong strongest\n",
+         RANDOM_SCANS, unsorted, repeated, overfull, wrongTop);
+  CHECK(unsorted == 0);
+  CHECK(repeated == 0);
+  CHECK(overfull == 0);
+  CHECK(wrongTop == 0);
+}
+
+int main()
+{
+  check_fixed();
+  check_random();
+  return host_test_result();
+}